@@ -3,6 +3,7 @@
 #include "flat_file.hpp"
 #include "hibp.hpp"
 #include <CLI/CLI.hpp>
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -10,6 +11,7 @@
 #include <filesystem>
 #include <fmt/format.h>
 #include <iostream>
+#include <span>
 #include <string>
 
 struct cli_config_t {
@@ -40,22 +42,20 @@ void define_options(CLI::App& app, cli_config_t& cli) {
 }
 
 void build(const cli_config_t& cli) {
-  flat_file::database<hibp::pawned_pw_sha1> db{cli.input_filename,
-                                               (1U << 16U) / sizeof(hibp::pawned_pw_sha1)};
-
-  unsigned count = 0;
+  // read in large spans, so no need for the record buffer. A one-shot scan, so drop-behind.
+  flat_file::database<hibp::pawned_pw_sha1> db{cli.input_filename, 1,
+                                               flat_file::access_advice::once};
 
   binfuse::sharded_filter8_sink sharded_filter(cli.output_filename);
 
   sharded_filter.stream_prepare();
-  for (const auto& record: db) {
-    auto key = hibp::bytearray_cast<std::uint64_t>(record.hash.data());
-    sharded_filter.stream_add(key);
-    count++;
-    if (count == cli.limit) {
-      break;
-    }
-  }
+  flat_file::for_each_span(db, 0, std::min(cli.limit, db.number_records()),
+                           [&](std::span<const hibp::pawned_pw_sha1> span) {
+                             for (const auto& record: span) {
+                               sharded_filter.stream_add(
+                                   hibp::bytearray_cast<std::uint64_t>(record.hash.data()));
+                             }
+                           });
   sharded_filter.stream_finalize();
 }
 } // namespace
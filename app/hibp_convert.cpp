@@ -1,6 +1,10 @@
+#include "columnar.hpp"
+#include "compressed.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
 #include <exception>
@@ -10,9 +14,14 @@
 #include <ios>
 #include <iostream>
 #include <istream>
+#include <map>
+#include <optional>
 #include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 struct cli_config_t {
   std::string output_filename;
@@ -22,8 +31,22 @@ struct cli_config_t {
   bool        standard_input  = false;
   bool        bin_to_txt      = false;
   bool        txt_to_bin      = false;
+  bool        bin_to_columns  = false;
+  bool        counts_only     = false;
+  bool        bin_to_compr    = false;
+  bool        compr_to_bin    = false;
+  bool        repack          = false;
+  bool        seal            = false;
+  bool        verify          = false;
+  unsigned    seal_toc_bits   = 0; // ie no embedded toc
+  unsigned    toc_bits        = 0; // ie no toc written
+  bool        toc_fences      = false;
+  bool        seal_fences     = false;
   bool        ntlm            = false;
+  bool        sha1t64         = false;
   std::size_t limit           = -1; // ie max
+
+  hibp::count_encoding count = hibp::count_encoding::int32;
 };
 
 namespace  {
@@ -36,6 +59,68 @@ void define_options(CLI::App& app, cli_config_t& cli) {
   app.add_flag("--bin-to-txt", cli.bin_to_txt,
                "From binary to text format. Choose either --txt-to-bin or --bin-to-txt");
 
+  app.add_flag("--bin-to-columns", cli.bin_to_columns,
+               "From binary to columnar format: <output>.hashes and <output>.counts. Searching "
+               "the hash column reads fewer bytes per query.");
+
+  app.add_flag("--counts-only", cli.counts_only,
+               "With --bin-to-columns, only rewrite <output>.counts, eg to refresh the counts. "
+               "The hashes in the input must match the existing <output>.hashes.");
+
+  app.add_flag("--bin-to-compressed", cli.bin_to_compr,
+               "From binary to block compressed format, which is searched with one read per "
+               "query via an in-memory index of blocks.");
+
+  app.add_flag("--compressed-to-bin", cli.compr_to_bin,
+               "From block compressed format back to binary format.");
+
+  app.add_flag("--repack", cli.repack,
+               "From binary format, with int32 counts, to binary format with the counts "
+               "encoded as per --count.");
+
+  app.add_flag("--seal", cli.seal,
+               "Seal the binary database of --input, in place: append a footer which records its "
+               "format, record count, sort order and content fingerprint, and optionally an "
+               "embedded table of contents. The records themselves are not changed.");
+
+  app.add_flag("--verify", cli.verify,
+               "Verify the sealed binary database of --input: recompute the fingerprint of its "
+               "records, and fail unless it matches the one recorded by --seal, ie unless the "
+               "records are unchanged since.");
+
+  app.add_option("--seal-toc-bits", cli.seal_toc_bits,
+                 "With --seal, embed a table of contents with this many bits, as for the "
+                 "--toc-bits of hibp-search and hibp-server, which then load it from the "
+                 "database without a rebuild. The database must be sorted by hash.")
+      ->check(CLI::Range(15, 32));
+
+  app.add_flag("--seal-fences", cli.seal_fences,
+               "With --seal-toc-bits, also embed the fences, as for --toc-fences.");
+
+  auto* toc_bits = app.add_option("--toc-bits", cli.toc_bits,
+                                  "With --txt-to-bin, also write the table of contents of the "
+                                  "output db, with this many bits, as for the --toc-bits of "
+                                  "hibp-search and hibp-server, next to it, while it is written. "
+                                  "So --toc can use it straight away, without a rebuild. The text "
+                                  "must be sorted by hash. Not with --stdout or --count.")
+                       ->check(CLI::Range(15, 32));
+
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "With --toc-bits, also write the fences, as for --toc-fences.")
+      ->needs(toc_bits);
+
+  const std::map<std::string, hibp::count_encoding> count_map{
+      {"int32", hibp::count_encoding::int32},
+      {"sat16", hibp::count_encoding::sat16},
+      {"log8", hibp::count_encoding::log8},
+      {"none", hibp::count_encoding::none},
+  };
+  app.add_option("--count", cli.count,
+                 "How the binary format stores counts: 'int32' exactly, 'sat16' saturating at "
+                 "65535, 'log8' on a log scale within ~5%, or 'none'. Applies to the output of "
+                 "--txt-to-bin and --repack and to the input of --bin-to-txt. (default: int32)")
+      ->transform(CLI::CheckedTransformer(count_map, CLI::ignore_case));
+
   app.add_option("-i,--input", cli.input_filename,
                  "The file that the downloaded binary database will be read from");
 
@@ -51,7 +136,10 @@ void define_options(CLI::App& app, cli_config_t& cli) {
   app.add_option("-l,--limit", cli.limit,
                  "The maximum number of records that will be converted (default: all)");
 
-  app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+  auto* ntlm = app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_flag("--sha1t64", cli.sha1t64, "Use sha1 hashes truncated to 64bits, rather than sha1.")
+      ->excludes(ntlm);
 
   app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
 }
@@ -81,10 +169,9 @@ std::ofstream get_output_stream(const std::string& output_filename, bool force)
   return output_stream;
 }
 
-template <hibp::pw_type PwType>
-void txt_to_bin(std::istream& input_stream, std::ostream& output_stream, std::size_t limit) {
-
-  auto writer = flat_file::stream_writer<PwType>(output_stream);
+// Writer is flat_file::stream_writer, or hibp::indexing_writer, for the table of contents
+template <hibp::any_pw_type PwType, typename Writer>
+void txt_to_bin(std::istream& input_stream, Writer& writer, std::size_t limit) {
 
   std::size_t count = 0;
   for (std::string line; std::getline(input_stream, line) && count != limit; count++) {
@@ -93,22 +180,245 @@ void txt_to_bin(std::istream& input_stream, std::ostream& output_stream, std::si
 }
 
 template <hibp::pw_type PwType>
-void bin_to_txt(const std::string& input_filename, std::ostream& output_stream, std::size_t limit) {
+void bin_to_columns(const std::string& input_filename, const std::string& output_base,
+                    std::size_t limit, bool counts_only) {
+
+  flat_file::database<PwType>   db{input_filename, (1U << 16U) / sizeof(PwType),
+                                   flat_file::access_advice::once};
+  hibp::columnar_writer<PwType> writer(output_base, counts_only);
+
+  std::size_t count = 0;
+  for (const auto& record: db) {
+    writer.write(record);
+    count++;
+    if (count == limit) break;
+  }
+  writer.finish();
+}
+
+template <hibp::pw_type PwType>
+void bin_to_compressed(const std::string& input_filename, std::ostream& output_stream,
+                       std::size_t limit) {
 
-  flat_file::database<PwType> db{input_filename, 4096 / sizeof(PwType)};
+  flat_file::database<PwType>     db{input_filename, (1U << 16U) / sizeof(PwType),
+                                     flat_file::access_advice::once};
+  hibp::compressed_writer<PwType> writer(output_stream);
 
   std::size_t count = 0;
   for (const auto& record: db) {
-    output_stream << record << '\n';
+    writer.write(record);
     count++;
     if (count == limit) break;
   }
 }
 
+template <hibp::pw_type PwType>
+void compressed_to_bin(const std::string& input_filename, std::ostream& output_stream,
+                       std::size_t limit) {
+
+  const hibp::compressed_database<PwType> db{input_filename};
+  auto                                    writer = flat_file::stream_writer<PwType>(output_stream);
+
+  std::size_t         count = 0;
+  std::vector<PwType> records;
+  for (std::size_t block = 0; block != db.number_blocks() && count != limit; ++block) {
+    records.clear();
+    db.decode_block(block, records);
+    for (const auto& record: records) {
+      writer.write(record);
+      count++;
+      if (count == limit) break;
+    }
+  }
+}
+
+template <hibp::any_pw_type PackedType>
+void repack(const std::string& input_filename, std::ostream& output_stream, std::size_t limit) {
+
+  using PwType = hibp::pawned_pw<PackedType::hash_size>; // with int32 counts
+  flat_file::database<PwType> db{input_filename, (1U << 16U) / sizeof(PwType),
+                                 flat_file::access_advice::once};
+  auto                        writer = flat_file::stream_writer<PackedType>(output_stream);
+
+  std::size_t count = 0;
+  for (const auto& record: db) {
+    PackedType packed;
+    packed.hash = record.hash;
+    packed.set_count(record.count);
+    writer.write(packed);
+    count++;
+    if (count == limit) break;
+  }
+}
+
+template <hibp::any_pw_type PwType>
+void bin_to_txt(const std::string& input_filename, std::ostream& output_stream, std::size_t limit) {
+
+  // formatting is the slow part, so read ahead meanwhile
+  flat_file::database<PwType> db{input_filename, 1, flat_file::access_advice::once};
+  flat_file::for_each_span(db, 0, std::min(limit, db.number_records()),
+                           [&](std::span<const PwType> span) {
+                             for (const auto& record: span) output_stream << record << '\n';
+                           });
+}
+
+// the name of a standard record type, as recorded in the footer of a sealed db
+template <hibp::pw_type PwType>
+constexpr const char* format_name() {
+  if constexpr (std::is_same_v<PwType, hibp::pawned_pw_ntlm>) {
+    return "ntlm";
+  } else if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1t64>) {
+    return "sha1t64";
+  } else {
+    return "sha1";
+  }
+}
+
+// one scan for the fingerprint and the sort order, then another for the toc, if wanted
+template <hibp::pw_type PwType>
+void seal(const std::string& filename, unsigned toc_bits, bool fences) {
+  flat_file::container_metadata metadata{sizeof(PwType), 0, 0, format_name<PwType>(), ""};
+  {
+    flat_file::database<PwType> db{filename, 1, flat_file::access_advice::once};
+    flat_file::fingerprinter    fingerprint;
+    bool                        by_hash  = true;
+    bool                        by_count = true;
+    std::optional<PwType>       prev;
+    flat_file::for_each_span(db, 0, db.number_records(), [&](std::span<const PwType> span) {
+      fingerprint.update(span);
+      for (const auto& pw: span) {
+        if (prev) {
+          by_hash  = by_hash && !(pw < *prev);
+          by_count = by_count && pw.count <= prev->count;
+        }
+        prev = pw;
+      }
+    });
+    metadata.record_count = db.number_records();
+    metadata.fingerprint  = fingerprint.value();
+    metadata.sort_key     = by_hash ? "hash" : by_count ? "count desc" : "";
+  }
+
+  std::vector<flat_file::container_section> sections;
+  if (toc_bits != 0) {
+    if (metadata.sort_key != "hash") {
+      throw std::runtime_error(
+          fmt::format("Cannot embed a table of contents, '{}' is not sorted by hash.", filename));
+    }
+    sections = hibp::toc_sections<PwType>(filename, toc_bits, fences);
+  }
+  flat_file::write_container(filename, metadata, sections);
+
+  std::cerr << fmt::format("{:30s} {:>15s}\n", "Format", metadata.format);
+  std::cerr << fmt::format("{:30s} {:15d} records\n", "DB size", metadata.record_count);
+  std::cerr << fmt::format("{:30s} {:>15s}\n", "Sorted by",
+                           metadata.sort_key.empty() ? "unsorted" : metadata.sort_key);
+  std::cerr << fmt::format("{:30s} {:15x}\n", "Fingerprint", metadata.fingerprint);
+  for (const auto& section: sections) {
+    std::cerr << fmt::format("{:30s} {:15d} bytes\n",
+                             fmt::format("Embedded {} ({})", section.name, section.param),
+                             section.data.size());
+  }
+}
+
+// one scan to recompute the fingerprint, which must match the one recorded by seal()
+template <hibp::pw_type PwType>
+void verify(const std::string& filename) {
+  const auto matches = flat_file::verify_fingerprint<PwType>(filename);
+  if (!matches) {
+    throw std::runtime_error(
+        fmt::format("'{}' is not sealed, so has no fingerprint to verify.", filename));
+  }
+  if (!*matches) {
+    throw std::runtime_error(fmt::format("'{}' does not match its fingerprint. Its records have "
+                                         "been changed since it was sealed.",
+                                         filename));
+  }
+  std::cerr << fmt::format("{:30s} {:15x} matches\n", "Fingerprint",
+                           flat_file::read_container(filename)->fingerprint);
+}
+
+// call func.template operator()<PwType>() for the standard record type selected by cli
+template <typename Func>
+void with_pw_type(const cli_config_t& cli, Func&& func) {
+  if (cli.ntlm) {
+    func.template operator()<hibp::pawned_pw_ntlm>();
+  } else if (cli.sha1t64) {
+    func.template operator()<hibp::pawned_pw_sha1t64>();
+  } else {
+    func.template operator()<hibp::pawned_pw_sha1>();
+  }
+}
+
+// as with_pw_type, but the record type also has the count encoding selected by cli
+template <typename Func>
+void with_record_type(const cli_config_t& cli, Func&& func) {
+  with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+    constexpr unsigned hash_size = PwType::hash_size;
+    switch (cli.count) {
+    case hibp::count_encoding::int32:
+      func.template operator()<PwType>();
+      break;
+    case hibp::count_encoding::sat16:
+      func.template operator()<hibp::pawned_pw<hash_size, hibp::count_sat16>>();
+      break;
+    case hibp::count_encoding::log8:
+      func.template operator()<hibp::pawned_pw<hash_size, hibp::count_log8>>();
+      break;
+    case hibp::count_encoding::none:
+      func.template operator()<hibp::pawned_pw<hash_size, hibp::count_none>>();
+      break;
+    }
+  });
+}
+
 void check_options(const cli_config_t& cli) {
-  if ((cli.bin_to_txt && cli.txt_to_bin) || (!cli.bin_to_txt && !cli.txt_to_bin)) {
+  if (static_cast<int>(cli.bin_to_txt) + static_cast<int>(cli.txt_to_bin) +
+          static_cast<int>(cli.bin_to_columns) + static_cast<int>(cli.bin_to_compr) +
+          static_cast<int>(cli.compr_to_bin) + static_cast<int>(cli.repack) +
+          static_cast<int>(cli.seal) + static_cast<int>(cli.verify) !=
+      1) {
     throw std::runtime_error(
-        "Please use exactly one of --bin-to-txt and --txt-to-bin, not both, and not neither.");
+        "Please use exactly one of --bin-to-txt, --txt-to-bin, --bin-to-columns, "
+        "--bin-to-compressed, --compressed-to-bin, --repack, --seal and --verify.");
+  }
+
+  if ((cli.seal_toc_bits != 0 || cli.seal_fences) && !cli.seal) {
+    throw std::runtime_error("--seal-toc-bits and --seal-fences only apply to --seal.");
+  }
+
+  if (cli.seal_fences && cli.seal_toc_bits == 0) {
+    throw std::runtime_error("--seal-fences needs --seal-toc-bits.");
+  }
+
+  if (cli.toc_bits != 0 &&
+      (!cli.txt_to_bin || cli.standard_output || cli.count != hibp::count_encoding::int32)) {
+    throw std::runtime_error("--toc-bits only applies to --txt-to-bin, to an output file, with "
+                             "int32 counts.");
+  }
+
+  if (cli.count != hibp::count_encoding::int32 && !cli.txt_to_bin && !cli.bin_to_txt &&
+      !cli.repack) {
+    throw std::runtime_error("--count only applies to --txt-to-bin, --bin-to-txt and --repack.");
+  }
+
+  if (cli.counts_only && !cli.bin_to_columns) {
+    throw std::runtime_error("--counts-only only applies to --bin-to-columns.");
+  }
+
+  if (cli.bin_to_columns && (cli.standard_input || cli.standard_output)) {
+    throw std::runtime_error(
+        "Sorry, --bin-to-columns needs files, not standard_input or standard_output.");
+  }
+
+  if (cli.seal || cli.verify) {
+    if (cli.input_filename.empty() || cli.standard_input || !cli.output_filename.empty() ||
+        cli.standard_output) {
+      throw std::runtime_error(cli.seal
+                                   ? "--seal works in place, on -i|--input only, without an output."
+                                   : "--verify works on -i|--input only, without an output.");
+    }
+    return;
   }
 
   if ((!cli.input_filename.empty() && cli.standard_input) ||
@@ -117,7 +427,7 @@ void check_options(const cli_config_t& cli) {
         "Please use exactly one of -i|--input and --stdin, not both, and not neither.");
   }
 
-  if (cli.bin_to_txt && cli.standard_input) {
+  if (!cli.txt_to_bin && cli.standard_input) {
     throw std::runtime_error(
         "Sorry, cannot read binary database from standard_input. Please use a file.");
   }
@@ -130,6 +440,41 @@ void check_options(const cli_config_t& cli) {
 }
 
 void convert(const cli_config_t& cli) {
+  if (cli.seal) {
+    std::cerr << fmt::format("Sealing `have i been pawned` binary database {} ...\n",
+                             cli.input_filename);
+    with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+      seal<PwType>(cli.input_filename, cli.seal_toc_bits, cli.seal_fences);
+    });
+    std::cerr << "Done.\n";
+    return;
+  }
+
+  if (cli.verify) {
+    std::cerr << fmt::format("Verifying sealed `have i been pawned` binary database {} ...\n",
+                             cli.input_filename);
+    with_pw_type(cli, [&]<hibp::pw_type PwType>() { verify<PwType>(cli.input_filename); });
+    std::cerr << "Done.\n";
+    return;
+  }
+
+  if (cli.bin_to_columns) {
+    if (!cli.force && !cli.counts_only &&
+        std::filesystem::exists(hibp::columnar_hashes_filename(cli.output_filename))) {
+      throw std::runtime_error(fmt::format("File '{}' exists. Use `--force` to overwrite.",
+                                           hibp::columnar_hashes_filename(cli.output_filename)));
+    }
+    std::cerr << fmt::format("Reading `have i been pawned` binary database from {}, "
+                             "converting to columnar format and writing {} to {}.* ... ",
+                             cli.input_filename, cli.counts_only ? "counts" : "hashes and counts",
+                             cli.output_filename);
+    with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+      bin_to_columns<PwType>(cli.input_filename, cli.output_filename, cli.limit, cli.counts_only);
+    });
+    std::cerr << "Done.\n";
+    return;
+  }
+
   std::istream* input_stream      = &std::cin;
   std::string   input_stream_name = "standard_input";
   std::ifstream ifs;
@@ -153,10 +498,19 @@ void convert(const cli_config_t& cli) {
                              "converting to binary format and writing to {} ... ",
                              input_stream_name, output_stream_name);
 
-    if (cli.ntlm) {
-      txt_to_bin<hibp::pawned_pw_ntlm>(*input_stream, *output_stream, cli.limit);
+    if (cli.toc_bits != 0) {
+      with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+        auto stream = flat_file::stream_writer<PwType>(*output_stream);
+        auto writer =
+            hibp::indexing_writer<PwType, decltype(stream)>(stream, cli.toc_bits, cli.toc_fences);
+        txt_to_bin<PwType>(*input_stream, writer, cli.limit);
+        writer.finish(cli.output_filename);
+      });
     } else {
-      txt_to_bin<hibp::pawned_pw_sha1>(*input_stream, *output_stream, cli.limit);
+      with_record_type(cli, [&]<hibp::any_pw_type PwType>() {
+        auto writer = flat_file::stream_writer<PwType>(*output_stream);
+        txt_to_bin<PwType>(*input_stream, writer, cli.limit);
+      });
     }
     std::cerr << "Done.\n";
   } else if (cli.bin_to_txt) {
@@ -165,11 +519,39 @@ void convert(const cli_config_t& cli) {
                              "converting to text format and writing to {} ...",
                              input_stream_name, output_stream_name);
 
-    if (cli.ntlm) {
-      bin_to_txt<hibp::pawned_pw_ntlm>(cli.input_filename, *output_stream, cli.limit);
-    } else {
-      bin_to_txt<hibp::pawned_pw_sha1>(cli.input_filename, *output_stream, cli.limit);
-    }
+    with_record_type(cli, [&]<hibp::any_pw_type PwType>() {
+      bin_to_txt<PwType>(cli.input_filename, *output_stream, cli.limit);
+    });
+    std::cerr << "Done.\n";
+  } else if (cli.bin_to_compr) {
+
+    std::cerr << fmt::format("Reading `have i been pawned` binary database from {}, "
+                             "converting to block compressed format and writing to {} ...",
+                             input_stream_name, output_stream_name);
+
+    with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+      bin_to_compressed<PwType>(cli.input_filename, *output_stream, cli.limit);
+    });
+    std::cerr << "Done.\n";
+  } else if (cli.compr_to_bin) {
+
+    std::cerr << fmt::format("Reading `have i been pawned` block compressed database from {}, "
+                             "converting to binary format and writing to {} ...",
+                             input_stream_name, output_stream_name);
+
+    with_pw_type(cli, [&]<hibp::pw_type PwType>() {
+      compressed_to_bin<PwType>(cli.input_filename, *output_stream, cli.limit);
+    });
+    std::cerr << "Done.\n";
+  } else if (cli.repack) {
+
+    std::cerr << fmt::format("Reading `have i been pawned` binary database from {}, "
+                             "re-encoding the counts and writing to {} ...",
+                             input_stream_name, output_stream_name);
+
+    with_record_type(cli, [&]<hibp::any_pw_type PwType>() {
+      repack<PwType>(cli.input_filename, *output_stream, cli.limit);
+    });
     std::cerr << "Done.\n";
   }
 }
@@ -178,7 +560,9 @@ void convert(const cli_config_t& cli) {
 int main(int argc, char* argv[]) {
   cli_config_t cli;
 
-  CLI::App app("Converting 'Have I been pawned' databases between text and binary formats");
+  CLI::App app(
+      "Converting 'Have I been pawned' databases between text, binary, columnar and compressed "
+      "formats");
   define_options(app, cli);
   CLI11_PARSE(app, argc, argv);
 
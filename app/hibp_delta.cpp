@@ -0,0 +1,135 @@
+#include "delta.hpp"
+#include "hibp.hpp"
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace {
+
+struct cli_config_t {
+  std::string db_filename;
+  std::string add_filename;
+  bool        standard_input = false;
+  bool        compact        = false;
+  bool        ntlm           = false;
+  bool        sha1t64        = false;
+  std::size_t memtable_mb    = 64;
+};
+
+void define_options(CLI::App& app, cli_config_t& cli) {
+
+  app.add_option("db_filename", cli.db_filename,
+                 "The binary database which the delta layer, in <db_filename>.delta/, adds to")
+      ->required();
+
+  app.add_option("-a,--add", cli.add_filename,
+                 "Add the hashes of this text file, one `HASH:COUNT` per line, as from the "
+                 "api, to the delta layer. A hash which is already in the db, or an earlier "
+                 "delta, has its count replaced. Lines without a count, eg from a blocklist, "
+                 "are given a count of 1.");
+
+  app.add_flag("--stdin", cli.standard_input, "As --add, but read the text from standard_input.");
+
+  app.add_flag("--compact", cli.compact,
+               "Merge the delta layer into db_filename, after any --add, and remove it. The db "
+               "is rewritten alongside, and renamed over the original, so servers which have "
+               "it open continue undisturbed. They use the new db when restarted.");
+
+  auto* ntlm = app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_flag("--sha1t64", cli.sha1t64, "Use sha1 hashes truncated to 64bits, rather than sha1.")
+      ->excludes(ntlm);
+
+  app.add_option("--memtable-mb", cli.memtable_mb,
+                 fmt::format("Records are sorted in memory, and written as a new delta run "
+                             "whenever this many MB have been added. (default = {}MB)",
+                             cli.memtable_mb));
+}
+
+template <hibp::pw_type PwType>
+void add(hibp::delta_store<PwType>& store, std::istream& input_stream) {
+  std::size_t count = 0;
+  for (std::string line; std::getline(input_stream, line); ++count) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    const std::string hash = line.substr(0, line.find(':'));
+    bool              valid = hibp::is_valid_hash<PwType>(hash);
+    if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1t64>) {
+      valid = valid || hibp::is_valid_hash<hibp::pawned_pw_sha1>(hash); // will be truncated
+    }
+    if (!valid) {
+      throw std::runtime_error(fmt::format("Not a valid hash on line {}: '{}'", count + 1, line));
+    }
+    PwType pw{line};
+    if (pw.count < 0) pw.count = 1; // no count
+    store.add(pw);
+  }
+  store.flush();
+  std::cerr << fmt::format("{:30s} {:15d} records\n", "Added", count);
+}
+
+template <hibp::pw_type PwType>
+void run(const cli_config_t& cli) {
+  using clk        = std::chrono::steady_clock;
+  const auto start = clk::now();
+
+  hibp::delta_store<PwType> store(cli.db_filename, (cli.memtable_mb << 20U) / sizeof(PwType));
+
+  if (cli.standard_input) {
+    add(store, std::cin);
+  } else if (!cli.add_filename.empty()) {
+    auto input_stream = std::ifstream(cli.add_filename);
+    if (!input_stream) {
+      throw std::runtime_error(fmt::format("Error opening '{}' for reading. Because: \"{}\".\n",
+                                           cli.add_filename,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    add(store, input_stream);
+  }
+  std::cerr << fmt::format("{:30s} {:15d} records in {} runs\n", "Delta layer",
+                           store.number_records(), store.number_runs());
+
+  if (cli.compact) {
+    std::cerr << fmt::format("Compacting delta layer into {} ...\n", cli.db_filename);
+    const std::size_t records = store.compact();
+    std::cerr << fmt::format("{:30s} {:15d} records\n", "DB size", records);
+  }
+  std::cerr << fmt::format("{:30s} {:15.1f} s\n", "Took",
+                           std::chrono::duration<double>(clk::now() - start).count());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  cli_config_t cli;
+
+  CLI::App app("Add local hashes, or counts, to a binary HIBP database, without rewriting it.");
+  define_options(app, cli);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    if (cli.standard_input && !cli.add_filename.empty()) {
+      throw std::runtime_error("Please use only one of --add and --stdin.");
+    }
+    if (cli.ntlm) {
+      run<hibp::pawned_pw_ntlm>(cli);
+    } else if (cli.sha1t64) {
+      run<hibp::pawned_pw_sha1t64>(cli);
+    } else {
+      run<hibp::pawned_pw_sha1>(cli);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "something went wrong: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
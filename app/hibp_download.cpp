@@ -4,7 +4,9 @@
 #include "dnl/resume.hpp"
 #include "dnl/shared.hpp"
 #include "flat_file.hpp"
+#include "flat_file/striped.hpp"
 #include "hibp.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <cstddef>
 #include <cstdint>
@@ -18,6 +20,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace {
 
@@ -60,6 +63,25 @@ void define_options(CLI::App& app, hibp::dnl::cli_config_t& cli) {
                  "The maximum number (prefix) files that will be downloaded (default: 100 000 hex "
                  "or 1 048 576 dec)");
 
+  app.add_option("--stripe-dirs", cli.stripe_dirs,
+                 "Write a striped db: split it into hash ranges, one in each of these "
+                 "directories, eg on separate devices, and write output_db_filename as the "
+                 "manifest which lists them. Comma separated. Not with --resume, --txt-out or "
+                 "--binfuse(8|16)-out.")
+      ->delimiter(',');
+
+  auto* toc_bits =
+      app.add_option("--toc-bits", cli.toc_bits,
+                     "Also write the table of contents of the db, with this many bits, as for "
+                     "the --toc-bits of hibp-search and hibp-server, next to it, while it is "
+                     "written. So --toc can use it straight away, without a rebuild. Not with "
+                     "--resume, --txt-out or --binfuse(8|16)-out.")
+          ->check(CLI::Range(15, 32));
+
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "With --toc-bits, also write the fences, as for --toc-fences.")
+      ->needs(toc_bits);
+
   app.add_flag("--testing", cli.testing,
                "Download from a local test server instead of public api.");
 }
@@ -69,9 +91,25 @@ void launch_bin_db(std::ofstream& output_db_stream, const hibp::dnl::cli_config_
                    std::size_t start_index) {
   // use a largegish output buffer ~240kB for efficient writes
   // keep stream instance alive here
-  auto ffsw = flat_file::stream_writer<PwType>(output_db_stream, 10'000);
-  hibp::dnl::run([&](const std::string& line) { ffsw.write(PwType{line}); }, start_index,
+  auto ffsw   = flat_file::stream_writer<PwType>(output_db_stream, 10'000);
+  auto writer = hibp::indexing_writer<PwType, decltype(ffsw)>(ffsw, cli.toc_bits, cli.toc_fences);
+  hibp::dnl::run([&](const std::string& line) { writer.write(PwType{line}); }, start_index,
                  cli.testing);
+  writer.finish(cli.output_db_filename);
+}
+
+// each stripe holds an equal range of prefixes, and so is written in turn
+template <hibp::pw_type PwType>
+void launch_striped_db(const hibp::dnl::cli_config_t& cli) {
+  const std::vector<std::filesystem::path> dirs(cli.stripe_dirs.begin(), cli.stripe_dirs.end());
+  const std::size_t                        stripes = dirs.size();
+  auto striped = flat_file::striped_writer<PwType>(
+      cli.output_db_filename, flat_file::stripe_filenames(cli.output_db_filename, dirs),
+      [stripes](const PwType& pw) { return hibp::hash_stripe(pw, stripes); });
+  auto writer =
+      hibp::indexing_writer<PwType, decltype(striped)>(striped, cli.toc_bits, cli.toc_fences);
+  hibp::dnl::run([&](const std::string& line) { writer.write(PwType{line}); }, 0, cli.testing);
+  writer.finish(cli.output_db_filename); // the toc is of the manifest, as for table_of_contents
 }
 
 template <hibp::pw_type PwType>
@@ -101,6 +139,17 @@ std::size_t get_start_index(const hibp::dnl::cli_config_t& cli) {
 }
 
 void launch_stream(const hibp::dnl::cli_config_t& cli) {
+  if (!cli.stripe_dirs.empty()) {
+    if (cli.ntlm) {
+      launch_striped_db<hibp::pawned_pw_ntlm>(cli);
+    } else if (cli.sha1t64) {
+      launch_striped_db<hibp::pawned_pw_sha1t64>(cli);
+    } else {
+      launch_striped_db<hibp::pawned_pw_sha1>(cli);
+    }
+    return;
+  }
+
   const std::size_t start_index = get_start_index(cli);
 
   std::ios_base::openmode mode = cli.txt_out ? std::ios_base::out : std::ios_base::binary;
@@ -159,6 +208,17 @@ void check_options(const hibp::dnl::cli_config_t& cli) {
     throw std::runtime_error("can't use `--binfuse(8|16)-out` with a hash format selector");
   }
 
+  if (!cli.stripe_dirs.empty() && (cli.resume || cli.txt_out || cli.binfuse8_out ||
+                                    cli.binfuse16_out)) {
+    throw std::runtime_error(
+        "can't use `--stripe-dirs` with `--resume`, `--txt-out` or `--binfuse(8|16)-out`");
+  }
+
+  if (cli.toc_bits != 0 && (cli.resume || cli.txt_out || cli.binfuse8_out || cli.binfuse16_out)) {
+    throw std::runtime_error(
+        "can't use `--toc-bits` with `--resume`, `--txt-out` or `--binfuse(8|16)-out`");
+  }
+
   if (cli.force && cli.resume) {
     throw std::runtime_error("can't use `--resume` and `--force` together");
   }
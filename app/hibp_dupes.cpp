@@ -1,21 +1,28 @@
 #include "bytearray_cast.hpp"
 #include "flat_file.hpp"
+#include "flat_file/pread.hpp"
 #include "hibp.hpp"
 #include <CLI/CLI.hpp>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
 #include <iostream>
+#include <limits>
+#include <span>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace {
 
 struct cli_config_t {
   std::string db_filename;
-  bool        ntlm = false;
-  unsigned    bits = 64; // 1Mega chapters
+  bool        ntlm    = false;
+  unsigned    bits    = 64; // 1Mega chapters
+  unsigned    threads = std::thread::hardware_concurrency();
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -30,22 +37,46 @@ void define_options(CLI::App& app, cli_config_t& cli) {
       ->check(CLI::Range(32, 64));
 
   app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_option("--threads", cli.threads,
+                 fmt::format("The number of threads to use (default: {})", cli.threads))
+      ->check(CLI::Range(1U, cli.threads));
 }
 
 template <hibp::pw_type PwType>
 void run_search(const cli_config_t& cli) {
-  flat_file::database<PwType> db(cli.db_filename, (1U << 16U) / sizeof(PwType));
+  const flat_file::shared_database<PwType> db(cli.db_filename, flat_file::access_advice::once);
 
   std::cout << fmt::format("Looking for duplicates in the first {} bits of the hash...\n",
                            cli.bits);
-  std::uint64_t last = -1;
-  for (auto& pw: db) {
-    auto prefix = hibp::bytearray_cast<std::uint64_t>(pw.hash.data()) >> (64 - cli.bits);
-    if (prefix == last) {
-      std::cout << fmt::format("{:016X} is a dupe (orig record: {})\n", prefix, pw.to_string());
-    }
-    last = prefix;
-  }
+
+  auto prefix_of = [&](const PwType& pw) {
+    return hibp::bytearray_cast<std::uint64_t>(pw.hash.data()) >> (64 - cli.bits);
+  };
+
+  // each thread scans its own range, output is collected and printed in db order
+  std::vector<std::string> dupes(cli.threads);
+  flat_file::for_each_range(
+      db.number_records(), cli.threads, [&](std::size_t idx, std::size_t first, std::size_t last) {
+        // compare across the range boundary with the last record of the previous range
+        std::uint64_t prev = std::numeric_limits<std::uint64_t>::max();
+        if (first != 0) {
+          PwType before;
+          db.read(first - 1, 1, &before);
+          prev = prefix_of(before);
+        }
+        flat_file::for_each_span(db, first, last, [&](std::span<const PwType> span) {
+          for (const auto& pw: span) {
+            auto prefix = prefix_of(pw);
+            if (prefix == prev) {
+              dupes[idx] +=
+                  fmt::format("{:016X} is a dupe (orig record: {})\n", prefix, pw.to_string());
+            }
+            prev = prefix;
+          }
+        });
+      });
+  for (const auto& d: dupes) std::cout << d;
 }
 } // namespace
 
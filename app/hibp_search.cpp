@@ -1,7 +1,16 @@
+#include "columnar.hpp"
+#include "compressed.hpp"
+#include "delta.hpp"
 #include "flat_file.hpp"
+#include "flat_file/striped.hpp"
 #include "hibp.hpp"
+#include "interp.hpp"
+#include "mphf.hpp"
 #include "ntlm.hpp"
+#include "rmi.hpp"
+#include "stree.hpp"
 #include "toc.hpp"
+#include "window_search.hpp"
 #include <CLI/CLI.hpp>
 #include <algorithm>
 #include <chrono>
@@ -10,6 +19,7 @@
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
 #include <iostream>
+#include <map>
 #include <optional>
 #include <ratio>
 #include <sha1.h>
@@ -22,17 +32,29 @@ namespace {
 struct cli_config_t {
   std::string db_filename;
   std::string plain_text_password;
-  bool        toc      = false;
-  bool        hash     = false;
-  bool        ntlm     = false;
-  bool        sha1t64  = false;
-  unsigned    toc_bits = 20; // 1Mega chapters
+  bool        toc        = false;
+  bool        toc_fences = false;
+  bool        stree      = false;
+  bool        mphf       = false;
+  bool        hash       = false;
+  bool        ntlm       = false;
+  bool        sha1t64    = false;
+  bool        columns    = false;
+  bool        compr      = false;
+  bool        delta      = false;
+  unsigned    toc_bits   = 20; // 1Mega chapters
+
+  hibp::search_strategy search   = hibp::search_strategy::binary;
+  hibp::count_encoding  count    = hibp::count_encoding::int32;
+  hibp::learned_index   index    = hibp::learned_index::none;
+  hibp::toc_read        toc_mode = hibp::toc_read::probe;
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
 
   app.add_option("db_filename", cli.db_filename,
-                 "The file that contains the binary database you downloaded")
+                 "The file that contains the binary database you downloaded, or the "
+                 "manifest of a striped one")
       ->required();
 
   app.add_option("plain-text-password", cli.plain_text_password,
@@ -48,23 +70,90 @@ void define_options(CLI::App& app, cli_config_t& cli) {
                "Download the sha1 format password hashes, but truncate them to 64bits in binary "
                "output format.");
 
-  app.add_flag("--toc", cli.toc,
-               "Use a bit mask oriented table of contents for extra performance.");
+  app.add_flag("--columns", cli.columns,
+               "db_filename is the base name of a columnar db, as written by "
+               "`hibp-convert --bin-to-columns`. Only the hash column is searched.");
+
+  app.add_flag("--compressed", cli.compr,
+               "db_filename is a block compressed db, as written by "
+               "`hibp-convert --bin-to-compressed`. Searched with one read.");
+
+  auto* toc = app.add_flag("--toc", cli.toc,
+                           "Use a bit mask oriented table of contents for extra performance.");
+
+  auto* stree = app.add_flag("--stree", cli.stree,
+                             "Use a static B+tree (S-tree) index of hash prefixes, searched with "
+                             "SIMD, for extra performance. Built on first use and saved next to "
+                             "the db.")
+                    ->excludes(toc);
+
+  app.add_flag("--mphf", cli.mphf,
+               "Use a perfect hash index, which maps each hash to its record, so each search "
+               "reads exactly one record. Built on first use and saved next to the db.")
+      ->excludes(toc)
+      ->excludes(stree);
+
+  const std::map<std::string, hibp::learned_index> index_map{
+      {"none", hibp::learned_index::none},
+      {"rmi", hibp::learned_index::rmi},
+  };
+  app.add_option("--index", cli.index,
+                 "Use a learned index. 'rmi' is a recursive model index: a few thousand linear "
+                 "models, of only ~100KB, which predict each hash's position within a small "
+                 "error window. Built on first use and saved next to the db. Cannot be combined "
+                 "with --toc, --stree or --mphf. (default: none)")
+      ->transform(CLI::CheckedTransformer(index_map, CLI::ignore_case));
 
   app.add_option("--toc-bits", cli.toc_bits,
                  fmt::format("Specify how may bits to use for table of content mask. default {}",
                              cli.toc_bits))
-      ->check(CLI::Range(15, 25));
-}
+      ->check(CLI::Range(15, 32));
 
-template <hibp::pw_type PwType>
-void run_search(const cli_config_t& cli) {
-  flat_file::database<PwType> db(cli.db_filename, 4096 / sizeof(PwType));
+  const std::map<std::string, hibp::toc_read> toc_read_map{
+      {"probe", hibp::toc_read::probe},
+      {"chapter", hibp::toc_read::chapter},
+  };
+  app.add_option("--toc-read", cli.toc_mode,
+                 "How --toc reads the chapter which may contain the hash. 'probe' binary searches "
+                 "it with one read per probe. 'chapter' reads the whole chapter, ~24KB for the "
+                 "full db, with a single read and searches it in memory. (default: probe)")
+      ->transform(CLI::CheckedTransformer(toc_read_map, CLI::ignore_case))
+      ->needs(toc);
 
-  if (cli.toc) {
-    hibp::toc_build<PwType>(cli.db_filename, cli.toc_bits);
-  }
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "Also keep the first 8 bytes of the hash at every 4KB page of the db in RAM, "
+               "~40MB for the full db, which narrow each chapter to the single page holding the "
+               "hash. Built with the toc and saved next to the db.")
+      ->needs(toc);
+
+  app.add_flag("--delta", cli.delta,
+               "Also search the delta layer of local additions in <db_filename>.delta/, as "
+               "written by `hibp-delta`. Its records take precedence over the db's.");
+
+  const std::map<std::string, hibp::search_strategy> search_map{
+      {"binary", hibp::search_strategy::binary},
+      {"interp", hibp::search_strategy::interp},
+  };
+  app.add_option("--search", cli.search,
+                 "How to search the db without an index. 'interp' estimates the position of the "
+                 "hash, because hashes are uniformly distributed, which takes ~3 reads rather "
+                 "than ~30. Cannot be combined with --toc or --stree. (default: binary)")
+      ->transform(CLI::CheckedTransformer(search_map, CLI::ignore_case));
+
+  const std::map<std::string, hibp::count_encoding> count_map{
+      {"int32", hibp::count_encoding::int32},
+      {"sat16", hibp::count_encoding::sat16},
+      {"log8", hibp::count_encoding::log8},
+      {"none", hibp::count_encoding::none},
+  };
+  app.add_option("--count", cli.count,
+                 "How the db stores counts, as written by `hibp-convert --repack --count=...`. "
+                 "Packed dbs can only be searched with --search. (default: int32)")
+      ->transform(CLI::CheckedTransformer(count_map, CLI::ignore_case));
+}
 
+template <hibp::pw_type PwType>
+PwType make_needle(const cli_config_t& cli) {
   PwType needle;
   if constexpr (std::is_same_v<PwType, hibp::pawned_pw_ntlm>) {
     if (cli.hash) {
@@ -86,18 +175,18 @@ void run_search(const cli_config_t& cli) {
       needle = PwType{SHA1{}(cli.plain_text_password)};
     }
   }
+  return needle;
+}
 
-  std::optional<PwType> maybe_ppw;
-
+// time the search and report the result
+template <hibp::any_pw_type PwType, typename SearchFunc>
+void timed_search(const PwType& needle, SearchFunc search) {
   using clk       = std::chrono::high_resolution_clock;
   using fmilli    = std::chrono::duration<double, std::milli>;
   auto start_time = clk::now();
-  if (cli.toc) {
-    maybe_ppw = hibp::toc_search<PwType>(db, needle, cli.toc_bits);
-  } else if (auto iter = std::lower_bound(db.begin(), db.end(), needle);
-             iter != db.end() && *iter == needle) {
-    maybe_ppw = *iter;
-  }
+
+  const std::optional<PwType> maybe_ppw = search();
+
   std::cout << fmt::format("search took {:.2}\n", duration_cast<fmilli>(clk::now() - start_time));
 
   std::cout << "needle = " << needle << "\n";
@@ -106,6 +195,111 @@ void run_search(const cli_config_t& cli) {
   else
     std::cout << "not found\n";
 }
+
+// build or load any index, and search the db, which has the flat_file::database interface
+template <hibp::pw_type PwType, typename DbType>
+void search_db(DbType& db, const cli_config_t& cli) {
+  std::optional<hibp::table_of_contents<PwType>> toc;
+  std::optional<hibp::stree<PwType>>             stree;
+  std::optional<hibp::mphf<PwType>>              mphf;
+  std::optional<hibp::rmi<PwType>>               rmi;
+  if (cli.toc) {
+    toc.emplace(cli.db_filename, cli.toc_bits, cli.toc_fences);
+  } else if (cli.stree) {
+    stree.emplace(cli.db_filename);
+  } else if (cli.mphf) {
+    mphf.emplace(cli.db_filename);
+  } else if (cli.index == hibp::learned_index::rmi) {
+    rmi.emplace(cli.db_filename);
+  }
+
+  std::optional<hibp::delta_store<PwType>> delta;
+  if (cli.delta) delta.emplace(cli.db_filename);
+
+  const PwType needle = make_needle<PwType>(cli);
+
+  timed_search(needle, [&]() -> std::optional<PwType> {
+    if (delta) {
+      if (auto maybe_ppw = delta->find(needle)) return maybe_ppw;
+    }
+    if (toc) return hibp::toc_search<PwType>(db, *toc, needle, cli.toc_mode);
+    if (stree) return hibp::window_search(db, *stree, needle);
+    if (mphf) return hibp::window_search(db, *mphf, needle);
+    if (rmi) return hibp::window_search(db, *rmi, needle);
+    if (cli.search == hibp::search_strategy::interp) return hibp::interp_search<PwType>(db, needle);
+
+    if (auto iter = std::lower_bound(db.begin(), db.end(), needle);
+        iter != db.end() && *iter == needle) {
+      return *iter;
+    }
+    return {};
+  });
+}
+
+template <hibp::pw_type PwType>
+void run_search(const cli_config_t& cli) {
+  if (cli.columns) {
+    hibp::columnar_database<PwType> db(cli.db_filename);
+    const PwType                    needle = make_needle<PwType>(cli);
+    timed_search(needle, [&] { return db.find(needle); });
+    return;
+  }
+
+  if (cli.compr) {
+    const hibp::compressed_database<PwType> db(cli.db_filename);
+    const PwType                            needle = make_needle<PwType>(cli);
+    timed_search(needle, [&] { return db.find(needle); });
+    return;
+  }
+
+  if (flat_file::is_striped(cli.db_filename)) {
+    // one positional read per stripe spanned, through a page sized buffer
+    const flat_file::striped_database<PwType> striped(cli.db_filename);
+    auto                                      db = striped.make_cursor(4096 / sizeof(PwType));
+    search_db<PwType>(db, cli);
+    return;
+  }
+  flat_file::database<PwType> db(cli.db_filename, 4096 / sizeof(PwType));
+  search_db<PwType>(db, cli);
+}
+
+// a db of packed records, which has no index, so just binary or interpolation search
+template <hibp::any_pw_type PackedType>
+void run_packed_search(const cli_config_t& cli) {
+  flat_file::database<PackedType> db(cli.db_filename, 4096 / sizeof(PackedType));
+
+  PackedType needle;
+  needle.hash = make_needle<hibp::pawned_pw<PackedType::hash_size>>(cli).hash;
+
+  timed_search(needle, [&]() -> std::optional<PackedType> {
+    if (cli.search == hibp::search_strategy::interp) return hibp::interp_search(db, needle);
+
+    if (auto iter = std::lower_bound(db.begin(), db.end(), needle);
+        iter != db.end() && *iter == needle) {
+      return *iter;
+    }
+    return {};
+  });
+}
+
+template <hibp::pw_type PwType>
+void dispatch_count(const cli_config_t& cli) {
+  constexpr unsigned hash_size = PwType::hash_size;
+  switch (cli.count) {
+  case hibp::count_encoding::int32:
+    run_search<PwType>(cli);
+    break;
+  case hibp::count_encoding::sat16:
+    run_packed_search<hibp::pawned_pw<hash_size, hibp::count_sat16>>(cli);
+    break;
+  case hibp::count_encoding::log8:
+    run_packed_search<hibp::pawned_pw<hash_size, hibp::count_log8>>(cli);
+    break;
+  case hibp::count_encoding::none:
+    run_packed_search<hibp::pawned_pw<hash_size, hibp::count_none>>(cli);
+    break;
+  }
+}
 } // namespace
 
 int main(int argc, char* argv[]) {
@@ -116,12 +310,43 @@ int main(int argc, char* argv[]) {
   CLI11_PARSE(app, argc, argv);
 
   try {
+    const bool rmi = cli.index != hibp::learned_index::none;
+    if (rmi && (cli.toc || cli.stree || cli.mphf)) {
+      throw std::runtime_error("--index cannot be combined with --toc, --stree or --mphf");
+    }
+    if (cli.search != hibp::search_strategy::binary && (cli.toc || cli.stree || cli.mphf || rmi)) {
+      throw std::runtime_error(
+          "--search=interp cannot be combined with --toc, --stree, --mphf or --index");
+    }
+    if ((cli.columns || cli.compr) &&
+        (cli.toc || cli.stree || cli.mphf || rmi || cli.search != hibp::search_strategy::binary)) {
+      throw std::runtime_error("--columns and --compressed cannot be combined with --toc, --stree, "
+                               "--mphf, --index or --search");
+    }
+    if (cli.delta && (cli.columns || cli.compr || cli.count != hibp::count_encoding::int32)) {
+      throw std::runtime_error(
+          "--delta cannot be combined with --columns, --compressed or --count");
+    }
+    if (flat_file::is_striped(cli.db_filename) &&
+        (cli.columns || cli.compr || cli.stree || cli.mphf || rmi ||
+         cli.count != hibp::count_encoding::int32)) {
+      throw std::runtime_error("A striped db cannot be searched with --columns, --compressed, "
+                               "--stree, --mphf, --index or --count");
+    }
+    if (cli.columns && cli.compr) {
+      throw std::runtime_error("Please use only one of --columns and --compressed");
+    }
+    if (cli.count != hibp::count_encoding::int32 &&
+        (cli.columns || cli.compr || cli.toc || cli.stree || cli.mphf || rmi)) {
+      throw std::runtime_error("--count cannot be combined with --columns, --compressed, --toc, "
+                               "--stree, --mphf or --index");
+    }
     if (cli.ntlm) {
-      run_search<hibp::pawned_pw_ntlm>(cli);
+      dispatch_count<hibp::pawned_pw_ntlm>(cli);
     } else if (cli.sha1t64) {
-      run_search<hibp::pawned_pw_sha1t64>(cli);
+      dispatch_count<hibp::pawned_pw_sha1t64>(cli);
     } else {
-      run_search<hibp::pawned_pw_sha1>(cli);
+      dispatch_count<hibp::pawned_pw_sha1>(cli);
     }
   } catch (const std::exception& e) {
     std::cerr << "something went wrong: " << e.what() << "\n";
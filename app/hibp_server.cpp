@@ -1,14 +1,23 @@
 #include "binfuse.hpp"
 #include "binfuse/sharded_filter.hpp"
+#include "compressed.hpp"
 #include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/pread.hpp"
+#include "flat_file/striped.hpp"
+#include "flat_file/uring.hpp"
 #include "hibp.hpp"
+#include "mphf.hpp"
+#include "rmi.hpp"
 #include "srv/server.hpp"
+#include "stree.hpp"
 #include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <cstdlib>
 #include <exception>
 #include <fmt/format.h>
 #include <iostream>
+#include <map>
 #include <stdexcept>
 #include <string>
 
@@ -17,8 +26,8 @@ namespace {
 void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
 
   app.add_option("--sha1-db", cli.sha1_db_filename,
-                 "The file that contains the binary database you downloaded. "
-                 "Used for /check/sha1|plain/... requests.");
+                 "The file that contains the binary database you downloaded, or the manifest "
+                 "of a striped one. Used for /check/sha1|plain/... requests.");
 
   app.add_option("--ntlm-db", cli.ntlm_db_filename,
                  "The file that contains the binary database of ntlm hashes you downloaded. "
@@ -54,12 +63,139 @@ void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
       "Use this to uniquefy the password provided for each query, "
       "thereby defeating the cache. The results will be wrong, but good for performance tests");
 
-  app.add_flag("--toc", cli.toc, "Use a table of contents for extra performance.");
+  auto* mmap = app.add_flag("--mmap", cli.mmap,
+                            "Memory map the dbs and share them across all threads, rather than "
+                            "reading through a buffer per thread. Fastest when the OS can cache "
+                            "most of the db.");
+
+  auto* io_uring = app.add_flag("--io-uring", cli.io_uring,
+                                "Search the dbs with batches of concurrent reads, submitted "
+                                "through io_uring, rather than one read at a time. Helps on fast "
+                                "SSDs when the db is not cached. Falls back to plain reads if "
+                                "io_uring is unavailable.")
+                       ->excludes(mmap);
+
+  auto* compressed =
+      app.add_flag("--compressed", cli.compressed,
+                   "The dbs are block compressed, as written by `hibp-convert "
+                   "--bin-to-compressed`. Each query is one read, via an in-memory index of "
+                   "blocks, and more of the smaller dbs fit in the OS page cache.")
+          ->excludes(mmap)
+          ->excludes(io_uring);
+
+  auto* elias_fano =
+      app.add_flag("--elias-fano", cli.elias_fano,
+                   "Hold the --sha1t64-db in RAM, Elias-Fano coded in ~5.5 bytes per record, and "
+                   "answer every query from there, without disk reads. Built on first use and "
+                   "saved next to the db. Cannot be combined with --sha1-db or --ntlm-db.")
+          ->excludes(mmap)
+          ->excludes(io_uring)
+          ->excludes(compressed);
+
+  app.add_option("--cache-mb", cli.cache_mb,
+                 "Read the dbs with O_DIRECT, through a page cache of this many MB, shared by "
+                 "all threads. Gives predictable memory use and hit rates which do not depend on "
+                 "the OS page cache. (default: 0, ie off)")
+      ->excludes(mmap)
+      ->excludes(io_uring)
+      ->excludes(compressed)
+      ->excludes(elias_fano);
+
+  auto* toc = app.add_flag("--toc", cli.toc, "Use a table of contents for extra performance.")
+                  ->excludes(compressed)
+                  ->excludes(elias_fano);
+
+  auto* stree = app.add_flag("--stree", cli.stree,
+                             "Use a static B+tree (S-tree) index of hash prefixes, searched with "
+                             "SIMD, for extra performance. Built on first use and saved next to "
+                             "the db.")
+                    ->excludes(toc)
+                    ->excludes(compressed)
+                    ->excludes(elias_fano);
+
+  auto* mphf = app.add_flag("--mphf", cli.mphf,
+                            "Use a perfect hash index, which maps each hash to its record, so "
+                            "each query reads exactly one record. Built on first use and saved "
+                            "next to the db.")
+                   ->excludes(toc)
+                   ->excludes(stree)
+                   ->excludes(compressed)
+                   ->excludes(elias_fano);
+
+  const std::map<std::string, hibp::learned_index> index_map{
+      {"none", hibp::learned_index::none},
+      {"rmi", hibp::learned_index::rmi},
+  };
+  app.add_option("--index", cli.index,
+                 "Use a learned index. 'rmi' is a recursive model index: a few thousand linear "
+                 "models, of only ~100KB, which predict each hash's position within a small "
+                 "error window. Built on first use and saved next to the db. (default: none)")
+      ->transform(CLI::CheckedTransformer(index_map, CLI::ignore_case))
+      ->excludes(toc)
+      ->excludes(stree)
+      ->excludes(mphf)
+      ->excludes(compressed)
+      ->excludes(elias_fano);
 
   app.add_option("--toc-bits", cli.toc_bits,
                  fmt::format("Specify how may bits to use for table of content mask. default {}",
                              cli.toc_bits))
-      ->check(CLI::Range(15, 25));
+      ->check(CLI::Range(15, 32));
+
+  const std::map<std::string, hibp::toc_read> toc_read_map{
+      {"probe", hibp::toc_read::probe},
+      {"chapter", hibp::toc_read::chapter},
+  };
+  app.add_option("--toc-read", cli.toc_mode,
+                 "How --toc reads the chapter which may contain the hash. 'probe' binary searches "
+                 "it with one read per probe. 'chapter' reads the whole chapter, ~24KB for the "
+                 "full db, with a single read and searches it in memory. Cannot be combined "
+                 "with --io-uring, which batches the reads of its own search of the chapter. "
+                 "(default: probe)")
+      ->transform(CLI::CheckedTransformer(toc_read_map, CLI::ignore_case))
+      ->needs(toc)
+      ->excludes(io_uring);
+
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "Also keep the first 8 bytes of the hash at every 4KB page of the db in RAM, "
+               "~40MB for the full db, which narrow each chapter to the single page holding the "
+               "hash. Built with the toc and saved next to the db.")
+      ->needs(toc);
+
+  app.add_flag("--delta", cli.delta,
+               "Also search the delta layer of local additions of each db, in <db>.delta/, as "
+               "written by `hibp-delta`. Its records take precedence over the db's. Each delta "
+               "run is mapped, with a bloom filter in RAM, so runs without the hash are skipped.");
+
+  const std::map<std::string, hibp::search_strategy> search_map{
+      {"binary", hibp::search_strategy::binary},
+      {"interp", hibp::search_strategy::interp},
+  };
+  app.add_option("--search", cli.search,
+                 "How to search the dbs without an index. 'interp' estimates the position of the "
+                 "hash, because hashes are uniformly distributed, which takes ~3 reads rather "
+                 "than ~30. Cannot be combined with --toc, --stree or --io-uring. "
+                 "(default: binary)")
+      ->transform(CLI::CheckedTransformer(search_map, CLI::ignore_case));
+
+  app.add_flag("--preload", cli.preload,
+               "Prefault the toc, the filters and, with --mmap, the dbs, using all cores, before "
+               "serving. Avoids the slow first minutes after a restart.");
+
+  app.add_flag("--mlock", cli.mlock,
+               "Like --preload, and then lock them in RAM, so they can never be paged out. "
+               "Requires sufficient `ulimit -l` or CAP_IPC_LOCK.");
+
+  const std::map<std::string, flat_file::huge_pages> huge_pages_map{
+      {"none", flat_file::huge_pages::none},
+      {"transparent", flat_file::huge_pages::transparent},
+      {"explicit", flat_file::huge_pages::hugetlb},
+  };
+  app.add_option("--huge-pages", cli.huge_pages,
+                 "Back the toc, filters and mmap'd dbs with huge pages, to reduce TLB misses. "
+                 "'transparent' uses THP where the kernel allows. 'explicit' uses the reserved "
+                 "hugetlbfs pool for the toc. (default: none)")
+      ->transform(CLI::CheckedTransformer(huge_pages_map, CLI::ignore_case));
 }
 } // namespace
 
@@ -70,10 +206,25 @@ cli_config_t cli;
 namespace {
 
 template <hibp::pw_type PwType>
-void prep_db(const std::string& db_filename, bool toc, unsigned toc_bits) {
-  auto test_db = flat_file::database<PwType>{db_filename};
-  if (toc) {
-    hibp::toc_build<PwType>(db_filename, toc_bits);
+void prep_db(const std::string& db_filename, const hibp::srv::cli_config_t& cli) {
+  if (cli.striped) {
+    auto test_db = flat_file::striped_database<PwType>{db_filename};
+  } else if (cli.mmap) {
+    auto test_db = flat_file::mmap_database<PwType>{db_filename};
+  } else if (cli.compressed) {
+    auto test_db = hibp::compressed_database<PwType>{db_filename}; // builds its index, if stale
+  } else {
+    auto test_db = flat_file::shared_database<PwType>{db_filename};
+  }
+  if (cli.toc) {
+    // built now, if need be, and saved, so the server only maps it
+    const hibp::table_of_contents<PwType> toc(db_filename, cli.toc_bits, cli.toc_fences);
+  } else if (cli.stree) {
+    const hibp::stree<PwType> stree(db_filename);
+  } else if (cli.mphf) {
+    const hibp::mphf<PwType> mphf(db_filename);
+  } else if (cli.index == hibp::learned_index::rmi) {
+    const hibp::rmi<PwType> rmi(db_filename);
   }
 }
 
@@ -86,13 +237,13 @@ void prep_filter(const std::string& db_filename) {
 // test db files open OK, before starting server, and build their tocs
 void prep_sources(const hibp::srv::cli_config_t& cli) {
   if (!cli.sha1_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli);
   }
   if (!cli.ntlm_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_ntlm>(cli.ntlm_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_ntlm>(cli.ntlm_db_filename, cli);
   }
   if (!cli.sha1t64_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_sha1t64>(cli.sha1t64_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_sha1t64>(cli.sha1t64_db_filename, cli);
   }
   if (!cli.binfuse8_filter_filename.empty()) {
     prep_filter<binfuse::sharded_filter8_source>(cli.binfuse8_filter_filename);
@@ -100,6 +251,9 @@ void prep_sources(const hibp::srv::cli_config_t& cli) {
   if (!cli.binfuse16_filter_filename.empty()) {
     prep_filter<binfuse::sharded_filter16_source>(cli.binfuse16_filter_filename);
   }
+  if (cli.io_uring && !flat_file::batch_reader{}.uses_io_uring()) {
+    std::cerr << "warning: io_uring is not available, falling back to plain reads\n";
+  }
 }
 } // namespace
 
@@ -116,6 +270,26 @@ int main(int argc, char* argv[]) {
         cli.binfuse8_filter_filename.empty()) {
       throw std::runtime_error("You must one of --sha1-db, --ntlm-db or --sha1t64-db");
     }
+    if (cli.search != hibp::search_strategy::binary &&
+        (cli.toc || cli.stree || cli.mphf || cli.index != hibp::learned_index::none ||
+         cli.io_uring || cli.compressed || cli.elias_fano)) {
+      throw std::runtime_error("--search=interp cannot be combined with --toc, --stree, --mphf, "
+                               "--index, --io-uring, --compressed or --elias-fano");
+    }
+    if (cli.elias_fano && (cli.sha1t64_db_filename.empty() || !cli.sha1_db_filename.empty() ||
+                           !cli.ntlm_db_filename.empty())) {
+      throw std::runtime_error("--elias-fano requires --sha1t64-db, and no --sha1-db or --ntlm-db");
+    }
+    cli.striped = flat_file::is_striped(cli.sha1_db_filename) ||
+                  flat_file::is_striped(cli.ntlm_db_filename) ||
+                  flat_file::is_striped(cli.sha1t64_db_filename);
+    if (cli.striped && (cli.mmap || cli.io_uring || cli.cache_mb != 0 || cli.compressed ||
+                        cli.elias_fano || cli.stree || cli.mphf ||
+                        cli.index != hibp::learned_index::none)) {
+      throw std::runtime_error("Striped dbs cannot be combined with --mmap, --io-uring, "
+                               "--cache-mb, --compressed, --elias-fano, --stree, --mphf or "
+                               "--index");
+    }
     prep_sources(cli);
 
     hibp::srv::run_server();
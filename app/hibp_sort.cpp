@@ -1,11 +1,17 @@
 #include "flat_file.hpp"
+#include "flat_file/striped.hpp"
 #include "hibp.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
+#include <cstddef>
 #include <cstdlib>
 #include <exception>
+#include <filesystem>
 #include <fmt/format.h>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace {
 
@@ -14,6 +20,10 @@ struct cli_config_t {
   bool        sort_by_count = false;
   bool        ntlm          = false;
   std::size_t max_memory    = 1000;
+  unsigned    toc_bits      = 0; // ie no toc written
+  bool        toc_fences    = false;
+
+  std::vector<std::string> stripe_dirs;
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -27,6 +37,23 @@ void define_options(CLI::App& app, cli_config_t& cli) {
 
   app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
 
+  app.add_option("--stripe-dirs", cli.stripe_dirs,
+                 "Write the sorted data as a striped db: split into hash ranges, one in each of "
+                 "these directories, eg on separate devices, with <input>.sorted as the manifest "
+                 "which lists them. Comma separated. Not with --sort-by-count.")
+      ->delimiter(',');
+
+  auto* toc_bits = app.add_option("--toc-bits", cli.toc_bits,
+                                  "Also write the table of contents of the sorted db, with this "
+                                  "many bits, as for the --toc-bits of hibp-search and "
+                                  "hibp-server, next to it, while it is merged. So --toc can use "
+                                  "it straight away, without a rebuild. Not with --sort-by-count.")
+                       ->check(CLI::Range(15, 32));
+
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "With --toc-bits, also write the fences, as for --toc-fences.")
+      ->needs(toc_bits);
+
   app.add_option(
       "--max-memory", cli.max_memory,
       fmt::format("The maximum size of each chunk to sort in memory (in MB). The peak memory "
@@ -38,12 +65,33 @@ void define_options(CLI::App& app, cli_config_t& cli) {
 
 template <hibp::pw_type PwType>
 std::string sort_db(const cli_config_t& cli) {
-  flat_file::database<PwType> db(cli.input_filename, 4096 / sizeof(PwType));
+  flat_file::database<PwType> db(cli.input_filename, 4096 / sizeof(PwType),
+                                 flat_file::access_advice::once);
 
   auto max_mem_bytes = cli.max_memory * 1024 * 1024;
 
   std::string sorted_filename;
-  if (cli.sort_by_count) {
+  if (!cli.stripe_dirs.empty()) {
+    // merged straight into the stripes
+    sorted_filename = fmt::format("{}.sorted", cli.input_filename);
+    const std::vector<std::filesystem::path> dirs(cli.stripe_dirs.begin(), cli.stripe_dirs.end());
+    const std::size_t                        stripes = dirs.size();
+    flat_file::striped_writer<PwType>        striped(
+        sorted_filename, flat_file::stripe_filenames(sorted_filename, dirs),
+        [stripes](const PwType& pw) { return hibp::hash_stripe(pw, stripes); },
+        flat_file::access_advice::once);
+    hibp::indexing_writer<PwType, decltype(striped)> sorted(striped, cli.toc_bits,
+                                                            cli.toc_fences);
+    db.disksort_to(sorted, {}, {}, max_mem_bytes);
+    sorted.finish(sorted_filename);
+  } else if (cli.toc_bits != 0) {
+    // merged through the indexer, even if there is only one chunk
+    sorted_filename = fmt::format("{}.sorted", cli.input_filename);
+    flat_file::file_writer<PwType> file(sorted_filename, flat_file::access_advice::once);
+    hibp::indexing_writer<PwType, decltype(file)> sorted(file, cli.toc_bits, cli.toc_fences);
+    db.disksort_to(sorted, {}, {}, max_mem_bytes);
+    sorted.finish(sorted_filename);
+  } else if (cli.sort_by_count) {
     std::cerr << "Sorting by count descending\n";
     sorted_filename = db.disksort(
         [](auto& a, auto& b) {
@@ -66,6 +114,14 @@ int main(int argc, char* argv[]) {
   CLI11_PARSE(app, argc, argv);
 
   try {
+    if (cli.sort_by_count && cli.toc_bits != 0) {
+      throw std::runtime_error("The table of contents needs the db sorted by hash, so --toc-bits "
+                               "cannot be combined with --sort-by-count");
+    }
+    if (cli.sort_by_count && !cli.stripe_dirs.empty()) {
+      throw std::runtime_error("A striped db is sorted by hash, so --stripe-dirs cannot be "
+                               "combined with --sort-by-count");
+    }
     std::string sorted_filename;
     if (cli.ntlm) {
       sorted_filename = sort_db<hibp::pawned_pw_ntlm>(cli);
@@ -1,5 +1,7 @@
 #include "flat_file.hpp"
+#include "flat_file/pread.hpp"
 #include "hibp.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <algorithm>
 #if __has_include(<bits/chrono.h>)
@@ -7,6 +9,7 @@
 #endif
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
@@ -18,9 +21,13 @@
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <map>
 #include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace {
@@ -33,6 +40,9 @@ struct cli_config_t {
   bool        ntlm            = false;
   bool        sha1t64         = false;
   std::size_t topn            = 50'000'000; // ~1GB in memory, about 5% of the DB
+  unsigned    threads         = std::thread::hardware_concurrency();
+  unsigned    toc_bits        = 0; // ie no toc written
+  bool        toc_fences      = false;
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -56,6 +66,21 @@ void define_options(CLI::App& app, cli_config_t& cli) {
                "Use sha1 hashes truncated to 64bits rather than full sha1.");
 
   app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
+
+  app.add_option("--threads", cli.threads,
+                 fmt::format("The number of threads to use (default: {})", cli.threads))
+      ->check(CLI::Range(1U, cli.threads));
+
+  auto* toc_bits = app.add_option("--toc-bits", cli.toc_bits,
+                                  "Also write the table of contents of the output db, with this "
+                                  "many bits, as for the --toc-bits of hibp-search and "
+                                  "hibp-server, next to it, while it is written. So --toc can "
+                                  "use it straight away, without a rebuild. Not with --stdout.")
+                       ->check(CLI::Range(15, 32));
+
+  app.add_flag("--toc-fences", cli.toc_fences,
+               "With --toc-bits, also write the fences, as for --toc-fences.")
+      ->needs(toc_bits);
 }
 
 std::ofstream get_output_stream(const std::string& output_filename, bool force) {
@@ -73,6 +98,57 @@ std::ofstream get_output_stream(const std::string& output_filename, bool force)
   return output_stream;
 }
 
+// how many records have each `count` value. Most counts are small and go in the dense part.
+struct count_histogram {
+  static constexpr std::int32_t dense_size = 1 << 16;
+
+  std::vector<std::size_t>            dense = std::vector<std::size_t>(dense_size);
+  std::map<std::int32_t, std::size_t> sparse; // large (and any negative) counts
+
+  void add(std::int32_t count) {
+    if (count >= 0 && count < dense_size) {
+      ++dense[static_cast<std::size_t>(count)];
+    } else {
+      ++sparse[count];
+    }
+  }
+
+  [[nodiscard]] std::size_t at(std::int32_t count) const {
+    if (count >= 0 && count < dense_size) return dense[static_cast<std::size_t>(count)];
+    auto iter = sparse.find(count);
+    return iter == sparse.end() ? 0 : iter->second;
+  }
+
+  // number of records with a count strictly greater than `count`
+  [[nodiscard]] std::size_t above(std::int32_t count) const {
+    std::size_t total = 0;
+    for (auto iter = sparse.upper_bound(count); iter != sparse.end(); ++iter) total += iter->second;
+    for (std::int32_t c = std::max(count + 1, 0); c < dense_size; ++c) {
+      total += dense[static_cast<std::size_t>(c)];
+    }
+    return total;
+  }
+};
+
+// the lowest count which makes it into the topn, and how many records with exactly that count
+// are needed to make up the topn
+std::pair<std::int32_t, std::size_t> find_threshold(const std::vector<count_histogram>& hists,
+                                                    std::size_t                         topn) {
+  std::map<std::int32_t, std::size_t, std::greater<>> totals;
+  for (const auto& hist: hists) {
+    for (std::int32_t c = 0; c != count_histogram::dense_size; ++c) {
+      if (auto n = hist.dense[static_cast<std::size_t>(c)]; n != 0) totals[c] += n;
+    }
+    for (const auto& [c, n]: hist.sparse) totals[c] += n;
+  }
+  std::size_t cumulative = 0;
+  for (const auto& [count, n]: totals) {
+    if (cumulative + n >= topn) return {count, topn - cumulative};
+    cumulative += n;
+  }
+  throw std::logic_error("topn exceeds size of db"); // checked by caller
+}
+
 template <hibp::pw_type PwType>
 void build_topn(const cli_config_t& cli) {
   std::ostream* output_stream      = &std::cout;
@@ -84,30 +160,72 @@ void build_topn(const cli_config_t& cli) {
     output_stream_name = cli.output_filename;
   }
 
-  flat_file::database<PwType> input_db(cli.input_filename, (1U << 16U) / sizeof(PwType));
+  // maintenance, often of the db hibp-server is serving: don't evict its pages
+  const flat_file::shared_database<PwType> input_db(cli.input_filename,
+                                                    flat_file::access_advice::once);
 
   if (input_db.number_records() <= cli.topn) {
     throw std::runtime_error(
         fmt::format("size of input db ({}) <= topn ({}). Output would be identical. Aborting.",
                     input_db.number_records(), cli.topn));
   }
-  std::vector<PwType> memdb(cli.topn);
-
-  std::cout << fmt::format("{:50}", "Read db from disk and topN sort by count desc ...");
 
   using clk   = std::chrono::high_resolution_clock;
   using fsecs = std::chrono::duration<double>;
-  auto start  = clk::now();
 
-  // TopN sort descending by count (par_unseq makes no sense, as disk bound and flat_file not
-  // thread safe)
-  std::partial_sort_copy(input_db.begin(), input_db.end(), memdb.begin(), memdb.end(),
-                         [](const auto& a, const auto& b) {
-                           if (a.count == b.count)
-                             return a < b; // fall back to hash asc for stability
-                           return a.count > b.count;
-                         });
+  // TopN by count desc, falling back to hash asc for stability. This is done in 2 parallel passes
+  // over the db, rather than with a partial_sort, so that each thread can scan its own range:
+  // 1. build a histogram of counts per range, which gives the threshold count for the topn
+  // 2. copy records above the threshold, plus just enough at the threshold, into place
+  std::cout << fmt::format("{:50}", "Read db from disk and build count histogram ...");
+  auto start = clk::now();
+
+  std::vector<count_histogram> hists(cli.threads);
+  flat_file::for_each_range(input_db.number_records(), cli.threads,
+                            [&](std::size_t idx, std::size_t first, std::size_t last) {
+                              flat_file::for_each_span(input_db, first, last,
+                                                       [&](std::span<const PwType> span) {
+                                                         for (const auto& pw: span) {
+                                                           hists[idx].add(pw.count);
+                                                         }
+                                                       });
+                            });
+  std::cout << fmt::format("{:>8.3}\n", duration_cast<fsecs>(clk::now() - start));
+
+  std::cout << fmt::format("{:50}", "Read db from disk and select topN by count desc ...");
+  start = clk::now();
+
+  const auto              threshold_and_needed = find_threshold(hists, cli.topn);
+  const std::int32_t      threshold            = threshold_and_needed.first;
+  const std::size_t       needed_at_threshold  = threshold_and_needed.second;
+
+  // where each range writes its output, and how many at the threshold it contributes. The db is
+  // sorted by hash, so taking the first ones in db order is the "hash asc" tie break.
+  std::vector<std::size_t> offsets(hists.size() + 1);
+  std::vector<std::size_t> take_at_threshold(hists.size());
+  std::size_t              remaining = needed_at_threshold;
+  for (std::size_t i = 0; i != hists.size(); ++i) {
+    take_at_threshold[i] = std::min(hists[i].at(threshold), remaining);
+    remaining -= take_at_threshold[i];
+    offsets[i + 1] = offsets[i] + hists[i].above(threshold) + take_at_threshold[i];
+  }
 
+  std::vector<PwType> memdb(cli.topn);
+  flat_file::for_each_range(input_db.number_records(), cli.threads,
+                            [&](std::size_t idx, std::size_t first, std::size_t last) {
+                              std::size_t out   = offsets[idx];
+                              std::size_t taken = 0;
+                              flat_file::for_each_span(
+                                  input_db, first, last, [&](std::span<const PwType> span) {
+                                    for (const auto& pw: span) {
+                                      if (pw.count > threshold ||
+                                          (pw.count == threshold &&
+                                           taken++ < take_at_threshold[idx])) {
+                                        memdb[out++] = pw;
+                                      }
+                                    }
+                                  });
+                            });
   std::cout << fmt::format("{:>8.3}\n", duration_cast<fsecs>(clk::now() - start));
 
   std::cout << fmt::format("{:50}", "Sort by hash ascending ...");
@@ -123,9 +241,13 @@ void build_topn(const cli_config_t& cli) {
   start = clk::now();
   std::cout << fmt::format("{:50}", "Write TopN db to disk ...");
   auto output_db = flat_file::stream_writer<PwType>(*output_stream);
+  if (!cli.standard_output) output_db.advise(cli.output_filename, flat_file::access_advice::once);
+  auto writer =
+      hibp::indexing_writer<PwType, decltype(output_db)>(output_db, cli.toc_bits, cli.toc_fences);
   for (const auto& pw: memdb) {
-    output_db.write(pw);
+    writer.write(pw);
   }
+  writer.finish(cli.output_filename);
   std::cout << fmt::format("{:>8.3}\n", duration_cast<fsecs>(clk::now() - start));
 }
 } // namespace
@@ -145,6 +267,11 @@ int main(int argc, char* argv[]) {
                                "both, and not neither.");
     }
 
+    if (cli.toc_bits != 0 && cli.standard_output) {
+      throw std::runtime_error("The table of contents is written next to the output file, so "
+                               "--toc-bits cannot be combined with --stdout.");
+    }
+
     if (cli.ntlm && cli.sha1t64) {
       throw std::runtime_error("Please don't use --ntlm and --sha1t64 together.");
     }
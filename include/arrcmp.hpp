@@ -6,6 +6,8 @@
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <emmintrin.h>
 #include <immintrin.h>
 #include <type_traits>
@@ -57,7 +59,8 @@ concept any_of = (std::same_as<T, U> || ...);
 // Uses compiler intrinsics for endianess conversion if required and if
 // `swap_if_required` == true.
 // It is the caller's responsibility to ensure that enough bytes are
-// readable/dereferencable etc. This compiles to just a `mov` and `bswap`
+// readable/dereferencable etc. `source` need not be aligned, eg in packed records.
+// This compiles to just a `mov` and `bswap`
 template <typename T, bool swap_if_required = true>
 constexpr T bytearray_cast(const std::byte* source) noexcept
   requires any_of<T, std::uint64_t, std::uint32_t, std::uint16_t, std::uint8_t>
@@ -67,7 +70,8 @@ constexpr T bytearray_cast(const std::byte* source) noexcept
                     std::endian::native == std::endian::little,
                 "mixed-endianess architectures are not supported");
 
-  T value = *reinterpret_cast<const T*>(source); // NOLINT reincast
+  T value; // NOLINT uninitialised
+  std::memcpy(&value, source, sizeof(T));
 
   if constexpr (swap_if_required && sizeof(T) > 1 && std::endian::native == std::endian::little) {
     return byteswap<T>(value);
@@ -260,4 +264,33 @@ constexpr Comp::return_t array_compare(const std::array<std::byte, N>& a,
   return array_compare<N>(a.data(), b.data(), comp);
 }
 
+// The number of the N sorted `keys` which are < needle, ie the lower_bound position within a
+// node of a static search tree. Compares the whole node at once, so there are no branches to
+// mispredict. `keys` must be aligned to the vector size.
+template <std::size_t N>
+constexpr unsigned count_less(const std::uint64_t* keys, std::uint64_t needle) noexcept {
+  unsigned count = 0;
+  if constexpr (impl::avx512 && N % 8 == 0) {
+    const auto vneedle = _mm512_set1_epi64(static_cast<long long>(needle));
+    for (std::size_t i = 0; i != N; i += 8) {
+      const auto vkeys = _mm512_load_si512(keys + i); // NOLINT pointer arithmetic
+      count += static_cast<unsigned>(std::popcount(_mm512_cmplt_epu64_mask(vkeys, vneedle)));
+    }
+  } else if constexpr (impl::avx2 && N % 4 == 0) {
+    // there is no unsigned 64bit compare in avx2: flip the sign bits and compare signed
+    const auto bias    = _mm256_set1_epi64x(std::numeric_limits<long long>::min());
+    const auto vneedle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(needle)), bias);
+    for (std::size_t i = 0; i != N; i += 4) {
+      // NOLINTNEXTLINE reincast & pointer arithmetic
+      const auto vkeys = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i));
+      const auto less  = _mm256_cmpgt_epi64(vneedle, _mm256_xor_si256(vkeys, bias));
+      count += static_cast<unsigned>(
+          std::popcount(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(less)))));
+    }
+  } else {
+    for (std::size_t i = 0; i != N; ++i) count += keys[i] < needle ? 1U : 0U; // NOLINT ptr arith
+  }
+  return count;
+}
+
 } // namespace arrcmp
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <bit>
 #include <concepts>
 #include <cstddef>
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <ios>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+// Columnar layout of a db: two files, in the same (hash sorted) order
+//   <base>.hashes  just the hashes, as pw_hash records
+//   <base>.counts  just the counts, as int32
+//
+// Searches only read the hash column, so more records fit in each page which is read, and the
+// page cache is not filled with counts. The count is then read exactly once. The count column
+// can be rewritten on its own, eg for a refresh where the counts have changed but the hashes
+// have not, which replaces the db atomically. A full rewrite replaces one column after the other,
+// so is not atomic: a reader, or a crash, between the two may find the new hashes with the old
+// counts. columnar_database refuses columns of different lengths, but cannot detect that case
+// when the lengths agree.
+
+namespace hibp {
+
+inline std::filesystem::path columnar_hashes_filename(const std::filesystem::path& base) {
+  return fmt::format("{}.hashes", base.string());
+}
+
+inline std::filesystem::path columnar_counts_filename(const std::filesystem::path& base) {
+  return fmt::format("{}.counts", base.string());
+}
+
+template <pw_type PwType>
+class columnar_database {
+public:
+  using value_type = PwType;
+  using hash_type  = pw_hash<PwType::hash_size>;
+
+  explicit columnar_database(const std::filesystem::path& base)
+      : hashes_(columnar_hashes_filename(base), 4096 / sizeof(hash_type)),
+        counts_(columnar_counts_filename(base)) {
+
+    if (hashes_.number_records() != counts_.number_records())
+      throw std::ios::failure(fmt::format("columnar db {}: {} hashes, but {} counts", base,
+                                          hashes_.number_records(), counts_.number_records()));
+  }
+
+  // the full record at pos, reassembled from both columns
+  PwType get_record(std::size_t pos) {
+    PwType pw;
+    pw.hash  = hashes_.get_record(pos).hash;
+    pw.count = counts_.get_record(pos);
+    return pw;
+  }
+
+  // binary search in [first, last) of the hash column, then read the count of the match
+  std::optional<PwType> find(const PwType& needle, std::size_t first, std::size_t last) {
+    const hash_type hash_needle{needle};
+
+    auto begin = hashes_.begin();
+    if (auto iter = std::lower_bound(begin + first, begin + last, hash_needle);
+        iter != begin + last && *iter == hash_needle) {
+      return get_record(static_cast<std::size_t>(iter - begin)); // found!
+    }
+    return {}; // not found;
+  }
+
+  std::optional<PwType> find(const PwType& needle) { return find(needle, 0, number_records()); }
+
+  // the hash column, eg to search with some other strategy
+  flat_file::database<hash_type>& hashes() { return hashes_; }
+
+  [[nodiscard]] std::size_t number_records() const { return hashes_.number_records(); }
+
+private:
+  flat_file::database<hash_type>    hashes_;
+  flat_file::database<std::int32_t> counts_;
+};
+
+// Writes the columns of a columnar db, from full records, which must arrive in sorted order, or
+// write() throws. With `counts_only`, the existing hash column is kept, and each record is
+// checked against it.
+// The columns are written to <column>.tmp files, which only replace the live ones once finish()
+// has checked them, so a failed write, or refresh, leaves the db as it was.
+template <pw_type PwType>
+class columnar_writer {
+public:
+  using hash_type = pw_hash<PwType::hash_size>;
+
+  explicit columnar_writer(const std::filesystem::path& base, bool counts_only = false)
+      : base_(base) {
+    if (counts_only) {
+      existing_.emplace(columnar_hashes_filename(base), 4096 / sizeof(hash_type));
+    } else {
+      hashes_.emplace(tmp_filename(columnar_hashes_filename(base)).string());
+    }
+    counts_.emplace(tmp_filename(columnar_counts_filename(base)).string());
+  }
+
+  // a "unique manager" .. no copies or moves
+  columnar_writer(const columnar_writer& other)            = delete;
+  columnar_writer& operator=(const columnar_writer& other) = delete;
+  columnar_writer(columnar_writer&& other)                 = delete;
+  columnar_writer& operator=(columnar_writer&& other)      = delete;
+
+  // unless finished, the .tmp files are removed, and the live columns are untouched
+  ~columnar_writer() {
+    if (finished_) return;
+    hashes_.reset();
+    counts_.reset();
+    std::error_code ec;
+    std::filesystem::remove(tmp_filename(columnar_hashes_filename(base_)), ec);
+    std::filesystem::remove(tmp_filename(columnar_counts_filename(base_)), ec);
+  }
+
+  void write(const PwType& pw) {
+    const hash_type hash{pw};
+    if (existing_) {
+      if (written_ == existing_->number_records() || !(existing_->get_record(written_) == hash))
+        throw std::runtime_error(fmt::format(
+            "columnar db {}: record {} does not match the hash column", base_, written_));
+    } else {
+      if (written_ != 0 && hash < prev_)
+        throw std::runtime_error(fmt::format(
+            "columnar db {}: records must be in sorted order, at record {}", base_, written_));
+      hashes_->write(hash);
+      prev_ = hash;
+    }
+    counts_->write(pw.count);
+    ++written_;
+  }
+
+  // with `counts_only`, throws unless every record of the existing hash column was written.
+  // Then the written columns replace the live ones: the hashes, then the counts, see above.
+  void finish() {
+    if (existing_ && written_ != existing_->number_records())
+      throw std::runtime_error(fmt::format("columnar db {}: {} counts written for {} hashes",
+                                           base_, written_, existing_->number_records()));
+    hashes_.reset(); // flushed and closed
+    counts_.reset();
+    if (!existing_) {
+      std::filesystem::rename(tmp_filename(columnar_hashes_filename(base_)),
+                              columnar_hashes_filename(base_));
+    }
+    std::filesystem::rename(tmp_filename(columnar_counts_filename(base_)),
+                            columnar_counts_filename(base_));
+    finished_ = true;
+  }
+
+private:
+  std::filesystem::path                               base_;
+  std::optional<flat_file::database<hash_type>>       existing_;
+  std::optional<flat_file::file_writer<hash_type>>    hashes_;
+  std::optional<flat_file::file_writer<std::int32_t>> counts_;
+  hash_type                                           prev_;
+  std::size_t                                         written_  = 0;
+  bool                                                finished_ = false;
+
+  static std::filesystem::path tmp_filename(const std::filesystem::path& filename) {
+    return fmt::format("{}.tmp", filename.string());
+  }
+};
+
+} // namespace hibp
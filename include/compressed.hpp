@@ -0,0 +1,320 @@
+#pragma once
+
+#include "flat_file/pread.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Block compressed format for a sorted db.
+//
+// The file is a sequence of fixed size blocks, so any block can be fetched with one aligned read.
+// Each block holds as many whole records as fit:
+//
+//   uint16      number of records in the block
+//   hash        the first hash of the block, in full
+//   varint      its count
+//   then, for each further record:
+//     uint8     L, the number of significant bytes in the delta to the previous hash
+//     L bytes   the delta, big endian, ie with its leading zero bytes elided
+//     varint    the count
+//   zero padding
+//
+// Sorted hashes share their leading bits with their neighbours, so the deltas are short: the
+// prefix which a ToC chapter, or the block, already implies is never stored again. Counts are
+// mostly small, so varints save most of their 4 bytes.
+//
+// An in-memory index, of the first hash of every block, finds the one block which can hold a
+// needle. That block is then read and decoded, so every lookup is exactly one read. The index
+// is saved in a sidecar file next to the db, which is rebuilt when it is missing or stale.
+
+namespace hibp {
+
+namespace details {
+
+inline constexpr std::size_t compressed_block_size  = 4096;
+inline constexpr std::size_t compressed_header_size = sizeof(std::uint16_t);
+inline constexpr std::size_t max_varint_size        = 5; // for 32bits
+
+inline std::size_t put_varint(std::uint32_t value, std::byte* out) {
+  std::size_t len = 0;
+  while (value >= 0x80U) {
+    out[len++] = static_cast<std::byte>(value | 0x80U); // NOLINT pointer arithmetic
+    value >>= 7U;
+  }
+  out[len++] = static_cast<std::byte>(value); // NOLINT pointer arithmetic
+  return len;
+}
+
+inline std::uint32_t get_varint(const std::byte*& in, const std::byte* end) {
+  std::uint32_t value = 0;
+  for (unsigned shift = 0; in != end && shift < 35; shift += 7) {
+    const auto b = std::to_integer<std::uint32_t>(*in++); // NOLINT pointer arithmetic
+    value |= (b & 0x7FU) << shift;
+    if ((b & 0x80U) == 0) return value;
+  }
+  throw std::runtime_error("compressed db: corrupt varint");
+}
+
+// big endian arithmetic on hashes
+template <std::size_t N>
+std::array<std::byte, N> hash_delta(const std::array<std::byte, N>& hash,
+                                    const std::array<std::byte, N>& prev) {
+  std::array<std::byte, N> delta{};
+  unsigned                 borrow = 0;
+  for (std::size_t i = N; i-- != 0;) {
+    const unsigned diff = std::to_integer<unsigned>(hash[i]) -
+                          std::to_integer<unsigned>(prev[i]) - borrow;
+    delta[i] = static_cast<std::byte>(diff);
+    borrow   = diff > 0xFFU ? 1 : 0; // unsigned wrap around
+  }
+  if (borrow != 0) throw std::runtime_error("compressed db: records must be in sorted order");
+  return delta;
+}
+
+template <std::size_t N>
+void hash_add(std::array<std::byte, N>& hash, const std::byte* delta, std::size_t len) {
+  unsigned carry = 0;
+  for (std::size_t i = 0; i != N; ++i) {
+    const std::size_t pos = N - 1 - i;
+    unsigned sum = std::to_integer<unsigned>(hash[pos]) + carry;
+    if (i < len) sum += std::to_integer<unsigned>(delta[len - 1 - i]); // NOLINT ptr arithmetic
+    hash[pos] = static_cast<std::byte>(sum);
+    carry     = sum >> 8U;
+  }
+}
+
+// sequential decoder for the records of one block
+template <pw_type PwType>
+class block_decoder {
+public:
+  explicit block_decoder(const std::byte* block)
+      : cur_(block + compressed_header_size), // NOLINT pointer arithmetic
+        end_(block + compressed_block_size) {   // NOLINT pointer arithmetic
+    std::uint16_t nrecs = 0;
+    std::memcpy(&nrecs, block, sizeof(nrecs));
+    remaining_ = nrecs;
+  }
+
+  // decode the next record into pw. false at the end of the block
+  bool next(PwType& pw) {
+    if (remaining_ == 0) return false;
+    if (first_) {
+      std::memcpy(pw.hash.data(), cur_, pw.hash.size());
+      cur_ += pw.hash.size(); // NOLINT pointer arithmetic
+      first_ = false;
+    } else {
+      const auto len = std::to_integer<std::size_t>(*cur_++); // NOLINT pointer arithmetic
+      if (len > pw.hash.size() || len > static_cast<std::size_t>(end_ - cur_))
+        throw std::runtime_error("compressed db: corrupt block");
+      hash_add(pw.hash, cur_, len);
+      cur_ += len; // NOLINT pointer arithmetic
+    }
+    pw.count = static_cast<std::int32_t>(get_varint(cur_, end_));
+    --remaining_;
+    return true;
+  }
+
+private:
+  const std::byte* cur_;
+  const std::byte* end_;
+  std::size_t      remaining_ = 0;
+  bool             first_     = true;
+};
+
+} // namespace details
+
+// Writes a block compressed db to `os`, from records which must arrive in sorted order.
+// Plugs in like flat_file::stream_writer.
+template <pw_type PwType>
+class compressed_writer {
+public:
+  explicit compressed_writer(std::ostream& os) : os_(os) {
+    os_.exceptions(std::ios::badbit | std::ios::failbit);
+  }
+
+  void write(const PwType& pw) {
+    std::array<std::byte, 1 + PwType::hash_size + details::max_varint_size> rec{};
+    std::size_t len = 0;
+    if (nrecs_ != 0) {
+      // delta to previous, with leading zero bytes elided
+      const auto delta = details::hash_delta(pw.hash, prev_);
+      const auto first = std::find_if(delta.begin(), delta.end(),
+                                      [](std::byte b) { return b != std::byte{}; });
+      const auto sig   = static_cast<std::size_t>(delta.end() - first);
+      rec[len++]       = static_cast<std::byte>(sig);
+      std::copy(first, delta.end(), rec.begin() + static_cast<std::ptrdiff_t>(len));
+      len += sig;
+      len += details::put_varint(static_cast<std::uint32_t>(pw.count), &rec[len]);
+    }
+    if (nrecs_ == 0 || pos_ + len > block_.size() || nrecs_ == max_block_records) {
+      flush();
+      // first record of the block is stored in full
+      std::memcpy(rec.data(), pw.hash.data(), pw.hash.size());
+      len = pw.hash.size();
+      len += details::put_varint(static_cast<std::uint32_t>(pw.count), &rec[len]);
+    }
+    std::memcpy(&block_[pos_], rec.data(), len);
+    pos_ += len;
+    ++nrecs_;
+    prev_ = pw.hash;
+  }
+
+  // write out the current, partial, block, if any. The next record will start a new block.
+  void flush() {
+    if (nrecs_ == 0) return;
+    std::memcpy(block_.data(), &nrecs_, sizeof(nrecs_));
+    os_.write(reinterpret_cast<const char*>(block_.data()), // NOLINT reincast
+              static_cast<std::streamsize>(block_.size()));
+    block_.fill(std::byte{});
+    pos_   = details::compressed_header_size;
+    nrecs_ = 0;
+  }
+
+  // owns a partial block, so no copies, and no moves
+  compressed_writer(const compressed_writer& other)            = delete;
+  compressed_writer& operator=(const compressed_writer& other) = delete;
+
+  ~compressed_writer() { flush(); }
+
+private:
+  static constexpr std::uint16_t max_block_records = 0xFFFFU;
+
+  std::ostream&                                         os_; // NOLINT ref
+  std::array<std::byte, details::compressed_block_size> block_{};
+  std::size_t                                           pos_   = details::compressed_header_size;
+  std::uint16_t                                         nrecs_ = 0;
+  std::array<std::byte, PwType::hash_size>              prev_{};
+};
+
+// Thread-safe, immutable handle on a block compressed db. Plugs in beside flat_file::database,
+// but is searched with find(), rather than through iterators.
+template <pw_type PwType>
+class compressed_database {
+public:
+  using value_type = PwType;
+  using hash_type  = pw_hash<PwType::hash_size>;
+  using block_type = std::array<std::byte, details::compressed_block_size>;
+
+  explicit compressed_database(std::filesystem::path filename)
+      : filename_(std::move(filename)), file_(filename_),
+        nblocks_(std::filesystem::file_size(filename_) / details::compressed_block_size) {
+
+    if (std::filesystem::file_size(filename_) % details::compressed_block_size != 0)
+      throw std::ios::failure(
+          fmt::format("compressed db {}: size is not a multiple of the block size", filename_));
+
+    const std::filesystem::path index_filename = fmt::format("{}.index", filename_.string());
+    if (!std::filesystem::exists(index_filename) ||
+        std::filesystem::last_write_time(index_filename) <=
+            std::filesystem::last_write_time(filename_) ||
+        std::filesystem::file_size(index_filename) !=
+            sizeof(std::uint64_t) + nblocks_ * sizeof(hash_type)) {
+      build_index();
+      save_index(index_filename);
+    } else {
+      load_index(index_filename);
+    }
+  }
+
+  // one read, of the only block which can contain the needle
+  std::optional<PwType> find(const PwType& needle) const {
+    const hash_type hash_needle{needle};
+
+    auto iter = std::upper_bound(index_.begin(), index_.end(), hash_needle);
+    if (iter == index_.begin()) return {}; // before the first record
+
+    const block_type block = read_block(static_cast<std::size_t>(iter - index_.begin()) - 1);
+
+    details::block_decoder<PwType> decoder(block.data());
+    for (PwType pw; decoder.next(pw);) {
+      if (const auto cmp = pw <=> needle; cmp >= 0) {
+        if (cmp == 0) return pw; // found!
+        break;
+      }
+    }
+    return {}; // not found;
+  }
+
+  // append all records of block block_no to out
+  void decode_block(std::size_t block_no, std::vector<PwType>& out) const {
+    const block_type               block = read_block(block_no);
+    details::block_decoder<PwType> decoder(block.data());
+    for (PwType pw; decoder.next(pw);) out.push_back(pw);
+  }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return nblocks_ * details::compressed_block_size; }
+  std::size_t           number_blocks() const { return nblocks_; }
+  std::size_t           number_records() const { return nrecs_; }
+  std::size_t           index_bytes() const { return index_.size() * sizeof(hash_type); }
+
+private:
+  std::filesystem::path            filename_;
+  flat_file::impl::positional_file file_;
+  std::size_t                      nblocks_;
+  std::size_t                      nrecs_ = 0;
+  std::vector<hash_type>           index_; // first hash of each block
+
+  [[nodiscard]] block_type read_block(std::size_t block_no) const {
+    block_type block; // NOLINT uninitialised
+    file_.read_at(std::uint64_t{block_no} * block.size(), block.data(), block.size());
+    return block;
+  }
+
+  void build_index() {
+    std::cerr << fmt::format("building compressed db index: {}\n", filename_);
+    index_.resize(nblocks_);
+    nrecs_ = 0;
+    // one large sequential read for many blocks, but only look at their headers
+    constexpr std::size_t   blocks_per_read = 256;
+    std::vector<block_type> blocks(blocks_per_read);
+    for (std::size_t first = 0; first < nblocks_; first += blocks_per_read) {
+      const std::size_t n = std::min(blocks_per_read, nblocks_ - first);
+      file_.read_at(std::uint64_t{first} * details::compressed_block_size, blocks.data(),
+                    n * details::compressed_block_size);
+      for (std::size_t i = 0; i != n; ++i) {
+        std::uint16_t nrecs = 0;
+        std::memcpy(&nrecs, blocks[i].data(), sizeof(nrecs));
+        std::memcpy(index_[first + i].hash.data(),
+                    &blocks[i][details::compressed_header_size], sizeof(hash_type));
+        nrecs_ += nrecs;
+      }
+    }
+  }
+
+  void save_index(const std::filesystem::path& index_filename) const {
+    std::cerr << fmt::format("saving compressed db index: {}\n", index_filename);
+    auto                stream = std::ofstream(index_filename, std::ios_base::binary);
+    const std::uint64_t nrecs  = nrecs_;
+    stream.write(reinterpret_cast<const char*>(&nrecs), sizeof(nrecs)); // NOLINT reincast
+    stream.write(reinterpret_cast<const char*>(index_.data()),           // NOLINT reincast
+                 static_cast<std::streamsize>(index_bytes()));
+  }
+
+  void load_index(const std::filesystem::path& index_filename) {
+    std::cerr << fmt::format("loading compressed db index: {}\n", index_filename);
+    auto          stream = std::ifstream(index_filename, std::ios_base::binary);
+    std::uint64_t nrecs  = 0;
+    stream.read(reinterpret_cast<char*>(&nrecs), sizeof(nrecs)); // NOLINT reincast
+    nrecs_ = static_cast<std::size_t>(nrecs);
+    index_.resize(nblocks_);
+    stream.read(reinterpret_cast<char*>(index_.data()), // NOLINT reincast
+                static_cast<std::streamsize>(index_bytes()));
+  }
+};
+
+} // namespace hibp
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "flat_file/container.hpp"
+#include "flat_file/mmap.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Delta layer: local additions to an immutable base db, without rewriting it, "LSM" style.
+//
+//   <db>.delta/run-000001.bin, run-000002.bin, ...
+//
+// Records are added to an in-memory memtable, which is sorted and flushed as a new "run": a
+// small, hash sorted, flat_file db. Queries look in the runs, newest first, and then in the base
+// db, so the newest record for a hash wins. That is also how counts are adjusted. Each run has
+// an in-memory bloom filter, built when it is opened, so the runs which do not hold the needle,
+// ie nearly all of them, cost a few cache misses rather than a search. Compaction merges the
+// runs into a new base db.
+//
+// There must only be one writer, ie one process adding or compacting, at a time. Readers see
+// the runs which existed when they opened the delta_store.
+
+namespace hibp {
+
+inline std::filesystem::path delta_dirname(const std::filesystem::path& db_filename) {
+  return fmt::format("{}.delta", db_filename.string());
+}
+
+namespace details {
+
+// Bloom filter of hashes. They are already uniformly distributed, so the probes are derived
+// from the first 8 bytes of the hash, rather than from another hash function.
+class delta_filter {
+public:
+  static constexpr std::size_t bits_per_key = 10;
+  static constexpr unsigned    probes       = 7; // ~1% false positives
+
+  explicit delta_filter(std::size_t keys)
+      : words_(std::bit_ceil(std::max<std::size_t>(keys * bits_per_key, 64)) / 64) {}
+
+  void add(std::uint64_t key) {
+    const std::uint64_t step = std::rotl(key, 32) | 1U;
+    for (unsigned i = 0; i != probes; ++i, key += step) {
+      const std::uint64_t bit = key & mask();
+      words_[bit / 64] |= std::uint64_t{1} << (bit % 64);
+    }
+  }
+
+  [[nodiscard]] bool may_contain(std::uint64_t key) const {
+    const std::uint64_t step = std::rotl(key, 32) | 1U;
+    for (unsigned i = 0; i != probes; ++i, key += step) {
+      const std::uint64_t bit = key & mask();
+      if ((words_[bit / 64] & (std::uint64_t{1} << (bit % 64))) == 0) return false;
+    }
+    return true;
+  }
+
+private:
+  std::vector<std::uint64_t> words_;
+
+  [[nodiscard]] std::uint64_t mask() const { return words_.size() * 64 - 1; }
+};
+
+// sort by hash, keeping only the last of each run of equal hashes, ie the newest
+template <pw_type PwType>
+void keep_newest(std::vector<PwType>& records) {
+  std::stable_sort(records.begin(), records.end());
+  auto out = records.begin();
+  for (auto iter = records.begin(); iter != records.end(); ++iter) {
+    if (std::next(iter) == records.end() || !(*std::next(iter) == *iter)) *out++ = *iter;
+  }
+  records.erase(out, records.end());
+}
+
+} // namespace details
+
+template <pw_type PwType>
+class delta_store {
+public:
+  using value_type = PwType;
+
+  static constexpr std::size_t default_memtable_records = (64U << 20U) / sizeof(PwType); // 64MB
+
+  // opens the existing runs of the db, if any
+  explicit delta_store(std::filesystem::path db_filename,
+                       std::size_t           memtable_records = default_memtable_records)
+      : db_filename_(std::move(db_filename)), dirname_(delta_dirname(db_filename_)),
+        memtable_records_(std::max<std::size_t>(memtable_records, 1)) {
+
+    if (!std::filesystem::exists(dirname_)) return;
+    std::vector<std::filesystem::path> run_filenames;
+    for (const auto& entry: std::filesystem::directory_iterator(dirname_)) {
+      if (run_sequence(entry.path())) run_filenames.push_back(entry.path());
+    }
+    std::sort(run_filenames.begin(), run_filenames.end()); // zero padded, so oldest first
+    for (const auto& run_filename: run_filenames) open_run(run_filename);
+  }
+
+  // the newest record for this hash in any run, or nullopt, when the base db decides. Only sees
+  // runs which have been flushed. Thread safe.
+  [[nodiscard]] std::optional<PwType> find(const PwType& needle) const {
+    const std::uint64_t key = hash_prefix(needle);
+    for (auto run = runs_.rbegin(); run != runs_.rend(); ++run) {
+      if (key < run->lo || key > run->hi || !run->filter.may_contain(key)) continue;
+      if (auto iter = std::lower_bound(run->db.begin(), run->db.end(), needle);
+          iter != run->db.end() && *iter == needle) {
+        return *iter; // found!
+      }
+    }
+    return {}; // not found;
+  }
+
+  // Add a record, or replace the count of an existing one. The memtable is flushed as a new run
+  // once it holds memtable_records.
+  void add(const PwType& pw) {
+    memtable_.push_back(pw);
+    if (memtable_.size() >= memtable_records_) flush();
+  }
+
+  // write the memtable as a new run, if it holds any records
+  void flush() {
+    if (memtable_.empty()) return;
+    details::keep_newest(memtable_);
+
+    std::filesystem::create_directories(dirname_);
+    const std::filesystem::path run_filename =
+        dirname_ / fmt::format("run-{:06d}.bin", next_sequence_);
+    const std::filesystem::path tmp_filename = fmt::format("{}.tmp", run_filename.string());
+    {
+      flat_file::file_writer<PwType> writer(tmp_filename.string());
+      for (const auto& pw: memtable_) writer.write(pw);
+    }
+    std::filesystem::rename(tmp_filename, run_filename); // so readers never see partial runs
+    memtable_.clear();
+    open_run(run_filename);
+  }
+
+  // Flush, and then merge all the runs into the base db, where the newest record for each hash
+  // wins, and remove them. The new base db is written alongside and then renamed over the old
+  // one, so readers which have it open keep their consistent view. Returns its record count.
+  // Only a plain base db can be compacted: the new one would not carry the footer and sections
+  // of a sealed db, and a striped db has no single file to replace. Those throw, before any
+  // change.
+  std::size_t compact() {
+    if (flat_file::is_striped(db_filename_)) {
+      throw std::runtime_error(
+          fmt::format("cannot compact into db {}: it is striped. Only plain dbs can be compacted",
+                      db_filename_));
+    }
+    if (flat_file::read_container(db_filename_)) {
+      throw std::runtime_error(fmt::format(
+          "cannot compact into db {}: it is sealed, and would lose its footer and sections. Only "
+          "plain dbs can be compacted",
+          db_filename_));
+    }
+    flush();
+
+    // the runs are small, so are merged in memory first
+    std::vector<PwType> delta;
+    for (const auto& run: runs_) delta.insert(delta.end(), run.db.begin(), run.db.end());
+    details::keep_newest(delta);
+
+    const std::filesystem::path tmp_filename = fmt::format("{}.compacting", db_filename_.string());
+    std::size_t                 written      = 0;
+    {
+      // one-shot scan and write, so they do not evict the working set of any servers
+      flat_file::database<PwType>    base(db_filename_, 1, flat_file::access_advice::once);
+      flat_file::file_writer<PwType> writer(tmp_filename.string(), flat_file::access_advice::once);
+      auto                           next  = delta.cbegin();
+      auto                           write = [&](const PwType& pw) {
+        writer.write(pw);
+        ++written;
+      };
+      flat_file::for_each_span(base, 0, base.number_records(), [&](std::span<const PwType> span) {
+        for (const auto& pw: span) {
+          for (; next != delta.cend() && *next < pw; ++next) write(*next);
+          if (next != delta.cend() && *next == pw) {
+            write(*next++); // replaced
+          } else {
+            write(pw);
+          }
+        }
+      });
+      for (; next != delta.cend(); ++next) write(*next);
+    }
+    std::filesystem::rename(tmp_filename, db_filename_);
+
+    for (const auto& run: runs_) std::filesystem::remove(run.db.filename());
+    runs_.clear();
+    return written;
+  }
+
+  [[nodiscard]] std::size_t number_runs() const { return runs_.size(); }
+
+  // in all the runs, so including any replaced by newer ones
+  [[nodiscard]] std::size_t number_records() const {
+    std::size_t records = 0;
+    for (const auto& run: runs_) records += run.db.number_records();
+    return records;
+  }
+
+private:
+  struct delta_run {
+    flat_file::mmap_database<PwType> db;
+    details::delta_filter            filter;
+    std::uint64_t                    lo = 0; // first and last keys
+    std::uint64_t                    hi = 0;
+  };
+
+  std::filesystem::path  db_filename_;
+  std::filesystem::path  dirname_;
+  std::size_t            memtable_records_;
+  std::vector<PwType>    memtable_;
+  std::vector<delta_run> runs_; // oldest first
+  std::size_t            next_sequence_ = 1;
+
+  // the sequence number of a run's filename, or nullopt if it is not one
+  static std::optional<std::size_t> run_sequence(const std::filesystem::path& filename) {
+    const std::string name = filename.filename().string();
+    if (name.size() != 14 || !name.starts_with("run-") || !name.ends_with(".bin")) return {};
+    const std::string digits = name.substr(4, 6);
+    if (digits.find_first_not_of("0123456789") != std::string::npos) return {};
+    return std::stoul(digits);
+  }
+
+  void open_run(const std::filesystem::path& run_filename) {
+    flat_file::mmap_database<PwType> db(run_filename, flat_file::access_advice::random);
+    if (db.number_records() == 0) return;
+    details::delta_filter filter(db.number_records());
+    for (const auto& pw: db) filter.add(hash_prefix(pw));
+    const std::uint64_t lo = hash_prefix(*db.begin());
+    const std::uint64_t hi = hash_prefix(db.back());
+    runs_.push_back({std::move(db), std::move(filter), lo, hi});
+    next_sequence_ = std::max(next_sequence_, *run_sequence(run_filename) + 1);
+  }
+};
+
+} // namespace hibp
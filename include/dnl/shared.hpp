@@ -33,6 +33,10 @@ struct cli_config_t {
   bool        testing       = false;
   std::size_t index_limit   = 0x100000;
   std::size_t parallel_max  = 300;
+  unsigned    toc_bits      = 0; // ie no toc written
+  bool        toc_fences    = false;
+
+  std::vector<std::string> stripe_dirs; // write a striped db, with a stripe in each
 };
 
 struct download {
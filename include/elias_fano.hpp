@@ -0,0 +1,289 @@
+#pragma once
+
+#include "bytearray_cast.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "packed_ints.hpp"
+#include "sidecar.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Elias-Fano coding of a sorted sha1t64 db, held entirely in RAM.
+//
+// Each 64bit key is split into its low `l` bits, stored verbatim in a packed array, and its high
+// bits, stored in unary in a bit vector: key i sets bit (key >> l) + i. With l = 64 - log2(n),
+// that is ~2 bits per key, so ~36 bits per key in all, rather than 64. Key i is found with
+// select1(i), and the keys with a given high part (a "bucket") with select0, both sped up by a
+// sample of every 256th one and zero.
+//
+// Counts are mostly small, so they are kept in a parallel byte array, with the rare count above
+// 254 in a sorted side table. So the ~1 billion record sha1t64 corpus needs ~5.5 bytes per
+// record, ~5GB, and every query is answered exactly, without any disk I/O.
+//
+// Built from the db on first use, and saved in a sidecar file next to the db, which is rebuilt
+// when it is missing or stale.
+
+namespace hibp {
+
+namespace details {
+
+// position of the rank'th (from 0) set bit of word, which must have more than rank set bits
+inline unsigned nth_set_bit(std::uint64_t word, std::size_t rank) {
+  for (; rank != 0; --rank) word &= word - 1; // clear the lowest set bit
+  return static_cast<unsigned>(std::countr_zero(word));
+}
+
+} // namespace details
+
+// Thread-safe, immutable, in-memory sha1t64 db. Plugs in beside flat_file::database, but is
+// searched with find(), rather than through iterators.
+class elias_fano_database {
+public:
+  using value_type = pawned_pw_sha1t64;
+
+  static constexpr std::size_t  sample_rate  = 256; // every 256th one and zero is sampled
+  static constexpr std::uint8_t count_escape = 0xFF;
+
+  explicit elias_fano_database(std::filesystem::path db_filename)
+      : db_filename_(std::move(db_filename)) {
+
+    const auto db_size = static_cast<std::size_t>(
+        flat_file::data_size<value_type>(db_filename_) / sizeof(value_type));
+    const std::filesystem::path ef_filename = fmt::format("{}.ef", db_filename_.string());
+    if (details::is_fresh(ef_filename, db_filename_) && load(ef_filename) && size_ == db_size) {
+      build_samples();
+      return;
+    }
+    build();
+    save(ef_filename);
+  }
+
+  // exact match, with its count, or nothing. No I/O.
+  [[nodiscard]] std::optional<value_type> find(const value_type& needle) const {
+    const std::uint64_t key = hash_prefix(needle);
+    if (size_ == 0) return {};
+
+    const std::uint64_t high = key >> low_bits_;
+    const std::uint64_t low  = key & low_mask();
+
+    // bucket `high` starts after the high'th zero, and ends at the next zero
+    std::size_t pos = high == 0 ? 0 : select(zeros_, false, high - 1) + 1;
+    for (std::size_t idx = pos - high; pos != upper_bits_ && bit(pos); ++pos, ++idx) {
+      if (const std::uint64_t candidate = lows_.get(idx); candidate >= low) {
+        if (candidate == low) return make_record(key, idx); // found!
+        break;
+      }
+    }
+    return {}; // not found;
+  }
+
+  // the idx'th record, in hash order
+  [[nodiscard]] value_type get_record(std::size_t idx) const {
+    const std::uint64_t high = select(ones_, true, idx) - idx;
+    return make_record((high << low_bits_) | lows_.get(idx), idx);
+  }
+
+  [[nodiscard]] std::size_t number_records() const { return size_; }
+
+  // RAM consumed, in total
+  [[nodiscard]] std::size_t bytes() const {
+    return (upper_.size() + lows_.words().size() + ones_.size() + zeros_.size()) *
+               sizeof(std::uint64_t) +
+           counts_.size() + exceptions_.size() * sizeof(std::uint64_t) +
+           exception_counts_.size() * sizeof(std::int32_t);
+  }
+
+  [[nodiscard]] double bits_per_record() const {
+    return size_ == 0 ? 0.0
+                      : static_cast<double>(bytes()) * 8.0 / static_cast<double>(size_);
+  }
+
+private:
+  std::filesystem::path      db_filename_;
+  std::size_t                size_       = 0;
+  unsigned                   low_bits_   = 0;
+  std::size_t                upper_bits_ = 0;
+  std::vector<std::uint64_t> upper_; // high parts, in unary
+  details::packed_ints       lows_;  // low parts, verbatim
+  std::vector<std::uint64_t> ones_;  // position of every sample_rate'th one in upper_
+  std::vector<std::uint64_t> zeros_; // and of every sample_rate'th zero
+
+  std::vector<std::uint8_t>  counts_;           // count_escape => see exceptions_
+  std::vector<std::uint64_t> exceptions_;       // sorted record numbers of large counts
+  std::vector<std::int32_t>  exception_counts_; // and their counts
+
+  [[nodiscard]] std::uint64_t low_mask() const { return (std::uint64_t{1} << low_bits_) - 1; }
+
+  [[nodiscard]] bool bit(std::size_t pos) const {
+    return ((upper_[pos / 64] >> (pos % 64)) & 1U) != 0;
+  }
+
+  // position in upper_ of the rank'th one (or zero)
+  [[nodiscard]] std::size_t select(const std::vector<std::uint64_t>& samples, bool ones,
+                                   std::size_t rank) const {
+    const std::size_t sample_pos = samples[rank / sample_rate];
+    std::size_t       remaining  = rank % sample_rate;
+    std::size_t       word_idx   = sample_pos / 64;
+
+    auto load = [&] { return ones ? upper_[word_idx] : ~upper_[word_idx]; };
+
+    // ignore the bits before the sample
+    std::uint64_t word = load() & (~std::uint64_t{0} << (sample_pos % 64));
+    while (remaining >= static_cast<std::size_t>(std::popcount(word))) {
+      remaining -= static_cast<std::size_t>(std::popcount(word));
+      ++word_idx;
+      word = load();
+    }
+    return word_idx * 64 + details::nth_set_bit(word, remaining);
+  }
+
+  [[nodiscard]] std::int32_t get_count(std::size_t idx) const {
+    const std::uint8_t count = counts_[idx];
+    if (count == 0) return -1; // unknown
+    if (count != count_escape) return count;
+    const auto iter = std::lower_bound(exceptions_.begin(), exceptions_.end(), idx);
+    return exception_counts_[static_cast<std::size_t>(iter - exceptions_.begin())];
+  }
+
+  [[nodiscard]] value_type make_record(std::uint64_t key, std::size_t idx) const {
+    value_type    pw;
+    std::uint64_t big_endian = key;
+    if constexpr (std::endian::native == std::endian::little) big_endian = byteswap(key);
+    std::memcpy(pw.hash.data(), &big_endian, sizeof(big_endian));
+    pw.count = get_count(idx);
+    return pw;
+  }
+
+  void build() {
+    std::cerr << fmt::format("building Elias-Fano index: {}\n", db_filename_);
+    // big buffer for sequential read
+    flat_file::database<value_type> db(db_filename_, (1U << 16U) / sizeof(value_type));
+
+    size_ = db.number_records();
+    // l = 64 - ceil(log2(n)), so there are about as many buckets as keys
+    low_bits_   = static_cast<unsigned>(std::clamp(
+        64 - static_cast<int>(std::bit_width(std::max<std::size_t>(size_, 2) - 1)), 1, 63));
+    upper_bits_ = size_ + (std::size_t{1} << (64 - low_bits_));
+    upper_.assign((upper_bits_ + 63) / 64, 0);
+    lows_ = details::packed_ints(size_, low_bits_);
+    counts_.assign(size_, 0);
+    exceptions_.clear();
+    exception_counts_.clear();
+
+    std::size_t   idx  = 0;
+    std::uint64_t prev = 0;
+    for (const auto& pw: db) {
+      const std::uint64_t key = hash_prefix(pw);
+      if (key < prev)
+        throw std::runtime_error(
+            fmt::format("Elias-Fano index: db {} is not sorted, at record {}", db_filename_, idx));
+      prev = key;
+
+      const std::size_t pos = (key >> low_bits_) + idx;
+      upper_[pos / 64] |= std::uint64_t{1} << (pos % 64);
+      lows_.set(idx, key & low_mask());
+
+      if (pw.count <= 0) {
+        counts_[idx] = 0;
+      } else if (pw.count < count_escape) {
+        counts_[idx] = static_cast<std::uint8_t>(pw.count);
+      } else {
+        counts_[idx] = count_escape;
+        exceptions_.push_back(idx);
+        exception_counts_.push_back(pw.count);
+      }
+      ++idx;
+    }
+    build_samples();
+
+    std::cerr << fmt::format("{:30s} {:15d} records\n", "DB size", size_);
+    std::cerr << fmt::format("{:30s} {:15.1f} bits per record\n", "Elias-Fano size",
+                             bits_per_record());
+    std::cerr << fmt::format("{:30s} {:15.1f}MB\n", "RAM consumed",
+                             static_cast<double>(bytes()) / (1U << 20U));
+  }
+
+  // the select samples are cheap to rebuild, so are not saved
+  void build_samples() {
+    ones_.clear();
+    zeros_.clear();
+    std::size_t nones  = 0;
+    std::size_t nzeros = 0;
+    for (std::size_t word_idx = 0; word_idx != upper_.size(); ++word_idx) {
+      // the tail of the last word is not part of the bit vector
+      const std::size_t   valid = std::min<std::size_t>(64, upper_bits_ - word_idx * 64);
+      const std::uint64_t mask =
+          valid == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << valid) - 1;
+      const std::uint64_t word   = upper_[word_idx];
+      const std::size_t   cones  = static_cast<std::size_t>(std::popcount(word));
+      const std::size_t   czeros = static_cast<std::size_t>(std::popcount(~word & mask));
+      // sample_rate > 64, so at most one sample of each per word
+      if (const std::size_t next = ones_.size() * sample_rate; nones + cones > next) {
+        ones_.push_back(word_idx * 64 + details::nth_set_bit(word, next - nones));
+      }
+      if (const std::size_t next = zeros_.size() * sample_rate; nzeros + czeros > next) {
+        zeros_.push_back(word_idx * 64 + details::nth_set_bit(~word & mask, next - nzeros));
+      }
+      nones += cones;
+      nzeros += czeros;
+    }
+  }
+
+  void save(const std::filesystem::path& ef_filename) const {
+    std::cerr << fmt::format("saving Elias-Fano index: {}\n", ef_filename);
+    details::replace_file(ef_filename, [&](std::ostream& stream) {
+      const std::array<std::uint64_t, 3> header{size_, low_bits_, upper_bits_};
+      stream.write(reinterpret_cast<const char*>(header.data()), // NOLINT reincast
+                   sizeof(header));
+      details::write_vector(stream, upper_);
+      details::write_vector(stream, lows_.words());
+      details::write_vector(stream, counts_);
+      details::write_vector(stream, exceptions_);
+      details::write_vector(stream, exception_counts_);
+    });
+    details::make_newer(ef_filename, db_filename_);
+  }
+
+  // false if the sidecar is truncated, or otherwise unusable, so it will be rebuilt
+  bool load(const std::filesystem::path& ef_filename) {
+    std::cerr << fmt::format("loading Elias-Fano index: {}\n", ef_filename);
+    auto stream = std::ifstream(ef_filename, std::ios_base::binary);
+
+    std::array<std::uint64_t, 3> header{};
+    stream.read(reinterpret_cast<char*>(header.data()), sizeof(header)); // NOLINT reincast
+    size_       = static_cast<std::size_t>(header[0]);
+    low_bits_   = static_cast<unsigned>(header[1]);
+    upper_bits_ = static_cast<std::size_t>(header[2]);
+    if (!stream || low_bits_ == 0 || low_bits_ > 63) return false;
+
+    lows_ = details::packed_ints(0, low_bits_);
+    details::read_vector(stream, upper_);
+    details::read_vector(stream, lows_.words());
+    details::read_vector(stream, counts_);
+    details::read_vector(stream, exceptions_);
+    details::read_vector(stream, exception_counts_);
+    // the sizes must be those build() gives, as find() and get_record() index without checks
+    return stream && counts_.size() == size_ &&
+           upper_bits_ == size_ + (std::size_t{1} << (64 - low_bits_)) &&
+           upper_.size() == (upper_bits_ + 63) / 64 &&
+           lows_.words().size() == details::packed_ints::words_for(size_, low_bits_) &&
+           exceptions_.size() == exception_counts_.size();
+  }
+};
+
+} // namespace hibp
@@ -1,10 +1,14 @@
 #pragma once
 
+#include "flat_file/advice.hpp"
+#include "flat_file/container.hpp"
 #include <algorithm>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #if HIBP_USE_PSTL && __cpp_lib_parallel_algorithm
 #include <execution>
 #endif
@@ -16,9 +20,14 @@
 #include <ios>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -35,6 +44,64 @@ struct ofstream_holder {
   std::ofstream ofstream_;
 };
 
+// random access iterator over any flat_file db type which provides `get_record(pos)`
+template <typename DbType, typename ValueType>
+struct record_iterator {
+  using iterator_category = std::random_access_iterator_tag;
+  using difference_type   = std::ptrdiff_t;
+  using value_type        = ValueType;
+  using pointer           = const ValueType*;
+  using reference         = const ValueType&;
+
+  record_iterator(DbType& ffdb, std::size_t pos) : ffdb_(&ffdb), pos_(pos) {}
+
+  // clang-format off
+  reference operator*() const { return current(); }
+  pointer   operator->() const { current(); return cur_; }
+
+  bool operator==(const record_iterator& other) const { return ffdb_ == other.ffdb_ && pos_ == other.pos_; }
+  
+  record_iterator& operator++() { return *this += 1; }
+  record_iterator operator++(int) { record_iterator tmp = *this; ++(*this); return tmp; } // NOLINT why const?
+  record_iterator& operator--() { return *this -= 1; }
+  record_iterator operator--(int) { record_iterator tmp = *this; --(*this); return tmp; } // NOLINT why const?
+
+  record_iterator& operator+=(std::size_t offset) { set_pos(pos_ + offset); return *this; }
+  record_iterator& operator-=(std::size_t offset) { set_pos(pos_ - offset); return *this; }
+
+  friend record_iterator operator+(record_iterator iter, std::size_t offset) { return iter += offset; }
+  friend record_iterator operator+(std::size_t offset, record_iterator iter) { return iter += offset; }
+  friend record_iterator operator-(record_iterator iter, std::size_t offset) { return iter -= offset; }
+  friend difference_type operator-(const record_iterator& a, const record_iterator& b) {
+      return static_cast<difference_type>(a.pos_ - b.pos_);
+  }
+  // clang-format on
+
+  std::size_t           pos() { return pos_; }
+  std::filesystem::path filename() { return ffdb_->filename(); }
+  access_advice         advice() { return ffdb_->advice(); }
+
+private:
+  DbType*     ffdb_ = nullptr;
+  std::size_t pos_{};
+  // cur_ and cur_valid_ are mutable so that operator* can be const
+  mutable const value_type* cur_;
+  mutable bool              cur_valid_ = false;
+
+  void set_pos(std::size_t pos) {
+    pos_       = pos;
+    cur_valid_ = false;
+  }
+
+  reference current() const {
+    if (!cur_valid_) {
+      cur_       = &ffdb_->get_record(pos_);
+      cur_valid_ = true;
+    }
+    return *cur_;
+  }
+};
+
 } // namespace impl
 
 template <typename ValueType>
@@ -57,13 +124,24 @@ public:
     if (buf_pos_ != 0) {
       db_.write(reinterpret_cast<char*>(buf_.data()), // NOLINT reincast
                 static_cast<std::streamsize>(sizeof(ValueType) * buf_pos_));
+      written_ += sizeof(ValueType) * buf_pos_;
       buf_pos_ = 0;
       if (flush_stream) {
         db_.flush();
       }
+      if (advisor_.drop_due(written_)) {
+        db_.flush(); // so the kernel has it all
+        advisor_.drop_behind(written_);
+      }
     }
   }
 
+  // apply an access pattern hint to `filename`, which is the file the stream writes to, eg
+  // access_advice::once for drop-behind of the written data
+  void advise(const std::filesystem::path& filename, access_advice advice) {
+    advisor_ = impl::file_advisor(filename, advice);
+  }
+
   // a "unique manager" .. no copies, move-only
   stream_writer(const stream_writer& other)            = delete;
   stream_writer& operator=(const stream_writer& other) = delete;
@@ -71,20 +149,29 @@ public:
   stream_writer(stream_writer&& other) noexcept            = default;
   stream_writer& operator=(stream_writer&& other) noexcept = default;
 
-  ~stream_writer() { flush(); }
+  ~stream_writer() {
+    flush();
+    if (advisor_.advice() == access_advice::once) {
+      db_.flush();
+      advisor_.drop_behind(written_, true);
+    }
+  }
 
 private:
   std::ostream&          db_; // NOLINT ref
   std::size_t            buf_pos_ = 0;
   std::vector<ValueType> buf_;
+  std::uint64_t          written_ = 0; // bytes
+  impl::file_advisor     advisor_;
 };
 
 template <typename ValueType>
 class file_writer : private impl::ofstream_holder, public stream_writer<ValueType> {
 public:
-  explicit file_writer(std::string dbfilename)
+  explicit file_writer(std::string dbfilename, access_advice advice = access_advice::normal)
       : ofstream_holder(std::move(dbfilename)), stream_writer<ValueType>(ofstream_) {
     if (!ofstream_.is_open()) throw std::domain_error("cannot open db: " + filename_);
+    if (advice != access_advice::normal) this->advise(filename_, advice);
   }
 };
 
@@ -97,9 +184,10 @@ class database {
   static_assert(std::is_standard_layout_v<ValueType>);
 
 public:
-  explicit database(std::filesystem::path filename, std::size_t buf_size = 1)
-      : filename_(std::move(filename)), dbfsize_(std::filesystem::file_size(filename_)),
-        db_(filename_, std::ios::binary), buf_(buf_size) {
+  explicit database(std::filesystem::path filename, std::size_t buf_size = 1,
+                    access_advice advice = access_advice::normal)
+      : filename_(std::move(filename)), dbfsize_(data_size<ValueType>(filename_)),
+        db_(filename_, std::ios::binary), buf_(buf_size), advisor_(filename_, advice) {
 
     static_assert(std::is_move_assignable_v<database>); // but that invalidates iterators!
 
@@ -115,8 +203,8 @@ public:
     db_.exceptions(std::ios::badbit | std::ios::failbit); // throw on any future errors
   }
 
-  using value_type = ValueType;
-  struct const_iterator;
+  using value_type     = ValueType;
+  using const_iterator = impl::record_iterator<database, ValueType>;
 
   const ValueType& get_record(std::size_t pos) {
     if (!(pos >= buf_start_ && pos < buf_end_)) { // NOLINT can be simplified
@@ -127,15 +215,31 @@ public:
       }
       db_.seekg(static_cast<std::streamoff>(pos * sizeof(ValueType)));
 
+      if (pos == 0) advisor_.restart(0); // another pass
+      advisor_.will_read((pos + nrecs) * sizeof(ValueType));
       db_.read(reinterpret_cast<char*>(buf_.data()), // NOLINT reinterpret_cast
                static_cast<std::streamsize>(sizeof(ValueType) * nrecs));
 
       buf_start_ = pos;
       buf_end_   = pos + nrecs;
+      consumed(buf_end_);
     }
     return buf_[pos - buf_start_];
   }
 
+  // copy records [pos, pos + nrecs) into dest, with a single read, bypassing the buffer
+  void read(std::size_t pos, std::size_t nrecs, ValueType* dest) {
+    if (pos + nrecs > dbsize_) {
+      throw std::out_of_range(fmt::format("flat_file: cannot read records [{}, {}) of {}", pos,
+                                          pos + nrecs, dbsize_));
+    }
+    db_.seekg(static_cast<std::streamoff>(pos * sizeof(ValueType)));
+    advisor_.will_read((pos + nrecs) * sizeof(ValueType));
+    db_.read(reinterpret_cast<char*>(dest), // NOLINT reinterpret_cast
+             static_cast<std::streamsize>(sizeof(ValueType) * nrecs));
+    consumed(pos + nrecs);
+  }
+
   const_iterator begin() { return {*this, 0}; }
   const_iterator end() { return {*this, dbsize_}; }
 
@@ -144,77 +248,331 @@ public:
   std::filesystem::path filename() const { return filename_; }
   std::size_t           filesize() const { return dbfsize_; }
   std::size_t           number_records() const { return dbsize_; }
+  access_advice         advice() const { return advisor_.advice(); }
 
   template <typename Comp = std::less<>, typename Proj = std::identity>
   std::string disksort(Comp comp = {}, Proj proj = {},
                        std::size_t max_memory_usage = 1'000'000'000);
 
+  // as disksort(), but the sorted records are written to `sorted`, eg a striped_writer
+  template <typename Writer, typename Comp = std::less<>, typename Proj = std::identity>
+  void disksort_to(Writer& sorted, Comp comp = {}, Proj proj = {},
+                   std::size_t max_memory_usage = 1'000'000'000);
+
 private:
   std::filesystem::path  filename_;
-  std::uintmax_t         dbfsize_;
+  std::uintmax_t         dbfsize_; // of the records, without any container footer
   std::size_t            dbsize_;
   std::ifstream          db_;
   std::size_t            buf_start_ = 0;
   std::size_t            buf_end_   = 0; // one past the end
   std::vector<ValueType> buf_;
+  impl::file_advisor     advisor_;
+
+  // records [0, end) have been read. For drop-behind, which assumes forward scans from 0.
+  void consumed(std::size_t end) {
+    if (advisor_.drop_due(end * sizeof(ValueType))) advisor_.drop_behind(end * sizeof(ValueType));
+  }
 };
 
+// Bulk sequential access to any flat_file db which provides `read(pos, nrecs, dest)`, eg
+// database, shared_database or their cursors. Yields the records [first, last) as spans over
+// one large reused buffer, each filled with a single read, so tight loops over them can
+// vectorise, without the per record checks of record_iterator. DbType may be const qualified.
+template <typename DbType>
+class span_reader {
+public:
+  using value_type = typename std::remove_const_t<DbType>::value_type;
+
+  // 64KB: big enough to amortise the read, small enough to stay in L2 cache
+  static constexpr std::size_t default_span_size = (1U << 16U) / sizeof(value_type);
+
+  span_reader(DbType& db, std::size_t first, std::size_t last,
+              std::size_t span_size = default_span_size)
+      : db_(&db), pos_(first), last_(std::min(last, db.number_records())),
+        buf_(std::max<std::size_t>(span_size, 1)) {}
+
+  explicit span_reader(DbType& db, std::size_t span_size = default_span_size)
+      : span_reader(db, 0, db.number_records(), span_size) {}
+
+  // the next span, which is empty at the end. Invalidates the previous span.
+  std::span<const value_type> next() {
+    const std::size_t nrecs = std::min(buf_.size(), last_ - std::min(pos_, last_));
+    if (nrecs != 0) db_->read(pos_, nrecs, buf_.data());
+    pos_ += nrecs;
+    return {buf_.data(), nrecs};
+  }
+
+  // position of the first record of the next span
+  [[nodiscard]] std::size_t pos() const { return pos_; }
+
+  // continue from `pos`, rather than from the end of the previous span
+  void seek(std::size_t pos) { pos_ = pos; }
+
+private:
+  DbType*                 db_;
+  std::size_t             pos_;
+  std::size_t             last_;
+  std::vector<value_type> buf_;
+};
+
+// Asynchronous, double (or n) buffered version of span_reader, for full scans. A background
+// I/O thread, with its own file handle, fills up to `nbuffers` spans ahead of the consumer, so
+// a scan runs at the speed of the slower of the disk and the consumer, rather than at the sum of
+// both. Same interface as span_reader. seek() forwards into spans which are already buffered
+// costs nothing; other seeks restart the read ahead. With access_advice::once, the records read
+// are dropped from the page cache behind the scan.
 template <typename ValueType>
-struct database<ValueType>::const_iterator {
-  using iterator_category = std::random_access_iterator_tag;
-  using difference_type   = std::ptrdiff_t;
-  using value_type        = ValueType;
-  using pointer           = const ValueType*;
-  using reference         = const ValueType&;
+class readahead_reader {
 
-  const_iterator(database<ValueType>& ffdb, std::size_t pos) : ffdb_(&ffdb), pos_(pos) {}
+  static_assert(std::is_trivially_copyable_v<ValueType>);
 
-  // clang-format off
-  reference operator*() const { return current(); }
-  pointer   operator->() const { current(); return cur_; }
+public:
+  using value_type = ValueType;
 
-  bool operator==(const const_iterator& other) const { return ffdb_ == other.ffdb_ && pos_ == other.pos_; }
-  
-  const_iterator& operator++() { return *this += 1; }
-  const_iterator operator++(int) { const_iterator tmp = *this; ++(*this); return tmp; } // NOLINT why const?
-  const_iterator& operator--() { return *this -= 1; }
-  const_iterator operator--(int) { const_iterator tmp = *this; --(*this); return tmp; } // NOLINT why const?
-
-  const_iterator& operator+=(std::size_t offset) { set_pos(pos_ + offset); return *this; }
-  const_iterator& operator-=(std::size_t offset) { set_pos(pos_ - offset); return *this; }
-
-  friend const_iterator operator+(const_iterator iter, std::size_t offset) { return iter += offset; }
-  friend const_iterator operator+(std::size_t offset, const_iterator iter) { return iter += offset; }
-  friend const_iterator operator-(const_iterator iter, std::size_t offset) { return iter -= offset; }
-  friend difference_type operator-(const const_iterator& a, const const_iterator& b) {
-      return static_cast<difference_type>(a.pos_ - b.pos_);
+  static constexpr std::size_t default_span_size = (1U << 16U) / sizeof(ValueType);
+  static constexpr unsigned    default_buffers   = 4;
+
+  readahead_reader(std::filesystem::path filename, std::size_t first, std::size_t last,
+                   std::size_t span_size = default_span_size, unsigned nbuffers = default_buffers,
+                   access_advice advice = access_advice::normal)
+      : filename_(std::move(filename)),
+        last_(std::min<std::size_t>(
+            last, static_cast<std::size_t>(data_size<ValueType>(filename_) / sizeof(ValueType)))),
+        pos_(first), bufs_(std::max(nbuffers, 2U)), advisor_(filename_, advice) {
+    // no bigger than needed, for small dbs or ranges
+    const std::size_t size =
+        std::max<std::size_t>(std::min(span_size, last_ - std::min(first, last_)), 1);
+    for (auto& buf: bufs_) buf.recs.resize(size);
+    start(first);
   }
-  // clang-format on
 
-  std::size_t           pos() { return pos_; }
-  std::filesystem::path filename() { return ffdb_->filename(); }
+  // a "unique manager" .. no copies or moves, the I/O thread refers to this
+  readahead_reader(const readahead_reader& other)            = delete;
+  readahead_reader& operator=(const readahead_reader& other) = delete;
+  readahead_reader(readahead_reader&& other)                 = delete;
+  readahead_reader& operator=(readahead_reader&& other)      = delete;
+
+  ~readahead_reader() { stop(); }
+
+  // the next span, which is empty at the end. Invalidates the previous span. Rethrows any error
+  // from the I/O thread.
+  std::span<const ValueType> next() {
+    const std::size_t target = pos_;
+    if (seeking_) {
+      seeking_ = false;
+      // still in the span we hold?
+      if (holding_ && target >= held().pos && target < held().pos + held().size) {
+        return take_from(target);
+      }
+    }
+    while (true) {
+      release();
+      if (!acquire()) {
+        if (target >= last_) return {}; // the end
+        start(target); // seeked beyond the end, and back again
+        continue;
+      }
+      const buffer& buf = held();
+      if (target < buf.pos || target > buf.pos + buf.size + bufs_.size() * buf.recs.size()) {
+        start(target); // backwards or far forwards: restart the read ahead
+        continue;
+      }
+      if (target < buf.pos + buf.size) return take_from(target);
+      // forwards, skip this span
+    }
+  }
+
+  // position of the first record of the next span
+  [[nodiscard]] std::size_t pos() const { return pos_; }
+
+  // continue from `pos`, rather than from the end of the previous span
+  void seek(std::size_t pos) {
+    if (pos != pos_) seeking_ = true;
+    pos_ = pos;
+  }
 
 private:
-  database*   ffdb_ = nullptr;
-  std::size_t pos_{};
-  // cur_ and cur_valid_ are mutable so that operator* can be const
-  mutable const value_type* cur_;
-  mutable bool              cur_valid_ = false;
+  struct buffer {
+    std::vector<ValueType> recs;
+    std::size_t            pos  = 0;
+    std::size_t            size = 0;
+  };
 
-  void set_pos(std::size_t pos) {
-    pos_       = pos;
-    cur_valid_ = false;
+  std::filesystem::path filename_;
+  std::size_t           last_;
+  std::size_t           pos_;
+  bool                  seeking_ = false;
+  bool                  holding_ = false; // whether the consumer holds bufs_[consumed_ % n]
+  std::vector<buffer>   bufs_;
+  impl::file_advisor    advisor_; // only used by the I/O thread, or when it is stopped
+
+  // shared with the I/O thread
+  std::mutex              mutex_;
+  std::condition_variable cv_;
+  std::size_t             produced_ = 0; // buffers filled by the I/O thread
+  std::size_t             consumed_ = 0; // buffers released by the consumer
+  bool                    done_     = false;
+  bool                    stop_     = false;
+  std::exception_ptr      error_;
+  std::thread             thread_;
+
+  buffer& held() { return bufs_[consumed_ % bufs_.size()]; }
+
+  std::span<const ValueType> take_from(std::size_t target) {
+    const buffer& buf = held();
+    pos_              = buf.pos + buf.size;
+    return std::span<const ValueType>(buf.recs.data(), buf.size).subspan(target - buf.pos);
   }
 
-  reference current() const {
-    if (!cur_valid_) {
-      cur_       = &ffdb_->get_record(pos_);
-      cur_valid_ = true;
+  // hand the held buffer back to the I/O thread
+  void release() {
+    if (!holding_) return;
+    {
+      const std::lock_guard lock(mutex_);
+      ++consumed_;
+      holding_ = false;
     }
-    return *cur_;
+    cv_.notify_all();
+  }
+
+  // wait for the next buffer. false at the end.
+  bool acquire() {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [&] { return produced_ != consumed_ || done_; });
+    if (produced_ == consumed_) {
+      if (error_) std::rethrow_exception(error_);
+      return false;
+    }
+    holding_ = true;
+    return true;
+  }
+
+  void start(std::size_t first) {
+    stop();
+    advisor_.restart(first * sizeof(ValueType));
+    produced_ = 0;
+    consumed_ = 0;
+    done_     = false;
+    stop_     = false;
+    holding_  = false;
+    error_    = nullptr;
+    thread_   = std::thread([this, first] { fill(first); });
+  }
+
+  void stop() {
+    if (!thread_.joinable()) return;
+    {
+      const std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // the I/O thread
+  void fill(std::size_t pos) {
+    try {
+      std::ifstream file(filename_, std::ios::binary);
+      if (!file.is_open())
+        throw std::ios::failure(fmt::format("cannot open db: {}, because '{}'", filename_,
+                                            std::strerror(errno))); // NOLINT errno
+      file.exceptions(std::ios::badbit | std::ios::failbit);
+      file.seekg(static_cast<std::streamoff>(pos * sizeof(ValueType)));
+
+      while (pos < last_) {
+        {
+          std::unique_lock lock(mutex_);
+          cv_.wait(lock, [&] { return stop_ || produced_ - consumed_ != bufs_.size(); });
+          if (stop_) return;
+        }
+        // not held by the consumer, as that one has not been released
+        buffer& buf = bufs_[produced_ % bufs_.size()];
+        buf.pos     = pos;
+        buf.size    = std::min(buf.recs.size(), last_ - pos);
+        advisor_.will_read((pos + buf.size) * sizeof(ValueType));
+        file.read(reinterpret_cast<char*>(buf.recs.data()), // NOLINT reinterpret_cast
+                  static_cast<std::streamsize>(sizeof(ValueType) * buf.size));
+        pos += buf.size;
+        // the records are in our buffer now, so the page cache can drop them
+        if (const std::uint64_t bytes = pos * sizeof(ValueType); advisor_.drop_due(bytes))
+          advisor_.drop_behind(bytes);
+        {
+          const std::lock_guard lock(mutex_);
+          ++produced_;
+        }
+        cv_.notify_all();
+      }
+    } catch (...) {
+      const std::lock_guard lock(mutex_);
+      error_ = std::current_exception();
+    }
+    {
+      const std::lock_guard lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
   }
 };
 
+// call `func(span)` for each span of the records [first, last) of the db, in order, while the
+// following spans are read ahead on a background thread. Follows the db's access_advice, if any.
+// A striped db is read one stripe after another, see striped.hpp.
+template <typename DbType, typename Func>
+void for_each_span(DbType& db, std::size_t first, std::size_t last, Func func) {
+  using value_type     = typename std::remove_const_t<DbType>::value_type;
+  using reader_type    = readahead_reader<value_type>;
+  access_advice advice = access_advice::normal; // the db's, if it has one
+  if constexpr (requires { db.advice(); }) advice = db.advice();
+  last = std::min(last, db.number_records());
+
+  if constexpr (requires { db.stripes(); }) {
+    std::vector<std::unique_ptr<reader_type>> readers; // of the stripes which overlap
+    auto open_next = [&, idx = std::size_t{0}]() mutable {
+      for (; idx != db.stripes().size(); ++idx) {
+        const auto& stripe = db.stripes()[idx];
+        if (stripe.first >= last || stripe.last <= first) continue;
+        readers.push_back(std::make_unique<reader_type>(
+            stripe.filename, std::max(first, stripe.first) - stripe.first,
+            std::min(last, stripe.last) - stripe.first, reader_type::default_span_size,
+            reader_type::default_buffers, advice));
+        ++idx;
+        return;
+      }
+    };
+    open_next();
+    for (std::size_t current = 0; current < readers.size(); ++current) {
+      open_next(); // its read ahead starts now, so there is no stall at the stripe boundary
+      auto& reader = *readers[current];
+      for (auto span = reader.next(); !span.empty(); span = reader.next()) func(span);
+      readers[current].reset();
+    }
+  } else {
+    reader_type reader(db.filename(), first, last, reader_type::default_span_size,
+                       reader_type::default_buffers, advice);
+    for (auto span = reader.next(); !span.empty(); span = reader.next()) func(span);
+  }
+}
+
+// the content fingerprint of all the records of the db, as recorded in the footer of a sealed
+// db, see fingerprinter, with one read ahead scan
+template <typename DbType>
+std::uint64_t fingerprint(DbType& db) {
+  fingerprinter fp;
+  for_each_span(db, 0, db.number_records(), [&](auto span) { fp.update(span); });
+  return fp.value();
+}
+
+// Whether the records of a sealed db still have the fingerprint recorded in its footer, ie were
+// not changed after it was sealed, by a one-shot scan. nullopt for a plain db, which has none.
+template <typename ValueType>
+std::optional<bool> verify_fingerprint(const std::filesystem::path& filename) {
+  const auto container = read_container(filename);
+  if (!container) return std::nullopt;
+  database<ValueType> db(filename, 1, access_advice::once);
+  return fingerprint(db) == container->fingerprint;
+}
+
 template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
 std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_iterator first,
                                           typename database<ValueType>::const_iterator last,
@@ -231,10 +589,16 @@ std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_it
   std::cerr << fmt::format("{:20s} = {:12d}\n", "chunk size", chunk_size);
   std::cerr << fmt::format("{:20s} = {:12d}\n", "number of chunks", number_of_chunks) << "\n";
 
+  // read ahead, so the next chunk is already arriving while this one is sorted
+  readahead_reader<ValueType> reader(first.filename(), first.pos(), last.pos(),
+                                     readahead_reader<ValueType>::default_span_size,
+                                     readahead_reader<ValueType>::default_buffers, first.advice());
+
   std::vector<std::string> chunk_filenames;
   chunk_filenames.reserve(number_of_chunks);
   for (std::size_t chunk = 0; chunk != number_of_chunks; ++chunk) {
-    std::string chunk_filename = fmt::format("{}.partial.{:04d}", first.filename(), chunk);
+    std::string chunk_filename =
+        fmt::format("{}.partial.{:04d}", first.filename().string(), chunk);
     chunk_filenames.push_back(chunk_filename);
 
     std::size_t start = chunk * chunk_size;
@@ -243,7 +607,13 @@ std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_it
 
     std::vector<ValueType> objs;
     objs.reserve(end - start);
-    std::copy(first + start, first + end, std::back_inserter(objs));
+    reader.seek(first.pos() + start);
+    while (objs.size() != end - start) {
+      const auto span = reader.next();
+      if (span.empty()) throw std::runtime_error("flat_file: db ended while sorting");
+      const std::size_t nrecs = std::min(span.size(), end - start - objs.size());
+      objs.insert(objs.end(), span.begin(), span.begin() + static_cast<std::ptrdiff_t>(nrecs));
+    }
     std::sort(
 #if HIBP_USE_PSTL && __cpp_lib_parallel_algorithm
         // it is also possible to use std::sort(par_unseq from PTSL in libc++ with
@@ -253,15 +623,18 @@ std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_it
         objs.begin(), objs.end(), [&](const auto& a, const auto& b) {
           return comp(std::invoke(proj, a), std::invoke(proj, b));
         });
-    auto part = file_writer<ValueType>(chunk_filename);
+    // read once by the merge, and then deleted, so no need to keep it in the page cache
+    auto part = file_writer<ValueType>(chunk_filename, access_advice::once);
     for (const auto& obj: objs) part.write(obj);
   }
   return chunk_filenames;
 }
 
-template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
-void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
-                         const std::string& sorted_filename, Comp comp = {}, Proj proj = {}) {
+// merge the sorted chunks into `sorted`, any writer of ValueType, eg a file_writer, and remove them
+template <typename ValueType, typename Writer, typename Comp = std::less<>,
+          typename Proj = std::identity>
+void merge_sorted_chunks_to(const std::vector<std::string>& chunk_filenames, Writer& sorted,
+                            Comp comp = {}, Proj proj = {}) {
 
   static_assert(std::is_invocable_v<Proj, ValueType>);
 
@@ -271,7 +644,8 @@ void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
     flat_file::database<ValueType>::const_iterator end;
 
     explicit chunk(std::string filename, std::size_t buf_size)
-        : db(std::move(filename), buf_size), current(db.begin()), end(db.end()) {}
+        : db(std::move(filename), buf_size, access_advice::once), current(db.begin()),
+          end(db.end()) {}
   };
 
   std::vector<chunk> chunks;
@@ -297,7 +671,6 @@ void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
     ++(chunks[i].current);
   }
 
-  auto sorted = flat_file::file_writer<ValueType>(sorted_filename);
   while (!heads.empty()) {
     const head& t = heads.top();
     sorted.write(t.value);
@@ -312,6 +685,14 @@ void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
   for (const auto& filename: chunk_filenames) std::filesystem::remove(filename);
 }
 
+template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
+void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
+                         const std::string& sorted_filename, Comp comp = {}, Proj proj = {},
+                         access_advice advice = access_advice::normal) {
+  auto sorted = flat_file::file_writer<ValueType>(sorted_filename, advice);
+  merge_sorted_chunks_to<ValueType>(chunk_filenames, sorted, comp, proj);
+}
+
 template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
 std::string disksort_range(typename database<ValueType>::const_iterator first,
                            typename database<ValueType>::const_iterator last, Comp comp = {},
@@ -320,7 +701,7 @@ std::string disksort_range(typename database<ValueType>::const_iterator first,
   std::vector<std::string> chunk_filenames =
       sort_into_chunks<ValueType>(first, last, comp, proj, max_memory_usage);
 
-  std::string sorted_filename = fmt::format("{}.sorted", first.filename());
+  std::string sorted_filename = fmt::format("{}.sorted", first.filename().string());
 
   if (chunk_filenames.size() == 1) {
     std::filesystem::rename(chunk_filenames[0], sorted_filename);
@@ -328,7 +709,7 @@ std::string disksort_range(typename database<ValueType>::const_iterator first,
   } else {
     std::cerr << fmt::format("\nmerging [{:12d},{:12d}) => {:s}\n", first.pos(), last.pos(),
                              sorted_filename);
-    merge_sorted_chunks<ValueType>(chunk_filenames, sorted_filename, comp, proj);
+    merge_sorted_chunks<ValueType>(chunk_filenames, sorted_filename, comp, proj, first.advice());
   }
   return sorted_filename;
 }
@@ -339,4 +720,13 @@ std::string database<ValueType>::disksort(Comp comp, Proj proj, std::size_t max_
   return disksort_range<ValueType>(begin(), end(), comp, proj, max_memory_usage);
 }
 
+template <typename ValueType>
+template <typename Writer, typename Comp, typename Proj>
+void database<ValueType>::disksort_to(Writer& sorted, Comp comp, Proj proj,
+                                      std::size_t max_memory_usage) {
+  merge_sorted_chunks_to<ValueType>(
+      sort_into_chunks<ValueType>(begin(), end(), comp, proj, max_memory_usage), sorted, comp,
+      proj);
+}
+
 } // namespace flat_file
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace flat_file {
+
+// hint to the OS about how a db is going to be accessed
+//  - normal:     no hint, the kernel's adaptive readahead
+//  - random:     point lookups, so no readahead
+//  - sequential: a scan, so aggressive readahead, and the pages are kept
+//  - once:       a one-shot scan or write, eg by a maintenance tool. As sequential, and the
+//                pages it brought into the page cache are dropped again behind the scan
+//                ("drop-behind"), so it does not evict the working set of a server on the same box
+//  - hot:        the whole file is needed soon, so start reading it into the page cache now
+enum class access_advice { normal, random, sequential, once, hot };
+
+namespace impl {
+
+#ifndef _WIN32
+// the whole file hints for `fd`. Advisory only, so failures are ignored.
+inline void fadvise(int fd, access_advice advice) {
+  switch (advice) {
+  case access_advice::random:
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    break;
+  case access_advice::sequential:
+  case access_advice::once:
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    break;
+  case access_advice::hot:
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED); // async
+    break;
+  case access_advice::normal:
+    break;
+  }
+}
+#endif
+
+// Applies an access_advice to a file, through a descriptor of its own, so it works alongside
+// the std::fstreams of database and stream_writer. The page cache is per file, so `hot` and the
+// drop-behind of `once` take effect for every reader and writer of that file. The kernel's
+// readahead hints (`random`, `sequential`) are per descriptor, so they only reach reads made
+// through this one. Advisory only: failures are ignored, and all of it is a no-op on Windows.
+//
+// Drop-behind must not drop pages which were in the page cache before the scan got to them, eg
+// those hibp-server is using, often of this same file. So readers call will_read() before each
+// read, which samples, with mincore(), the residency of the pages up to a window ahead, before
+// the kernel's readahead gets to them. Only pages which were not resident are dropped. That
+// needs Linux; elsewhere reads keep all pages. Writers start new files, so all they write is
+// dropped.
+class file_advisor {
+public:
+  // drop-behind granularity. Writes are dropped one window behind the writer, so the kernel has
+  // had a window's worth of time to write them back, and the writer rarely waits for the disk.
+  static constexpr std::uint64_t drop_window = 16ULL << 20U; // 16MB
+
+  // DONTNEED only drops whole folios, which readahead makes up to 2MB. So drops start and end on
+  // this alignment, or the folios straddling their ends are left behind.
+  static constexpr std::uint64_t drop_align = 2ULL << 20U;
+
+  file_advisor() = default; // no advice
+
+  file_advisor(const std::filesystem::path& filename, access_advice advice) : advice_(advice) {
+#ifndef _WIN32
+    if (advice_ == access_advice::normal) return;
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT vararg
+    if (fd_ == -1) return;
+    fadvise(fd_, advice_);
+    page_size_ = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#else
+    (void)filename;
+#endif
+  }
+
+  // a "unique manager" .. no copies, move-only
+  file_advisor(const file_advisor& other)            = delete;
+  file_advisor& operator=(const file_advisor& other) = delete;
+
+  file_advisor(file_advisor&& other) noexcept
+      : advice_(std::exchange(other.advice_, access_advice::normal)),
+        fd_(std::exchange(other.fd_, -1)), page_size_(other.page_size_),
+        started_(other.started_), dropped_(other.dropped_), sampled_(other.sampled_),
+        read_(other.read_), resident_(std::move(other.resident_)) {}
+
+  file_advisor& operator=(file_advisor&& other) noexcept {
+    if (this != &other) {
+      close();
+      advice_    = std::exchange(other.advice_, access_advice::normal);
+      fd_        = std::exchange(other.fd_, -1);
+      page_size_ = other.page_size_;
+      started_   = other.started_;
+      dropped_   = other.dropped_;
+      sampled_   = other.sampled_;
+      read_      = other.read_;
+      resident_  = std::move(other.resident_);
+    }
+    return *this;
+  }
+
+  ~file_advisor() { close(); }
+
+  [[nodiscard]] access_advice advice() const { return advice_; }
+
+  // about to read bytes up to `end`, so sample the residency of the pages up to a window beyond
+  void will_read(std::uint64_t end) noexcept {
+    if (!dropping()) return;
+    read_ = std::max(read_, end);
+    while (sampled_ < end + drop_window && sample()) {
+    }
+  }
+
+  // whether bytes [0, end) have been consumed far enough past the last drop to drop again
+  [[nodiscard]] bool drop_due(std::uint64_t end) const {
+    return dropping() && end >= started_ + drop_window;
+  }
+
+  // Bytes [0, end) have been read, or written and handed to the kernel, and are not needed
+  // again. Starts writeback of the newest of them, and drops those from before the previous call
+  // from the page cache. For reads, there is nothing to write back. The rest is dropped on
+  // destruction, or now with `all`.
+  void drop_behind(std::uint64_t end, bool all = false) noexcept {
+    if (!dropping() || end < started_) return;
+#ifdef __linux__
+    // a length of 0 means "to the end of the file", for both of these syscalls
+    if (end != started_) {
+      ::sync_file_range(fd_, static_cast<::off_t>(started_),
+                        static_cast<::off_t>(end - started_), SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    const std::uint64_t upto = all ? (end + page_size_ - 1) / page_size_ * page_size_
+                                   : started_ / drop_align * drop_align;
+    started_                 = end;
+    if (upto <= dropped_) return;
+#ifdef __linux__
+    // DONTNEED skips dirty pages, so wait for any which are still being written
+    ::sync_file_range(fd_, static_cast<::off_t>(dropped_), static_cast<::off_t>(upto - dropped_),
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                          SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+    drop_not_resident(upto);
+  }
+
+  // the consumer moved to `offset`, eg with a seek. Drops all it consumed so far. The pages
+  // before the next alignment are left alone, as they may be some other reader's.
+  void restart(std::uint64_t offset) noexcept {
+    drop_behind(std::max(started_, read_), true);
+    if (!dropping()) return;
+    read_    = 0;
+    started_ = (offset + drop_align - 1) / drop_align * drop_align;
+    dropped_ = started_;
+    sampled_ = started_;
+    resident_.clear();
+  }
+
+private:
+  access_advice advice_    = access_advice::normal;
+  int           fd_        = -1;
+  std::uint64_t page_size_ = 4096;
+  std::uint64_t started_   = 0; // bytes [0, started_) have had writeback started
+  std::uint64_t dropped_   = 0; // bytes [0, dropped_) have been dropped, drop_align aligned
+  std::uint64_t sampled_   = 0; // end of the sampled residency, page aligned
+  std::uint64_t read_      = 0; // end of the reads, for the final drop
+
+  // whether each page from dropped_ to sampled_ was resident before it was read (in bit 0)
+  std::vector<unsigned char> resident_;
+
+  [[nodiscard]] bool dropping() const { return fd_ != -1 && advice_ == access_advice::once; }
+
+  // sample the residency of the next window. false at the end of the file.
+  bool sample() noexcept {
+#ifndef _WIN32
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) return false;
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+    if (sampled_ >= size) return false;
+
+    const std::uint64_t len    = std::min(drop_window, size - sampled_);
+    const std::size_t   old    = resident_.size();
+    const auto          npages = static_cast<std::size_t>((len + page_size_ - 1) / page_size_);
+    resident_.resize(old + npages, 1U); // unknown: keep them
+#ifdef __linux__
+    void* addr = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd_, static_cast<::off_t>(sampled_));
+    if (addr != MAP_FAILED) { // NOLINT int to ptr cast in macro
+      if (::mincore(addr, len, resident_.data() + old) != 0) {
+        std::fill(resident_.begin() + static_cast<std::ptrdiff_t>(old), resident_.end(), 1U);
+      }
+      ::munmap(addr, len);
+    }
+#endif
+    sampled_ += len;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // drop the pages of [dropped_, upto) which were not resident before they were read
+  void drop_not_resident([[maybe_unused]] std::uint64_t upto) noexcept {
+#ifndef _WIN32
+    const auto was_resident = [&](std::size_t page) {
+      return page < resident_.size() && (resident_[page] & 1U) != 0;
+    };
+    const auto  npages = static_cast<std::size_t>((upto - dropped_) / page_size_);
+    std::size_t run    = 0; // the first page of the current run of pages to drop
+    for (std::size_t page = 0; page <= npages; ++page) {
+      if (page == npages || was_resident(page)) {
+        if (page != run) {
+          ::posix_fadvise(fd_, static_cast<::off_t>(dropped_ + run * page_size_),
+                          static_cast<::off_t>((page - run) * page_size_), POSIX_FADV_DONTNEED);
+        }
+        run = page + 1;
+      }
+    }
+    resident_.erase(resident_.begin(),
+                    resident_.begin() +
+                        static_cast<std::ptrdiff_t>(std::min(npages, resident_.size())));
+    dropped_ = upto;
+#endif
+  }
+
+  void close() noexcept {
+    drop_behind(std::max(started_, read_), true); // the tail
+#ifndef _WIN32
+    if (fd_ != -1) ::close(fd_);
+#endif
+    fd_ = -1;
+  }
+};
+
+} // namespace impl
+
+} // namespace flat_file
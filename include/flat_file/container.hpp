@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <ios>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace flat_file {
+
+// A "sealed" db is a self-describing container: the records, exactly as before, followed by
+// optional sections, eg an embedded index, then a table of those sections, and then a fixed
+// size footer which describes the records:
+//
+//   [records][section payloads, page aligned][section table][footer]
+//
+// It is a footer, not a header, so the records still start at offset 0 and a record's position
+// is unchanged. All the flat_file dbs read only the records, via data_size(), so code which
+// knows nothing about containers keeps working. Plain dbs have no footer and are unaffected.
+
+// what the footer records about the records
+struct container_metadata {
+  std::uint32_t record_size  = 0;
+  std::uint64_t record_count = 0;
+  std::uint64_t fingerprint  = 0; // of the records' bytes, see fingerprinter
+  std::string   format;           // eg "sha1", up to 15 chars
+  std::string   sort_key;         // eg "hash" for ascending by hash, or "" if unsorted
+};
+
+// a section to embed: its payload, identified by name, eg "toc", and an integer param, eg bits
+struct container_section {
+  std::string       name; // up to 15 chars
+  std::uint64_t     param = 0;
+  std::vector<char> data;
+};
+
+struct container_info : container_metadata {
+  struct section {
+    std::string   name;
+    std::uint64_t param  = 0;
+    std::uint64_t offset = 0; // in the file
+    std::uint64_t bytes  = 0;
+  };
+
+  std::uint32_t        version = 0;
+  std::vector<section> sections;
+
+  [[nodiscard]] std::uint64_t data_size() const { return record_count * record_size; }
+
+  // the section with this name and param, if any
+  [[nodiscard]] const section* find(std::string_view name, std::uint64_t param) const {
+    const auto iter = std::find_if(sections.begin(), sections.end(), [&](const section& s) {
+      return s.name == name && s.param == param;
+    });
+    return iter == sections.end() ? nullptr : &*iter;
+  }
+};
+
+// Content fingerprint of a stream of records: a 64bit multiply-xorshift hash, over 8 byte words.
+// Fast enough to be computed in the same scan as other work, and to detect any change to the
+// records, but not cryptographic.
+class fingerprinter {
+public:
+  void update(std::span<const std::byte> bytes) {
+    bytes_ += bytes.size();
+    while (!bytes.empty()) {
+      const std::size_t n = std::min(bytes.size(), word_.size() - fill_);
+      std::memcpy(word_.data() + fill_, bytes.data(), n);
+      fill_ += n;
+      bytes = bytes.subspan(n);
+      if (fill_ == word_.size()) mix();
+    }
+  }
+
+  template <typename ValueType>
+  void update(std::span<const ValueType> records) {
+    update(std::as_bytes(records));
+  }
+
+  [[nodiscard]] std::uint64_t value() const {
+    fingerprinter tail = *this;
+    if (tail.fill_ != 0) {
+      std::fill(tail.word_.begin() + static_cast<std::ptrdiff_t>(tail.fill_), tail.word_.end(),
+                std::byte{0});
+      tail.mix();
+    }
+    return tail.hash_ ^ tail.bytes_;
+  }
+
+private:
+  static constexpr std::uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+
+  std::uint64_t            hash_  = 0x243F6A8885A308D3ULL;
+  std::uint64_t            bytes_ = 0;
+  std::array<std::byte, 8> word_{};
+  std::size_t              fill_ = 0;
+
+  void mix() {
+    std::uint64_t word = 0;
+    std::memcpy(&word, word_.data(), sizeof(word));
+    hash_ = (hash_ ^ word) * multiplier;
+    hash_ ^= hash_ >> 32U;
+    fill_ = 0;
+  }
+};
+
+namespace impl {
+
+inline constexpr std::array<char, 8> container_magic{'F', 'L', 'A', 'T', 'F', 'I', 'L', 'E'};
+inline constexpr std::uint32_t       container_version = 1;
+inline constexpr std::uint64_t       container_align   = 4096; // of section payloads
+
+using container_name = std::array<char, 16>; // NUL padded
+
+struct container_footer {
+  std::uint32_t       version       = container_version;
+  std::uint32_t       record_size   = 0;
+  std::uint64_t       record_count  = 0;
+  std::uint64_t       fingerprint   = 0;
+  container_name      format{};
+  container_name      sort_key{};
+  std::uint32_t       section_count = 0;
+  std::uint32_t       reserved      = 0;
+  std::array<char, 8> magic         = container_magic; // last, so it is at the end of the file
+};
+static_assert(sizeof(container_footer) == 72);
+
+struct container_section_entry {
+  container_name name{};
+  std::uint64_t  param  = 0;
+  std::uint64_t  offset = 0;
+  std::uint64_t  bytes  = 0;
+};
+static_assert(sizeof(container_section_entry) == 40);
+
+inline container_name to_container_name(std::string_view name) {
+  if (name.size() >= container_name{}.size())
+    throw std::invalid_argument(fmt::format("container name '{}' is too long", name));
+  container_name result{};
+  std::copy(name.begin(), name.end(), result.begin());
+  return result;
+}
+
+inline std::string from_container_name(const container_name& name) {
+  return {name.data(), static_cast<std::size_t>(std::find(name.begin(), name.end(), '\0') -
+                                                name.begin())};
+}
+
+} // namespace impl
+
+// The footer and section table of a sealed db, or nullopt for a plain db. Throws on a footer
+// which cannot be trusted, ie of an unknown version or inconsistent with the size of the file.
+inline std::optional<container_info> read_container(const std::filesystem::path& filename) {
+  const auto file_size = static_cast<std::uint64_t>(std::filesystem::file_size(filename));
+  impl::container_footer footer;
+  if (file_size < sizeof(footer)) return std::nullopt;
+
+  std::ifstream is(filename, std::ios::binary);
+  if (!is) throw std::ios::failure(fmt::format("cannot open db: {}", filename));
+  is.seekg(static_cast<std::streamoff>(file_size - sizeof(footer)));
+  is.read(reinterpret_cast<char*>(&footer), sizeof(footer)); // NOLINT reincast
+  if (!is || footer.magic != impl::container_magic) return std::nullopt;
+
+  if (footer.version != impl::container_version) {
+    throw std::ios::failure(
+        fmt::format("db {} has an unsupported container version {}", filename, footer.version));
+  }
+  const auto corrupt = [&] {
+    return std::ios::failure(fmt::format("db {} has a corrupt container footer", filename));
+  };
+  const std::uint64_t table_bytes = footer.section_count * sizeof(impl::container_section_entry);
+  if (footer.record_size == 0 || table_bytes > file_size - sizeof(footer)) throw corrupt();
+  const std::uint64_t table_start = file_size - sizeof(footer) - table_bytes;
+  if (footer.record_count > table_start / footer.record_size) throw corrupt();
+  const std::uint64_t data_end = footer.record_count * footer.record_size;
+
+  container_info info;
+  info.version      = footer.version;
+  info.record_size  = footer.record_size;
+  info.record_count = footer.record_count;
+  info.fingerprint  = footer.fingerprint;
+  info.format       = impl::from_container_name(footer.format);
+  info.sort_key     = impl::from_container_name(footer.sort_key);
+
+  std::vector<impl::container_section_entry> table(footer.section_count);
+  is.seekg(static_cast<std::streamoff>(table_start));
+  is.read(reinterpret_cast<char*>(table.data()), // NOLINT reincast
+          static_cast<std::streamsize>(table_bytes));
+  if (!is) throw corrupt();
+  for (const auto& entry: table) {
+    if (entry.offset < data_end || entry.offset > table_start ||
+        entry.bytes > table_start - entry.offset)
+      throw corrupt();
+    info.sections.push_back(
+        {impl::from_container_name(entry.name), entry.param, entry.offset, entry.bytes});
+  }
+  return info;
+}
+
+// read a whole section's payload into dest, which must have room for section.bytes
+inline void read_section(const std::filesystem::path& filename,
+                         const container_info::section& section, void* dest) {
+  std::ifstream is(filename, std::ios::binary);
+  is.seekg(static_cast<std::streamoff>(section.offset));
+  is.read(static_cast<char*>(dest), static_cast<std::streamsize>(section.bytes));
+  if (!is) {
+    throw std::ios::failure(
+        fmt::format("cannot read section '{}' of db: {}", section.name, filename));
+  }
+}
+
+// A "striped" db is one logical db whose records are split, in order, across several plain or
+// sealed dbs, "stripes", eg one on each of several devices. It is named by a small text
+// manifest, which lists the stripes, one per line, after a magic first line:
+//
+//   flat_file stripes
+//   /mnt/ssd0/hibp_all.sha1.bin.stripe0
+//   /mnt/ssd1/hibp_all.sha1.bin.stripe1
+//
+// Relative paths are relative to the manifest's directory. See striped.hpp.
+
+inline constexpr std::string_view stripe_manifest_magic = "flat_file stripes\n";
+
+inline bool is_striped(const std::filesystem::path& filename) {
+  std::ifstream is(filename, std::ios::binary);
+  std::string   head(stripe_manifest_magic.size(), '\0');
+  is.read(head.data(), static_cast<std::streamsize>(head.size()));
+  return is && head == stripe_manifest_magic;
+}
+
+// the stripes named by a manifest, in order
+inline std::vector<std::filesystem::path>
+read_stripe_manifest(const std::filesystem::path& filename) {
+  if (!is_striped(filename)) {
+    throw std::ios::failure(fmt::format("not a striped db manifest: {}", filename));
+  }
+  std::ifstream is(filename);
+  std::string   line;
+  std::getline(is, line); // the magic
+  std::vector<std::filesystem::path> stripes;
+  while (std::getline(is, line)) {
+    if (line.empty()) continue;
+    const std::filesystem::path stripe(line);
+    stripes.push_back(stripe.is_absolute() ? stripe : filename.parent_path() / stripe);
+  }
+  if (stripes.empty()) {
+    throw std::ios::failure(fmt::format("striped db has no stripes: {}", filename));
+  }
+  return stripes;
+}
+
+inline void write_stripe_manifest(const std::filesystem::path&              filename,
+                                  const std::vector<std::filesystem::path>& stripes) {
+  std::ofstream os(filename);
+  if (!os) throw std::ios::failure(fmt::format("cannot open striped db manifest: {}", filename));
+  os.exceptions(std::ios::badbit | std::ios::failbit);
+  os << stripe_manifest_magic;
+  for (const auto& stripe: stripes) os << stripe.string() << '\n';
+}
+
+// The size in bytes of the records of the db, ie the whole file for a plain db, or up to the
+// sections for a sealed one, whose record size must then be that of ValueType. Not for striped
+// dbs, which have no single file of records.
+template <typename ValueType>
+std::uint64_t data_size(const std::filesystem::path& filename) {
+  if (is_striped(filename)) {
+    throw std::ios::failure(
+        fmt::format("db {} is striped, which is not supported by this reader", filename));
+  }
+  const auto container = read_container(filename);
+  if (!container) return static_cast<std::uint64_t>(std::filesystem::file_size(filename));
+  if (container->record_size != sizeof(ValueType)) {
+    throw std::ios::failure(fmt::format("db {} has records of {} bytes, not {} bytes", filename,
+                                        container->record_size, sizeof(ValueType)));
+  }
+  return container->data_size();
+}
+
+// Seal the db in place: append the sections and the footer. Any existing container is replaced,
+// the records are left untouched. metadata must match them.
+inline void write_container(const std::filesystem::path&          filename,
+                            const container_metadata&             metadata,
+                            const std::vector<container_section>& sections) {
+  std::uint64_t data_end = std::filesystem::file_size(filename);
+  if (const auto existing = read_container(filename)) data_end = existing->data_size();
+  if (metadata.record_size == 0 || data_end != metadata.record_count * metadata.record_size) {
+    throw std::runtime_error(fmt::format("cannot seal db {}: {} records of {} bytes do not match "
+                                         "its {} bytes of records",
+                                         filename, metadata.record_count, metadata.record_size,
+                                         data_end));
+  }
+  std::filesystem::resize_file(filename, data_end); // strip any existing container
+
+  impl::container_footer footer;
+  footer.record_size   = metadata.record_size;
+  footer.record_count  = metadata.record_count;
+  footer.fingerprint   = metadata.fingerprint;
+  footer.format        = impl::to_container_name(metadata.format);
+  footer.sort_key      = impl::to_container_name(metadata.sort_key);
+  footer.section_count = static_cast<std::uint32_t>(sections.size());
+
+  std::fstream os(filename, std::ios::in | std::ios::out | std::ios::binary);
+  if (!os) throw std::ios::failure(fmt::format("cannot open db for sealing: {}", filename));
+  os.exceptions(std::ios::badbit | std::ios::failbit);
+  os.seekp(static_cast<std::streamoff>(data_end));
+
+  // payloads are page aligned, so they can be mapped in place
+  std::vector<impl::container_section_entry> table;
+  std::uint64_t                              offset = data_end;
+  for (const auto& section: sections) {
+    const std::uint64_t start =
+        (offset + impl::container_align - 1) / impl::container_align * impl::container_align;
+    const std::vector<char> padding(start - offset);
+    os.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    os.write(section.data.data(), static_cast<std::streamsize>(section.data.size()));
+    table.push_back({impl::to_container_name(section.name), section.param, start,
+                     section.data.size()});
+    offset = start + section.data.size();
+  }
+  os.write(reinterpret_cast<const char*>(table.data()), // NOLINT reincast
+           static_cast<std::streamsize>(table.size() * sizeof(impl::container_section_entry)));
+  os.write(reinterpret_cast<const char*>(&footer), sizeof(footer)); // NOLINT reincast
+}
+
+} // namespace flat_file
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "flat_file/advice.hpp"
+#include "flat_file/container.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <ios>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace flat_file {
+
+namespace impl {
+
+// read-only mapping of an entire file. Move-only, unmapped on destruction.
+class mmap_region {
+public:
+  explicit mmap_region(const std::filesystem::path& filename)
+      : size_(static_cast<std::size_t>(std::filesystem::file_size(filename))) {
+    if (size_ == 0) return; // nothing to map, data() == nullptr
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) // NOLINT int to ptr cast in macro
+      throw std::ios::failure(fmt::format("cannot open db: {}", filename));
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) throw std::ios::failure(fmt::format("cannot map db: {}", filename));
+
+    addr_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping alive
+    if (addr_ == nullptr) throw std::ios::failure(fmt::format("cannot map db: {}", filename));
+#else
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT vararg
+    if (fd == -1)
+      throw std::ios::failure(fmt::format("cannot open db: {}, because '{}'", filename,
+                                          std::strerror(errno))); // NOLINT errno
+
+    addr_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (addr_ == MAP_FAILED) { // NOLINT int to ptr cast in macro
+      addr_ = nullptr;
+      throw std::ios::failure(fmt::format("cannot map db: {}, because '{}'", filename,
+                                          std::strerror(errno))); // NOLINT errno
+    }
+#endif
+  }
+
+  // a "unique manager" .. no copies, move-only
+  mmap_region(const mmap_region& other)            = delete;
+  mmap_region& operator=(const mmap_region& other) = delete;
+
+  mmap_region(mmap_region&& other) noexcept
+      : addr_(std::exchange(other.addr_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+  mmap_region& operator=(mmap_region&& other) noexcept {
+    if (this != &other) {
+      unmap();
+      addr_ = std::exchange(other.addr_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  ~mmap_region() { unmap(); }
+
+  [[nodiscard]] const std::byte* data() const { return static_cast<const std::byte*>(addr_); }
+  [[nodiscard]] std::size_t      size() const { return size_; }
+
+  // advisory only, so failures are ignored. There is no drop-behind for mappings, so `once` is
+  // just sequential here.
+  void advise([[maybe_unused]] access_advice advice) const {
+#ifndef _WIN32
+    if (addr_ == nullptr) return;
+    int posix_advice = POSIX_MADV_NORMAL;
+    if (advice == access_advice::random) {
+      posix_advice = POSIX_MADV_RANDOM;
+    } else if (advice == access_advice::sequential || advice == access_advice::once) {
+      posix_advice = POSIX_MADV_SEQUENTIAL;
+    } else if (advice == access_advice::hot) {
+      posix_advice = POSIX_MADV_WILLNEED;
+    }
+    ::posix_madvise(addr_, size_, posix_advice);
+#endif
+  }
+
+private:
+  void*       addr_ = nullptr;
+  std::size_t size_ = 0;
+
+  void unmap() noexcept {
+    if (addr_ == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(addr_);
+#else
+    ::munmap(addr_, size_);
+#endif
+    addr_ = nullptr;
+  }
+};
+
+} // namespace impl
+
+// Read-only, memory mapped alternative to flat_file::database.
+//
+// All member functions are const and there is no buffer state, so a single instance can be
+// shared by any number of threads. Every record access is a plain memory load, without syscalls
+// or copying. The iterators are plain pointers into the mapping, so they work with
+// std::lower_bound etc just like database::const_iterator.
+template <typename ValueType>
+class mmap_database {
+
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
+
+public:
+  explicit mmap_database(std::filesystem::path filename,
+                         access_advice         advice = access_advice::random)
+      : filename_(std::move(filename)), region_(filename_) {
+
+    // the records, without any container footer
+    const auto data_bytes = static_cast<std::size_t>(data_size<ValueType>(filename_));
+    if (data_bytes % sizeof(ValueType) != 0)
+      throw std::ios::failure("db file size is not a multiple of the record size");
+
+    dbsize_ = data_bytes / sizeof(ValueType);
+    region_.advise(advice);
+  }
+
+  using value_type     = ValueType;
+  using const_iterator = const ValueType*;
+
+  const ValueType& get_record(std::size_t pos) const {
+    if (pos >= dbsize_) {
+      throw std::runtime_error(
+          "flat_file:get_record cannot return data, are you dereferencing db.end()?");
+    }
+    return begin()[pos];
+  }
+
+  const_iterator begin() const {
+    return reinterpret_cast<const ValueType*>(region_.data()); // NOLINT reincast
+  }
+  const_iterator end() const { return begin() + dbsize_; }
+
+  const ValueType& back() const { return *std::prev(end()); }
+
+  // change the access pattern hint, eg to sequential before a full scan
+  void advise(access_advice advice) const { region_.advise(advice); }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return region_.size(); }
+  std::size_t           number_records() const { return dbsize_; }
+
+private:
+  std::filesystem::path filename_;
+  impl::mmap_region     region_;
+  std::size_t           dbsize_ = 0;
+};
+
+} // namespace flat_file
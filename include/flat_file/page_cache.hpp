@@ -0,0 +1,279 @@
+#pragma once
+
+#include "flat_file/pread.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+namespace flat_file {
+
+namespace impl {
+
+// Open for positional reads which bypass the kernel page cache, where supported. Falls back to
+// a normal, buffered, open, eg on tmpfs or other OSes.
+inline positional_file open_direct(const std::filesystem::path& filename) {
+#ifdef O_DIRECT
+  try {
+    return positional_file(filename, O_DIRECT);
+  } catch (const std::ios::failure&) {
+    // filesystem doesn't support O_DIRECT
+  }
+#endif
+  return positional_file(filename);
+}
+
+} // namespace impl
+
+// A process wide, fixed budget, cache of file pages, shared by any number of threads and files.
+//
+// Pages are page_size bytes, and page aligned, so they can be read with O_DIRECT. The cache is
+// split into shards, each with its own lock, its own share of the budget and its own CLOCK
+// (second chance LRU) eviction. Misses read outside the lock, so slow reads only block the
+// threads which are waiting for the same page: the first to miss marks the page as in flight,
+// and any others wait for its read, rather than reading the page again.
+class page_cache {
+public:
+  static constexpr std::size_t page_size = 4096;
+
+  explicit page_cache(std::size_t budget_bytes, unsigned nshards = 64) {
+    const std::size_t total_pages = std::max<std::size_t>(budget_bytes / page_size, 1);
+    nshards_ = static_cast<unsigned>(std::clamp<std::size_t>(nshards, 1, total_pages));
+    shards_  = std::make_unique<shard[]>(nshards_); // NOLINT c-array
+    for (unsigned i = 0; i != nshards_; ++i) {
+      shards_[i].init(total_pages / nshards_ + (i < total_pages % nshards_ ? 1 : 0));
+    }
+  }
+
+  struct stats_t {
+    std::uint64_t hits   = 0;
+    std::uint64_t misses = 0;
+  };
+
+  // Each file using the cache needs a unique id. Ids are never reused.
+  std::uint32_t register_file() {
+    const std::uint32_t file_id = next_file_id_++;
+    if (file_id >= max_files) throw std::runtime_error("page_cache: too many files");
+    return file_id;
+  }
+
+  // copy `bytes` at `offset` of `file` into `dest`, via the cache. Thread safe.
+  void read(std::uint32_t file_id, const impl::positional_file& file, std::uint64_t offset,
+            void* dest, std::size_t bytes) {
+    auto* out = static_cast<std::byte*>(dest);
+    while (bytes != 0) {
+      const std::uint64_t page_no = offset / page_size;
+      const std::size_t   skip    = static_cast<std::size_t>(offset % page_size);
+      const std::size_t   n       = std::min(bytes, page_size - skip);
+      copy_from_page(file_id, file, page_no, skip, out, n);
+      out += n; // NOLINT pointer arithmetic
+      offset += n;
+      bytes -= n;
+    }
+  }
+
+  [[nodiscard]] stats_t stats() const {
+    stats_t total;
+    for (unsigned i = 0; i != nshards_; ++i) {
+      const std::lock_guard lock(shards_[i].mutex);
+      total.hits += shards_[i].hits;
+      total.misses += shards_[i].misses;
+    }
+    return total;
+  }
+
+  [[nodiscard]] std::size_t capacity_bytes() const {
+    std::size_t pages = 0;
+    for (unsigned i = 0; i != nshards_; ++i) pages += shards_[i].slots.size();
+    return pages * page_size;
+  }
+
+private:
+  // page keys are (file_id, page_no) packed into 64bits: 2^40 pages is 4PB per file
+  static constexpr unsigned      page_no_bits = 40;
+  static constexpr std::uint32_t max_files    = 1U << (64U - page_no_bits);
+
+  struct page_deleter {
+    void operator()(std::byte* pages) const noexcept {
+      ::operator delete[](pages, std::align_val_t{page_size});
+    }
+  };
+  using page_buffer = std::unique_ptr<std::byte[], page_deleter>; // NOLINT c-array
+
+  static page_buffer make_pages(std::size_t npages) {
+    return page_buffer{static_cast<std::byte*>(
+        ::operator new[](npages * page_size, std::align_val_t{page_size}))};
+  }
+
+  struct slot {
+    std::uint64_t key        = 0;
+    bool          referenced = false;
+  };
+
+  struct shard {
+    mutable std::mutex                             mutex;
+    std::condition_variable                        loaded; // an in flight read has ended
+    std::unordered_map<std::uint64_t, std::size_t> index; // page key => slot
+    std::unordered_set<std::uint64_t>              in_flight; // page keys being read
+    std::vector<slot>                              slots;
+    page_buffer                                    pages;
+    std::size_t                                    used = 0;
+    std::size_t                                    hand = 0; // CLOCK hand
+    std::uint64_t                                  hits   = 0;
+    std::uint64_t                                  misses = 0;
+
+    void init(std::size_t npages) {
+      slots.resize(npages);
+      pages = make_pages(npages);
+      index.reserve(npages);
+    }
+
+    std::byte* page(std::size_t slot_idx) const {
+      return pages.get() + slot_idx * page_size; // NOLINT pointer arithmetic
+    }
+
+    // a free slot if there is one, otherwise evict the first page not referenced since the hand
+    // last passed it
+    std::size_t victim() {
+      if (used != slots.size()) return used++;
+      while (slots[hand].referenced) {
+        slots[hand].referenced = false;
+        hand                   = (hand + 1) % slots.size();
+      }
+      const std::size_t slot_idx = hand;
+      index.erase(slots[slot_idx].key);
+      hand = (hand + 1) % slots.size();
+      return slot_idx;
+    }
+  };
+
+  unsigned                   nshards_;
+  std::unique_ptr<shard[]>   shards_; // NOLINT c-array
+  std::atomic<std::uint32_t> next_file_id_{0};
+
+  shard& shard_for(std::uint64_t key) {
+    // fibonacci hashing, so consecutive pages spread across shards
+    const std::uint64_t mixed = key * 0x9E3779B97F4A7C15ULL; // NOLINT magic number
+    return shards_[static_cast<std::size_t>((mixed >> 32U) % nshards_)];
+  }
+
+  void copy_from_page(std::uint32_t file_id, const impl::positional_file& file,
+                      std::uint64_t page_no, std::size_t skip, std::byte* dest,
+                      std::size_t bytes) {
+    const std::uint64_t key = (std::uint64_t{file_id} << page_no_bits) | page_no;
+    shard&              sh  = shard_for(key);
+    {
+      std::unique_lock lock(sh.mutex);
+      while (true) {
+        if (auto iter = sh.index.find(key); iter != sh.index.end()) {
+          ++sh.hits;
+          sh.slots[iter->second].referenced = true;
+          std::memcpy(dest, sh.page(iter->second) + skip, bytes); // NOLINT pointer arithmetic
+          return;
+        }
+        // the page is absent, or was evicted again, or its read failed, unless still in flight
+        if (sh.in_flight.insert(key).second) break;
+        sh.loaded.wait(lock);
+      }
+      ++sh.misses;
+    }
+
+    // miss: read the whole, aligned, page without holding the lock. Only the last page of the
+    // file comes back short, and nothing beyond the file is ever copied out.
+    alignas(page_size) std::array<std::byte, page_size> buf; // NOLINT uninitialised
+    try {
+      if (file.read_some(page_no * page_size, buf.data(), page_size) < skip + bytes)
+        throw std::ios::failure(fmt::format("page_cache: short read of page {}", page_no));
+    } catch (...) {
+      {
+        const std::lock_guard lock(sh.mutex);
+        sh.in_flight.erase(key);
+      }
+      sh.loaded.notify_all(); // so a waiter tries the read itself
+      throw;
+    }
+    std::memcpy(dest, buf.data() + skip, bytes); // NOLINT pointer arithmetic
+
+    {
+      const std::lock_guard lock(sh.mutex);
+      sh.in_flight.erase(key);
+      const std::size_t slot_idx = sh.victim();
+      std::memcpy(sh.page(slot_idx), buf.data(), page_size);
+      sh.slots[slot_idx] = {key, false};
+      sh.index.emplace(key, slot_idx);
+    }
+    sh.loaded.notify_all();
+  }
+};
+
+// Thread-safe, immutable handle on a flat_file db, which reads through a shared page_cache,
+// with O_DIRECT where possible. This gives predictable resident memory, controlled by the size
+// of the cache, rather than depending on the kernel's page cache.
+//
+// Threads read through their own cursor, as with shared_database. A buffer of 1 record is
+// sufficient, because the cache already holds the pages.
+template <typename ValueType>
+class cached_database {
+
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
+
+public:
+  cached_database(std::filesystem::path filename, page_cache& cache)
+      : filename_(std::move(filename)), dbfsize_(data_size<ValueType>(filename_)),
+        file_(impl::open_direct(filename_)), cache_(&cache), file_id_(cache.register_file()) {
+
+    if (dbfsize_ % sizeof(ValueType) != 0)
+      throw std::ios::failure("db file size is not a multiple of the record size");
+
+    dbsize_ = static_cast<std::size_t>(dbfsize_ / sizeof(ValueType));
+  }
+
+  using value_type = ValueType;
+  using cursor     = impl::buffered_cursor<cached_database>;
+
+  [[nodiscard]] cursor make_cursor(std::size_t buf_size = 1) const { return {*this, buf_size}; }
+
+  // copy records [pos, pos + nrecs) into dest. Thread safe.
+  void read(std::size_t pos, std::size_t nrecs, ValueType* dest) const {
+    if (pos + nrecs > dbsize_) {
+      throw std::out_of_range(fmt::format("flat_file: cannot read records [{}, {}) of {}", pos,
+                                          pos + nrecs, dbsize_));
+    }
+    cache_->read(file_id_, file_, static_cast<std::uint64_t>(pos) * sizeof(ValueType), dest,
+                 nrecs * sizeof(ValueType));
+  }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return dbfsize_; }
+  std::size_t           number_records() const { return dbsize_; }
+
+private:
+  std::filesystem::path filename_;
+  std::uintmax_t        dbfsize_;
+  std::size_t           dbsize_{};
+  impl::positional_file file_;
+  page_cache*           cache_;
+  std::uint32_t         file_id_;
+};
+
+} // namespace flat_file
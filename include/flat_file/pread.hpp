@@ -0,0 +1,290 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "flat_file/advice.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <ios>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace flat_file {
+
+namespace impl {
+
+// A read-only file which is only accessed with positional reads. These do not use or modify a
+// shared file offset, so read_at() is safe to call from any number of threads at once.
+class positional_file {
+public:
+  explicit positional_file(const std::filesystem::path& filename, int extra_flags = 0) {
+#ifdef _WIN32
+    (void)extra_flags;
+    handle_ = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle_ == INVALID_HANDLE_VALUE) // NOLINT int to ptr cast in macro
+      throw std::ios::failure(fmt::format("cannot open db: {}", filename));
+#else
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC | extra_flags); // NOLINT vararg
+    if (fd_ == -1)
+      throw std::ios::failure(fmt::format("cannot open db: {}, because '{}'", filename,
+                                          std::strerror(errno))); // NOLINT errno
+#endif
+  }
+
+  // a "unique manager" .. no copies, move-only
+  positional_file(const positional_file& other)            = delete;
+  positional_file& operator=(const positional_file& other) = delete;
+
+#ifdef _WIN32
+  positional_file(positional_file&& other) noexcept
+      : handle_(std::exchange(other.handle_, INVALID_HANDLE_VALUE)) {}
+
+  positional_file& operator=(positional_file&& other) noexcept {
+    if (this != &other) {
+      close();
+      handle_ = std::exchange(other.handle_, INVALID_HANDLE_VALUE);
+    }
+    return *this;
+  }
+#else
+  positional_file(positional_file&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+
+  positional_file& operator=(positional_file&& other) noexcept {
+    if (this != &other) {
+      close();
+      fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+  }
+#endif
+
+  ~positional_file() { close(); }
+
+  // read exactly `bytes` starting at `offset`, or throw
+  void read_at(std::uint64_t offset, void* dest, std::size_t bytes) const {
+    auto* out = static_cast<char*>(dest);
+    while (bytes != 0) {
+      const std::size_t got = read_some(offset, out, bytes);
+      if (got == 0)
+        throw std::ios::failure(fmt::format(
+            "flat_file: read of {} bytes at {} failed: 'unexpected end of file'", bytes, offset));
+      out += got;
+      offset += got;
+      bytes -= got;
+    }
+  }
+
+  // a single read of up to `bytes` starting at `offset`. Returns the number of bytes read, which
+  // is only short at the end of the file (or 0 beyond it). Throws on error.
+  std::size_t read_some(std::uint64_t offset, void* dest, std::size_t bytes) const {
+#ifdef _WIN32
+    OVERLAPPED ov{};
+    ov.Offset        = static_cast<DWORD>(offset);
+    ov.OffsetHigh    = static_cast<DWORD>(offset >> 32U);
+    DWORD      got   = 0;
+    const auto chunk = static_cast<DWORD>(std::min<std::size_t>(bytes, 1U << 30U));
+    if (!ReadFile(handle_, dest, chunk, &got, &ov)) {
+      if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+      throw std::ios::failure(fmt::format("flat_file: read of {} bytes at {} failed", bytes,
+                                          offset));
+    }
+    return static_cast<std::size_t>(got);
+#else
+    while (true) {
+      const ::ssize_t got = ::pread(fd_, dest, bytes, static_cast<::off_t>(offset));
+      if (got >= 0) return static_cast<std::size_t>(got);
+      if (errno != EINTR) // NOLINT errno
+        throw std::ios::failure(fmt::format("flat_file: read of {} bytes at {} failed: '{}'",
+                                            bytes, offset,
+                                            std::strerror(errno))); // NOLINT errno
+    }
+#endif
+  }
+
+  // per descriptor, so this shapes the kernel's readahead for read_at()
+  void advise([[maybe_unused]] access_advice advice) const {
+#ifndef _WIN32
+    fadvise(fd_, advice);
+#endif
+  }
+
+#ifndef _WIN32
+  [[nodiscard]] int fd() const { return fd_; }
+#endif
+
+private:
+#ifdef _WIN32
+  HANDLE handle_ = INVALID_HANDLE_VALUE; // NOLINT int to ptr cast in macro
+
+  void close() noexcept {
+    if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_); // NOLINT int to ptr cast in macro
+    handle_ = INVALID_HANDLE_VALUE;                             // NOLINT int to ptr cast in macro
+  }
+#else
+  int fd_ = -1;
+
+  void close() noexcept {
+    if (fd_ != -1) ::close(fd_);
+    fd_ = -1;
+  }
+#endif
+};
+
+// A read buffer onto a thread safe db handle, which only needs to provide `value_type`,
+// `read(pos, nrecs, dest)`, `number_records()`, `filesize()` and `filename()`. It has the same
+// interface as flat_file::database. Not thread safe: use one per thread.
+template <typename DbType>
+class buffered_cursor {
+public:
+  using value_type     = typename DbType::value_type;
+  using const_iterator = record_iterator<buffered_cursor, value_type>;
+
+  buffered_cursor(const DbType& db, std::size_t buf_size) : db_(&db), buf_(buf_size) {}
+
+  const value_type& get_record(std::size_t pos) {
+    if (!(pos >= buf_start_ && pos < buf_end_)) { // NOLINT can be simplified
+      if (pos >= db_->number_records()) {
+        throw std::runtime_error(
+            "flat_file:get_record cannot return data, are you dereferencing db.end()?");
+      }
+      const std::size_t nrecs = std::min(buf_.size(), db_->number_records() - pos);
+      db_->read(pos, nrecs, buf_.data());
+      buf_start_ = pos;
+      buf_end_   = pos + nrecs;
+    }
+    return buf_[pos - buf_start_];
+  }
+
+  // copy records [pos, pos + nrecs) into dest, with a single read, bypassing the buffer
+  void read(std::size_t pos, std::size_t nrecs, value_type* dest) { db_->read(pos, nrecs, dest); }
+
+  const_iterator begin() { return {*this, 0}; }
+  const_iterator end() { return {*this, db_->number_records()}; }
+
+  const value_type& back() { return *std::prev(end()); }
+
+  std::filesystem::path filename() const { return db_->filename(); }
+  std::size_t           filesize() const { return db_->filesize(); }
+  std::size_t           number_records() const { return db_->number_records(); }
+
+private:
+  const DbType*           db_;
+  std::size_t             buf_start_ = 0;
+  std::size_t             buf_end_   = 0; // one past the end
+  std::vector<value_type> buf_;
+};
+
+} // namespace impl
+
+// Thread-safe, immutable handle on a flat_file db.
+//
+// One file descriptor and one copy of the metadata are shared by all threads. Threads read
+// through their own `cursor`, which is cheap to create, owns a small read-ahead buffer and
+// fills it with positional reads. Cursors therefore never contend with each other.
+//
+// A cursor has the same interface as flat_file::database, so it works with std::lower_bound,
+// toc_search etc. Just like database, a cursor invalidates its iterators when moved.
+template <typename ValueType>
+class shared_database {
+
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
+
+public:
+  explicit shared_database(std::filesystem::path filename,
+                           access_advice         advice = access_advice::normal)
+      : filename_(std::move(filename)), dbfsize_(data_size<ValueType>(filename_)),
+        file_(filename_), advice_(advice) {
+
+    if (dbfsize_ % sizeof(ValueType) != 0)
+      throw std::ios::failure("db file size is not a multiple of the record size");
+
+    dbsize_ = static_cast<std::size_t>(dbfsize_ / sizeof(ValueType));
+    file_.advise(advice_);
+  }
+
+  using value_type = ValueType;
+  using cursor     = impl::buffered_cursor<shared_database>;
+
+  [[nodiscard]] cursor make_cursor(std::size_t buf_size = 1) const { return {*this, buf_size}; }
+
+  // copy records [pos, pos + nrecs) into dest. Thread safe.
+  void read(std::size_t pos, std::size_t nrecs, ValueType* dest) const {
+    if (pos + nrecs > dbsize_) {
+      throw std::out_of_range(fmt::format("flat_file: cannot read records [{}, {}) of {}", pos,
+                                          pos + nrecs, dbsize_));
+    }
+    file_.read_at(static_cast<std::uint64_t>(pos) * sizeof(ValueType), dest,
+                  nrecs * sizeof(ValueType));
+  }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return dbfsize_; }
+  std::size_t           number_records() const { return dbsize_; }
+  access_advice         advice() const { return advice_; }
+
+  // for readers which batch their own positional reads
+  [[nodiscard]] const impl::positional_file& file() const { return file_; }
+
+private:
+  std::filesystem::path   filename_;
+  std::uintmax_t          dbfsize_;
+  std::size_t             dbsize_;
+  impl::positional_file   file_;
+  access_advice           advice_;
+};
+
+// Split [0, size) into up to `nthreads` contiguous ranges and call
+// `func(range_idx, first, last)` for each range on its own thread. Blocks until all are done and
+// rethrows the first exception thrown by any of them.
+template <typename Func>
+void for_each_range(std::size_t size, unsigned nthreads, Func func) {
+  const std::size_t nranges = std::clamp<std::size_t>(nthreads, 1, std::max<std::size_t>(size, 1));
+  const std::size_t per_range = size / nranges;
+  const std::size_t remainder = size % nranges;
+
+  std::vector<std::exception_ptr> exceptions(nranges);
+  {
+    std::vector<std::jthread> threads;
+    threads.reserve(nranges);
+    std::size_t first = 0;
+    for (std::size_t idx = 0; idx != nranges; ++idx) {
+      const std::size_t last = first + per_range + (idx < remainder ? 1 : 0);
+      threads.emplace_back([&, idx, first, last]() {
+        try {
+          func(idx, first, last);
+        } catch (...) {
+          exceptions[idx] = std::current_exception();
+        }
+      });
+      first = last;
+    }
+  } // wait here until threads join
+
+  for (const auto& e: exceptions) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+} // namespace flat_file
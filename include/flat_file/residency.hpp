@@ -0,0 +1,262 @@
+#pragma once
+
+#include "flat_file/pread.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace flat_file {
+
+// how to back long lived, randomly accessed, memory
+//  - none:        normal pages
+//  - transparent: ask the kernel to use transparent huge pages (madvise MADV_HUGEPAGE)
+//  - hugetlb:     explicit huge pages from the hugetlbfs pool (MAP_HUGETLB), only possible for
+//                 anonymous memory. Falls back to transparent if the pool is exhausted.
+enum class huge_pages { none, transparent, hugetlb };
+
+struct residency_options {
+  bool       preload = false; // prefault all pages, in parallel
+  bool       lock    = false; // mlock all pages, implies preload
+  huge_pages huge    = huge_pages::none;
+
+  [[nodiscard]] bool any() const { return preload || lock || huge != huge_pages::none; }
+};
+
+struct residency_report {
+  std::string name;
+  std::size_t bytes   = 0;
+  double      seconds = 0;
+  bool        locked  = false;
+  bool        huge    = false; // huge pages were requested and accepted by the kernel
+
+  [[nodiscard]] std::string to_string() const {
+    return fmt::format("{:30s} {:10.1f}MB in {:7.3f}s{}{}", name,
+                       static_cast<double>(bytes) / (1U << 20U), seconds,
+                       locked ? ", locked" : "", huge ? ", huge pages" : "");
+  }
+};
+
+namespace impl {
+
+inline constexpr std::size_t huge_page_size = 2UL << 20U;
+
+inline std::size_t os_page_size() {
+#ifdef _WIN32
+  return 4096;
+#else
+  static const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  return page_size;
+#endif
+}
+
+inline std::size_t round_up(std::size_t bytes, std::size_t multiple) {
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+// touch one byte in every page, using all cores, so the OS faults them all in now, rather than
+// on first use
+inline void prefault(const std::byte* data, std::size_t bytes) {
+  const std::size_t page_size = os_page_size();
+  const std::size_t npages    = round_up(bytes, page_size) / page_size;
+  for_each_range(npages, std::max(std::thread::hardware_concurrency(), 1U),
+                 [&](std::size_t, std::size_t first, std::size_t last) {
+                   std::byte sum{};
+                   for (std::size_t page = first; page != last; ++page) {
+                     // NOLINTNEXTLINE pointer arithmetic
+                     sum ^= *static_cast<const volatile std::byte*>(data + page * page_size);
+                   }
+                   [[maybe_unused]] volatile std::byte sink = sum;
+                 });
+}
+
+} // namespace impl
+
+// Control the residency of `bytes` of memory at `data`, which may be anonymous or a file
+// mapping, according to `opts`. Returns what was done and how long it took. Throws
+// std::system_error if locking was requested but refused, eg due to `ulimit -l`.
+inline residency_report make_resident(std::string name, const void* data, std::size_t bytes,
+                                      const residency_options& opts) {
+  residency_report report{std::move(name), bytes};
+  if (data == nullptr || bytes == 0) return report;
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto* base = static_cast<const std::byte*>(data);
+
+#ifndef _WIN32
+  // madvise and mlock need page aligned ranges
+  const auto addr    = reinterpret_cast<std::uintptr_t>(base); // NOLINT reincast
+  const auto aligned = addr / impl::os_page_size() * impl::os_page_size();
+  // NOLINTNEXTLINE int to ptr
+  void*             range     = reinterpret_cast<void*>(aligned);
+  const std::size_t range_len = bytes + (addr - aligned);
+
+#ifdef MADV_HUGEPAGE
+  if (opts.huge != huge_pages::none) {
+    report.huge = ::madvise(range, range_len, MADV_HUGEPAGE) == 0;
+  }
+#endif
+  if (opts.preload || opts.lock) {
+    ::madvise(range, range_len, MADV_WILLNEED); // start readahead of file mappings, async
+    impl::prefault(base, bytes);
+  }
+  if (opts.lock) {
+    if (::mlock(range, range_len) != 0) {
+      throw std::system_error(errno, std::generic_category(), // NOLINT errno
+                              fmt::format("cannot lock {} in RAM (check `ulimit -l`)",
+                                          report.name));
+    }
+    report.locked = true;
+  }
+#else
+  if (opts.preload || opts.lock) impl::prefault(base, bytes);
+#endif
+
+  report.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return report;
+}
+
+// Find the address range at which `filename` is memory mapped into this process, eg by a
+// library which does not expose its mapping. Linux only, elsewhere always nullopt.
+inline std::optional<std::span<const std::byte>>
+find_mapping([[maybe_unused]] const std::filesystem::path& filename) {
+#ifdef __linux__
+  const std::string canonical = std::filesystem::canonical(filename).string();
+
+  std::ifstream maps("/proc/self/maps");
+  std::uintptr_t first = std::numeric_limits<std::uintptr_t>::max();
+  std::uintptr_t last  = 0;
+  for (std::string line; std::getline(maps, line);) {
+    // format: start-end perms offset dev inode pathname
+    const auto path_pos = line.find('/');
+    if (path_pos == std::string::npos || line.substr(path_pos) != canonical) continue;
+
+    std::istringstream is(line);
+    std::uintptr_t     start = 0;
+    std::uintptr_t     end   = 0;
+    char               dash  = 0;
+    is >> std::hex >> start >> dash >> end;
+    first = std::min(first, start);
+    last  = std::max(last, end);
+  }
+  if (last != 0) {
+    // NOLINTNEXTLINE int to ptr
+    return std::span<const std::byte>{reinterpret_cast<const std::byte*>(first), last - first};
+  }
+#endif
+  return std::nullopt;
+}
+
+// Like make_resident(), but for a file which may not be mapped into this process (or whose
+// mapping cannot be found). Then the best we can do is read it through, to warm the OS cache.
+inline residency_report make_file_resident(std::string name, const std::filesystem::path& filename,
+                                           const residency_options& opts) {
+  if (auto mapping = find_mapping(filename)) {
+    return make_resident(std::move(name), mapping->data(), mapping->size(), opts);
+  }
+
+  residency_report report{std::move(name), static_cast<std::size_t>(
+                                               std::filesystem::file_size(filename))};
+  if (!opts.preload && !opts.lock) return report;
+
+  const auto                    start = std::chrono::steady_clock::now();
+  const impl::positional_file   file(filename);
+  constexpr std::size_t         chunk = 1UL << 20U;
+  for_each_range(impl::round_up(report.bytes, chunk) / chunk,
+                 std::max(std::thread::hardware_concurrency(), 1U),
+                 [&](std::size_t, std::size_t first, std::size_t last) {
+                   std::vector<std::byte> buf(chunk);
+                   for (std::size_t i = first; i != last; ++i)
+                     file.read_some(std::uint64_t{i} * chunk, buf.data(), chunk);
+                 });
+  report.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return report;
+}
+
+// Allocator for large, long lived arrays which may be backed by huge pages. Allocations are
+// whole pages straight from the OS, and the huge page mode is part of the allocator's state,
+// so it moves along with the container.
+template <typename T>
+class page_allocator {
+public:
+  using value_type                             = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_swap            = std::true_type;
+
+  page_allocator() = default;
+  explicit page_allocator(huge_pages huge) : huge_(huge) {}
+
+  template <typename U>
+  page_allocator(const page_allocator<U>& other) : huge_(other.huge()) {} // NOLINT implicit
+
+  T* allocate(std::size_t n) {
+#ifdef _WIN32
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+#else
+    const std::size_t bytes = alloc_size(n);
+    void*             addr  = MAP_FAILED; // NOLINT int to ptr cast in macro
+#ifdef MAP_HUGETLB
+    if (huge_ == huge_pages::hugetlb) {
+      addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (addr == MAP_FAILED) { // NOLINT int to ptr cast in macro
+      addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (addr == MAP_FAILED) throw std::bad_alloc{}; // NOLINT int to ptr cast in macro
+#ifdef MADV_HUGEPAGE
+      if (huge_ != huge_pages::none) ::madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    return static_cast<T*>(addr);
+#endif
+  }
+
+  void deallocate(T* ptr, std::size_t n) noexcept {
+#ifdef _WIN32
+    ::operator delete(ptr, std::align_val_t{alignof(T)});
+#else
+    ::munmap(ptr, alloc_size(n));
+#endif
+  }
+
+  [[nodiscard]] huge_pages huge() const { return huge_; }
+
+  template <typename U>
+  bool operator==(const page_allocator<U>& other) const {
+    return huge_ == other.huge();
+  }
+
+private:
+  huge_pages huge_ = huge_pages::none;
+
+  [[nodiscard]] std::size_t alloc_size(std::size_t n) const {
+    return impl::round_up(std::max<std::size_t>(n * sizeof(T), 1),
+                          huge_ == huge_pages::hugetlb ? impl::huge_page_size
+                                                       : impl::os_page_size());
+  }
+};
+
+} // namespace flat_file
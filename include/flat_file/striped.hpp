@@ -0,0 +1,187 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "flat_file/advice.hpp"
+#include "flat_file/container.hpp"
+#include "flat_file/pread.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <functional>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Striped dbs: one logical db split, in record order, across several files, "stripes", which
+// can be on different devices. For hibp dbs each stripe holds a range of hashes, so concurrent
+// queries spread their reads over all the devices. The manifest format is in container.hpp.
+
+namespace flat_file {
+
+// one stripe of a striped db, and the records [first, last) of the logical db which it holds
+struct stripe {
+  std::filesystem::path filename;
+  std::size_t           first = 0;
+  std::size_t           last  = 0;
+};
+
+// the stripe filenames for a striped db, one in each of `dirs`: <dir>/<manifest name>.stripeN
+inline std::vector<std::filesystem::path>
+stripe_filenames(const std::filesystem::path&              manifest_filename,
+                 const std::vector<std::filesystem::path>& dirs) {
+  std::vector<std::filesystem::path> filenames;
+  for (std::size_t idx = 0; idx != dirs.size(); ++idx) {
+    filenames.push_back(dirs[idx] / fmt::format("{}.stripe{}",
+                                                manifest_filename.filename().string(), idx));
+  }
+  return filenames;
+}
+
+// Thread-safe, immutable handle on a striped db, with the same interface as shared_database: a
+// record's position is its position in the logical db, and reads which span stripes are split
+// between them. Each stripe has its own file descriptor, so reads of different stripes run in
+// parallel on their devices. A plain db is opened as a single stripe, so callers need not care.
+template <typename ValueType>
+class striped_database {
+
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
+
+public:
+  explicit striped_database(std::filesystem::path filename,
+                            access_advice         advice = access_advice::normal)
+      : filename_(std::move(filename)), advice_(advice) {
+
+    const auto filenames = is_striped(filename_) ? read_stripe_manifest(filename_)
+                                                 : std::vector<std::filesystem::path>{filename_};
+    for (const auto& stripe_filename: filenames) {
+      const std::uint64_t bytes = data_size<ValueType>(stripe_filename);
+      if (bytes % sizeof(ValueType) != 0)
+        throw std::ios::failure(fmt::format(
+            "db stripe file size is not a multiple of the record size: {}", stripe_filename));
+
+      const std::size_t first = dbsize_;
+      dbsize_ += static_cast<std::size_t>(bytes / sizeof(ValueType));
+      dbfsize_ += bytes;
+      stripes_.push_back({stripe_filename, first, dbsize_});
+      files_.emplace_back(stripe_filename);
+      files_.back().advise(advice_);
+    }
+  }
+
+  using value_type = ValueType;
+  using cursor     = impl::buffered_cursor<striped_database>;
+
+  [[nodiscard]] cursor make_cursor(std::size_t buf_size = 1) const { return {*this, buf_size}; }
+
+  // copy records [pos, pos + nrecs) into dest, with one read per stripe spanned. Thread safe.
+  void read(std::size_t pos, std::size_t nrecs, ValueType* dest) const {
+    if (pos + nrecs > dbsize_) {
+      throw std::out_of_range(fmt::format("flat_file: cannot read records [{}, {}) of {}", pos,
+                                          pos + nrecs, dbsize_));
+    }
+    // the first stripe which ends after pos
+    auto idx = static_cast<std::size_t>(
+        std::upper_bound(stripes_.begin(), stripes_.end(), pos,
+                         [](std::size_t p, const stripe& s) { return p < s.last; }) -
+        stripes_.begin());
+    while (nrecs != 0) {
+      const stripe&     s     = stripes_[idx];
+      const std::size_t count = std::min(nrecs, s.last - pos);
+      files_[idx].read_at(static_cast<std::uint64_t>(pos - s.first) * sizeof(ValueType), dest,
+                          count * sizeof(ValueType));
+      pos += count;
+      dest += count; // NOLINT ptr arith
+      nrecs -= count;
+      ++idx;
+    }
+  }
+
+  // in record order, see for_each_span()
+  [[nodiscard]] const std::vector<stripe>& stripes() const { return stripes_; }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return dbfsize_; }
+  std::size_t           number_records() const { return dbsize_; }
+  access_advice         advice() const { return advice_; }
+
+private:
+  std::filesystem::path              filename_; // the manifest
+  std::uintmax_t                     dbfsize_ = 0;
+  std::size_t                        dbsize_  = 0;
+  std::vector<stripe>                stripes_;
+  std::vector<impl::positional_file> files_; // parallel to stripes_
+  access_advice                      advice_;
+};
+
+// Writes a striped db: each record to the stripe which `select(record)` picks, and then, on
+// close(), the manifest. So the manifest only appears once the stripes are complete. Records
+// arrive in order, so the selected stripe must never go backwards. Stripes may stay empty.
+// Without a close(), eg when unwinding from an error, the partial stripes are removed instead.
+template <typename ValueType>
+class striped_writer {
+public:
+  using selector = std::function<std::size_t(const ValueType&)>;
+
+  striped_writer(std::filesystem::path manifest_filename,
+                 std::vector<std::filesystem::path> stripe_filenames, selector select,
+                 access_advice advice = access_advice::normal)
+      : manifest_filename_(std::move(manifest_filename)),
+        stripe_filenames_(std::move(stripe_filenames)), select_(std::move(select)) {
+    if (stripe_filenames_.empty()) {
+      throw std::invalid_argument(
+          fmt::format("striped db needs at least one stripe: {}", manifest_filename_));
+    }
+    for (const auto& filename: stripe_filenames_) {
+      writers_.push_back(std::make_unique<file_writer<ValueType>>(filename.string(), advice));
+    }
+  }
+
+  // a "unique manager" .. no copies or moves
+  striped_writer(const striped_writer& other)            = delete;
+  striped_writer& operator=(const striped_writer& other) = delete;
+  striped_writer(striped_writer&& other)                 = delete;
+  striped_writer& operator=(striped_writer&& other)      = delete;
+
+  ~striped_writer() {
+    if (writers_.empty()) return;
+    writers_.clear();
+    std::error_code ec;
+    for (const auto& filename: stripe_filenames_) std::filesystem::remove(filename, ec);
+  }
+
+  void write(const ValueType& value) {
+    const std::size_t idx = select_(value);
+    if (idx < current_ || idx >= writers_.size()) {
+      throw std::runtime_error(fmt::format("striped db {}: record for stripe {} after stripe {}, "
+                                           "of {}. Records must arrive in stripe order",
+                                           manifest_filename_, idx, current_, writers_.size()));
+    }
+    current_ = idx;
+    writers_[idx]->write(value);
+  }
+
+  // flush and close the stripes, and write the manifest
+  void close() {
+    if (writers_.empty()) return;
+    writers_.clear();
+    write_stripe_manifest(manifest_filename_, stripe_filenames_);
+  }
+
+private:
+  std::filesystem::path                                manifest_filename_;
+  std::vector<std::filesystem::path>                   stripe_filenames_;
+  selector                                             select_;
+  std::vector<std::unique_ptr<file_writer<ValueType>>> writers_;
+  std::size_t                                          current_ = 0;
+};
+
+} // namespace flat_file
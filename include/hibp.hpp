@@ -3,16 +3,21 @@
 #if defined(__i386__) || defined(__x86_64__)
 #include "arrcmp.hpp"
 #endif
+#include "bytearray_cast.hpp"
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <charconv>
+#include <cmath>
 #include <compare>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
 #include <fmt/format.h>
 #include <ostream>
 #include <string>
 #include <string_view>
+#include <type_traits>
 
 namespace hibp {
 
@@ -39,10 +44,89 @@ constexpr char nibble_to_char(std::byte nibble) {
   assert(n <= 15);
   return static_cast<char>(n + (n < 10 ? '0' : 'A' - 10));
 }
+
+template <std::size_t HashSize>
+std::strong_ordering hash_compare(const std::array<std::byte, HashSize>& lhs,
+                                  const std::array<std::byte, HashSize>& rhs) {
+#if defined(__i386__) || defined(__x86_64__)
+  // arrcmp loads are alignment safe, so this also suits packed records
+  return arrcmp::array_compare(lhs, rhs, arrcmp::three_way{});
+#else
+  //arrcmp is for x86 only
+  return lhs <=> rhs;
+#endif
+}
+
+template <std::size_t HashSize>
+bool hash_equal(const std::array<std::byte, HashSize>& lhs,
+                const std::array<std::byte, HashSize>& rhs) {
+#if defined(__i386__) || defined(__x86_64__)
+  return arrcmp::array_compare(lhs, rhs, arrcmp::equal{});
+#else
+  //arrcmp is for x86 only
+  return lhs == rhs;
+#endif
+}
 } // namespace detail
 
-template <unsigned HashSize>
+// Count encodings for pawned_pw: how much of the prevalence count each record stores. Chosen at
+// compile time, so the record layout is packed and there is no dispatch on the hot path.
+//  - count_int32: the exact count
+//  - count_sat16: the exact count, saturating at 65535
+//  - count_log8:  log scale, 8 steps per doubling, ie within ~5%
+//  - count_none:  no count at all, just the presence of the hash
+// Counts of 0 or less mean "unknown" (see pawned_pw::count = -1). The quantised encodings
+// store them as 0, which decodes to -1.
+struct count_int32 {
+  using storage = std::int32_t;
+  static constexpr storage encode(std::int32_t count) { return count; }
+  static constexpr std::int32_t decode(storage stored) { return stored; }
+};
+
+struct count_sat16 {
+  using storage = std::uint16_t;
+  static constexpr storage encode(std::int32_t count) {
+    return static_cast<storage>(std::clamp<std::int32_t>(count, 0, 0xFFFF));
+  }
+  static constexpr std::int32_t decode(storage stored) { return stored == 0 ? -1 : stored; }
+};
+
+struct count_log8 {
+  using storage = std::uint8_t;
+  static constexpr unsigned steps    = 8;   // per doubling
+  static constexpr unsigned max_code = 248; // 2^30.875, so always decodes within int32
+  static storage encode(std::int32_t count) {
+    if (count <= 0) return 0;
+    const auto code = 1 + std::lround(std::log2(static_cast<double>(count)) * steps);
+    return static_cast<storage>(std::min<long>(code, max_code));
+  }
+  static std::int32_t decode(storage stored) {
+    if (stored == 0) return -1;
+    return static_cast<std::int32_t>(
+        std::lround(std::exp2(static_cast<double>(stored - 1) / steps)));
+  }
+};
+
+struct count_none {
+  struct storage {};
+  static constexpr storage encode(std::int32_t /* count */) { return {}; }
+  // the hash is present, which is all we know. Consistent with the binfuse filters.
+  static constexpr std::int32_t decode(storage /* stored */) { return 1; }
+};
+
+// the above, as selected at runtime, eg by a command line option
+enum class count_encoding { int32, sat16, log8, none };
+
+template <typename T>
+concept count_policy = requires(std::int32_t count, typename T::storage stored) {
+  { T::encode(count) } -> std::same_as<typename T::storage>;
+  { T::decode(stored) } -> std::same_as<std::int32_t>;
+};
+
+template <unsigned HashSize, count_policy CountPolicy = count_int32>
 struct pawned_pw {
+  using count_policy_type = CountPolicy;
+
   constexpr static unsigned hash_size       = HashSize;
   constexpr static unsigned hash_str_size   = hash_size * 2;
   constexpr static unsigned prefix_str_size = 5;
@@ -58,7 +142,6 @@ struct pawned_pw {
       ++i;
     }
 
-    count          = -1;
     auto count_idx = hash_str_size + 1;
     if constexpr (HashSize == 8) { // special case for sha1t64
       // is this a sha1 hash?
@@ -66,36 +149,21 @@ struct pawned_pw {
         count_idx = 20UL * 2 + 1; // skip foward to the count at end of sha1 hash
       }
     }
+    std::int32_t parsed = -1;
     if (text.size() > count_idx) {
-      std::from_chars(text.c_str() + count_idx, text.c_str() + text.size(), count);
+      std::from_chars(text.c_str() + count_idx, text.c_str() + text.size(), parsed);
     }
+    set_count(parsed);
   }
 
+  [[nodiscard]] std::int32_t get_count() const { return CountPolicy::decode(count); }
+  void set_count(std::int32_t new_count) { count = CountPolicy::encode(new_count); }
+
   std::strong_ordering operator<=>(const pawned_pw& rhs) const {
-    if constexpr (HashSize == 8) { // alignment problems => fallback
-      return hash <=> rhs.hash;
-    } else {
-#if defined(__i386__) || defined(__x86_64__)
-      return arrcmp::array_compare(hash, rhs.hash, arrcmp::three_way{});
-#else
-      //arrcmp is for x86 only
-      return hash <=> rhs.hash;
-#endif
-    }
+    return detail::hash_compare(hash, rhs.hash);
   }
 
-  bool operator==(const pawned_pw& rhs) const {
-    if constexpr (HashSize == 8) { // alignment problems => fallback
-      return hash == rhs.hash;
-    } else {
-#if defined(__i386__) || defined(__x86_64__)
-      return arrcmp::array_compare(hash, rhs.hash, arrcmp::equal{});
-#else
-      //arrcmp is for x86 only
-      return hash == rhs.hash;
-#endif
-    }
-  }
+  bool operator==(const pawned_pw& rhs) const { return detail::hash_equal(hash, rhs.hash); }
 
   [[nodiscard]] std::string to_string() const {
     std::string buffer(60, '\0');
@@ -104,9 +172,13 @@ struct pawned_pw {
       *strptr++ = detail::nibble_to_char(h >> 4U);
       *strptr++ = detail::nibble_to_char(h & std::byte(0x0FU));
     }
-    *strptr++      = ':';
-    auto [ptr, ec] = std::to_chars(strptr, buffer.data() + buffer.size(), count);
-    buffer.resize(static_cast<std::size_t>(ptr - buffer.data()));
+    if constexpr (std::is_same_v<CountPolicy, count_none>) {
+      buffer.resize(static_cast<std::size_t>(strptr - buffer.data()));
+    } else {
+      *strptr++      = ':';
+      auto [ptr, ec] = std::to_chars(strptr, buffer.data() + buffer.size(), get_count());
+      buffer.resize(static_cast<std::size_t>(ptr - buffer.data()));
+    }
     return buffer;
   }
 
@@ -115,23 +187,82 @@ struct pawned_pw {
   }
 
   std::array<std::byte, HashSize> hash{};
-  std::int32_t                    count = -1; // important to be definitive about size
+
+  // important to be definitive about size. Takes no space with count_none.
+  [[no_unique_address]] typename CountPolicy::storage count = CountPolicy::encode(-1);
+};
+
+// Just the hash of a pawned_pw. The record type of the hash column of a columnar db, see
+// columnar.hpp
+template <unsigned HashSize>
+struct pw_hash {
+  constexpr static unsigned hash_size = HashSize;
+
+  pw_hash() = default;
+  template <count_policy CountPolicy>
+  explicit pw_hash(const pawned_pw<HashSize, CountPolicy>& pw) : hash(pw.hash) {}
+
+  std::strong_ordering operator<=>(const pw_hash& rhs) const {
+    return detail::hash_compare(hash, rhs.hash);
+  }
+
+  bool operator==(const pw_hash& rhs) const { return detail::hash_equal(hash, rhs.hash); }
+
+  std::array<std::byte, HashSize> hash{};
 };
 
 using pawned_pw_sha1    = pawned_pw<20>;
 using pawned_pw_ntlm    = pawned_pw<16>;
 using pawned_pw_sha1t64 = pawned_pw<8>;
 
+// sha1t64 with smaller counts, or none: 10, 9 and 8 byte records, rather than 12
+using pawned_pw_sha1t64_c16 = pawned_pw<8, count_sat16>;
+using pawned_pw_sha1t64_c8  = pawned_pw<8, count_log8>;
+using pawned_pw_sha1t64_nc  = pawned_pw<8, count_none>;
+
+static_assert(sizeof(pawned_pw_sha1t64_c16) == 10);
+static_assert(sizeof(pawned_pw_sha1t64_c8) == 9);
+#ifndef _MSC_VER // which ignores [[no_unique_address]]
+static_assert(sizeof(pawned_pw_sha1t64_nc) == 8);
+#endif
+
 template <typename T>
 concept pw_type = std::is_same_v<T, pawned_pw_sha1> || std::is_same_v<T, pawned_pw_ntlm> ||
                   std::is_same_v<T, pawned_pw_sha1t64>;
 
+namespace detail {
+template <typename T>
+struct is_pawned_pw : std::false_type {};
+
+template <unsigned HashSize, count_policy CountPolicy>
+struct is_pawned_pw<pawned_pw<HashSize, CountPolicy>> : std::true_type {};
+} // namespace detail
+
+// any pawned_pw record, including those with packed counts
+template <typename T>
+concept any_pw_type = detail::is_pawned_pw<T>::value;
+
+// The leading 64 bits of the hash, as an integer which orders as the hash does. The key of the
+// indices, eg the S-tree, MPHF and RMI.
+template <any_pw_type PwType>
+inline std::uint64_t hash_prefix(const PwType& pw) {
+  return bytearray_cast<std::uint64_t>(pw.hash.data());
+}
+
 template <pw_type PwType>
 inline bool is_valid_hash(const std::string& hash) {
   return hash.size() == PwType::hash_size * 2 &&
          hash.find_first_not_of("0123456789ABCDEF") == std::string_view::npos;
 }
 
+// Which of `stripes` equal hash ranges holds this pw, in a striped db, see flat_file/striped.hpp.
+// The ranges start on 5 hex digit prefixes, so each of the api's "files" is in a single stripe.
+template <pw_type PwType>
+inline std::size_t hash_stripe(const PwType& pw, std::size_t stripes) {
+  const std::uint32_t prefix = bytearray_cast<std::uint32_t>(pw.hash.data()) >> 12U; // 20 bits
+  return static_cast<std::size_t>((std::uint64_t{prefix} * stripes) >> 20U);
+}
+
 template <pw_type PwType>
 inline std::string url(const std::string& prefix_str, bool testing) {
   std::string server_path =
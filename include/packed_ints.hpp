@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Compact arrays for the in-memory indices, and their (de)serialisation to sidecar files.
+
+namespace hibp::details {
+
+// unsigned integers of a fixed bit width, packed into 64bit words
+class packed_ints {
+public:
+  packed_ints() = default;
+
+  packed_ints(std::size_t size, unsigned width) : width_(width), words_(words_for(size, width)) {}
+
+  // the words allocated for `size` ints. +1: get() may read one beyond
+  static std::size_t words_for(std::size_t size, unsigned width) {
+    return (size * width + 63) / 64 + 1;
+  }
+
+  void set(std::size_t idx, std::uint64_t value) {
+    const std::size_t bit   = idx * width_;
+    const std::size_t word  = bit / 64;
+    const auto        shift = static_cast<unsigned>(bit % 64);
+    words_[word] |= value << shift;
+    if (shift + width_ > 64) words_[word + 1] |= value >> (64 - shift);
+  }
+
+  [[nodiscard]] std::uint64_t get(std::size_t idx) const {
+    const std::size_t bit   = idx * width_;
+    const std::size_t word  = bit / 64;
+    const auto        shift = static_cast<unsigned>(bit % 64);
+    std::uint64_t     value = words_[word] >> shift;
+    if (shift + width_ > 64) value |= words_[word + 1] << (64 - shift);
+    return width_ == 64 ? value : value & ((std::uint64_t{1} << width_) - 1);
+  }
+
+  [[nodiscard]] unsigned width() const { return width_; }
+
+  std::vector<std::uint64_t>&                     words() { return words_; }
+  [[nodiscard]] const std::vector<std::uint64_t>& words() const { return words_; }
+
+private:
+  unsigned                   width_ = 0;
+  std::vector<std::uint64_t> words_;
+};
+
+// a vector of trivially copyable T, as a uint64 size followed by the elements
+template <typename T>
+void write_vector(std::ostream& os, const std::vector<T>& vec) {
+  const std::uint64_t size = vec.size();
+  os.write(reinterpret_cast<const char*>(&size), sizeof(size));   // NOLINT reincast
+  os.write(reinterpret_cast<const char*>(vec.data()),             // NOLINT reincast
+           static_cast<std::streamsize>(vec.size() * sizeof(T)));
+}
+
+// the bytes from the read position to the end of the stream, 0 if it cannot seek
+inline std::uint64_t remaining_bytes(std::istream& is) {
+  const auto pos = is.tellg();
+  if (pos == std::istream::pos_type(-1)) return 0;
+  is.seekg(0, std::ios_base::end);
+  const auto end = is.tellg();
+  is.seekg(pos);
+  return end > pos ? static_cast<std::uint64_t>(end - pos) : 0;
+}
+
+// The size is not trusted: one beyond the rest of the stream, eg of a corrupt sidecar, fails the
+// stream, rather than allocating it, so the sidecar is rebuilt.
+template <typename T>
+void read_vector(std::istream& is, std::vector<T>& vec) {
+  std::uint64_t size = 0;
+  is.read(reinterpret_cast<char*>(&size), sizeof(size)); // NOLINT reincast
+  if (!is || size > remaining_bytes(is) / sizeof(T)) {
+    vec.clear();
+    is.setstate(std::ios_base::failbit);
+    return;
+  }
+  vec.resize(static_cast<std::size_t>(size));
+  is.read(reinterpret_cast<char*>(vec.data()), // NOLINT reincast
+          static_cast<std::streamsize>(vec.size() * sizeof(T)));
+}
+
+} // namespace hibp::details
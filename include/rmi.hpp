@@ -0,0 +1,36 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <utility>
+
+namespace hibp {
+
+// learned indices, as an alternative to the ToC, selected with --index
+enum class learned_index { none, rmi };
+
+namespace details {
+class rmi_index; // see rmi.cpp
+} // namespace details
+
+// Recursive model index of the db's 64bit hash prefixes. Stored in a sidecar file, next to the
+// db, which is rebuilt when it is older than the db (or for a different size of db). Immutable
+// once constructed, so it can be shared between threads. Search with window_search.
+template <pw_type PwType>
+class rmi {
+public:
+  // loads the index of db_filename from its up to date sidecar file, else builds and saves it
+  explicit rmi(const std::filesystem::path& db_filename);
+
+  // the [first, last) record positions which would contain the needle, as predicted by the
+  // model, within its error bounds
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(const PwType& needle,
+                                                           std::size_t   db_size) const;
+
+private:
+  std::shared_ptr<const details::rmi_index> index_;
+};
+
+} // namespace hibp
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <ios>
+#include <system_error>
+
+// Sidecar files: the indices of a db, saved next to it, eg <db>.18.toc, <db>.stree or <db>.mphf.
+
+namespace hibp::details {
+
+// A sidecar file is only used if it is newer than its db, otherwise it is rebuilt
+inline bool is_fresh(const std::filesystem::path& filename,
+                     const std::filesystem::path& db_filename) {
+  return std::filesystem::exists(filename) && std::filesystem::last_write_time(filename) >
+                                                  std::filesystem::last_write_time(db_filename);
+}
+
+// One saved right after the db was written can share its timestamp, on filesystems with coarse
+// ones, so is moved past it.
+inline void make_newer(const std::filesystem::path& filename,
+                       const std::filesystem::path& db_filename) {
+  const auto db_time = std::filesystem::last_write_time(db_filename);
+  if (std::filesystem::last_write_time(filename) <= db_time) {
+    std::filesystem::last_write_time(filename, db_time + std::chrono::seconds(1));
+  }
+}
+
+// Written alongside and renamed over the old file, so processes which have it mapped, or are
+// reading it, keep the old inode, rather than see it truncated and rewritten under them. Throws
+// std::ios::failure if the write fails, and leaves the old file, if any, in place.
+template <typename Write>
+void replace_file(const std::filesystem::path& filename, Write write) {
+  const std::filesystem::path tmp_filename = fmt::format("{}.tmp", filename.string());
+  try {
+    auto stream = std::ofstream(tmp_filename, std::ios_base::binary);
+    stream.exceptions(std::ios::badbit | std::ios::failbit);
+    write(stream);
+    stream.close();
+  } catch (...) {
+    std::error_code ec;
+    std::filesystem::remove(tmp_filename, ec);
+    throw;
+  }
+  std::filesystem::rename(tmp_filename, filename);
+}
+
+} // namespace hibp::details
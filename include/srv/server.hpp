@@ -1,5 +1,9 @@
 #pragma once
 
+#include "flat_file/residency.hpp"
+#include "interp.hpp"
+#include "rmi.hpp"
+#include "toc.hpp"
 #include <cstdint>
 #include <string>
 #include <thread>
@@ -7,18 +11,34 @@
 namespace hibp::srv {
 
 struct cli_config_t {
-  std::string   sha1_db_filename;
-  std::string   ntlm_db_filename;
-  std::string   sha1t64_db_filename;
-  std::string   binfuse8_filter_filename;
-  std::string   binfuse16_filter_filename;
-  std::string   bind_address = "localhost";
-  std::uint16_t port         = 8082;
-  unsigned int  threads      = std::thread::hardware_concurrency();
-  bool          json         = false;
-  bool          perf_test    = false;
-  bool          toc          = false;
-  unsigned      toc_bits     = 20; // 1Mega chapters
+  std::string           sha1_db_filename;
+  std::string           ntlm_db_filename;
+  std::string           sha1t64_db_filename;
+  std::string           binfuse8_filter_filename;
+  std::string           binfuse16_filter_filename;
+  std::string           bind_address = "localhost";
+  std::uint16_t         port         = 8082;
+  unsigned int          threads      = std::thread::hardware_concurrency();
+  bool                  json         = false;
+  bool                  perf_test    = false;
+  bool                  mmap         = false;
+  bool                  io_uring     = false;
+  unsigned              cache_mb     = 0; // 0 => no user space page cache
+  bool                  compressed   = false;
+  bool                  elias_fano   = false;
+  bool                  delta        = false;
+  bool                  striped      = false; // any of the dbs, see flat_file/striped.hpp
+  bool                  toc          = false;
+  unsigned              toc_bits     = 20; // 1Mega chapters
+  hibp::toc_read        toc_mode     = hibp::toc_read::probe;
+  bool                  toc_fences   = false;
+  bool                  stree        = false;
+  bool                  mphf         = false;
+  hibp::learned_index   index        = hibp::learned_index::none;
+  hibp::search_strategy search       = hibp::search_strategy::binary;
+  bool                  preload      = false;
+  bool                  mlock        = false;
+  flat_file::huge_pages huge_pages   = flat_file::huge_pages::none;
 };
 
 extern cli_config_t cli;
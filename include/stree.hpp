@@ -0,0 +1,32 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <utility>
+
+namespace hibp {
+
+namespace details {
+class stree_index; // see stree.cpp
+} // namespace details
+
+// S-tree: a static, implicit B+tree index of the db's 64bit hash prefixes. Stored in a sidecar
+// file, next to the db, which is rebuilt when it is older than the db (or the wrong size).
+// Immutable once constructed, so it can be shared between threads. Search with window_search.
+template <pw_type PwType>
+class stree {
+public:
+  // loads the index of db_filename from its up to date sidecar file, else builds and saves it
+  explicit stree(const std::filesystem::path& db_filename);
+
+  // the [first, last) record positions which would contain the needle
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(const PwType& needle,
+                                                           std::size_t   db_size) const;
+
+private:
+  std::shared_ptr<const details::stree_index> index_;
+};
+
+} // namespace hibp
@@ -1,17 +1,353 @@
 #pragma once
 
 #include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/residency.hpp"
 #include "hibp.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace hibp {
 
+namespace details {
+
+using word_vector = std::vector<std::uint64_t, flat_file::page_allocator<std::uint64_t>>;
+
+// Immutable 64bit words: either owned, in whole pages from the OS, so they can be locked and
+// backed by huge pages, or a view of a read-only file mapping, used in place. A mapping costs no
+// copy, and its pages are shared, through the page cache, with every process which maps the file.
+class word_array {
+public:
+  word_array() = default;
+  explicit word_array(word_vector words) : owned_(std::move(words)), view_(owned_) {}
+
+  // `size` words at `offset` bytes, which must be 8 byte aligned, into the mapping
+  word_array(std::shared_ptr<const flat_file::impl::mmap_region> region, std::size_t offset,
+             std::size_t size)
+      : region_(std::move(region)),
+        view_(reinterpret_cast<const std::uint64_t*>(region_->data() + offset), // NOLINT
+              size) {}
+
+  // the view points into owned_, so no copies, but moving the vector keeps its buffer
+  word_array(const word_array& other)                = delete;
+  word_array& operator=(const word_array& other)     = delete;
+  word_array(word_array&& other) noexcept            = default;
+  word_array& operator=(word_array&& other) noexcept = default;
+  ~word_array()                                      = default;
+
+  [[nodiscard]] std::span<const std::uint64_t> view() const { return view_; }
+  [[nodiscard]] bool                           mapped() const { return region_ != nullptr; }
+  [[nodiscard]] flat_file::huge_pages huge() const { return owned_.get_allocator().huge(); }
+
+  // copy into owned pages, eg to back them with huge pages, which a file mapping cannot be
+  void own(flat_file::huge_pages huge) {
+    *this = word_array(word_vector(view_.begin(), view_.end(),
+                                   flat_file::page_allocator<std::uint64_t>{huge}));
+  }
+
+private:
+  word_vector                                         owned_;
+  std::shared_ptr<const flat_file::impl::mmap_region> region_;
+  std::span<const std::uint64_t>                      view_;
+};
+
+// The toc: the db position of the first record of each chapter, a non-decreasing sequence.
+//
+// Entries are grouped in blocks of 64. Each block is stored as its first position, in a whole
+// 64bit word, followed by the offsets of its entries from that, packed at a common bit width,
+// just wide enough for the widest block. So a block is 1 + width words, a lookup touches one or
+// two cache lines, and positions are not limited to 4 billion records. That is width + 1 bits
+// per entry, rather than 32: ~18 for the default 20 bit toc of the full sha1 db, ~6 at 32 bits.
+//
+// Saved as a header of magic, size and width, followed by the words, which are used in place.
+class toc_table {
+public:
+  static constexpr std::size_t   block        = 64;
+  static constexpr std::uint64_t magic        = 0x3143'4f54'5042'4948; // "HIBPTOC1", little endian
+  static constexpr std::size_t   header_bytes = 3 * sizeof(std::uint64_t);
+
+  toc_table() = default;
+  toc_table(word_array words, std::size_t size, unsigned width)
+      : words_(std::move(words)), size_(size), width_(width) {}
+
+  [[nodiscard]] std::uint64_t operator[](std::size_t idx) const {
+    return get(words_.view().data(), idx, width_);
+  }
+
+  [[nodiscard]] std::size_t size() const { return size_; }
+  [[nodiscard]] bool        empty() const { return size_ == 0; }
+  [[nodiscard]] unsigned    width() const { return width_; }
+
+  word_array&                     words() { return words_; }
+  [[nodiscard]] const word_array& words() const { return words_; }
+
+  void write(std::ostream& os) const {
+    const std::uint64_t header[] = {magic, size_, width_};           // NOLINT c-array
+    os.write(reinterpret_cast<const char*>(header), sizeof(header)); // NOLINT reincast
+    os.write(reinterpret_cast<const char*>(words_.view().data()),    // NOLINT reincast
+             static_cast<std::streamsize>(words_.view().size_bytes()));
+  }
+
+  // the table in these `bytes` at `offset` into the mapping, eg of a toc file, or a section of a
+  // sealed db, used in place. nullopt if they are not a valid table.
+  static std::optional<toc_table> map(std::shared_ptr<const flat_file::impl::mmap_region> region,
+                                      std::size_t offset, std::size_t bytes) {
+    if (bytes < header_bytes || offset % sizeof(std::uint64_t) != 0 ||
+        offset + bytes > region->size()) {
+      return {};
+    }
+    std::uint64_t header[3] = {};                                // NOLINT c-array
+    std::memcpy(header, region->data() + offset, header_bytes); // NOLINT ptr arith
+    const std::uint64_t size  = header[1];
+    const std::uint64_t width = header[2];
+    if (header[0] != magic || width > 64) return {};
+
+    const std::uint64_t words = (size + block - 1) / block * (1 + width);
+    if (bytes != header_bytes + words * sizeof(std::uint64_t)) return {};
+    return toc_table(word_array(std::move(region), offset + header_bytes,
+                                static_cast<std::size_t>(words)),
+                     static_cast<std::size_t>(size), static_cast<unsigned>(width));
+  }
+
+  // entry idx of the table in `words`, at `width`
+  static std::uint64_t get(const std::uint64_t* words, std::size_t idx, unsigned width) {
+    const std::size_t   first = idx / block * (1 + width);
+    const std::uint64_t base  = words[first]; // NOLINT ptr arith
+    if (width == 0) return base;
+    const std::size_t bit    = (idx % block) * width;
+    const std::size_t word   = first + 1 + bit / 64;
+    const auto        shift  = static_cast<unsigned>(bit % 64);
+    std::uint64_t     offset = words[word] >> shift; // NOLINT ptr arith
+    if (shift + width > 64) offset |= words[word + 1] << (64 - shift); // NOLINT ptr arith
+    return base + (width == 64 ? offset : offset & ((std::uint64_t{1} << width) - 1));
+  }
+
+private:
+  word_array  words_;
+  std::size_t size_  = 0;
+  unsigned    width_ = 0;
+};
+
+// builds a toc_table, one entry at a time
+class toc_builder {
+public:
+  static constexpr std::size_t block = toc_table::block;
+
+  // append the position of the next chapter
+  void push_back(std::uint64_t pos) {
+    const std::uint64_t offset = size_ % block == 0 ? 0 : pos - words_[size_ / block * stride()];
+    if (const auto needed = static_cast<unsigned>(std::bit_width(offset)); needed > width_) {
+      widen(needed);
+    }
+    if (size_ % block == 0) {
+      words_.push_back(pos);
+      words_.resize(words_.size() + width_);
+    }
+    if (offset != 0) {
+      const std::size_t bit   = (size_ % block) * width_;
+      const std::size_t word  = size_ / block * stride() + 1 + bit / 64;
+      const auto        shift = static_cast<unsigned>(bit % 64);
+      words_[word] |= offset << shift;
+      if (shift + width_ > 64) words_[word + 1] |= offset >> (64 - shift);
+    }
+    ++size_;
+  }
+
+  [[nodiscard]] std::size_t size() const { return size_; }
+
+  // append the entries of another builder, eg of the next range of prefixes, built on another
+  // thread. This one must hold whole blocks, so the other's blocks follow on unchanged, once
+  // both are at the same width.
+  void append(toc_builder&& other) {
+    if (size_ % block != 0) {
+      throw std::logic_error("toc_builder: can only append after a whole number of blocks");
+    }
+    if (other.width_ > width_) widen(other.width_);
+    if (width_ > other.width_) other.widen(width_);
+    words_.insert(words_.end(), other.words_.begin(), other.words_.end());
+    size_ += std::exchange(other.size_, 0);
+    other.words_.clear();
+  }
+
+  [[nodiscard]] toc_table finish() && {
+    return {word_array(std::move(words_)), std::exchange(size_, 0), std::exchange(width_, 0)};
+  }
+
+private:
+  word_vector words_;
+  std::size_t size_  = 0;
+  unsigned    width_ = 0;
+
+  [[nodiscard]] std::size_t stride() const { return 1 + width_; }
+
+  // re-encode the entries so far at the new, greater, width. Offsets only widen in the first
+  // few blocks, so this is rare and cheap.
+  void widen(unsigned width) {
+    toc_builder wider;
+    wider.width_ = width;
+    for (std::size_t idx = 0; idx != size_; ++idx) {
+      wider.push_back(toc_table::get(words_.data(), idx, width_));
+    }
+    *this = std::move(wider);
+  }
+};
+
+} // namespace details
+
+// how toc_search reads a chapter: binary search with a (dependent) read per probe, or read the
+// whole chapter at once and search it in memory
+enum class toc_read { probe, chapter };
+
+// TOC: "Table of contents" of one db, see toc.cpp. Immutable once constructed, so it can be
+// shared by any number of threads, and a process can hold several, eg one for each of several
+// dbs of the same type of pw.
+template <pw_type PwType>
+class table_of_contents {
+public:
+  // Loads the toc of db_filename, and its fences if wanted, from the db if they are embedded in
+  // it, or from its up to date sidecar files. Either way they are mapped and used in place. Else
+  // they are built, and saved, on `threads` threads, 0 = auto.
+  table_of_contents(std::filesystem::path db_filename, unsigned bits, bool fences = false,
+                    unsigned threads = 0);
+
+  // the [first, last) record positions of the "chapter" which would contain the needle, narrowed
+  // to a single page by the fences, if they were loaded
+  [[nodiscard]] std::pair<std::size_t, std::size_t> chapter(const PwType& needle,
+                                                            std::size_t   db_size) const;
+
+  // prefault, lock and/or huge page back the toc, as per opts. Huge pages need a private copy.
+  // Not thread safe, so call before sharing.
+  flat_file::residency_report make_resident(const flat_file::residency_options& opts);
+
+  [[nodiscard]] unsigned bits() const { return bits_; }
+  [[nodiscard]] bool     has_fences() const { return !fences_.view().empty(); }
+  [[nodiscard]] bool     mapped() const { return table_.words().mapped(); } // ie not a copy
+
+  // the entries, only for inspection
+  [[nodiscard]] const details::toc_table& table() const { return table_; }
+
+private:
+  std::filesystem::path db_filename_;
+  unsigned              bits_;
+  details::toc_table    table_;
+  details::word_array   fences_;
+
+  bool load_embedded(bool with_fences);
+};
+
+// build the toc, and the fences if requested, as sections to embed in the db when sealing it
 template <pw_type PwType>
-void toc_build(const std::filesystem::path& db_filename, unsigned bits);
+std::vector<flat_file::container_section> toc_sections(const std::filesystem::path& db_filename,
+                                                       unsigned bits, bool fences = false,
+                                                       unsigned threads = 0);
 
+// Builds the toc, and the fences if wanted, of a db from its records as they are written, in
+// order, see indexing_writer. So a freshly written db is ready for --toc without a scan.
 template <pw_type PwType>
-std::optional<PwType> toc_search(flat_file::database<PwType>& db, const PwType& needle,
-                                 unsigned bits);
+class toc_indexer {
+public:
+  explicit toc_indexer(unsigned bits, bool fences = false) : bits_(bits), fences_(fences) {}
+
+  void add(const PwType& pw);
+
+  // Save the toc file, and the fences file, of the db which was written, and is now complete, as
+  // table_of_contents would. If the records were not sorted by hash, or had a gap, nothing is
+  // saved, with a warning, and false returned.
+  bool save(const std::filesystem::path& db_filename);
+
+private:
+  unsigned             bits_;
+  bool                 fences_;
+  details::toc_builder toc_;
+  details::word_vector fence_keys_;
+  std::size_t          pos_  = 0;
+  std::size_t          file_ = 0;
+  std::string          error_; // why the records cannot be indexed
+};
+
+// Decorates a sequential writer of PwType records, eg flat_file::stream_writer or
+// striped_writer, to also pass them to a toc_indexer, unless toc_bits is 0. finish() then
+// completes the db and saves the toc next to it, with no extra i/o.
+template <pw_type PwType, typename Writer>
+class indexing_writer {
+public:
+  indexing_writer(Writer& writer, unsigned toc_bits, bool fences = false) : writer_(writer) {
+    if (toc_bits != 0) indexer_.emplace(toc_bits, fences);
+  }
+
+  void write(const PwType& pw) {
+    writer_.write(pw);
+    if (indexer_) indexer_->add(pw);
+  }
+
+  // flush, or close, the writer, and then save the index of db_filename, eg a striped db's
+  // manifest. Returns false if an index was wanted, but not saved.
+  bool finish(const std::filesystem::path& db_filename) {
+    if constexpr (requires { writer_.close(); }) {
+      writer_.close();
+    } else {
+      writer_.flush(true);
+    }
+    return !indexer_ || indexer_->save(db_filename);
+  }
+
+private:
+  Writer&                            writer_;
+  std::optional<toc_indexer<PwType>> indexer_;
+};
+
+// Search the records [first, last) of the db, eg a chapter, after reading all of them with one
+// positional read into a per thread buffer. The comparisons in memory then use the SIMD arrcmp.
+// DbTypes without read(pos, nrecs, dest), eg flat_file::mmap_database, are searched in place.
+template <pw_type PwType, typename DbType>
+std::optional<PwType> toc_search_span(DbType& db, const PwType& needle, std::size_t first,
+                                      std::size_t last) {
+  if constexpr (requires(PwType* dest) { db.read(first, last - first, dest); }) {
+    thread_local std::vector<PwType> span;
+    span.resize(last - first);
+    if (first != last) db.read(first, last - first, span.data());
+    if (auto iter = std::lower_bound(span.begin(), span.end(), needle);
+        iter != span.end() && *iter == needle) {
+      return *iter; // found!
+    }
+    return {}; // not found;
+  } else {
+    auto begin = db.begin();
+    if (auto iter = std::lower_bound(begin + first, begin + last, needle);
+        iter != begin + last && *iter == needle) {
+      return *iter; // found!
+    }
+    return {}; // not found;
+  }
+}
+
+// DbType can be any of the flat_file databases, eg flat_file::database or
+// flat_file::mmap_database
+template <pw_type PwType, typename DbType>
+std::optional<PwType> toc_search(DbType& db, const table_of_contents<PwType>& toc,
+                                 const PwType& needle, toc_read mode = toc_read::probe) {
+  const auto [first, last] = toc.chapter(needle, db.number_records());
+
+  if (mode == toc_read::chapter) return toc_search_span(db, needle, first, last);
+
+  auto begin = db.begin();
+  if (auto iter = std::lower_bound(begin + first, begin + last, needle);
+      iter != begin + last && *iter == needle) {
+    return *iter; // found!
+  }
+  return {}; // not found;
+}
 
 } // namespace hibp
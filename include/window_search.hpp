@@ -0,0 +1,34 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace hibp {
+
+// An index which narrows the search for a needle to a window of the records of the db it was
+// constructed from, eg hibp::stree, hibp::mphf or hibp::rmi
+template <typename IndexType, typename PwType>
+concept window_index = requires(const IndexType& index, const PwType& needle, std::size_t size) {
+  { index.window(needle, size) } -> std::same_as<std::pair<std::size_t, std::size_t>>;
+};
+
+// Search the window of the db which the index gives for the needle. The index must be that of
+// this db. DbType can be any of the flat_file databases, eg flat_file::database or
+// flat_file::mmap_database
+template <pw_type PwType, window_index<PwType> IndexType, typename DbType>
+std::optional<PwType> window_search(DbType& db, const IndexType& index, const PwType& needle) {
+  const auto [first, last] = index.window(needle, db.number_records());
+
+  auto begin = db.begin();
+  if (auto iter = std::lower_bound(begin + first, begin + last, needle);
+      iter != begin + last && *iter == needle) {
+    return *iter; // found!
+  }
+  return {}; // not found;
+}
+
+} // namespace hibp
@@ -2,12 +2,15 @@
 #include "flat_file.hpp"
 #include "hibp.hpp"
 #include <algorithm>
+#include <cstddef>
 #include <filesystem>
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
 #include <iostream>
 #include <stdexcept>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 
 namespace hibp::diffutils {
 
@@ -25,58 +28,96 @@ struct hunk {
   }
 };
 
+namespace {
+
+// the first positions, from old_pos and new_pos respectively, at which the dbs differ, or at
+// which either ends. Compares a large span of each at a time.
+template <hibp::pw_type PwType, typename Equals>
+std::pair<std::size_t, std::size_t>
+mismatch_from(flat_file::readahead_reader<PwType>& old_reader, std::size_t old_pos,
+              flat_file::readahead_reader<PwType>& new_reader, std::size_t new_pos, Equals equals) {
+  while (true) {
+    old_reader.seek(old_pos);
+    new_reader.seek(new_pos);
+    const auto old_span = old_reader.next();
+    const auto new_span = new_reader.next();
+    const auto common   = std::min(old_span.size(), new_span.size());
+    if (common == 0) return {old_pos, new_pos};
+
+    const auto [old_iter, new_iter] =
+        std::mismatch(old_span.begin(), old_span.begin() + static_cast<std::ptrdiff_t>(common),
+                      new_span.begin(), equals);
+    const auto same = static_cast<std::size_t>(old_iter - old_span.begin());
+    old_pos += same;
+    new_pos += same;
+    if (same != common) return {old_pos, new_pos};
+  }
+}
+
+} // namespace
+
 template <hibp::pw_type PwType>
 void run_diff(const std::filesystem::path& old_path, const std::filesystem::path& new_path,
               std::ostream& diff) {
-  flat_file::database<PwType> db_old(old_path, (1U << 16U) / sizeof(PwType));
-  flat_file::database<PwType> db_new(new_path, (1U << 16U) / sizeof(PwType));
+  flat_file::database<PwType> db_old(old_path);
+  flat_file::database<PwType> db_new(new_path);
+
+  const std::size_t old_size = db_old.number_records();
+  const std::size_t new_size = db_new.number_records();
 
-  auto old_begin   = db_old.begin();
-  auto new_begin   = db_new.begin();
-  auto deep_equals = [](const PwType& a, const PwType& b) { return a == b && a.count == b.count; };
+  // almost all records are the same, so these scan the dbs, with read ahead. get_record is only
+  // for the diffs. A one-shot scan, so with drop-behind.
+  using reader_type = flat_file::readahead_reader<PwType>;
+  reader_type old_reader(old_path, 0, old_size, reader_type::default_span_size,
+                         reader_type::default_buffers, flat_file::access_advice::once);
+  reader_type new_reader(new_path, 0, new_size, reader_type::default_span_size,
+                         reader_type::default_buffers, flat_file::access_advice::once);
+
+  std::size_t old_pos     = 0;
+  std::size_t new_pos     = 0;
+  auto        deep_equals = [](const PwType& a, const PwType& b) {
+    return a == b && a.count == b.count;
+  };
   while (true) {
-    auto [diff_iter_old, diff_iter_new] =
-        std::mismatch(old_begin, db_old.end(), new_begin, db_new.end(), deep_equals);
+    std::tie(old_pos, new_pos) =
+        mismatch_from(old_reader, old_pos, new_reader, new_pos, deep_equals);
 
-    if (diff_iter_old == db_old.end()) {
+    if (old_pos == old_size) {
       // OLD was shorter..
       // copy rest of new into diff as inserts
-      while (diff_iter_new != db_new.end()) {
-        const hunk h{hunk_type::insert, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                     *diff_iter_new};
-        diff << h << '\n';
-
-        ++diff_iter_new;
+      new_reader.seek(new_pos);
+      for (auto span = new_reader.next(); !span.empty(); span = new_reader.next()) {
+        for (const auto& pw: span) {
+          const hunk h{hunk_type::insert, static_cast<unsigned>(old_pos), pw};
+          diff << h << '\n';
+        }
       }
       break;
     }
-    if (diff_iter_new == db_new.end()) { // protect against deref of end()
+    if (new_pos == new_size) { // protect against reading beyond the end
       throw std::runtime_error("NEW was shorter");
     }
-    // fine to dereference both
+    // fine to read both
+    const PwType old_pw = db_old.get_record(old_pos);
+    const PwType new_pw = db_new.get_record(new_pos);
 
-    if (std::next(diff_iter_old) != db_old.end() &&
-        deep_equals(*std::next(diff_iter_old), *diff_iter_new)) {
+    if (old_pos + 1 != old_size && deep_equals(db_old.get_record(old_pos + 1), new_pw)) {
       throw std::runtime_error("Deletion from OLD");
     }
-    // fine to dereference std::next(new)
-    if (std::next(diff_iter_new) != db_new.end() &&
-        deep_equals(*diff_iter_old, *std::next(diff_iter_new))) {
-      const hunk h{hunk_type::insert, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                   *diff_iter_new};
+    // fine to read new_pos + 1
+    if (new_pos + 1 != new_size && deep_equals(old_pw, db_new.get_record(new_pos + 1))) {
+      const hunk h{hunk_type::insert, static_cast<unsigned>(old_pos), new_pw};
       diff << h << '\n';
-      old_begin = diff_iter_old;
-      new_begin = diff_iter_new + 1;
+      new_pos += 1;
       continue;
     }
-    if (*diff_iter_old != *diff_iter_new) { // comparing hash only
+    if (old_pw != new_pw) { // comparing hash only
       throw std::runtime_error("Replacement implies deletion");
     }
-    const hunk h{hunk_type::update, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                 *diff_iter_new};
+    const hunk h{hunk_type::update, static_cast<unsigned>(old_pos), new_pw};
     diff << h << '\n';
-    old_begin = diff_iter_old + 1;
-    new_begin = diff_iter_new + 1;
+    old_pos += 1;
+    new_pos += 1;
   }
 }
 
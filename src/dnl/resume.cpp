@@ -18,6 +18,12 @@ namespace hibp::dnl {
 // utility function for --resume
 template <pw_type PwType>
 std::size_t get_last_prefix(const std::string& filename, bool testing) { // NOLINT static/annon ns
+  // records will be appended, so a container footer of a sealed db would end up in their midst
+  if (const auto container = flat_file::read_container(filename)) {
+    std::cerr << fmt::format("db_file '{}' was sealed, removed its container footer.\n", filename);
+    std::filesystem::resize_file(filename, container->data_size());
+  }
+
   auto filesize = std::filesystem::file_size(filename);
   if (auto tailsize = filesize % sizeof(PwType); tailsize != 0) {
     std::cerr << fmt::format("db_file '{}' size was not a multiple of {}, trimmed off {} bytes.\n",
@@ -0,0 +1,377 @@
+#include "mphf.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "packed_ints.hpp"
+#include "sidecar.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hibp {
+
+namespace details {
+
+// Perfect hash index, PTHash style, which maps each 64bit hash prefix in the db to its record
+// position, so that a search reads just that one record.
+//
+// The keys are split into partitions of ~1024 keys each, by ranges of key value. Because the db
+// is sorted, each partition is a contiguous range of records, so positions only need enough bits
+// for an offset within the partition. Each partition has its own table of slots, and its keys
+// are hashed into ~keys/4 buckets, skewed so that 60% of keys land in 30% of buckets. Buckets
+// are placed largest first: each searches for the smallest "pilot" which sends all its keys
+// to free slots, and only the pilot is stored, ~3 bits per key. Each slot then stores the
+// record position of its key.
+//
+// It is not quite minimal: 3% of slots are left empty, which makes the build much faster, and
+// costs less than remapping them would, as every slot stores a position anyway.
+class mphf_index {
+public:
+  static constexpr std::size_t partition_keys = 1024; // on average
+  static constexpr std::size_t bucket_keys    = 4;    // on average
+  static constexpr double      load_factor    = 0.97;
+  static constexpr std::size_t max_pilot      = std::size_t{1} << 24U;
+
+  mphf_index() = default;
+
+  // pass 1: for the keys in [lo, hi], which is only part of the key space for a partial db
+  mphf_index(std::size_t db_size, std::uint64_t lo, std::uint64_t hi)
+      : db_size_(db_size), lo_(lo) {
+    const auto range_bits = static_cast<unsigned>(std::bit_width(hi - lo));
+    const auto bits       = static_cast<unsigned>(std::bit_width(db_size / partition_keys));
+    // at most 63, as a shift by 64 is undefined: a small db, < 1024 records, of keys which
+    // span half or more of the key space, still has its 1 or 2 partitions
+    shift_ = range_bits > bits ? std::min(range_bits - bits, 63U) : 0;
+    partitions_           = static_cast<std::size_t>((hi - lo) >> shift_) + 1;
+  }
+
+  [[nodiscard]] std::size_t partitions() const { return partitions_; }
+
+  // for keys in [lo, hi]
+  [[nodiscard]] std::size_t partition(std::uint64_t key) const {
+    return static_cast<std::size_t>((key - lo_) >> shift_);
+  }
+
+  // pass 2: allocate the slots, once the size of every partition is known
+  void allocate(const std::vector<std::size_t>& records, const std::vector<std::size_t>& keys,
+                std::size_t max_run) {
+    max_run_ = max_run;
+    rec_start_.assign(partitions() + 1, 0);
+    slot_start_.assign(partitions() + 1, 0);
+    bucket_start_.assign(partitions() + 1, 0);
+    std::size_t max_records = 1;
+    for (std::size_t p = 0; p != partitions(); ++p) {
+      const auto slots = static_cast<std::size_t>(
+          std::ceil(static_cast<double>(keys[p]) / load_factor));
+      rec_start_[p + 1]    = rec_start_[p] + records[p];
+      slot_start_[p + 1]   = slot_start_[p] + slots;
+      bucket_start_[p + 1] = bucket_start_[p] + (keys[p] + bucket_keys - 1) / bucket_keys;
+      max_records          = std::max(max_records, records[p]);
+    }
+    positions_ = packed_ints(slot_start_.back(),
+                             static_cast<unsigned>(std::bit_width(max_records - 1)));
+    unpacked_pilots_.assign(bucket_start_.back(), 0);
+  }
+
+  // place the distinct `keys` of partition p, which start at `offsets` within the partition
+  void build_partition(std::size_t p, const std::vector<std::uint64_t>& keys,
+                       const std::vector<std::size_t>& offsets) {
+    const std::size_t nslots   = slot_start_[p + 1] - slot_start_[p];
+    const std::size_t nbuckets = bucket_start_[p + 1] - bucket_start_[p];
+    if (keys.empty()) return;
+
+    // counting sort of the keys into their buckets
+    std::vector<std::size_t> first(nbuckets + 1, 0);
+    for (const auto key: keys) ++first[bucket(key, nbuckets) + 1];
+    std::partial_sum(first.begin(), first.end(), first.begin());
+    std::vector<std::size_t> members(keys.size());
+    std::vector<std::size_t> fill(first.begin(), first.end() - 1);
+    for (std::size_t i = 0; i != keys.size(); ++i) members[fill[bucket(keys[i], nbuckets)]++] = i;
+
+    std::vector<std::size_t> order(nbuckets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) {
+      return first[lhs + 1] - first[lhs] > first[rhs + 1] - first[rhs];
+    });
+
+    std::vector<bool>        taken(nslots);
+    std::vector<std::size_t> slots;
+    for (const auto b: order) {
+      if (first[b] == first[b + 1]) break; // only empty buckets remain
+      std::size_t pilot = 0;
+      for (;; ++pilot) {
+        if (pilot == max_pilot)
+          throw std::runtime_error(fmt::format("mphf: no pilot found for partition {}", p));
+        slots.clear();
+        for (std::size_t m = first[b]; m != first[b + 1]; ++m) {
+          const std::size_t slot = slot_of(keys[members[m]], pilot, nslots);
+          if (taken[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end()) break;
+          slots.push_back(slot);
+        }
+        if (slots.size() == first[b + 1] - first[b]) break; // all placed
+      }
+      unpacked_pilots_[bucket_start_[p] + b] = pilot;
+      for (std::size_t m = first[b]; m != first[b + 1]; ++m) {
+        const std::size_t slot = slots[m - first[b]];
+        taken[slot]            = true;
+        positions_.set(slot_start_[p] + slot, offsets[members[m]]);
+      }
+    }
+  }
+
+  // pack the pilots, now that the largest is known
+  void finish() {
+    const std::size_t max_pilot_found =
+        std::accumulate(unpacked_pilots_.begin(), unpacked_pilots_.end(), std::size_t{0},
+                        [](std::size_t lhs, std::size_t rhs) { return std::max(lhs, rhs); });
+    pilots_ = packed_ints(unpacked_pilots_.size(),
+                          std::max(1U, static_cast<unsigned>(std::bit_width(max_pilot_found))));
+    for (std::size_t i = 0; i != unpacked_pilots_.size(); ++i) pilots_.set(i, unpacked_pilots_[i]);
+    unpacked_pilots_ = {};
+  }
+
+  // the [first, last) records which would contain a record with this hash prefix
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(std::uint64_t key,
+                                                           std::size_t   db_size) const {
+    if (rec_start_.empty() || db_size != db_size_) return {0, db_size}; // not built
+    if (key < lo_) return {0, 0};
+    if (partition(key) >= partitions_) return {db_size, db_size};
+
+    const std::size_t p      = partition(key);
+    const std::size_t nslots = slot_start_[p + 1] - slot_start_[p];
+    if (nslots == 0) return {rec_start_[p], rec_start_[p]}; // empty partition
+
+    const std::size_t b     = bucket(key, bucket_start_[p + 1] - bucket_start_[p]);
+    const std::size_t slot  = slot_of(key, pilots_.get(bucket_start_[p] + b), nslots);
+    const std::size_t first = rec_start_[p] + positions_.get(slot_start_[p] + slot);
+    return {first, std::min(first + max_run_, rec_start_[p + 1])};
+  }
+
+  [[nodiscard]] std::size_t pilot_bytes() const {
+    return pilots_.words().size() * sizeof(std::uint64_t);
+  }
+  [[nodiscard]] std::size_t position_bytes() const {
+    return positions_.words().size() * sizeof(std::uint64_t);
+  }
+  [[nodiscard]] std::size_t bytes() const {
+    return pilot_bytes() + position_bytes() +
+           (rec_start_.size() + slot_start_.size() + bucket_start_.size()) * sizeof(std::uint64_t);
+  }
+
+  void save(std::ostream& os) const {
+    const std::array<std::uint64_t, 7> header{
+        db_size_, lo_, shift_, partitions_, max_run_, pilots_.width(), positions_.width()};
+    os.write(reinterpret_cast<const char*>(header.data()), sizeof(header)); // NOLINT reincast
+    write_vector(os, rec_start_);
+    write_vector(os, slot_start_);
+    write_vector(os, bucket_start_);
+    write_vector(os, pilots_.words());
+    write_vector(os, positions_.words());
+  }
+
+  // false if the sidecar is truncated, or otherwise unusable, so it will be rebuilt
+  bool load(std::istream& is) {
+    std::array<std::uint64_t, 7> header{};
+    is.read(reinterpret_cast<char*>(header.data()), sizeof(header)); // NOLINT reincast
+    if (!is || header[2] > 63 || header[5] > 64 || header[6] > 64) return false;
+    db_size_    = static_cast<std::size_t>(header[0]);
+    lo_         = header[1];
+    shift_      = static_cast<unsigned>(header[2]);
+    partitions_ = static_cast<std::size_t>(header[3]);
+    max_run_    = static_cast<std::size_t>(header[4]);
+    pilots_     = packed_ints(0, static_cast<unsigned>(header[5]));
+    positions_  = packed_ints(0, static_cast<unsigned>(header[6]));
+    read_vector(is, rec_start_);
+    read_vector(is, slot_start_);
+    read_vector(is, bucket_start_);
+    read_vector(is, pilots_.words());
+    read_vector(is, positions_.words());
+    return is && rec_start_.size() == partitions() + 1 && slot_start_.size() == partitions() + 1 &&
+           bucket_start_.size() == partitions() + 1 &&
+           covers(pilots_, static_cast<std::size_t>(bucket_start_.back())) &&
+           covers(positions_, static_cast<std::size_t>(slot_start_.back()));
+  }
+
+  [[nodiscard]] std::size_t db_size() const { return db_size_; }
+  [[nodiscard]] std::size_t max_run() const { return max_run_; }
+
+private:
+  static constexpr std::uint64_t bucket_seed    = 0x9E3779B97F4A7C15ULL;
+  static constexpr std::uint64_t slot_seed      = 0xC2B2AE3D27D4EB4FULL;
+  static constexpr std::uint64_t pilot_seed     = 0x165667B19E3779F9ULL;
+  static constexpr std::uint64_t skew_threshold = 0x9999999999999999ULL; // 60% of 2^64
+
+  std::size_t                db_size_    = 0;
+  std::uint64_t              lo_         = 0; // the first key
+  unsigned                   shift_      = 0; // partition = (key - lo) >> shift
+  std::size_t                partitions_ = 0;
+  std::size_t                max_run_    = 1; // most records sharing one prefix, usually 1
+  std::vector<std::uint64_t> rec_start_;       // first record of each partition
+  std::vector<std::uint64_t> slot_start_;      // first slot of each partition
+  std::vector<std::uint64_t> bucket_start_;    // first bucket of each partition
+  packed_ints                pilots_;          // one per bucket
+  packed_ints                positions_;       // one per slot: the offset within the partition
+  std::vector<std::size_t>   unpacked_pilots_; // during the build
+
+  // splitmix64 finaliser
+  static constexpr std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 30U;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27U;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31U;
+    return x;
+  }
+
+  static std::size_t bucket(std::uint64_t key, std::size_t nbuckets) {
+    const std::uint64_t hash  = mix(key ^ bucket_seed);
+    const std::size_t   dense = std::max<std::size_t>(1, nbuckets * 3 / 10);
+    if (dense == nbuckets || hash < skew_threshold) return hash % dense;
+    return dense + hash % (nbuckets - dense);
+  }
+
+  // the packed ints have the words for at least `size` entries, as the packed_ints ctor
+  // allocates, without overflow for a corrupt size
+  static bool covers(const packed_ints& ints, std::size_t size) {
+    const std::size_t words = ints.words().size();
+    return words != 0 && (ints.width() == 0 || size <= (words - 1) * 64 / ints.width());
+  }
+
+  static std::size_t slot_of(std::uint64_t key, std::size_t pilot, std::size_t nslots) {
+    return (mix(key ^ slot_seed) ^ mix(pilot ^ pilot_seed)) % nslots;
+  }
+};
+
+template <pw_type PwType>
+mphf_index build_mphf(const std::filesystem::path& db_path) {
+  // big buffer for a one-shot sequential read
+  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType),
+                                 flat_file::access_advice::once);
+
+  const std::size_t db_size = db.number_records();
+  mphf_index        index(db_size, db_size == 0 ? 0 : hash_prefix(db.get_record(0)),
+                          db_size == 0 ? 0 : hash_prefix(db.back()));
+
+  // pass 1: size the partitions
+  std::vector<std::size_t> records(index.partitions(), 0);
+  std::vector<std::size_t> keys(index.partitions(), 0);
+  std::size_t              max_run = 1;
+  std::size_t              run     = 0;
+  std::uint64_t            prev    = 0;
+  for (std::size_t pos = 0; const auto& pw: db) {
+    const std::uint64_t key = hash_prefix(pw);
+    if (pos != 0 && key < prev)
+      throw std::runtime_error(
+          fmt::format("mphf: db {} is not sorted, at record {}", db_path, pos));
+    const std::size_t p = index.partition(key);
+    ++records[p];
+    if (pos == 0 || key != prev) {
+      ++keys[p];
+      run = 0;
+    }
+    max_run = std::max(max_run, ++run);
+    prev    = key;
+    ++pos;
+  }
+  index.allocate(records, keys, max_run);
+
+  // pass 2: place the keys of each partition
+  auto                       iter = db.begin();
+  std::vector<std::uint64_t> part_keys;
+  std::vector<std::size_t>   offsets;
+  for (std::size_t p = 0; p != index.partitions(); ++p) {
+    part_keys.clear();
+    offsets.clear();
+    for (std::size_t offset = 0; offset != records[p]; ++offset, ++iter) {
+      const std::uint64_t key = hash_prefix(*iter);
+      if (part_keys.empty() || key != part_keys.back()) {
+        part_keys.push_back(key);
+        offsets.push_back(offset);
+      }
+    }
+    index.build_partition(p, part_keys, offsets);
+  }
+  index.finish();
+
+  const auto per_key = [&](std::size_t bytes) {
+    return db_size == 0 ? 0.0 : static_cast<double>(bytes) * 8 / static_cast<double>(db_size);
+  };
+  std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", db_size);
+  std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads without MPHF",
+                           std::ceil(std::log2(db_size)));
+  std::cout << fmt::format("{:30s} {:15d} of ~{} keys\n", "Number of MPHF partitions",
+                           index.partitions(), mphf_index::partition_keys);
+  std::cout << fmt::format("{:30s} {:15.1f} bits per key\n", "MPHF pilots",
+                           per_key(index.pilot_bytes()));
+  std::cout << fmt::format("{:30s} {:15.1f} bits per key\n", "MPHF record positions",
+                           per_key(index.position_bytes()));
+  std::cout << fmt::format("{:30s} {:15.1f}MB consumed\n", "MPHF in total",
+                           static_cast<double>(index.bytes()) / pow(2, 20));
+  std::cout << fmt::format("{:30s} {:15d} per query (max)\n", "Records read with MPHF",
+                           index.max_run());
+  return index;
+}
+
+inline void save_mphf(const mphf_index& index, const std::filesystem::path& mphf_filename,
+                      const std::filesystem::path& db_filename) {
+  std::cout << fmt::format("saving MPHF index: {}\n", mphf_filename);
+  replace_file(mphf_filename, [&](std::ostream& os) { index.save(os); });
+  make_newer(mphf_filename, db_filename);
+}
+
+// nullopt if the file is corrupt or truncated
+inline std::optional<mphf_index> load_mphf(const std::filesystem::path& mphf_filename) {
+  std::cout << fmt::format("loading MPHF index: {}\n", mphf_filename);
+  auto       mphf_stream = std::ifstream(mphf_filename, std::ios_base::binary);
+  mphf_index index;
+  if (!index.load(mphf_stream)) return std::nullopt;
+  return index;
+}
+
+} // namespace details
+
+template <pw_type PwType>
+mphf<PwType>::mphf(const std::filesystem::path& db_filename) {
+
+  const std::string mphf_filename = fmt::format("{}.mphf", db_filename.string());
+  const auto        db_size       = static_cast<std::size_t>(
+      flat_file::data_size<PwType>(db_filename) / sizeof(PwType));
+
+  std::optional<details::mphf_index> index;
+  if (details::is_fresh(mphf_filename, db_filename)) {
+    index = details::load_mphf(mphf_filename);
+  }
+  if (!index || index->db_size() != db_size) {
+    index = details::build_mphf<PwType>(db_filename);
+    details::save_mphf(*index, mphf_filename, db_filename);
+  }
+  index_ = std::make_shared<const details::mphf_index>(std::move(*index));
+}
+
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> mphf<PwType>::window(const PwType& needle,
+                                                         std::size_t   db_size) const {
+  return index_->window(hash_prefix(needle), db_size);
+}
+
+// explicit instantiations for public API
+
+template class mphf<hibp::pawned_pw_sha1>;
+template class mphf<hibp::pawned_pw_ntlm>;
+template class mphf<hibp::pawned_pw_sha1t64>;
+
+} // namespace hibp
@@ -0,0 +1,252 @@
+#include "rmi.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "packed_ints.hpp"
+#include "sidecar.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hibp {
+
+namespace details {
+
+// Recursive model index (RMI): two stages of linear models, from the 64bit hash prefix to the
+// position of its record in the db.
+//
+// The root model is the line through the first and last keys, which picks one of `leaves`
+// second stage models. Each of those is a least squares fit to the positions of the keys which
+// the root sends to it, with the min and max error of that fit stored alongside. So a lookup
+// evaluates two linear functions, in RAM, and then searches only the window of records within
+// those error bounds. The hashes are uniformly distributed, so each leaf is nearly linear:
+// 4096 leaves, ie 128KB, typically give windows of a few thousand records for the full db.
+class rmi_index {
+public:
+  static constexpr std::size_t max_leaves = 4096;
+  static constexpr std::size_t min_keys   = 16; // per leaf, for small dbs
+
+  struct leaf_model {
+    double       slope     = 0.0;
+    double       intercept = 0.0;
+    std::int64_t err_lo    = 0; // so position is in [prediction + err_lo, prediction + err_hi]
+    std::int64_t err_hi    = -1;
+  };
+
+  rmi_index() = default;
+
+  rmi_index(std::size_t db_size, std::uint64_t lo, std::uint64_t hi)
+      : db_size_(db_size), lo_(lo), hi_(hi),
+        leaves_(std::clamp<std::size_t>(db_size / min_keys, 1, max_leaves)) {}
+
+  // the leaf which the root model picks for this key, and the key's offset within the leaf,
+  // in [0, 1). Keys must be in [lo, hi].
+  [[nodiscard]] std::pair<std::size_t, double> root(std::uint64_t key) const {
+    const double unit = hi_ == lo_ ? 0.0
+                                   : static_cast<double>(key - lo_) / static_cast<double>(hi_ - lo_);
+    const double scaled = unit * static_cast<double>(leaves_.size());
+    const auto   leaf   = std::min(static_cast<std::size_t>(scaled), leaves_.size() - 1);
+    return {leaf, scaled - static_cast<double>(leaf)};
+  }
+
+  [[nodiscard]] std::int64_t predict(std::size_t leaf, double offset) const {
+    return static_cast<std::int64_t>(
+        std::floor(leaves_[leaf].slope * offset + leaves_[leaf].intercept));
+  }
+
+  // the [first, last) records which would contain a record with this hash prefix
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(std::uint64_t key,
+                                                           std::size_t   db_size) const {
+    if (leaves_.empty() || db_size != db_size_) return {0, db_size}; // not built
+    if (key < lo_) return {0, 0};
+    if (key > hi_) return {db_size, db_size};
+
+    const auto [leaf, offset] = root(key);
+    const std::int64_t pred   = predict(leaf, offset);
+    const auto         size   = static_cast<std::int64_t>(db_size);
+    const std::int64_t first  = std::clamp<std::int64_t>(pred + leaves_[leaf].err_lo, 0, size);
+    const std::int64_t last = std::clamp<std::int64_t>(pred + leaves_[leaf].err_hi + 1, first, size);
+    return {static_cast<std::size_t>(first), static_cast<std::size_t>(last)};
+  }
+
+  [[nodiscard]] std::vector<leaf_model>& leaves() { return leaves_; }
+  [[nodiscard]] std::size_t              db_size() const { return db_size_; }
+  [[nodiscard]] std::size_t bytes() const { return leaves_.size() * sizeof(leaf_model); }
+
+  void save(std::ostream& os) const {
+    const std::array<std::uint64_t, 3> header{db_size_, lo_, hi_};
+    os.write(reinterpret_cast<const char*>(header.data()), sizeof(header)); // NOLINT reincast
+    write_vector(os, leaves_);
+  }
+
+  // false if the sidecar is truncated, or otherwise unusable, so it will be rebuilt
+  bool load(std::istream& is) {
+    std::array<std::uint64_t, 3> header{};
+    is.read(reinterpret_cast<char*>(header.data()), sizeof(header)); // NOLINT reincast
+    db_size_ = static_cast<std::size_t>(header[0]);
+    lo_      = header[1];
+    hi_      = header[2];
+    read_vector(is, leaves_);
+    return is && !leaves_.empty() && leaves_.size() <= max_leaves;
+  }
+
+private:
+  std::size_t             db_size_ = 0;
+  std::uint64_t           lo_      = 0; // the first key
+  std::uint64_t           hi_      = 0; // the last key
+  std::vector<leaf_model> leaves_;
+};
+
+template <pw_type PwType>
+rmi_index build_rmi(const std::filesystem::path& db_path) {
+  // big buffer for a one-shot sequential read
+  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType),
+                                 flat_file::access_advice::once);
+
+  const std::size_t db_size = db.number_records();
+  if (db_size == 0) throw std::runtime_error(fmt::format("rmi: db {} is empty", db_path));
+  rmi_index index(db_size, hash_prefix(db.get_record(0)), hash_prefix(db.back()));
+
+  // pass 1: least squares fit of each leaf, relative to its first record
+  struct sums {
+    double      x   = 0.0;
+    double      y   = 0.0;
+    double      xx  = 0.0;
+    double      xy  = 0.0;
+    std::size_t n   = 0;
+    std::size_t pos = 0; // of the first record
+  };
+  std::vector<sums> fit(index.leaves().size());
+  std::size_t       pos  = 0;
+  std::uint64_t     prev = 0;
+  for (const auto& pw: db) {
+    const std::uint64_t key = hash_prefix(pw);
+    if (pos != 0 && key < prev)
+      throw std::runtime_error(
+          fmt::format("rmi: db {} is not sorted, at record {}", db_path, pos));
+    prev = key;
+
+    const auto [leaf, x] = index.root(key);
+    auto& s              = fit[leaf];
+    if (s.n == 0) s.pos = pos;
+    const auto y = static_cast<double>(pos - s.pos);
+    s.x += x;
+    s.y += y;
+    s.xx += x * x;
+    s.xy += x * y;
+    ++s.n;
+    ++pos;
+  }
+  std::size_t records_before = 0;
+  for (std::size_t leaf = 0; leaf != fit.size(); ++leaf) {
+    const auto& s     = fit[leaf];
+    auto&       model = index.leaves()[leaf];
+    if (s.n == 0) {
+      model.intercept = static_cast<double>(records_before); // empty window
+      continue;
+    }
+    const auto   n     = static_cast<double>(s.n);
+    const double denom = n * s.xx - s.x * s.x;
+    model.slope        = s.n > 1 && denom > 0.0 ? (n * s.xy - s.x * s.y) / denom : 0.0;
+    model.intercept    = (s.y - model.slope * s.x) / n + static_cast<double>(s.pos);
+    records_before     = s.pos + s.n;
+  }
+
+  // pass 2: the error bounds of each leaf
+  for (auto& model: index.leaves()) model = {model.slope, model.intercept, 0, -1};
+  std::vector<bool> seen(index.leaves().size());
+  double            sum_abs_err = 0.0;
+  std::int64_t      max_abs_err = 0;
+  pos                           = 0;
+  for (const auto& pw: db) {
+    const auto [leaf, x]   = index.root(hash_prefix(pw));
+    const std::int64_t err = static_cast<std::int64_t>(pos) - index.predict(leaf, x);
+    auto&              model = index.leaves()[leaf];
+    model.err_lo             = seen[leaf] ? std::min(model.err_lo, err) : err;
+    model.err_hi             = seen[leaf] ? std::max(model.err_hi, err) : err;
+    seen[leaf]               = true;
+    sum_abs_err += static_cast<double>(std::abs(err));
+    max_abs_err = std::max(max_abs_err, std::abs(err));
+    ++pos;
+  }
+
+  std::size_t max_window = 0;
+  for (const auto& model: index.leaves()) {
+    max_window = std::max(max_window, static_cast<std::size_t>(model.err_hi - model.err_lo + 1));
+  }
+  std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", db_size);
+  std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads without RMI",
+                           std::ceil(std::log2(db_size)));
+  std::cout << fmt::format("{:30s} {:15d} ({:.1f}KB consumed)\n", "Number of RMI leaf models",
+                           index.leaves().size(), static_cast<double>(index.bytes()) / 1024);
+  std::cout << fmt::format("{:30s} {:15d} records\n", "RMI max error", max_abs_err);
+  std::cout << fmt::format("{:30s} {:15.1f} records\n", "RMI mean error",
+                           sum_abs_err / static_cast<double>(db_size));
+  std::cout << fmt::format("{:30s} {:15d} records\n", "RMI max window", max_window);
+  std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads with RMI",
+                           std::ceil(std::log2(static_cast<double>(max_window))));
+  return index;
+}
+
+inline void save_rmi(const rmi_index& index, const std::filesystem::path& rmi_filename,
+                     const std::filesystem::path& db_filename) {
+  std::cout << fmt::format("saving RMI index: {}\n", rmi_filename);
+  replace_file(rmi_filename, [&](std::ostream& os) { index.save(os); });
+  make_newer(rmi_filename, db_filename);
+}
+
+// nullopt if the file is corrupt or truncated
+inline std::optional<rmi_index> load_rmi(const std::filesystem::path& rmi_filename) {
+  std::cout << fmt::format("loading RMI index: {}\n", rmi_filename);
+  auto      rmi_stream = std::ifstream(rmi_filename, std::ios_base::binary);
+  rmi_index index;
+  if (!index.load(rmi_stream)) return std::nullopt;
+  return index;
+}
+
+} // namespace details
+
+template <pw_type PwType>
+rmi<PwType>::rmi(const std::filesystem::path& db_filename) {
+
+  const std::string rmi_filename = fmt::format("{}.rmi", db_filename.string());
+  const auto        db_size      = static_cast<std::size_t>(
+      flat_file::data_size<PwType>(db_filename) / sizeof(PwType));
+
+  std::optional<details::rmi_index> index;
+  if (details::is_fresh(rmi_filename, db_filename)) {
+    index = details::load_rmi(rmi_filename);
+  }
+  if (!index || index->db_size() != db_size) {
+    index = details::build_rmi<PwType>(db_filename);
+    details::save_rmi(*index, rmi_filename, db_filename);
+  }
+  index_ = std::make_shared<const details::rmi_index>(std::move(*index));
+}
+
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> rmi<PwType>::window(const PwType& needle,
+                                                        std::size_t   db_size) const {
+  return index_->window(hash_prefix(needle), db_size);
+}
+
+// explicit instantiations for public API
+
+template class rmi<hibp::pawned_pw_sha1>;
+template class rmi<hibp::pawned_pw_ntlm>;
+template class rmi<hibp::pawned_pw_sha1t64>;
+
+} // namespace hibp
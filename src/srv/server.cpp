@@ -2,9 +2,22 @@
 #include "binfuse.hpp"
 #include "binfuse/sharded_filter.hpp"
 #include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/page_cache.hpp"
+#include "flat_file/pread.hpp"
+#include "flat_file/residency.hpp"
+#include "flat_file/striped.hpp"
+#include "flat_file/uring.hpp"
+#include "compressed.hpp"
+#include "delta.hpp"
+#include "elias_fano.hpp"
 #include "hibp.hpp"
+#include "interp.hpp"
+#include "mphf.hpp"
+#include "rmi.hpp"
 #include "ntlm.hpp"
 #include "srv/server.hpp"
+#include "stree.hpp"
 #include "toc.hpp"
 #include <algorithm>
 #include <atomic>
@@ -21,6 +34,7 @@
 #include <sha1.h>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -42,15 +56,101 @@ auto respond(int count, auto req) { // NOLINT copied
   return response.done();
 }
 
+template <typename DbType, typename... Args>
+std::unique_ptr<DbType> make_db(const std::string& db_filename, Args&&... args) {
+  return db_filename.empty() ? std::unique_ptr<DbType>{}
+                             : std::make_unique<DbType>(db_filename, std::forward<Args>(args)...);
+}
+
+template <pw_type PwType>
+const std::string& db_filename_for() {
+  if constexpr (std::is_same_v<PwType, pawned_pw_ntlm>) {
+    return cli.ntlm_db_filename;
+  } else if constexpr (std::is_same_v<PwType, pawned_pw_sha1t64>) {
+    return cli.sha1t64_db_filename;
+  } else {
+    return cli.sha1_db_filename;
+  }
+}
+
+// the delta layer of the db for this type of pw, which is immutable once opened, so a single
+// instance across threads. null without --delta.
+template <pw_type PwType>
+const delta_store<PwType>* delta_db() {
+  static const auto store =
+      make_db<const delta_store<PwType>>(cli.delta ? db_filename_for<PwType>() : std::string{});
+  return store.get();
+}
+
+// the toc of the db for this type of pw, mapped from its file, so shared with any other servers
+// of the db. A single instance across threads. null without --toc.
 template <pw_type PwType>
-auto search_and_respond(flat_file::database<PwType>& db, const PwType& needle, auto req) {
-  std::optional<PwType> maybe_ppw;
+table_of_contents<PwType>* toc_of() {
+  static const auto toc = make_db<table_of_contents<PwType>>(
+      cli.toc ? db_filename_for<PwType>() : std::string{}, cli.toc_bits, cli.toc_fences);
+  return toc.get();
+}
 
-  if (cli.toc) {
-    maybe_ppw = hibp::toc_search(db, needle, cli.toc_bits);
+// the S-tree, minimal perfect hash or RMI of the db for this type of pw, which are immutable, so
+// a single instance across threads. null unless that index is in use.
+template <pw_type PwType>
+const hibp::stree<PwType>* stree_of() {
+  static const auto stree =
+      make_db<const hibp::stree<PwType>>(cli.stree ? db_filename_for<PwType>() : std::string{});
+  return stree.get();
+}
+
+template <pw_type PwType>
+const hibp::mphf<PwType>* mphf_of() {
+  static const auto mphf =
+      make_db<const hibp::mphf<PwType>>(cli.mphf ? db_filename_for<PwType>() : std::string{});
+  return mphf.get();
+}
+
+template <pw_type PwType>
+const hibp::rmi<PwType>* rmi_of() {
+  static const auto rmi = make_db<const hibp::rmi<PwType>>(
+      cli.index == learned_index::rmi ? db_filename_for<PwType>() : std::string{});
+  return rmi.get();
+}
+
+// the [first, last) window of records which would contain the needle, via the index in use
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> index_window(const PwType& needle, std::size_t db_size) {
+  if (cli.toc) return toc_of<PwType>()->chapter(needle, db_size);
+  if (cli.stree) return stree_of<PwType>()->window(needle, db_size);
+  if (cli.mphf) return mphf_of<PwType>()->window(needle, db_size);
+  if (cli.index == hibp::learned_index::rmi) return rmi_of<PwType>()->window(needle, db_size);
+  return {0, db_size};
+}
+
+template <typename DbType>
+auto search_and_respond(DbType& db, const typename DbType::value_type& needle, auto req) {
+  std::optional<typename DbType::value_type> maybe_ppw;
+
+  if (const auto* delta = delta_db<typename DbType::value_type>()) {
+    // local additions take precedence
+    if (auto delta_ppw = delta->find(needle)) {
+      return respond(delta_ppw->count, req); // NOLINT copied
+    }
+  }
+
+  const auto [first, last] = index_window(needle, db.number_records());
+  if constexpr (requires { db.find(needle); }) {
+    // self indexed, eg block compressed
+    maybe_ppw = db.find(needle);
+  } else if constexpr (requires { db.find(needle, first, last); }) {
+    // batched reader: let it search the window
+    maybe_ppw = db.find(needle, first, last);
+  } else if (cli.search == search_strategy::interp) {
+    maybe_ppw = hibp::interp_search(db, needle);
+  } else if (cli.toc && cli.toc_mode == toc_read::chapter) {
+    // the whole chapter in one read
+    maybe_ppw = hibp::toc_search_span(db, needle, first, last);
   } else {
-    auto iter = std::lower_bound(db.begin(), db.end(), needle);
-    if (iter != db.end() && *iter == needle) {
+    auto begin = db.begin();
+    if (auto iter = std::lower_bound(begin + first, begin + last, needle);
+        iter != begin + last && *iter == needle) {
       maybe_ppw = *iter;
     }
   }
@@ -77,9 +177,9 @@ void uniqefy_plain(std::string& plain_password) {
   }
 }
 
-template <pw_type PwType>
-auto handle_plain_search(flat_file::database<PwType>& sha1_db, std::string plain_password,
-                         auto req) {
+template <typename DbType>
+auto handle_plain_search(DbType& db, std::string plain_password, auto req) {
+  using PwType = typename DbType::value_type;
   uniqefy_plain(plain_password);
 
   PwType needle;
@@ -89,7 +189,7 @@ auto handle_plain_search(flat_file::database<PwType>& sha1_db, std::string plain
     // note that sha1t64 can also be constructed from sha1 text hash
     needle = PwType{SHA1{}(plain_password)};
   }
-  return search_and_respond<PwType>(sha1_db, needle, req); // NOLINT copied
+  return search_and_respond(db, needle, req); // NOLINT copied
 }
 
 template <hibp::binfuse_filter_source_type FilterType>
@@ -119,14 +219,104 @@ auto handle_hash_filter_search(FilterType& filter, const std::string& password,
   return handle_filter_search(filter, needle, req);
 }
 
-template <pw_type PwType>
-auto handle_hash_search(flat_file::database<PwType>& db, const std::string& password, auto req) { // NOLINT copied
+template <typename DbType>
+auto handle_hash_search(DbType& db, const std::string& password, auto req) { // NOLINT copied
+  using PwType = typename DbType::value_type;
 
   if (!is_valid_hash<PwType>(password)) {
     return bad_request("Invalid hash provided. Check type of hash.", req);
   }
   const PwType needle{password};
-  return search_and_respond<PwType>(db, needle, req);
+  return search_and_respond(db, needle, req);
+}
+
+// Sources which are shared by all threads as a single instance. Opened on first use, which is
+// before serving when residency options were given, so they can be prefaulted and locked.
+template <hibp::binfuse_filter_source_type FilterType>
+auto& shared_filter(const std::string& filter_filename) {
+  static auto filter = make_db<FilterType>(filter_filename);
+  return filter;
+}
+
+// read-only mappings are thread safe: single instance across threads per db file
+template <pw_type PwType>
+auto& mapped_db(const std::string& db_filename) {
+  static auto db = make_db<flat_file::mmap_database<PwType>>(db_filename);
+  return db;
+}
+
+// block compressed dbs only use positional reads, so are also thread safe
+template <pw_type PwType>
+auto& compressed_db(const std::string& db_filename) {
+  static auto db = make_db<const compressed_database<PwType>>(db_filename);
+  return db;
+}
+
+// the Elias-Fano coded sha1t64 db is immutable and in RAM, so is also thread safe
+auto& elias_fano_db(const std::string& db_filename) {
+  static auto db = make_db<const elias_fano_database>(db_filename);
+  return db;
+}
+
+// a per thread reader, eg a cursor, onto a shared db handle. null if there is no db.
+template <typename ReaderType, typename SharedDbType, typename... Args>
+std::unique_ptr<ReaderType> make_reader(const std::unique_ptr<SharedDbType>& db, Args&&... args) {
+  return db ? std::make_unique<ReaderType>(*db, std::forward<Args>(args)...)
+            : std::unique_ptr<ReaderType>{};
+}
+
+// route a request to the db or filter for its format. Sources which were not supplied are null.
+// NOLINTNEXTLINE cognitive complexity
+auto dispatch(auto* sha1_db, auto* ntlm_db, auto* sha1t64_db,
+              binfuse::sharded_filter16_source* binfuse16_filter,
+              binfuse::sharded_filter8_source* binfuse8_filter, std::string_view format,
+              const std::string& password, auto req) {
+  if (format == "plain") {
+    if (sha1_db) {
+      return handle_plain_search(*sha1_db, password, req);
+    }
+    if (ntlm_db) {
+      return handle_plain_search(*ntlm_db, password, req);
+    }
+    if (sha1t64_db) {
+      return handle_plain_search(*sha1t64_db, password, req);
+    }
+    if (binfuse16_filter) {
+      return handle_plain_filter_search(*binfuse16_filter, password, req);
+    }
+    if (binfuse8_filter) {
+      return handle_plain_filter_search(*binfuse8_filter, password, req);
+    }
+    return fail_missing_db_for_format(
+        req, "--sha1-db, --ntlm-db, --sha1t64-db, --binfuse16-filter or --binfuse8-filter, ",
+        "/check/plain");
+  }
+  if (format == "sha1") {
+    if (!sha1_db) return fail_missing_db_for_format(req, "--sha1-db", "/check/sha1");
+    return handle_hash_search(*sha1_db, password, req);
+  }
+  if (format == "ntlm") {
+    if (!ntlm_db) return fail_missing_db_for_format(req, "--ntlm-db", "/check/ntlm");
+    return handle_hash_search(*ntlm_db, password, req);
+  }
+  if (format == "sha1t64") {
+    if (!sha1t64_db) return fail_missing_db_for_format(req, "--sha1t64-db", "/check/sha1t64");
+    return handle_hash_search(*sha1t64_db, password, req);
+  }
+  if (format == "binfuse16") {
+    if (!binfuse16_filter)
+      return fail_missing_db_for_format(req, "--binfuse16-filter", "/check/binfuse16");
+    return handle_hash_filter_search(*binfuse16_filter, password, req);
+  }
+  if (format == "binfuse8") {
+    if (!binfuse8_filter)
+      return fail_missing_db_for_format(req, "--binfuse8-filter", "/check/binfuse8");
+    return handle_hash_filter_search(*binfuse8_filter, password, req);
+  }
+  return req->create_response(restinio::status_not_found())
+      .set_body("Bad format specified.")
+      .connection_close()
+      .done();
 }
 
 // NOLINTNEXTLINE cognitive complexity
@@ -137,85 +327,107 @@ auto get_router(const std::string& sha1_db_filename, const std::string& ntlm_db_
   auto router = std::make_unique<restinio::router::express_router_t<>>();
   router->http_get(R"(/check/:format/:password)", [&](auto req, auto params) { // NOLINT copied + complexity
     try {
-      // unique db object (ie set of buffers and pointers) per thread and per db file supplied
-      using sha1_db_t = flat_file::database<pawned_pw_sha1>;
-      thread_local auto sha1_db =
-          sha1_db_filename.empty()
-              ? std::unique_ptr<sha1_db_t>{}
-              : std::make_unique<sha1_db_t>(sha1_db_filename, 4096 / sizeof(hibp::pawned_pw_sha1));
-
-      using ntlm_db_t = flat_file::database<pawned_pw_ntlm>;
-      thread_local auto ntlm_db =
-          ntlm_db_filename.empty()
-              ? std::unique_ptr<ntlm_db_t>{}
-              : std::make_unique<ntlm_db_t>(ntlm_db_filename, 4096 / sizeof(hibp::pawned_pw_ntlm));
-
-      using sha1t64_db_t = flat_file::database<pawned_pw_sha1t64>;
-      thread_local auto sha1t64_db =
-          sha1t64_db_filename.empty()
-              ? std::unique_ptr<sha1t64_db_t>{}
-              : std::make_unique<sha1t64_db_t>(sha1t64_db_filename,
-                                               4096 / sizeof(hibp::pawned_pw_sha1t64));
-
-      // only single instance across threads for binfuse filters
-      static auto binfuse16_filter =
-          binfuse16_filter_filename.empty()
-              ? std::unique_ptr<binfuse::sharded_filter16_source>{}
-              : std::make_unique<binfuse::sharded_filter16_source>(binfuse16_filter_filename);
-
-      static auto binfuse8_filter =
-          binfuse8_filter_filename.empty()
-              ? std::unique_ptr<binfuse::sharded_filter8_source>{}
-              : std::make_unique<binfuse::sharded_filter8_source>(binfuse8_filter_filename);
+      using binfuse::sharded_filter16_source;
+      using binfuse::sharded_filter8_source;
+      auto* binfuse16 = shared_filter<sharded_filter16_source>(binfuse16_filter_filename).get();
+      auto* binfuse8  = shared_filter<sharded_filter8_source>(binfuse8_filter_filename).get();
 
       const std::string password{params["password"]};
 
-      if (params["format"] == "plain") {
-        if (sha1_db) {
-          return handle_plain_search(*sha1_db, password, req);
-        }
-        if (ntlm_db) {
-          return handle_plain_search(*ntlm_db, password, req);
-        }
-        if (sha1t64_db) {
-          return handle_plain_search(*sha1t64_db, password, req);
-        }
-        if (binfuse16_filter) {
-          return handle_plain_filter_search(*binfuse16_filter, password, req);
-        }
-        if (binfuse8_filter) {
-          return handle_plain_filter_search(*binfuse8_filter, password, req);
-        }
-        return fail_missing_db_for_format(
-            req, "--sha1-db, --ntlm-db, --sha1t64-db, --binfuse16-filter or --binfuse8-filter, ",
-            "/check/plain");
+      if (cli.elias_fano) {
+        // only for sha1t64, see main(), so there are no sha1 or ntlm dbs
+        return dispatch(mapped_db<pawned_pw_sha1>(sha1_db_filename).get(),
+                        mapped_db<pawned_pw_ntlm>(ntlm_db_filename).get(),
+                        elias_fano_db(sha1t64_db_filename).get(), binfuse16, binfuse8,
+                        params["format"], password, req);
       }
-      if (params["format"] == "sha1") {
-        if (!sha1_db) return fail_missing_db_for_format(req, "--sha1-db", "/check/sha1");
-        return handle_hash_search(*sha1_db, password, req);
+
+      if (cli.mmap) {
+        return dispatch(mapped_db<pawned_pw_sha1>(sha1_db_filename).get(),
+                        mapped_db<pawned_pw_ntlm>(ntlm_db_filename).get(),
+                        mapped_db<pawned_pw_sha1t64>(sha1t64_db_filename).get(), binfuse16,
+                        binfuse8, params["format"], password, req);
       }
-      if (params["format"] == "ntlm") {
-        if (!ntlm_db) return fail_missing_db_for_format(req, "--ntlm-db", "/check/ntlm");
-        return handle_hash_search(*ntlm_db, password, req);
+
+      if (cli.compressed) {
+        return dispatch(compressed_db<pawned_pw_sha1>(sha1_db_filename).get(),
+                        compressed_db<pawned_pw_ntlm>(ntlm_db_filename).get(),
+                        compressed_db<pawned_pw_sha1t64>(sha1t64_db_filename).get(), binfuse16,
+                        binfuse8, params["format"], password, req);
       }
-      if (params["format"] == "sha1t64") {
-        if (!sha1t64_db) return fail_missing_db_for_format(req, "--sha1t64-db", "/check/sha1t64");
-        return handle_hash_search(*sha1t64_db, password, req);
+
+      if (cli.cache_mb != 0) {
+        // one page cache, with a fixed budget, shared by all threads and all db files. The
+        // cache holds the pages, so cursors only need to buffer a single record.
+        using sha1_cached_db    = flat_file::cached_database<pawned_pw_sha1>;
+        using ntlm_cached_db    = flat_file::cached_database<pawned_pw_ntlm>;
+        using sha1t64_cached_db = flat_file::cached_database<pawned_pw_sha1t64>;
+        static flat_file::page_cache cache(std::size_t{cli.cache_mb} << 20U);
+        static auto sha1_cached    = make_db<sha1_cached_db>(sha1_db_filename, cache);
+        static auto ntlm_cached    = make_db<ntlm_cached_db>(ntlm_db_filename, cache);
+        static auto sha1t64_cached = make_db<sha1t64_cached_db>(sha1t64_db_filename, cache);
+
+        thread_local auto sha1_db    = make_reader<sha1_cached_db::cursor>(sha1_cached, 1);
+        thread_local auto ntlm_db    = make_reader<ntlm_cached_db::cursor>(ntlm_cached, 1);
+        thread_local auto sha1t64_db = make_reader<sha1t64_cached_db::cursor>(sha1t64_cached, 1);
+
+        return dispatch(sha1_db.get(), ntlm_db.get(), sha1t64_db.get(), binfuse16, binfuse8,
+                        params["format"], password, req);
       }
-      if (params["format"] == "binfuse16") {
-        if (!binfuse16_filter)
-          return fail_missing_db_for_format(req, "--binfuse16-filter", "/check/binfuse16");
-        return handle_hash_filter_search(*binfuse16_filter, password, req);
+
+      if (cli.striped) {
+        // a file handle per stripe across threads, so concurrent queries for different hash
+        // ranges read from different devices at once, and a cursor per thread, as below. Plain
+        // dbs are opened as a single stripe.
+        using flat_file::striped_database;
+        using sha1_striped_db    = striped_database<pawned_pw_sha1>;
+        using ntlm_striped_db    = striped_database<pawned_pw_ntlm>;
+        using sha1t64_striped_db = striped_database<pawned_pw_sha1t64>;
+        static auto sha1_striped    = make_db<sha1_striped_db>(sha1_db_filename);
+        static auto ntlm_striped    = make_db<ntlm_striped_db>(ntlm_db_filename);
+        static auto sha1t64_striped = make_db<sha1t64_striped_db>(sha1t64_db_filename);
+
+        thread_local auto sha1_db = make_reader<sha1_striped_db::cursor>(
+            sha1_striped, 4096 / sizeof(pawned_pw_sha1));
+        thread_local auto ntlm_db = make_reader<ntlm_striped_db::cursor>(
+            ntlm_striped, 4096 / sizeof(pawned_pw_ntlm));
+        thread_local auto sha1t64_db = make_reader<sha1t64_striped_db::cursor>(
+            sha1t64_striped, 4096 / sizeof(pawned_pw_sha1t64));
+
+        return dispatch(sha1_db.get(), ntlm_db.get(), sha1t64_db.get(), binfuse16, binfuse8,
+                        params["format"], password, req);
       }
-      if (params["format"] == "binfuse8") {
-        if (!binfuse8_filter)
-          return fail_missing_db_for_format(req, "--binfuse8-filter", "/check/binfuse8");
-        return handle_hash_filter_search(*binfuse8_filter, password, req);
+
+      // single file handle across threads per db file, and a cursor (ie a read buffer) per
+      // thread and per db file supplied
+      using flat_file::shared_database;
+      static auto sha1_shared    = make_db<shared_database<pawned_pw_sha1>>(sha1_db_filename);
+      static auto ntlm_shared    = make_db<shared_database<pawned_pw_ntlm>>(ntlm_db_filename);
+      static auto sha1t64_shared = make_db<shared_database<pawned_pw_sha1t64>>(sha1t64_db_filename);
+
+      if (cli.io_uring) {
+        // each thread has its own ring(s), so queries never wait on each other's submissions
+        using flat_file::batch_cursor;
+        thread_local auto sha1_db    = make_reader<batch_cursor<pawned_pw_sha1>>(sha1_shared);
+        thread_local auto ntlm_db    = make_reader<batch_cursor<pawned_pw_ntlm>>(ntlm_shared);
+        thread_local auto sha1t64_db = make_reader<batch_cursor<pawned_pw_sha1t64>>(sha1t64_shared);
+
+        return dispatch(sha1_db.get(), ntlm_db.get(), sha1t64_db.get(), binfuse16, binfuse8,
+                        params["format"], password, req);
       }
-      return req->create_response(restinio::status_not_found())
-          .set_body("Bad format specified.")
-          .connection_close()
-          .done();
+
+      using sha1_cursor    = shared_database<pawned_pw_sha1>::cursor;
+      using ntlm_cursor    = shared_database<pawned_pw_ntlm>::cursor;
+      using sha1t64_cursor = shared_database<pawned_pw_sha1t64>::cursor;
+      thread_local auto sha1_db =
+          make_reader<sha1_cursor>(sha1_shared, 4096 / sizeof(pawned_pw_sha1));
+      thread_local auto ntlm_db =
+          make_reader<ntlm_cursor>(ntlm_shared, 4096 / sizeof(pawned_pw_ntlm));
+      thread_local auto sha1t64_db =
+          make_reader<sha1t64_cursor>(sha1t64_shared, 4096 / sizeof(pawned_pw_sha1t64));
+
+      return dispatch(sha1_db.get(), ntlm_db.get(), sha1t64_db.get(), binfuse16, binfuse8,
+                      params["format"], password, req);
     } catch (const std::exception& e) {
       // TODO log error to std::cerr with thread mutex
       return req->create_response(restinio::status_internal_server_error())
@@ -231,6 +443,40 @@ auto get_router(const std::string& sha1_db_filename, const std::string& ntlm_db_
 
   return router;
 }
+
+// open the single instance sources now, rather than on the first request, and prefault, lock
+// and/or huge page back them, as per cli options. Reports time and size for each.
+void make_sources_resident(const flat_file::residency_options& opts) {
+  std::vector<flat_file::residency_report> reports;
+  auto add_db = [&]<typename PwType>(const std::string& db_filename) {
+    if (db_filename.empty()) return;
+    if (cli.toc) reports.push_back(toc_of<PwType>()->make_resident(opts));
+    if (cli.compressed) {
+      reports.push_back(flat_file::make_file_resident(
+          std::filesystem::path(db_filename).filename().string(), db_filename, opts));
+    }
+    if (cli.mmap) {
+      const auto& db = mapped_db<PwType>(db_filename);
+      reports.push_back(flat_file::make_resident(db->filename().filename().string(), db->begin(),
+                                                 db->filesize(), opts));
+    }
+  };
+  add_db.operator()<pawned_pw_sha1>(cli.sha1_db_filename);
+  add_db.operator()<pawned_pw_ntlm>(cli.ntlm_db_filename);
+  add_db.operator()<pawned_pw_sha1t64>(cli.sha1t64_db_filename);
+
+  // binfuse filters don't expose their mappings, so these are found by filename
+  auto add_filter = [&]<typename FilterType>(const std::string& filter_filename) {
+    if (filter_filename.empty()) return;
+    shared_filter<FilterType>(filter_filename); // opens and maps
+    reports.push_back(flat_file::make_file_resident(
+        std::filesystem::path(filter_filename).filename().string(), filter_filename, opts));
+  };
+  add_filter.operator()<binfuse::sharded_filter16_source>(cli.binfuse16_filter_filename);
+  add_filter.operator()<binfuse::sharded_filter8_source>(cli.binfuse8_filter_filename);
+
+  for (const auto& report: reports) std::cout << report.to_string() << "\n";
+}
 } // namespace
 
 void run_server() {
@@ -239,6 +485,31 @@ void run_server() {
     using request_handler_t = restinio::router::express_router_t<>;
   };
 
+  if (const flat_file::residency_options opts{cli.preload, cli.mlock, cli.huge_pages};
+      opts.any()) {
+    make_sources_resident(opts);
+  }
+
+  if (cli.elias_fano) {
+    // build or load it now, rather than on the first request
+    const auto& db = elias_fano_db(cli.sha1t64_db_filename);
+    std::cout << fmt::format("Elias-Fano sha1t64 db: {} records in {:.1f}MB of RAM\n",
+                             db->number_records(),
+                             static_cast<double>(db->bytes()) / (1U << 20U));
+  }
+
+  if (cli.delta) {
+    // open them now, which builds their filters, rather than on the first request
+    auto report = [](const auto* delta, const std::string& db_filename) {
+      if (delta == nullptr) return;
+      std::cout << fmt::format("delta layer of {}: {} records in {} runs\n", db_filename,
+                               delta->number_records(), delta->number_runs());
+    };
+    report(delta_db<pawned_pw_sha1>(), cli.sha1_db_filename);
+    report(delta_db<pawned_pw_ntlm>(), cli.ntlm_db_filename);
+    report(delta_db<pawned_pw_sha1t64>(), cli.sha1t64_db_filename);
+  }
+
   std::string server = fmt::format("http://{}:{}", cli.bind_address, cli.port);
   std::string plain_using;
   if (!cli.sha1_db_filename.empty()) {
@@ -0,0 +1,230 @@
+#include "stree.hpp"
+#include "arrcmp.hpp"
+#include "flat_file.hpp"
+#include "flat_file/residency.hpp"
+#include "hibp.hpp"
+#include "sidecar.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hibp {
+
+namespace details {
+
+// S-tree: a static B+tree, stored in one array, without pointers.
+//
+// The leaves hold the 64bit hash prefix of every `stride`th record of the db, ie the first record
+// in each page of the db. Each node is 8 keys, one cache line, and is searched with a single
+// branchless SIMD compare (arrcmp::count_less). Internal nodes have 9 children and hold the first
+// key of children 1..8. So 1 billion records (6 million leaf keys) need 8 node visits, all in
+// RAM, followed by a search within one page of the db.
+class stree_index {
+public:
+  static constexpr std::size_t   node_keys = 8;
+  static constexpr std::size_t   fanout    = node_keys + 1;
+  static constexpr std::uint64_t pad       = std::numeric_limits<std::uint64_t>::max();
+
+  stree_index() = default;
+
+  stree_index(std::size_t nkeys, std::size_t stride) : nkeys_(nkeys), stride_(stride) {
+    if (nkeys_ == 0) return;
+    layer_nodes_.push_back((nkeys_ + node_keys - 1) / node_keys); // leaves
+    while (layer_nodes_.back() > 1) {
+      layer_nodes_.push_back((layer_nodes_.back() + fanout - 1) / fanout);
+    }
+    // layers are stored from the root down, so the top of the tree shares cache lines & pages
+    std::size_t offset = 0;
+    layer_offset_.resize(layer_nodes_.size());
+    for (std::size_t h = layer_nodes_.size(); h-- != 0;) {
+      layer_offset_[h] = offset;
+      offset += layer_nodes_[h] * node_keys;
+    }
+    nodes_.resize(offset, pad);
+  }
+
+  // fill the tree from the leaf keys
+  void assign(const std::vector<std::uint64_t>& keys) {
+    std::copy(keys.begin(), keys.end(), nodes_.begin() + static_cast<std::ptrdiff_t>(leaves()));
+    std::size_t leaves_per_child = 1; // leaf nodes under each node of layer h - 1
+    for (std::size_t h = 1; h != layer_nodes_.size(); ++h) {
+      for (std::size_t j = 0; j != layer_nodes_[h]; ++j) {
+        for (std::size_t i = 0; i != node_keys; ++i) {
+          const std::size_t first_key = (j * fanout + i + 1) * leaves_per_child * node_keys;
+          nodes_[layer_offset_[h] + j * node_keys + i] = first_key < nkeys_ ? keys[first_key] : pad;
+        }
+      }
+      leaves_per_child *= fanout;
+    }
+  }
+
+  // index of the first leaf key >= needle
+  [[nodiscard]] std::size_t lower_bound(std::uint64_t needle) const {
+    std::size_t j = 0;
+    for (std::size_t h = layer_nodes_.size() - 1; h != 0; --h) {
+      j = j * fanout + arrcmp::count_less<node_keys>(node(h, j), needle);
+    }
+    return j * node_keys + arrcmp::count_less<node_keys>(node(0, j), needle);
+  }
+
+  // the [first, last) records which would contain a record with this hash prefix
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(std::uint64_t prefix,
+                                                           std::size_t   db_size) const {
+    if (nkeys_ == 0) return {0, db_size}; // not built, or empty db
+
+    std::size_t idx = lower_bound(prefix);
+    // record (idx - 1) * stride is < prefix, so the needle must be after it
+    const std::size_t first = idx == 0 ? 0 : (idx - 1) * stride_ + 1;
+    // rarely, the prefix is shared by several records, across sampled keys
+    while (idx < nkeys_ && key(idx) == prefix) ++idx;
+    const std::size_t last = idx >= nkeys_ ? db_size : std::min(idx * stride_, db_size);
+    return {std::min(first, last), last};
+  }
+
+  [[nodiscard]] std::size_t nkeys() const { return nkeys_; }
+  [[nodiscard]] std::size_t height() const { return layer_nodes_.size(); }
+  [[nodiscard]] std::size_t bytes() const { return nodes_.size() * sizeof(std::uint64_t); }
+  [[nodiscard]] std::uint64_t*       data() { return nodes_.data(); }
+  [[nodiscard]] const std::uint64_t* data() const { return nodes_.data(); }
+
+private:
+  std::size_t              nkeys_  = 0;
+  std::size_t              stride_ = 1;
+  std::vector<std::size_t> layer_nodes_; // h = 0 is the leaves
+  std::vector<std::size_t> layer_offset_;
+
+  // page aligned, so every node is cache line aligned, as required by the SIMD loads
+  std::vector<std::uint64_t, flat_file::page_allocator<std::uint64_t>> nodes_;
+
+  [[nodiscard]] std::size_t leaves() const { return layer_offset_[0]; }
+
+  [[nodiscard]] const std::uint64_t* node(std::size_t h, std::size_t j) const {
+    return &nodes_[layer_offset_[h] + j * node_keys];
+  }
+
+  [[nodiscard]] std::uint64_t key(std::size_t idx) const { return nodes_[leaves() + idx]; }
+};
+
+// one leaf key per page of db
+template <pw_type PwType>
+constexpr std::size_t stree_stride = 4096 / sizeof(PwType);
+
+template <pw_type PwType>
+std::size_t stree_keys(std::size_t db_size) {
+  return (db_size + stree_stride<PwType> - 1) / stree_stride<PwType>;
+}
+
+template <pw_type PwType>
+stree_index build(const std::filesystem::path& db_path) {
+  // big buffer for a one-shot sequential read
+  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType),
+                                 flat_file::access_advice::once);
+
+  const std::size_t db_size = db.number_records();
+  const std::size_t nkeys   = stree_keys<PwType>(db_size);
+
+  std::vector<std::uint64_t> keys;
+  keys.reserve(nkeys);
+  for (std::size_t pos = 0; pos < db_size; pos += stree_stride<PwType>) {
+    keys.push_back(hash_prefix(db.get_record(pos)));
+  }
+
+  stree_index index(nkeys, stree_stride<PwType>);
+  index.assign(keys);
+
+  std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", db_size);
+  std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads without S-tree",
+                           std::ceil(std::log2(db_size)));
+  std::cout << fmt::format("{:30s} {:15d} ({:.1f}MB consumed)\n", "Number of S-tree keys", nkeys,
+                           static_cast<double>(index.bytes()) / pow(2, 20));
+  std::cout << fmt::format("{:30s} {:15d} nodes of {} keys per query\n", "S-tree height",
+                           index.height(), stree_index::node_keys);
+  std::cout << fmt::format("{:30s} {:15d} records in db\n", "Each S-tree leaf key covers",
+                           stree_stride<PwType>);
+  return index;
+}
+
+// The sidecar file: a header of magic and db size, then the nodes, as they are in memory
+
+constexpr std::uint64_t stree_magic = 0x3145'4552'5453'4948; // "HISTREE1", little endian
+
+inline void save(const stree_index& index, std::size_t db_size,
+                 const std::filesystem::path& stree_filename,
+                 const std::filesystem::path& db_filename) {
+  std::cout << fmt::format("saving S-tree index: {}\n", stree_filename);
+  replace_file(stree_filename, [&](std::ostream& os) {
+    const std::array<std::uint64_t, 2> header{stree_magic, db_size};
+    os.write(reinterpret_cast<const char*>(header.data()), sizeof(header)); // NOLINT reincast
+    os.write(reinterpret_cast<const char*>(index.data()),                   // NOLINT reincast
+             static_cast<std::streamsize>(index.bytes()));
+  });
+  make_newer(stree_filename, db_filename);
+}
+
+// nullopt if the file is for another db, or is truncated, or longer than expected
+template <pw_type PwType>
+std::optional<stree_index> load(const std::filesystem::path& stree_filename,
+                                std::size_t                  db_size) {
+  std::cout << fmt::format("loading S-tree index: {}\n", stree_filename);
+  auto stree_stream = std::ifstream(stree_filename, std::ios_base::binary);
+
+  std::array<std::uint64_t, 2> header{};
+  stree_stream.read(reinterpret_cast<char*>(header.data()), sizeof(header)); // NOLINT reincast
+  if (!stree_stream || header[0] != stree_magic || header[1] != db_size) return std::nullopt;
+
+  stree_index index(stree_keys<PwType>(db_size), stree_stride<PwType>);
+  stree_stream.read(reinterpret_cast<char*>(index.data()), // NOLINT reincast
+                    static_cast<std::streamsize>(index.bytes()));
+  if (!stree_stream || stree_stream.peek() != std::ifstream::traits_type::eof()) {
+    return std::nullopt;
+  }
+  return index;
+}
+
+} // namespace details
+
+template <pw_type PwType>
+stree<PwType>::stree(const std::filesystem::path& db_filename) {
+
+  const std::string stree_filename = fmt::format("{}.stree", db_filename.string());
+  const auto        db_size        = static_cast<std::size_t>(
+      flat_file::data_size<PwType>(db_filename) / sizeof(PwType));
+
+  std::optional<details::stree_index> index;
+  if (details::is_fresh(stree_filename, db_filename)) {
+    index = details::load<PwType>(stree_filename, db_size);
+  }
+  if (!index) {
+    index = details::build<PwType>(db_filename);
+    details::save(*index, db_size, stree_filename, db_filename);
+  }
+  index_ = std::make_shared<const details::stree_index>(std::move(*index));
+}
+
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> stree<PwType>::window(const PwType& needle,
+                                                          std::size_t   db_size) const {
+  return index_->window(hash_prefix(needle), db_size);
+}
+
+// explicit instantiations for public API
+
+template class stree<hibp::pawned_pw_sha1>;
+template class stree<hibp::pawned_pw_ntlm>;
+template class stree<hibp::pawned_pw_sha1t64>;
+
+} // namespace hibp
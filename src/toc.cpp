@@ -1,127 +1,286 @@
 #include "toc.hpp"
 #include "bytearray_cast.hpp"
 #include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/pread.hpp"
+#include "flat_file/residency.hpp"
+#include "flat_file/striped.hpp"
 #include "hibp.hpp"
+#include "sidecar.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fmt/format.h>
 #include <fmt/std.h> // IWYU pragma: keep
-#include <fstream>
 #include <iostream>
-#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <ostream>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace hibp {
 
 namespace details {
 
-using toc_entry = std::uint32_t; // limited to 4Billion pws. will throw when too big
+// the entries of the toc files and sections of older versions, see load_legacy()
+using legacy_toc_entry = std::uint32_t;
 
-// one instance per type of pw
+// fence pointers: the first 8 bytes of the hash of the first record of every page of the db,
+// of whole records per 4KB page
 template <pw_type PwType>
-std::vector<toc_entry> toc;
+constexpr std::size_t fence_stride = 4096 / sizeof(PwType);
 
+// the leading `bits` of the hash, up to 32
 template <pw_type PwType>
-std::uint32_t pw_to_prefix(const PwType& pw, unsigned bits) {
-  return hibp::bytearray_cast<std::uint32_t>(pw.hash.data()) >>
-         (sizeof(toc_entry) * 8 - bits);
+std::size_t pw_to_prefix(const PwType& pw, unsigned bits) {
+  return static_cast<std::size_t>(hibp::bytearray_cast<std::uint64_t>(pw.hash.data()) >>
+                                  (64 - bits));
 }
 
+struct toc_parts {
+  toc_table  table;
+  word_array fences; // empty, unless built
+};
+
+// every 20 bit prefix, ie every file of the download, must be present in the db
+inline std::runtime_error missing_prefix(std::size_t file) {
+  return std::runtime_error(
+      fmt::format("Missing prefix {:05X}. There must be a gap. Probably corrupt data. "
+                  "Cannot build table of contents",
+                  file));
+}
+
+// the first position in the db whose record's prefix is >= prefix, by binary search
+template <pw_type PwType>
+std::size_t prefix_position(const flat_file::striped_database<PwType>& db, std::size_t prefix,
+                            unsigned bits) {
+  std::size_t first = 0;
+  std::size_t count = db.number_records();
+  while (count != 0) {
+    const std::size_t half = count / 2;
+    PwType            pw;
+    db.read(first + half, 1, &pw);
+    if (pw_to_prefix(pw, bits) < prefix) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  return first;
+}
+
+// the toc, and the fences, of one range of prefixes, and so of records, built by one thread
+struct toc_range {
+  std::size_t first_prefix = 0;
+  std::size_t last_prefix  = 0;
+  std::size_t first        = 0; // [first, last) records
+  std::size_t last         = 0;
+  toc_builder toc;
+  word_vector fences;
+};
+
+// Builds the toc and, optionally, the fences, in one one-shot pass over the db, which may be
+// striped. The prefixes are split into ranges, of whole toc blocks and whole 20 bit files, and
+// each range's records are scanned by their own thread, with their own read ahead, so the build
+// runs at the speed of the disk(s), rather than of one core. The ranges' tocs are then appended.
+// `threads` = 0 is one per core, but at least 64K records each.
 template <pw_type PwType>
-void build(const std::filesystem::path& db_path, unsigned bits) {
-  // big buffer for sequential read
-  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType));
+toc_parts build(const std::filesystem::path& db_path, unsigned bits, bool with_fences,
+                unsigned threads) {
+  const flat_file::striped_database<PwType> db(db_path, flat_file::access_advice::once);
 
-  std::size_t toc_entries = 1UL << bits; // default = 1Mega entries (just like the files)
+  std::size_t toc_entries = std::size_t{1} << bits; // default = 1Mega entries (just like the files)
 
-  auto last_pw_prefix = pw_to_prefix(db.back(), bits);
+  auto last_pw_prefix = pw_to_prefix(db.make_cursor().back(), bits);
   if (last_pw_prefix + 1 < toc_entries) {
     std::cout << fmt::format("Warning: DB is partial, reduced size toc.\n");
     toc_entries = last_pw_prefix + 1;
   }
 
-  const std::size_t db_size = db.number_records();
-  if (db_size > std::numeric_limits<toc_entry>::max()) {
-    throw std::runtime_error(fmt::format("Fatal: ToC value type is too small for this db"));
-  }
+  const std::size_t db_size        = db.number_records();
   const std::size_t toc_entry_size = db_size / toc_entries;
   std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", db_size);
   std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads without ToC",
                            std::ceil(std::log2(db_size)));
   std::cout << fmt::format("{:30s} {:15d}\n", "Number of bits in ToC prefix", bits);
-  std::cout << fmt::format("{:30s} {:15d} ({:.1f}MB consumed)\n", "Number of ToC entries",
-                           toc_entries,
-                           static_cast<double>(toc_entries * sizeof(toc_entry)) / pow(2, 20));
+  std::cout << fmt::format("{:30s} {:15d}\n", "Number of ToC entries", toc_entries);
   std::cout << fmt::format("{:30s} {:15d} records in db (avg)\n", "Each ToC entry covers",
                            toc_entry_size);
   std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads with ToC",
-                           std::ceil(std::log2(toc_entry_size)));
-  toc<PwType>.reserve(toc_entries);
+                           std::ceil(std::log2(std::max<std::size_t>(toc_entry_size, 1))));
+
+  constexpr std::size_t stride = fence_stride<PwType>;
+  const std::size_t     pages  = (db_size + stride - 1) / stride;
+  if (with_fences) {
+    std::cout << fmt::format("{:30s} {:15d} ({:.1f}MB consumed)\n", "Number of fences", pages,
+                             static_cast<double>(pages * sizeof(std::uint64_t)) / pow(2, 20));
+    std::cout << fmt::format("{:30s} {:15d} per query\n", "Max disk reads with fences", 1);
+  }
 
-  toc_entry last_pos = 0;
-  for (std::uint32_t prefix = 0; prefix != toc_entries; prefix++) {
-    auto found_iter = std::find_if(db.begin() + last_pos, db.end(), [=](const PwType& pw) {
-      return pw_to_prefix(pw, bits) == prefix;
-    });
-    if (found_iter == db.end()) {
-      throw std::runtime_error(fmt::format("Missing prefix {:05X}. There must be a gap. Probably "
-                                           "corrupt data. Cannot build table of contents",
-                                           prefix));
-    }
-    last_pos = static_cast<toc_entry>(found_iter - db.begin()); // range checked above
-    toc<PwType>.push_back(last_pos);
-    if (prefix % 1000 == 0) {
-      std::cout << fmt::format("{:30s} {:14.1f}%\r", "Building table of contents",
-                               prefix * 100 / static_cast<double>(toc_entries))
-                << std::flush;
-    }
+  // With more than 20 bits some chapters are empty, and start where the next one does. But
+  // every 20 bit prefix, ie every file of the download, must be present. So each range starts a
+  // file and a toc block, and is checked on its own.
+  const unsigned file_bits = std::min(bits, 20U);
+  const std::size_t align =
+      std::max<std::size_t>(toc_builder::block, std::size_t{1} << (bits - file_bits));
+  if (threads == 0) {
+    constexpr std::size_t min_records = 1UL << 16U;
+    threads = static_cast<unsigned>(std::clamp<std::size_t>(
+        db_size / min_records, 1, std::max(std::thread::hardware_concurrency(), 1U)));
   }
+  const std::size_t per_range =
+      ((toc_entries + threads - 1) / threads + align - 1) / align * align;
+
+  std::vector<toc_range> ranges;
+  for (std::size_t prefix = 0; prefix < toc_entries; prefix += per_range) {
+    toc_range range;
+    range.first_prefix = prefix;
+    range.last_prefix  = std::min(prefix + per_range, toc_entries);
+    range.first        = ranges.empty() ? 0 : ranges.back().last;
+    range.last =
+        range.last_prefix == toc_entries ? db_size : prefix_position(db, range.last_prefix, bits);
+    ranges.push_back(std::move(range));
+  }
+  std::cout << fmt::format("{:30s} {:15d}\n", "Threads building ToC", ranges.size());
+
+  const std::size_t        progress = std::max<std::size_t>(toc_entries / 1000, 1);
+  std::atomic<std::size_t> entries_done{0};
+  std::mutex               cout_mutex;
+
+  auto scan = [&](toc_range& range) {
+    toc_builder&      toc        = range.toc;
+    const std::size_t first_file = range.first_prefix >> (bits - file_bits);
+    const std::size_t last_file  = (range.last_prefix - 1) >> (bits - file_bits);
+
+    // a new chapter starts at each record whose prefix differs from the previous one
+    std::size_t reported     = 0;
+    auto        add_chapters = [&](std::size_t prefix, std::size_t pos) {
+      const std::size_t before = toc.size();
+      while (range.first_prefix + toc.size() <= prefix) toc.push_back(pos);
+      if (before / progress != toc.size() / progress) {
+        const std::size_t done = entries_done += toc.size() - std::exchange(reported, toc.size());
+        const std::lock_guard lock(cout_mutex);
+        std::cout << fmt::format("{:30s} {:14.1f}%\r", "Building table of contents",
+                                 static_cast<double>(done) * 100 /
+                                     static_cast<double>(toc_entries))
+                  << std::flush;
+      }
+    };
+
+    std::size_t pos  = range.first;
+    std::size_t file = first_file;
+    flat_file::for_each_span(db, range.first, range.last, [&](std::span<const PwType> span) {
+      for (const auto& pw: span) {
+        if (const std::size_t pw_file = pw_to_prefix(pw, file_bits); pw_file != file) {
+          if (pw_file != file + 1 || pos == range.first) {
+            throw missing_prefix(pos == range.first ? first_file : file + 1);
+          }
+          file = pw_file;
+        }
+        add_chapters(pw_to_prefix(pw, bits), pos);
+        if (with_fences && pos % stride == 0) range.fences.push_back(hash_prefix(pw));
+        ++pos;
+      }
+    });
+    if (range.first == range.last) throw missing_prefix(first_file);
+    if (file != last_file) throw missing_prefix(file + 1);
+    add_chapters(range.last_prefix - 1, range.last); // trailing empty chapters
+  };
+  flat_file::for_each_range(ranges.size(), static_cast<unsigned>(ranges.size()),
+                            [&](std::size_t idx, std::size_t, std::size_t) { scan(ranges[idx]); });
   std::cout << "\n";
+
+  toc_builder toc;
+  word_vector fences;
+  if (with_fences) fences.reserve(pages);
+  for (auto& range: ranges) {
+    toc.append(std::move(range.toc));
+    fences.insert(fences.end(), range.fences.begin(), range.fences.end());
+  }
+  toc_parts parts{std::move(toc).finish(), word_array(std::move(fences))};
+  std::cout << fmt::format("{:30s} {:15d} bits per entry ({:.1f}MB consumed)\n", "ToC size",
+                           parts.table.width() + 1,
+                           static_cast<double>(parts.table.words().view().size_bytes()) /
+                               pow(2, 20));
+  return parts;
 }
 
-template <pw_type PwType>
-void save(const std::filesystem::path& toc_filename) {
+// the toc file of db_filename
+inline void save(const std::filesystem::path& toc_filename, const toc_table& table,
+                 const std::filesystem::path& db_filename) {
   std::cout << fmt::format("saving table of contents: {}\n", toc_filename);
-  auto toc_stream = std::ofstream(toc_filename, std::ios_base::binary);
-  toc_stream.write(reinterpret_cast<char*>(toc<PwType>.data()), // NOLINT reincast
-                   static_cast<std::streamsize>(sizeof(toc_entry) * toc<PwType>.size()));
+  replace_file(toc_filename, [&](std::ostream& os) { table.write(os); });
+  make_newer(toc_filename, db_filename);
 }
 
-template <pw_type PwType>
-void load(const std::filesystem::path& toc_filename) {
-  std::cout << fmt::format("loading table of contents: {}\n", toc_filename);
-  const auto toc_file_size = static_cast<std::size_t>(std::filesystem::file_size(toc_filename));
-  auto       toc_stream    = std::ifstream(toc_filename, std::ios_base::binary);
-  toc<PwType>              = std::vector<toc_entry>(toc_file_size / sizeof(toc_entry));
-  toc_stream.read(reinterpret_cast<char*>(toc<PwType>.data()), // NOLINT reincast
-                  static_cast<std::streamsize>(toc_file_size));
+inline void save_fences(const std::filesystem::path& fences_filename, const word_array& fences,
+                        const std::filesystem::path& db_filename) {
+  std::cout << fmt::format("saving fences: {}\n", fences_filename);
+  replace_file(fences_filename, [&](std::ostream& os) {
+    os.write(reinterpret_cast<const char*>(fences.view().data()), // NOLINT reincast
+             static_cast<std::streamsize>(fences.view().size_bytes()));
+  });
+  make_newer(fences_filename, db_filename);
 }
 
-template <pw_type PwType>
-std::optional<PwType> search(flat_file::database<PwType>& db, const PwType& needle, unsigned bits) {
-  const std::uint32_t pw_prefix = pw_to_prefix(needle, bits);
+inline std::shared_ptr<const flat_file::impl::mmap_region>
+map_file(const std::filesystem::path& filename) {
+  return std::make_shared<const flat_file::impl::mmap_region>(filename);
+}
 
-  if (pw_prefix >= toc<PwType>.size()) {
-    return {}; // must be partial db & toc, and therefore "not found"
+// the fences file, mapped. nullopt if it does not match the db, so it will be rebuilt.
+template <pw_type PwType>
+std::optional<word_array> load_fences(const std::filesystem::path& fences_filename,
+                                      std::size_t                  db_size) {
+  std::cout << fmt::format("loading fences: {}\n", fences_filename);
+  const auto file_size = static_cast<std::size_t>(std::filesystem::file_size(fences_filename));
+  if (file_size != (db_size + fence_stride<PwType> - 1) / fence_stride<PwType> *
+                       sizeof(std::uint64_t)) {
+    return {};
   }
+  return word_array(map_file(fences_filename), 0, file_size / sizeof(std::uint64_t));
+}
 
-  const std::size_t begin_offset = toc<PwType>[pw_prefix];
-  const std::size_t end_offset =
-      pw_prefix + 1 < toc<PwType>.size() ? toc<PwType>[pw_prefix + 1] : db.number_records();
+// Older versions saved, and embedded, the toc as a plain array of 32bit positions. These are
+// still loaded, but re-encoded, so are a private copy. nullopt if the bytes cannot be such an
+// array for these bits.
+inline std::optional<toc_table> load_legacy(const std::byte* data, std::size_t bytes,
+                                            unsigned bits) {
+  if (bytes % sizeof(legacy_toc_entry) != 0 ||
+      bytes > (std::size_t{1} << bits) * sizeof(legacy_toc_entry)) {
+    return {};
+  }
+  toc_builder toc;
+  for (std::size_t offset = 0; offset != bytes; offset += sizeof(legacy_toc_entry)) {
+    legacy_toc_entry entry{};
+    std::memcpy(&entry, data + offset, sizeof(entry)); // NOLINT ptr arith
+    toc.push_back(entry);
+  }
+  return std::move(toc).finish();
+}
 
-  if (auto iter = std::lower_bound(db.begin() + begin_offset, db.begin() + end_offset, needle);
-      iter != db.end() && *iter == needle) {
-    return *iter; // found!
+// the toc file, mapped. nullopt if it is not a toc for these bits, so it will be rebuilt.
+inline std::optional<toc_table> load(const std::filesystem::path& toc_filename, unsigned bits) {
+  std::cout << fmt::format("loading table of contents: {}\n", toc_filename);
+  const auto region = map_file(toc_filename);
+  if (auto table = toc_table::map(region, 0, region->size())) {
+    if (table->size() > (std::size_t{1} << bits)) return {};
+    return table;
   }
-  return {}; // not found;
+  return load_legacy(region->data(), region->size(), bits);
 }
 
 } // namespace details
@@ -131,54 +290,235 @@ std::optional<PwType> search(flat_file::database<PwType>& db, const PwType& need
 // bit masks the needle's pw_hash to index into a table of db positions
 // effectively the same as selecting one of the published files to download
 // but all in a single file and therefore much lower syscall i/o overhead
+//
+// The table is compactly encoded, see toc_table, so up to 32 bits, and any number of records.
+// The toc file is mapped and used in place, so loading it is instant, and all the processes
+// using a db, eg several servers, share one copy in the page cache.
+//
+// Fences: optionally, and in the same pass, the first 8 bytes of the hash at every 4KB page of
+// the db. These narrow each chapter to the single page which holds the record, so every query
+// is one page read. Saved next to the db as <db>.fences, ~40MB for the full sha1 db, and also
+// mapped.
+//
+// A sealed db may carry both, embedded by toc_sections(), and they are then mapped from there,
+// without any scan, however the db was copied.
+//
+// A striped db has a single toc, of its logical record positions, saved next to its manifest.
 template <pw_type PwType>
-void toc_build(const std::filesystem::path& db_filename, unsigned bits) {
-
-  const std::string toc_filename = fmt::format("{}.{}.toc", db_filename.string(), bits);
+table_of_contents<PwType>::table_of_contents(std::filesystem::path db_filename, unsigned bits,
+                                             bool fences, unsigned threads)
+    : db_filename_(std::move(db_filename)), bits_(bits) {
+  if (load_embedded(fences)) return;
+
+  const std::string toc_filename    = fmt::format("{}.{}.toc", db_filename_.string(), bits);
+  const std::string fences_filename = fmt::format("{}.fences", db_filename_.string());
+
+  auto is_stale = [&](const std::string& filename) {
+    return !details::is_fresh(filename, db_filename_);
+  };
+
+  bool toc_stale = is_stale(toc_filename);
+  if (!toc_stale) {
+    if (auto table = details::load(toc_filename, bits)) {
+      table_ = std::move(*table);
+    } else {
+      toc_stale = true;
+    }
+  }
+  if (!toc_stale && fences && !is_stale(fences_filename)) {
+    const auto db_size = flat_file::striped_database<PwType>(db_filename_).number_records();
+    if (auto loaded = details::load_fences<PwType>(fences_filename, db_size)) {
+      fences_ = std::move(*loaded);
+      return;
+    }
+  }
+  if (toc_stale || fences) {
+    // a private copy, until the next process maps the saved files
+    auto parts = details::build<PwType>(db_filename_, bits, fences, threads);
+    if (toc_stale) {
+      details::save(toc_filename, parts.table, db_filename_);
+      table_ = std::move(parts.table);
+    }
+    if (fences) {
+      details::save_fences(fences_filename, parts.fences, db_filename_);
+      fences_ = std::move(parts.fences);
+    }
+  }
+}
 
-  if (!std::filesystem::exists(toc_filename) || (std::filesystem::last_write_time(toc_filename) <=
-                                                 std::filesystem::last_write_time(db_filename))) {
+// the toc, and the fences if wanted, from the sections embedded in a sealed db, mapped in place.
+// false if it has none for these bits, or they do not match its records, so the sidecar files
+// are used instead.
+template <pw_type PwType>
+bool table_of_contents<PwType>::load_embedded(bool with_fences) {
+  const auto container = flat_file::read_container(db_filename_);
+  if (!container || container->record_size != sizeof(PwType) || container->sort_key != "hash") {
+    return false;
+  }
+  constexpr std::size_t stride         = details::fence_stride<PwType>;
+  const auto*           toc_section    = container->find("ctoc", bits_);
+  const bool            legacy         = toc_section == nullptr;
+  if (legacy) toc_section = container->find("toc", bits_); // embedded by older versions
+  const auto* fences_section = container->find("fences", stride);
+  if (toc_section == nullptr) return false;
+  if (with_fences && (fences_section == nullptr ||
+                      fences_section->bytes != (container->record_count + stride - 1) / stride *
+                                                   sizeof(std::uint64_t))) {
+    return false;
+  }
 
-    details::build<PwType>(db_filename, bits);
-    details::save<PwType>(toc_filename);
-  } else {
-    details::load<PwType>(toc_filename);
+  std::cout << fmt::format("loading table of contents: embedded in {}\n", db_filename_);
+  const auto region = details::map_file(db_filename_); // only the sections' pages are touched
+  const auto offset = static_cast<std::size_t>(toc_section->offset);
+  const auto bytes  = static_cast<std::size_t>(toc_section->bytes);
+  auto table = legacy ? details::load_legacy(region->data() + offset, bytes, bits_) // NOLINT
+                      : details::toc_table::map(region, offset, bytes);
+  if (!table || table->size() > (std::size_t{1} << bits_) ||
+      (!table->empty() && (*table)[table->size() - 1] >= container->record_count)) {
+    return false;
+  }
+  table_ = std::move(*table);
+  if (with_fences) {
+    std::cout << fmt::format("loading fences: embedded in {}\n", db_filename_);
+    fences_ = details::word_array(region, static_cast<std::size_t>(fences_section->offset),
+                                  static_cast<std::size_t>(fences_section->bytes) /
+                                      sizeof(std::uint64_t));
   }
+  return true;
 }
 
 template <pw_type PwType>
-std::optional<PwType> toc_search(flat_file::database<PwType>& db, const PwType& needle,
-                                 unsigned bits) {
+std::pair<std::size_t, std::size_t>
+table_of_contents<PwType>::chapter(const PwType& needle, std::size_t db_size) const {
+  const std::size_t pw_prefix = details::pw_to_prefix(needle, bits_);
 
-  return details::search(db, needle, bits);
+  if (pw_prefix >= table_.size()) {
+    return {db_size, db_size}; // must be partial db & toc, and therefore "not found"
+  }
+
+  const auto        begin_offset = static_cast<std::size_t>(table_[pw_prefix]);
+  const std::size_t end_offset   = pw_prefix + 1 < table_.size()
+                                       ? static_cast<std::size_t>(table_[pw_prefix + 1])
+                                       : db_size;
+
+  const auto fence = fences_.view();
+  if (fence.empty() || begin_offset == end_offset) return {begin_offset, end_offset};
+
+  // narrow the chapter to the pages whose fences bracket the needle, usually just one. The
+  // chapter spans only a handful of pages, so this touches a cache line or two.
+  constexpr std::size_t stride     = details::fence_stride<PwType>;
+  const std::uint64_t   key        = hash_prefix(needle);
+  const std::size_t     first_page = begin_offset / stride;
+  const std::size_t     end_page   = std::min(fence.size(), (end_offset + stride - 1) / stride);
+
+  // pages after first_page whose first key is < key cannot be preceded by the needle
+  const auto lo   = std::lower_bound(fence.begin() + static_cast<std::ptrdiff_t>(first_page) + 1,
+                                     fence.begin() + static_cast<std::ptrdiff_t>(end_page), key);
+  const auto page = static_cast<std::size_t>(lo - fence.begin()) - 1;
+  // and pages whose first key is > key cannot contain it
+  const auto hi = std::upper_bound(lo, fence.begin() + static_cast<std::ptrdiff_t>(end_page), key);
+  const auto end = static_cast<std::size_t>(hi - fence.begin());
+
+  return {std::max(begin_offset, page * stride), std::min(end_offset, end * stride)};
 }
 
-// explicit instantiations for public API
+template <pw_type PwType>
+flat_file::residency_report
+table_of_contents<PwType>::make_resident(const flat_file::residency_options& opts) {
+  auto& words = table_.words();
+  if (words.mapped() ? opts.huge != flat_file::huge_pages::none : opts.huge != words.huge()) {
+    // huge pages must be requested when allocating, so move to a new allocation
+    words.own(opts.huge);
+  }
+  return flat_file::make_resident(fmt::format("toc of {}", db_filename_.filename()),
+                                  words.view().data(), words.view().size_bytes(), opts);
+}
+
+// the same chapters, fences and checks as build(), of one range, from 0, one record at a time
+template <pw_type PwType>
+void toc_indexer<PwType>::add(const PwType& pw) {
+  if (!error_.empty()) return;
+
+  const std::size_t file   = details::pw_to_prefix(pw, std::min(bits_, 20U));
+  const std::size_t prefix = details::pw_to_prefix(pw, bits_);
+  if (file < file_ || prefix + 1 < toc_.size()) {
+    error_ = fmt::format("Record {} is out of order. The db must be sorted by hash", pos_);
+  } else if (file != file_ && (file != file_ + 1 || pos_ == 0)) {
+    error_ = details::missing_prefix(pos_ == 0 ? 0 : file_ + 1).what();
+  }
+  if (!error_.empty()) {
+    toc_        = {}; // release the memory
+    fence_keys_ = {};
+    return;
+  }
+  file_ = file;
+  while (toc_.size() <= prefix) toc_.push_back(pos_);
+  if (fences_ && pos_ % details::fence_stride<PwType> == 0) {
+    fence_keys_.push_back(hash_prefix(pw));
+  }
+  ++pos_;
+}
 
-// sha1
+template <pw_type PwType>
+bool toc_indexer<PwType>::save(const std::filesystem::path& db_filename) {
+  if (error_.empty() && pos_ == 0) error_ = "The db is empty";
+  if (!error_.empty()) {
+    std::cout << fmt::format("Warning: not saving table of contents of {}. {}\n", db_filename,
+                             error_);
+    return false;
+  }
+  const std::string toc_filename = fmt::format("{}.{}.toc", db_filename.string(), bits_);
+  details::save(toc_filename, std::move(toc_).finish(), db_filename);
+  if (fences_) {
+    const std::string fences_filename = fmt::format("{}.fences", db_filename.string());
+    details::save_fences(fences_filename, details::word_array(std::move(fence_keys_)),
+                         db_filename);
+  }
+  return true;
+}
 
-template void toc_build<hibp::pawned_pw_sha1>(const std::filesystem::path& db_filename,
-                                              unsigned                     bits);
+template <pw_type PwType>
+std::vector<flat_file::container_section> toc_sections(const std::filesystem::path& db_filename,
+                                                       unsigned bits, bool fences,
+                                                       unsigned threads) {
+  const auto parts = details::build<PwType>(db_filename, bits, fences, threads);
+
+  std::vector<flat_file::container_section> sections;
+  // "ctoc", the compact toc, as in the toc file. Older versions embedded a "toc" section.
+  std::ostringstream toc_stream;
+  parts.table.write(toc_stream);
+  const std::string toc_bytes = std::move(toc_stream).str();
+  sections.push_back({"ctoc", bits, {toc_bytes.begin(), toc_bytes.end()}});
+  if (fences) {
+    const auto  words = parts.fences.view();
+    const auto* bytes = reinterpret_cast<const char*>(words.data()); // NOLINT reincast
+    sections.push_back({"fences",
+                        details::fence_stride<PwType>,
+                        {bytes, bytes + words.size_bytes()}}); // NOLINT ptr arith
+  }
+  return sections;
+}
 
-template std::optional<hibp::pawned_pw_sha1>
-toc_search<hibp::pawned_pw_sha1>(flat_file::database<hibp::pawned_pw_sha1>& db,
-                                 const hibp::pawned_pw_sha1& needle, unsigned bits);
+// explicit instantiations for public API
 
-// ntlm
+template class table_of_contents<hibp::pawned_pw_sha1>;
+template class table_of_contents<hibp::pawned_pw_ntlm>;
+template class table_of_contents<hibp::pawned_pw_sha1t64>;
 
-template void toc_build<hibp::pawned_pw_ntlm>(const std::filesystem::path& db_filename,
-                                              unsigned                     bits);
+template class toc_indexer<hibp::pawned_pw_sha1>;
+template class toc_indexer<hibp::pawned_pw_ntlm>;
+template class toc_indexer<hibp::pawned_pw_sha1t64>;
 
-template std::optional<hibp::pawned_pw_ntlm>
-toc_search<hibp::pawned_pw_ntlm>(flat_file::database<hibp::pawned_pw_ntlm>& db,
-                                 const hibp::pawned_pw_ntlm& needle, unsigned bits);
+template std::vector<flat_file::container_section>
+toc_sections<hibp::pawned_pw_sha1>(const std::filesystem::path& db_filename, unsigned bits,
+                                   bool fences, unsigned threads);
 
-// sha1t64
-template void toc_build<hibp::pawned_pw_sha1t64>(const std::filesystem::path& db_filename,
-                                                 unsigned                     bits);
+template std::vector<flat_file::container_section>
+toc_sections<hibp::pawned_pw_ntlm>(const std::filesystem::path& db_filename, unsigned bits,
+                                   bool fences, unsigned threads);
 
-template std::optional<hibp::pawned_pw_sha1t64>
-toc_search<hibp::pawned_pw_sha1t64>(flat_file::database<hibp::pawned_pw_sha1t64>& db,
-                                    const hibp::pawned_pw_sha1t64& needle, unsigned bits);
+template std::vector<flat_file::container_section>
+toc_sections<hibp::pawned_pw_sha1t64>(const std::filesystem::path& db_filename, unsigned bits,
+                                      bool fences, unsigned threads);
 
 } // namespace hibp
@@ -0,0 +1,100 @@
+// Not a unit test. Compares the per record cost of a sequential scan through
+// flat_file::database's iterators with the same scan through flat_file::span_reader and through
+// flat_file::readahead_reader.
+//
+// usage: bench_flat_file [db_filename] [repeats]
+//
+// Run it on a db which is in the OS page cache (ie run it twice), so it measures CPU, not disk.
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iostream>
+#include <span>
+#include <string>
+
+namespace {
+
+using PwType = hibp::pawned_pw_sha1;
+
+template <typename Func>
+double ns_per_record(std::size_t records, unsigned repeats, Func func) {
+  using clk        = std::chrono::high_resolution_clock;
+  const auto start = clk::now();
+  for (unsigned i = 0; i != repeats; ++i) func();
+  const std::chrono::duration<double, std::nano> elapsed = clk::now() - start;
+  return elapsed.count() / static_cast<double>(records * repeats);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    const std::filesystem::path db_filename =
+        argc > 1 ? argv[1] : "data/hibp_test.sha1.bin"; // NOLINT pointer arith
+    const unsigned repeats = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 20; // NOLINT
+
+    flat_file::database<PwType> db(db_filename, (1U << 16U) / sizeof(PwType));
+    const std::size_t           records = db.number_records();
+
+    // sum the counts and fold in the leading hash bytes, so neither loop can be optimised away
+    std::uint64_t iter_sum = 0;
+    const double  iter_ns  = ns_per_record(records, repeats, [&] {
+      for (const auto& pw: db) {
+        iter_sum += static_cast<std::uint64_t>(pw.count) ^ static_cast<std::uint8_t>(pw.hash[0]);
+      }
+    });
+
+    std::uint64_t span_sum = 0;
+    const double  span_ns  = ns_per_record(records, repeats, [&] {
+      flat_file::span_reader reader(db);
+      for (auto span = reader.next(); !span.empty(); span = reader.next()) {
+        for (const auto& pw: span) {
+          span_sum += static_cast<std::uint64_t>(pw.count) ^ static_cast<std::uint8_t>(pw.hash[0]);
+        }
+      }
+    });
+
+    std::uint64_t readahead_sum = 0;
+    const double  readahead_ns  = ns_per_record(records, repeats, [&] {
+      flat_file::readahead_reader<PwType> reader(db_filename, 0, records);
+      for (auto span = reader.next(); !span.empty(); span = reader.next()) {
+        for (const auto& pw: span) {
+          readahead_sum +=
+              static_cast<std::uint64_t>(pw.count) ^ static_cast<std::uint8_t>(pw.hash[0]);
+        }
+      }
+    });
+
+    // the cost of just reading the records into memory, which all scans share
+    const double read_ns = ns_per_record(records, repeats, [&] {
+      flat_file::span_reader reader(db);
+      for (auto span = reader.next(); !span.empty(); span = reader.next()) {
+      }
+    });
+
+    if (iter_sum != span_sum || iter_sum != readahead_sum) {
+      std::cerr << fmt::format("checksum mismatch: {} != {} != {}\n", iter_sum, span_sum,
+                               readahead_sum);
+      return EXIT_FAILURE;
+    }
+    std::cout << fmt::format("{:30s} {:15d} records x {} repeats\n", "DB size", records, repeats);
+    std::cout << fmt::format("{:30s} {:15.2f} ns/record\n", "read only", read_ns);
+    std::cout << fmt::format("{:30s} {:15.2f} ns/record ({:.2f} above read)\n",
+                             "const_iterator scan", iter_ns, iter_ns - read_ns);
+    std::cout << fmt::format("{:30s} {:15.2f} ns/record ({:.2f} above read)\n", "span_reader scan",
+                             span_ns, span_ns - read_ns);
+    std::cout << fmt::format("{:30s} {:15.2f} ns/record (read ahead on a 2nd thread)\n",
+                             "readahead_reader scan", readahead_ns);
+  } catch (const std::exception& e) {
+    std::cerr << "something went wrong: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -226,7 +226,7 @@ testSearchPlainSha1Toc() {
     count=$($builddir/hibp-search --toc --toc-bits=$bits $tmpdir/hibp_test.sha1.bin "${plain}" | grep '^found' | cut -d: -f2)
     assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
     toc_size=$(echo $(wc -c $tmpdir/hibp_test.sha1.bin.$bits.toc) | cut -d' ' -f1)
-    correct_toc_size=256
+    correct_toc_size=176
     assertEquals "toc size of ${toc_size} wrong" "${correct_toc_size}" "${toc_size}"
 }
 
@@ -237,7 +237,7 @@ testSearchPlainNtlmToc() {
     count=$($builddir/hibp-search --toc --toc-bits=$bits --ntlm $tmpdir/hibp_test.ntlm.bin "${plain}" | grep '^found' | cut -d: -f2)
     assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
     toc_size=$(echo $(wc -c $tmpdir/hibp_test.ntlm.bin.$bits.toc) | cut -d' ' -f1)
-    correct_toc_size=256
+    correct_toc_size=176
     assertEquals "toc size of ${toc_size} wrong" "${correct_toc_size}" "${toc_size}"
 }
 
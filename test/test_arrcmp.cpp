@@ -1,6 +1,8 @@
 #include "arrcmp.hpp"
 #include "gtest/gtest.h"
+#include <algorithm>
 #include <array>
+#include <compare>
 #include <cstddef>
 #include <string>
 #include <utility>
@@ -65,3 +67,24 @@ void test_set() {
 TEST(arrcmp, arrays) {                         // NOLINT
   test_set<1, 2 * arrcmp::impl::maxvec - 1>(); // TODO auto detect the largest MM register
 }
+
+TEST(arrcmp, unaligned) { // NOLINT
+  // packed 9 byte records, as for sha1t64 with an 8bit count, so most hashes are not aligned
+  constexpr std::size_t               rec_size = 9;
+  std::array<std::byte, 8 * rec_size> buf{};
+  for (std::size_t i = 0; i != buf.size(); ++i) buf[i] = std::byte(i * 37); // NOLINT magic
+
+  for (std::size_t a = 0; a != 8; ++a) {
+    for (std::size_t b = 0; b != 8; ++b) {
+      std::array<std::byte, 8> aa{};
+      std::array<std::byte, 8> bb{};
+      std::copy_n(&buf[a * rec_size], 8, aa.begin());
+      std::copy_n(&buf[b * rec_size], 8, bb.begin());
+      EXPECT_EQ(arrcmp::array_compare<8>(&buf[a * rec_size], &buf[b * rec_size],
+                                         arrcmp::three_way{}),
+                aa <=> bb);
+      EXPECT_EQ(arrcmp::array_compare<8>(&buf[a * rec_size], &buf[b * rec_size], arrcmp::equal{}),
+                aa == bb);
+    }
+  }
+}
@@ -0,0 +1,536 @@
+#include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/page_cache.hpp"
+#include "flat_file/pread.hpp"
+#include "flat_file/residency.hpp"
+#include "flat_file/striped.hpp"
+#include "flat_file/uring.hpp"
+#include "hibp.hpp"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::filesystem::path test_db_path() {
+  return std::filesystem::canonical(std::filesystem::current_path() / "data") /
+         "hibp_test.sha1.bin";
+}
+
+// scratch files are written here, never next to the checked in test db
+std::filesystem::path test_tmp_dir() {
+  return std::filesystem::canonical(std::filesystem::current_path() / "tmp");
+}
+
+} // namespace
+
+TEST(flat_file, shared_database_cursors_across_threads) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::shared_database<PwType> db(test_db_path());
+
+  std::atomic<std::size_t> found{};
+  std::atomic<std::size_t> searched{};
+  flat_file::for_each_range(db.number_records(), 4, [&](std::size_t, std::size_t first,
+                                                        std::size_t last) {
+    auto cursor = db.make_cursor(4096 / sizeof(PwType));
+    auto reader = db.make_cursor(); // separate cursor so the needle stays valid
+
+    std::mt19937_64                            generator{first};
+    std::uniform_int_distribution<std::size_t> distribution(first, last - 1);
+    for (std::size_t i = 0; i != (last - first) / 50; ++i) {
+      const PwType needle = reader.get_record(distribution(generator));
+      auto         iter   = std::lower_bound(cursor.begin(), cursor.end(), needle);
+      if (iter != cursor.end() && *iter == needle && iter->count == needle.count) ++found;
+      ++searched;
+    }
+  });
+  EXPECT_GT(searched, 0);
+  EXPECT_EQ(found, searched);
+}
+
+TEST(flat_file, shared_database_read_matches_database) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::shared_database<PwType> shared(test_db_path());
+  flat_file::database<PwType>              db(test_db_path(), 100);
+
+  ASSERT_EQ(shared.number_records(), db.number_records());
+
+  std::vector<PwType> buf(10);
+  shared.read(shared.number_records() - buf.size(), buf.size(), buf.data());
+  EXPECT_EQ(buf.back(), db.back());
+  EXPECT_EQ(buf.back().count, db.back().count);
+
+  EXPECT_THROW(shared.read(shared.number_records() - 1, 2, buf.data()), std::out_of_range);
+
+  auto cursor = shared.make_cursor();
+  EXPECT_THROW(cursor.get_record(shared.number_records()), std::runtime_error);
+}
+
+TEST(flat_file, database_and_cursor_read_a_span) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::shared_database<PwType> shared(test_db_path());
+  flat_file::database<PwType>              db(test_db_path(), 100);
+  auto                                     cursor = shared.make_cursor(100);
+
+  const PwType first = db.get_record(1000); // fills the buffer
+  std::vector<PwType> span(500);
+  db.read(1000, span.size(), span.data());
+  EXPECT_EQ(span.front(), first);
+  EXPECT_EQ(db.get_record(1000), first); // buffer is unaffected
+
+  std::vector<PwType> cursor_span(span.size());
+  cursor.read(1000, cursor_span.size(), cursor_span.data());
+  EXPECT_TRUE(std::equal(span.begin(), span.end(), cursor_span.begin()));
+  EXPECT_EQ(span.back(), db.get_record(1000 + span.size() - 1));
+
+  EXPECT_THROW(db.read(db.number_records() - 1, 2, span.data()), std::out_of_range);
+}
+
+TEST(flat_file, readahead_reader_matches_database) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  flat_file::database<PwType> db(test_db_path(), 4096 / sizeof(PwType));
+
+  // small spans and only 2 buffers, so the I/O thread is often waiting for the consumer
+  flat_file::readahead_reader<PwType> reader(test_db_path(), 10, db.number_records(), 1000, 2);
+  std::size_t                         pos = 10;
+  for (auto span = reader.next(); !span.empty(); span = reader.next()) {
+    ASSERT_LE(span.size(), 1000U);
+    for (const auto& pw: span) ASSERT_EQ(pw, db.get_record(pos++));
+  }
+  EXPECT_EQ(pos, db.number_records());
+  EXPECT_EQ(reader.pos(), db.number_records());
+
+  // forwards within the buffered spans, backwards, far forwards and beyond the end
+  for (const std::size_t target: {std::size_t{500}, std::size_t{1700}, std::size_t{1701},
+                                  std::size_t{20}, db.number_records() - 3}) {
+    reader.seek(target);
+    const auto span = reader.next();
+    ASSERT_FALSE(span.empty());
+    EXPECT_EQ(span.front(), db.get_record(target));
+    EXPECT_EQ(reader.pos(), target + span.size());
+  }
+  reader.seek(db.number_records() + 10);
+  EXPECT_TRUE(reader.next().empty());
+}
+
+TEST(flat_file, access_advice_once_keeps_data_and_resident_pages) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const auto copy_path = test_tmp_dir() / "advice_copy.sha1.bin";
+  {
+    // one-shot scan and write, both with drop-behind
+    flat_file::database<PwType> db(test_db_path(), 4096 / sizeof(PwType),
+                                   flat_file::access_advice::once);
+    EXPECT_EQ(db.advice(), flat_file::access_advice::once);
+    flat_file::file_writer<PwType> writer(copy_path.string(), flat_file::access_advice::once);
+    for (const auto& pw: db) writer.write(pw);
+  }
+  flat_file::database<PwType> db(test_db_path(), 4096 / sizeof(PwType));
+  ASSERT_EQ(std::filesystem::file_size(copy_path), db.filesize());
+
+  const flat_file::shared_database<PwType> copy(copy_path, flat_file::access_advice::once);
+  std::size_t                              pos = 0;
+  flat_file::for_each_span(copy, 0, copy.number_records(), [&](std::span<const PwType> span) {
+    for (const auto& pw: span) ASSERT_EQ(pw, db.get_record(pos++));
+  });
+  EXPECT_EQ(pos, db.number_records());
+
+  // seeks restart the drop-behind
+  flat_file::readahead_reader<PwType> reader(copy_path, 0, copy.number_records(), 1000, 2,
+                                             flat_file::access_advice::once);
+  for (const std::size_t target: {std::size_t{5000}, std::size_t{20}, db.number_records() - 3}) {
+    reader.seek(target);
+    const auto span = reader.next();
+    ASSERT_FALSE(span.empty());
+    EXPECT_EQ(span.front(), db.get_record(target));
+  }
+
+#ifdef __linux__
+  // pages which were in the page cache before a one-shot scan are still there after it
+  const flat_file::mmap_database<PwType> mapped(test_db_path());
+  const auto                             resident_pages = [&] {
+    const auto  page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> vec((mapped.filesize() + page_size - 1) / page_size);
+    // NOLINTNEXTLINE const_cast, reincast
+    ::mincore(const_cast<PwType*>(mapped.begin()), mapped.filesize(), vec.data());
+    return std::count_if(vec.begin(), vec.end(), [](unsigned char v) { return (v & 1U) != 0; });
+  };
+  for (const auto& pw: mapped) pos += static_cast<std::size_t>(pw.count != 0); // fault them in
+  const auto before = resident_pages();
+  {
+    flat_file::database<PwType> once(test_db_path(), 4096 / sizeof(PwType),
+                                     flat_file::access_advice::once);
+    for (const auto& pw: once) pos += static_cast<std::size_t>(pw.count != 0);
+  }
+  EXPECT_EQ(resident_pages(), before);
+#endif
+  std::filesystem::remove(copy_path);
+}
+
+TEST(flat_file, sealed_container_is_transparent_to_readers) { // NOLINT
+  using PwType      = hibp::pawned_pw_sha1;
+  const auto sealed = test_tmp_dir() / "sealed_copy.sha1.bin";
+  std::filesystem::copy_file(test_db_path(), sealed,
+                             std::filesystem::copy_options::overwrite_existing);
+  EXPECT_FALSE(flat_file::read_container(sealed));
+
+  flat_file::database<PwType> db(test_db_path(), 4096 / sizeof(PwType));
+  flat_file::fingerprinter    whole;
+  flat_file::fingerprinter    in_spans; // the fingerprint does not depend on the span sizes
+  std::vector<PwType>         records(db.begin(), db.end());
+  const std::span<const PwType> all(records);
+  whole.update(all);
+  for (std::size_t pos = 0; pos < all.size(); pos += 7) {
+    in_spans.update(all.subspan(pos, std::min<std::size_t>(7, all.size() - pos)));
+  }
+  EXPECT_EQ(whole.value(), in_spans.value());
+
+  const flat_file::container_metadata metadata{sizeof(PwType), db.number_records(), whole.value(),
+                                               "sha1", "hash"};
+  const std::vector<char>             payload{'a', 'b', 'c'};
+  flat_file::write_container(sealed, metadata, {{"first", 1, payload}, {"second", 2, {}}});
+  flat_file::write_container(sealed, metadata, {{"test", 42, payload}}); // replaces the above
+
+  const auto info = flat_file::read_container(sealed);
+  ASSERT_TRUE(info);
+  EXPECT_EQ(info->record_count, db.number_records());
+  EXPECT_EQ(info->fingerprint, whole.value());
+  EXPECT_EQ(info->format, "sha1");
+  EXPECT_EQ(info->sort_key, "hash");
+  ASSERT_EQ(info->sections.size(), 1);
+  EXPECT_EQ(info->find("test", 1), nullptr);
+  const auto* section = info->find("test", 42);
+  ASSERT_NE(section, nullptr);
+  EXPECT_EQ(section->offset % 4096, 0);
+  std::vector<char> read_back(section->bytes);
+  flat_file::read_section(sealed, *section, read_back.data());
+  EXPECT_EQ(read_back, payload);
+
+  // all the readers see exactly the records
+  EXPECT_GT(std::filesystem::file_size(sealed), db.filesize());
+  flat_file::database<PwType> sealed_db(sealed, 4096 / sizeof(PwType));
+  EXPECT_EQ(sealed_db.number_records(), db.number_records());
+  EXPECT_TRUE(std::equal(sealed_db.begin(), sealed_db.end(), records.begin(), records.end()));
+  EXPECT_EQ(flat_file::shared_database<PwType>(sealed).number_records(), db.number_records());
+  const flat_file::mmap_database<PwType> mapped(sealed);
+  EXPECT_TRUE(std::equal(mapped.begin(), mapped.end(), records.begin(), records.end()));
+  flat_file::readahead_reader<PwType> reader(sealed, 0, std::numeric_limits<std::size_t>::max());
+  std::size_t                         pos = 0;
+  for (auto span = reader.next(); !span.empty(); span = reader.next()) pos += span.size();
+  EXPECT_EQ(pos, db.number_records());
+
+  // but only as their own type of record
+  EXPECT_THROW(flat_file::database<hibp::pawned_pw_ntlm>{sealed}, std::ios::failure);
+  EXPECT_THROW(flat_file::write_container(sealed, {sizeof(PwType), 1, 0, "sha1", ""}, {}),
+               std::runtime_error);
+
+  // a footer of another version, or which does not match the file, is not trusted
+  std::filesystem::resize_file(sealed, std::filesystem::file_size(sealed) + 4096);
+  EXPECT_FALSE(flat_file::read_container(sealed)); // magic no longer at the end: plain file
+  std::filesystem::resize_file(sealed, std::filesystem::file_size(sealed) - 4096);
+  {
+    std::fstream      file(sealed, std::ios::binary | std::ios::in | std::ios::out);
+    const std::size_t version_pos =
+        std::filesystem::file_size(sealed) - sizeof(flat_file::impl::container_footer);
+    file.seekp(static_cast<std::streamoff>(version_pos));
+    file.put(2);
+  }
+  EXPECT_THROW(flat_file::read_container(sealed), std::ios::failure);
+  std::filesystem::remove(sealed);
+}
+
+TEST(flat_file, sealed_fingerprint_detects_changed_record) { // NOLINT
+  using PwType      = hibp::pawned_pw_sha1;
+  const auto sealed = test_tmp_dir() / "fingerprint_copy.sha1.bin";
+  std::filesystem::copy_file(test_db_path(), sealed,
+                             std::filesystem::copy_options::overwrite_existing);
+  EXPECT_FALSE(flat_file::verify_fingerprint<PwType>(sealed)); // plain, so none to verify
+
+  std::size_t db_size = 0;
+  {
+    flat_file::database<PwType> db(sealed, 4096 / sizeof(PwType));
+    db_size = db.number_records();
+    flat_file::write_container(sealed,
+                               {sizeof(PwType), db_size, flat_file::fingerprint(db), "sha1", "hash"},
+                               {{"test", 1, {'a', 'b', 'c'}}});
+  }
+  const auto verified = flat_file::verify_fingerprint<PwType>(sealed);
+  ASSERT_TRUE(verified);
+  EXPECT_TRUE(*verified); // NOLINT unchecked access
+
+  // one bit of the count of one record, in place
+  {
+    std::fstream file(sealed, std::ios::binary | std::ios::in | std::ios::out);
+    const auto   count_pos = (db_size / 2) * sizeof(PwType) + sizeof(PwType) - 1;
+    file.seekg(static_cast<std::streamoff>(count_pos));
+    const auto byte = static_cast<char>(file.get() ^ 0x01);
+    file.seekp(static_cast<std::streamoff>(count_pos));
+    file.put(byte);
+  }
+  const auto corrupted = flat_file::verify_fingerprint<PwType>(sealed);
+  ASSERT_TRUE(corrupted);
+  EXPECT_FALSE(*corrupted); // NOLINT unchecked access
+  std::filesystem::remove(sealed);
+}
+
+TEST(flat_file, striped_database_matches_database) { // NOLINT
+  using PwType        = hibp::pawned_pw_sha1;
+  const auto dir      = test_tmp_dir();
+  const auto manifest = dir / "striped.sha1.bin";
+  std::filesystem::remove(manifest);
+
+  flat_file::database<PwType> db(test_db_path(), 4096 / sizeof(PwType));
+  const std::vector<PwType>   records(db.begin(), db.end());
+
+  // written in reverse and disk sorted into 3 hash range stripes, in 2 chunks
+  const auto reversed = dir / "striped_reversed.sha1.bin";
+  {
+    flat_file::file_writer<PwType> writer(reversed.string());
+    for (auto iter = records.rbegin(); iter != records.rend(); ++iter) writer.write(*iter);
+  }
+  // the test db only holds a few prefixes, so thirds by record, rather than by hash_stripe()
+  const auto thirds = [&](const PwType& pw) -> std::size_t {
+    return pw < records[records.size() / 3] ? 0 : pw < records[records.size() * 2 / 3] ? 1 : 2;
+  };
+  const auto stripe_filenames = flat_file::stripe_filenames(manifest, {dir, dir, dir});
+  {
+    flat_file::striped_writer<PwType> writer(manifest, stripe_filenames, thirds);
+    flat_file::database<PwType>(reversed, 100).disksort_to(writer, {}, {},
+                                                            records.size() / 2 * sizeof(PwType));
+    EXPECT_FALSE(std::filesystem::exists(manifest)); // until close()
+    writer.close();
+  }
+  std::filesystem::remove(reversed);
+  ASSERT_TRUE(flat_file::is_striped(manifest));
+  EXPECT_FALSE(flat_file::is_striped(test_db_path()));
+
+  const flat_file::striped_database<PwType> striped(manifest);
+  ASSERT_EQ(striped.number_records(), records.size());
+  EXPECT_EQ(striped.filesize(), db.filesize());
+  ASSERT_EQ(striped.stripes().size(), 3);
+  std::size_t first = 0;
+  for (const auto& stripe: striped.stripes()) {
+    EXPECT_EQ(stripe.first, first);
+    first = stripe.last;
+  }
+  EXPECT_EQ(striped.stripes()[0].last, records.size() / 3);
+  EXPECT_EQ(striped.stripes()[1].last, records.size() * 2 / 3);
+
+  auto cursor = striped.make_cursor(100);
+  EXPECT_TRUE(std::equal(cursor.begin(), cursor.end(), records.begin(), records.end()));
+  for (std::size_t pos = 0; pos < records.size(); pos += 97) {
+    const auto iter = std::lower_bound(cursor.begin(), cursor.end(), records[pos]);
+    ASSERT_NE(iter, cursor.end());
+    EXPECT_EQ(iter->count, records[pos].count);
+  }
+
+  // a read, and a scan, across stripe boundaries
+  const std::size_t   from = striped.stripes()[0].last - 5;
+  const std::size_t   to   = striped.stripes()[2].first + 5;
+  std::vector<PwType> span(to - from);
+  striped.read(from, span.size(), span.data());
+  EXPECT_TRUE(
+      std::equal(span.begin(), span.end(), records.begin() + static_cast<std::ptrdiff_t>(from)));
+  EXPECT_THROW(striped.read(records.size() - 1, 2, span.data()), std::out_of_range);
+  std::vector<PwType> scanned;
+  flat_file::for_each_span(striped, from, to, [&](std::span<const PwType> s) {
+    scanned.insert(scanned.end(), s.begin(), s.end());
+  });
+  EXPECT_EQ(scanned, span);
+
+  // relative stripe paths are relative to the manifest, and a plain db is a single stripe
+  std::vector<std::filesystem::path> relative;
+  for (const auto& filename: stripe_filenames) relative.push_back(filename.filename());
+  flat_file::write_stripe_manifest(manifest, relative);
+  EXPECT_EQ(flat_file::striped_database<PwType>(manifest).number_records(), records.size());
+  EXPECT_EQ(flat_file::striped_database<PwType>(test_db_path()).stripes().size(), 1);
+
+  // single file readers refuse, and stripes must be written in order
+  EXPECT_THROW(flat_file::database<PwType>{manifest}, std::ios::failure);
+  std::filesystem::remove(manifest);
+  {
+    flat_file::striped_writer<PwType> writer(manifest, stripe_filenames, thirds);
+    writer.write(records.back());
+    EXPECT_THROW(writer.write(records.front()), std::runtime_error);
+  }
+  // which, unclosed, removes its partial stripes and writes no manifest
+  for (const auto& filename: stripe_filenames) EXPECT_FALSE(std::filesystem::exists(filename));
+  EXPECT_FALSE(std::filesystem::exists(manifest));
+}
+
+TEST(flat_file, for_each_range_covers_everything_once) { // NOLINT
+  for (std::size_t size: {0UL, 1UL, 5UL, 1000UL}) {
+    std::vector<std::atomic<int>> visits(size);
+    flat_file::for_each_range(size, 8, [&](std::size_t, std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i != last; ++i) ++visits[i];
+    });
+    EXPECT_TRUE(std::all_of(visits.begin(), visits.end(), [](const auto& v) { return v == 1; }));
+  }
+}
+
+TEST(flat_file, for_each_range_rethrows) { // NOLINT
+  EXPECT_THROW(flat_file::for_each_range(100, 4,
+                                         [](std::size_t idx, std::size_t, std::size_t) {
+                                           if (idx == 2) throw std::runtime_error("oops");
+                                         }),
+               std::runtime_error);
+}
+
+TEST(flat_file, batch_cursor_finds_like_lower_bound) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::shared_database<PwType> db(test_db_path());
+  auto                                     reader = db.make_cursor(4096 / sizeof(PwType));
+
+  for (const bool use_io_uring: {true, false}) {
+    flat_file::batch_cursor<PwType> cursor(db, 16, use_io_uring);
+    if (!use_io_uring) {
+      EXPECT_FALSE(cursor.uses_io_uring());
+    }
+
+    for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+      const PwType needle = reader.get_record(pos);
+      const auto   found  = cursor.find(needle, 0, db.number_records());
+      ASSERT_TRUE(found.has_value());
+      EXPECT_EQ(found->count, needle.count);
+    }
+    // search for an absent needle, and in a window which does not contain it
+    PwType absent = reader.get_record(0);
+    absent.hash.back() ^= std::byte{0x01}; // NOLINT magic number
+    if (!std::binary_search(reader.begin(), reader.end(), absent)) {
+      EXPECT_FALSE(cursor.find(absent, 0, db.number_records()).has_value());
+    }
+    EXPECT_FALSE(cursor.find(reader.get_record(10), 11, db.number_records()).has_value());
+    EXPECT_FALSE(cursor.find(reader.get_record(10), 0, 0).has_value());
+  }
+}
+
+TEST(flat_file, batch_reader_recovers_from_a_failed_batch) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::shared_database<PwType> db(test_db_path());
+  auto                                     reader = db.make_cursor(4096 / sizeof(PwType));
+  const std::uint64_t                      end    = db.number_records() * sizeof(PwType);
+
+  for (const bool use_io_uring: {true, false}) {
+    flat_file::batch_reader batch(4, use_io_uring);
+
+    // a read beyond the end fails the batch, which is larger than the queue...
+    std::vector<PwType>                  got(10);
+    std::vector<flat_file::read_request> requests;
+    for (std::size_t i = 0; i != got.size(); ++i)
+      requests.push_back({i * 1000 * sizeof(PwType), &got[i], sizeof(PwType)});
+    requests[1].offset = end;
+    EXPECT_THROW(batch.read(db.file(), requests), std::ios::failure);
+
+    // ...but leaves nothing behind to corrupt the next one
+    requests[1].offset = 1000 * sizeof(PwType);
+    std::fill(got.begin(), got.end(), PwType{});
+    batch.read(db.file(), requests);
+    for (std::size_t i = 0; i != got.size(); ++i) EXPECT_EQ(got[i], reader.get_record(i * 1000));
+  }
+}
+
+TEST(flat_file, cached_database_matches_database_across_threads) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  flat_file::page_cache                    cache(64 * flat_file::page_cache::page_size, 4);
+  const flat_file::cached_database<PwType> cached(test_db_path(), cache);
+  const flat_file::shared_database<PwType> shared(test_db_path());
+
+  ASSERT_EQ(cached.number_records(), shared.number_records());
+  ASSERT_EQ(cache.capacity_bytes(), 64 * flat_file::page_cache::page_size);
+
+  std::atomic<std::size_t> mismatches{};
+  flat_file::for_each_range(shared.number_records(), 4, [&](std::size_t, std::size_t first,
+                                                            std::size_t last) {
+    auto cursor = cached.make_cursor();
+    auto reader = shared.make_cursor(4096 / sizeof(PwType));
+
+    std::mt19937_64                            generator{first};
+    std::uniform_int_distribution<std::size_t> distribution(first, last - 1);
+    for (std::size_t i = 0; i != (last - first) / 20; ++i) {
+      const std::size_t pos    = distribution(generator);
+      const PwType&     record = reader.get_record(pos);
+      if (cursor.get_record(pos) != record || cursor.get_record(pos).count != record.count)
+        ++mismatches;
+    }
+    // records near the end of the file, which is not page aligned
+    const PwType& last_record = cursor.get_record(shared.number_records() - 1);
+    if (last_record != reader.get_record(shared.number_records() - 1)) ++mismatches;
+
+    auto iter = std::lower_bound(cursor.begin(), cursor.end(), reader.get_record(last - 1));
+    if (iter.pos() != last - 1) ++mismatches;
+  });
+  EXPECT_EQ(mismatches, 0);
+
+  const auto stats = cache.stats();
+  EXPECT_GT(stats.hits, 0);
+  EXPECT_GT(stats.misses, 64); // ie it has evicted pages
+
+  std::vector<PwType> buf(2);
+  EXPECT_THROW(cached.read(cached.number_records() - 1, 2, buf.data()), std::out_of_range);
+}
+
+TEST(flat_file, page_cache_reads_each_page_once_across_threads) { // NOLINT
+  constexpr std::size_t page_size = flat_file::page_cache::page_size;
+  constexpr std::size_t npages    = 8; // fewer than any shard holds, so nothing is evicted
+  constexpr unsigned    nthreads  = 8;
+  flat_file::page_cache cache(64 * page_size, 4);
+  const std::uint32_t   file_id = cache.register_file();
+  const auto            file    = flat_file::impl::open_direct(test_db_path());
+  ASSERT_GE(std::filesystem::file_size(test_db_path()), npages * page_size);
+
+  // every thread misses on every page at once: the first reads it, the others wait for it
+  flat_file::for_each_range(nthreads, nthreads, [&](std::size_t, std::size_t, std::size_t) {
+    std::byte byte{};
+    for (std::size_t page = 0; page != npages; ++page) {
+      cache.read(file_id, file, page * page_size, &byte, 1);
+    }
+  });
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.misses, npages);
+  EXPECT_EQ(stats.hits, (nthreads - 1) * npages);
+
+  // a failed read is not left in flight, so the next attempt reads again, rather than waiting
+  const std::uint64_t end = std::filesystem::file_size(test_db_path());
+  std::byte           byte{};
+  EXPECT_THROW(cache.read(file_id, file, end, &byte, 1), std::ios::failure);
+  EXPECT_THROW(cache.read(file_id, file, end, &byte, 1), std::ios::failure);
+}
+
+TEST(flat_file, residency_of_mapping_and_page_allocated_vector) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::mmap_database<PwType> db(test_db_path());
+  const flat_file::residency_options     opts{.preload = true,
+                                              .huge    = flat_file::huge_pages::transparent};
+
+  const auto report = flat_file::make_resident("db", db.begin(), db.filesize(), opts);
+  EXPECT_EQ(report.bytes, db.filesize());
+  EXPECT_FALSE(report.locked);
+
+  // huge page backed allocations fall back to normal pages if none are reserved
+  std::vector<int, flat_file::page_allocator<int>> vec(
+      1000, 42, flat_file::page_allocator<int>{flat_file::huge_pages::hugetlb});
+  vec.resize(1'000'000, 43);
+  EXPECT_EQ(vec.front(), 42);
+  EXPECT_EQ(vec.back(), 43);
+  EXPECT_EQ(vec.get_allocator().huge(), flat_file::huge_pages::hugetlb);
+
+#ifdef __linux__
+  const auto mapping = flat_file::find_mapping(test_db_path());
+  ASSERT_TRUE(mapping.has_value());
+  EXPECT_GE(mapping->size(), db.filesize());
+#endif
+}
@@ -1,35 +1,104 @@
+#include "bytearray_cast.hpp"
+#include "columnar.hpp"
+#include "compressed.hpp"
+#include "delta.hpp"
+#include "elias_fano.hpp"
 #include "flat_file.hpp"
+#include "flat_file/mmap.hpp"
+#include "flat_file/striped.hpp"
 #include "hibp.hpp"
+#include "interp.hpp"
+#include "mphf.hpp"
+#include "rmi.hpp"
+#include "stree.hpp"
 #include "toc.hpp"
+#include "window_search.hpp"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <type_traits>
+#include <vector>
 
-template <hibp::pw_type PwType>
-void run_search(bool toc, unsigned toc_bits = 0) { // NOLINT complexity
-  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+template <typename DbType>
+DbType open_db(const std::filesystem::path& db_path) {
+  using PwType = typename DbType::value_type;
+  if constexpr (std::is_same_v<DbType, flat_file::database<PwType>>) {
+    return DbType(db_path, 4096 / sizeof(PwType));
+  } else {
+    return DbType(db_path);
+  }
+}
 
-  std::filesystem::path db_path;
+// interp: no index, interpolation search
+// toc_chapter: toc, reading each chapter with a single read
+enum class index_t { none, toc, stree, interp, mphf, rmi, toc_chapter };
 
-  if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1>) {
-    db_path = testdatadir / "hibp_test.sha1.bin";
-  } else if constexpr (std::is_same_v<PwType, hibp::pawned_pw_ntlm>) {
-    db_path = testdatadir / "hibp_test.ntlm.bin";
-  } else if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1t64>) {
-    db_path = testdatadir / "hibp_test.sha1t64.bin";
+// A copy, in test/tmp, of the checked in test db, and its golden master toc, made newer than the
+// db, so it is mapped as is. The indexes built next to it, and all scratch files, therefore stay
+// out of test/data.
+inline std::filesystem::path copy_test_db(const std::string& filename) {
+  const auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  const auto testtmpdir  = std::filesystem::canonical(std::filesystem::current_path() / "tmp");
+  for (const auto& entry: std::filesystem::directory_iterator(testtmpdir)) {
+    if (entry.path().filename().string().starts_with(filename)) {
+      std::filesystem::remove(entry.path()); // the indexes of an earlier run
+    }
   }
+  const auto db_path  = testtmpdir / filename;
+  const auto toc_name = filename + ".18.toc";
+  std::filesystem::copy_file(testdatadir / filename, db_path);
+  std::filesystem::copy_file(testdatadir / toc_name, testtmpdir / toc_name);
+  std::filesystem::last_write_time(testtmpdir / toc_name, std::filesystem::last_write_time(db_path) +
+                                                              std::chrono::seconds(1));
+  return db_path;
+}
+
+template <hibp::pw_type PwType>
+std::filesystem::path test_db_path() {
+  static const std::filesystem::path db_path = [] {
+    if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1>) {
+      return copy_test_db("hibp_test.sha1.bin");
+    } else if constexpr (std::is_same_v<PwType, hibp::pawned_pw_ntlm>) {
+      return copy_test_db("hibp_test.ntlm.bin");
+    } else {
+      return copy_test_db("hibp_test.sha1t64.bin");
+    }
+  }();
+  return db_path;
+}
 
-  if (toc) {
-    // this probably does nothing as these are checking into git as golden masters
-    // the build is properly tested during system_tests
-    hibp::toc_build<PwType>(db_path, toc_bits);
+template <hibp::pw_type PwType, typename DbType = flat_file::database<PwType>>
+void run_search(index_t index, unsigned toc_bits = 0) { // NOLINT complexity
+  const std::filesystem::path db_path = test_db_path<PwType>();
+
+  std::optional<hibp::table_of_contents<PwType>> toc;
+  std::optional<hibp::stree<PwType>>             stree;
+  std::optional<hibp::mphf<PwType>>              mphf;
+  std::optional<hibp::rmi<PwType>>               rmi;
+  if (index == index_t::toc || index == index_t::toc_chapter) {
+    // the golden master, mapped. The build is properly tested during system_tests
+    toc.emplace(db_path, toc_bits);
+    EXPECT_TRUE(toc->mapped());
+  } else if (index == index_t::stree) {
+    stree.emplace(db_path);
+  } else if (index == index_t::mphf) {
+    mphf.emplace(db_path);
+  } else if (index == index_t::rmi) {
+    rmi.emplace(db_path);
   }
 
-  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+  DbType db = open_db<DbType>(db_path);
 
   std::mt19937_64                            generator{std::random_device{}()};
   std::uniform_int_distribution<std::size_t> distribution(0, db.number_records() - 1);
@@ -42,8 +111,21 @@ void run_search(bool toc, unsigned toc_bits = 0) { // NOLINT complexity
           << needle_idx << " (byte offset: " << sizeof(PwType) * needle_idx << ")";
     SCOPED_TRACE(trace.str());
 
-    if (toc) {
-      std::optional<PwType> maybe_ppw = hibp::toc_search<PwType>(db, needle, toc_bits);
+    if (index != index_t::none) {
+      std::optional<PwType> maybe_ppw;
+      if (index == index_t::toc) {
+        maybe_ppw = hibp::toc_search<PwType>(db, *toc, needle);
+      } else if (index == index_t::toc_chapter) {
+        maybe_ppw = hibp::toc_search<PwType>(db, *toc, needle, hibp::toc_read::chapter);
+      } else if (index == index_t::stree) {
+        maybe_ppw = hibp::window_search(db, *stree, needle);
+      } else if (index == index_t::mphf) {
+        maybe_ppw = hibp::window_search(db, *mphf, needle);
+      } else if (index == index_t::rmi) {
+        maybe_ppw = hibp::window_search(db, *rmi, needle);
+      } else {
+        maybe_ppw = hibp::interp_search<PwType>(db, needle);
+      }
       EXPECT_TRUE(maybe_ppw);
       EXPECT_EQ(*maybe_ppw, needle);             // NOLINT unchecked access
       EXPECT_EQ(maybe_ppw->count, needle.count); // NOLINT unchecked access
@@ -57,25 +139,952 @@ void run_search(bool toc, unsigned toc_bits = 0) { // NOLINT complexity
 }
 
 TEST(hibp_integration, search_sha1) { // NOLINT
-  run_search<hibp::pawned_pw_sha1>(false);
+  run_search<hibp::pawned_pw_sha1>(index_t::none);
 }
 
 TEST(hibp_integration, search_ntlm) { // NOLINT
-  run_search<hibp::pawned_pw_ntlm>(false);
+  run_search<hibp::pawned_pw_ntlm>(index_t::none);
 }
 
 TEST(hibp_integration, search_sha1t64) { // NOLINT
-  run_search<hibp::pawned_pw_sha1t64>(false);
+  run_search<hibp::pawned_pw_sha1t64>(index_t::none);
 }
 
 TEST(hibp_integration, toc_search_sha1) { // NOLINT
-  run_search<hibp::pawned_pw_sha1>(true, 18);
+  run_search<hibp::pawned_pw_sha1>(index_t::toc, 18);
 }
 
 TEST(hibp_integration, toc_search_ntlm) { // NOLINT
-  run_search<hibp::pawned_pw_ntlm>(true, 18);
+  run_search<hibp::pawned_pw_ntlm>(index_t::toc, 18);
 }
 
 TEST(hibp_integration, toc_search_sha1t64) { // NOLINT
-  run_search<hibp::pawned_pw_sha1t64>(true, 18);
+  run_search<hibp::pawned_pw_sha1t64>(index_t::toc, 18);
+}
+
+TEST(hibp_integration, toc_chapter_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1>(index_t::toc_chapter, 18);
+}
+
+TEST(hibp_integration, toc_chapter_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm>(index_t::toc_chapter, 18);
+}
+
+TEST(hibp_integration, toc_chapter_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64>(index_t::toc_chapter, 18);
+}
+
+TEST(hibp_integration, toc_table_encoding) { // NOLINT
+  // positions well beyond 4 billion, with a jump which widens the offsets mid-block
+  std::vector<std::uint64_t>                   positions;
+  std::mt19937_64                              generator{std::random_device{}()};
+  std::uniform_int_distribution<std::uint64_t> gap(0, 100);
+  std::uint64_t                                pos = 5'000'000'000;
+  for (std::size_t i = 0; i != 1000; ++i) {
+    pos += i == 700 ? 1'000'000 : gap(generator);
+    positions.push_back(pos);
+  }
+  hibp::details::toc_builder builder;
+  for (const auto p: positions) builder.push_back(p);
+  const auto toc = std::move(builder).finish();
+  ASSERT_EQ(toc.size(), positions.size());
+  EXPECT_EQ(toc.width(), 20); // for the jump, rather than 13 for 64 gaps of up to 100
+  for (std::size_t i = 0; i != positions.size(); ++i) EXPECT_EQ(toc[i], positions[i]);
+
+  // and used in place, from a file
+  const auto filename = test_db_path<hibp::pawned_pw_sha1>().parent_path() / "encoding.toc";
+  {
+    std::ofstream os(filename, std::ios::binary);
+    toc.write(os);
+  }
+  const auto region = std::make_shared<const flat_file::impl::mmap_region>(filename);
+  const auto mapped = hibp::details::toc_table::map(region, 0, region->size());
+  ASSERT_TRUE(mapped);
+  EXPECT_TRUE(mapped->words().mapped());
+  ASSERT_EQ(mapped->size(), positions.size());
+  for (std::size_t i = 0; i != positions.size(); ++i) EXPECT_EQ((*mapped)[i], positions[i]);
+  EXPECT_FALSE(hibp::details::toc_table::map(region, 0, region->size() - 8));
+  std::filesystem::remove(filename);
+}
+
+TEST(hibp_integration, toc_search_32bits) { // NOLINT
+  using PwType       = hibp::pawned_pw_sha1;
+  const auto db_path = test_db_path<PwType>();
+  std::filesystem::remove(db_path.string() + ".32.toc");
+  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+
+  auto prefix32 = [](const PwType& pw) {
+    return hibp::bytearray_cast<std::uint32_t>(pw.hash.data());
+  };
+  for (int pass = 0; pass != 2; ++pass) { // built, then mapped
+    const hibp::table_of_contents<PwType> toc(db_path, 32);
+    EXPECT_EQ(toc.mapped(), pass == 1);
+    for (std::size_t pos = 0; pos < db.number_records(); ++pos) {
+      const PwType needle = db.get_record(pos);
+      const auto [first, last] = toc.chapter(needle, db.number_records());
+      ASSERT_LE(first, pos);
+      ASSERT_GT(last, pos);
+      // exactly the records with the needle's 32bit prefix, ie very few
+      ASSERT_EQ(prefix32(db.get_record(first)), prefix32(needle));
+      ASSERT_EQ(prefix32(db.get_record(last - 1)), prefix32(needle));
+      if (first != 0) {
+        ASSERT_LT(prefix32(db.get_record(first - 1)), prefix32(needle));
+      }
+      if (last != db.number_records()) {
+        ASSERT_GT(prefix32(db.get_record(last)), prefix32(needle));
+      }
+    }
+  }
+  const hibp::table_of_contents<PwType> toc(db_path, 32);
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.back() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::toc_search<PwType>(db, toc, needle).has_value(), present);
+      EXPECT_EQ(hibp::toc_search<PwType>(db, toc, needle, hibp::toc_read::chapter).has_value(),
+                present);
+    }
+  }
+  std::filesystem::remove(db_path.string() + ".32.toc");
+}
+
+TEST(hibp_integration, toc_rebuild_while_mapped) { // NOLINT
+  using PwType                = hibp::pawned_pw_sha1;
+  const auto db_path          = test_db_path<PwType>();
+  const auto toc_path         = db_path.string() + ".19.toc";
+  const auto db_size          = flat_file::database<PwType>(db_path).number_records();
+  const auto [needle, expect] = [&] {
+    flat_file::database<PwType> db(db_path);
+    const PwType                pw = db.get_record(db_size / 2);
+    return std::pair{pw, hibp::table_of_contents<PwType>(db_path, 19).chapter(pw, db_size)};
+  }();
+
+  const hibp::table_of_contents<PwType> mapped(db_path, 19);
+  ASSERT_TRUE(mapped.mapped());
+  // stale, so rebuilt and saved by "another process", which replaces the file, and the mapping
+  // of the first is undisturbed
+  std::filesystem::last_write_time(toc_path, std::filesystem::last_write_time(db_path) -
+                                                 std::chrono::hours(1));
+  const hibp::table_of_contents<PwType> rebuilt(db_path, 19);
+  EXPECT_FALSE(rebuilt.mapped());
+  EXPECT_EQ(mapped.chapter(needle, db_size), expect);
+  EXPECT_GT(std::filesystem::last_write_time(toc_path), std::filesystem::last_write_time(db_path));
+  EXPECT_FALSE(std::filesystem::exists(toc_path + ".tmp"));
+  EXPECT_TRUE(hibp::table_of_contents<PwType>(db_path, 19).mapped()); // not rebuilt again
+  std::filesystem::remove(toc_path);
+}
+
+TEST(hibp_integration, toc_chapter_search_not_found) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const hibp::table_of_contents<PwType> toc(test_db_path<PwType>(), 18);
+  flat_file::database<PwType>           db(test_db_path<PwType>(), 4096 / sizeof(PwType));
+
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x00}, std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.back() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::toc_search<PwType>(db, toc, needle, hibp::toc_read::chapter).has_value(),
+                present);
+    }
+  }
+}
+
+TEST(hibp_integration, toc_build_threads) { // NOLINT
+  // the ranges built on each thread are stitched into exactly the single threaded toc and fences
+  using PwType = hibp::pawned_pw_sha1;
+  for (const unsigned bits: {15U, 18U, 32U}) {
+    const auto single = hibp::toc_sections<PwType>(test_db_path<PwType>(), bits, true, 1);
+    for (const unsigned threads: {2U, 7U, 64U}) {
+      const auto parallel = hibp::toc_sections<PwType>(test_db_path<PwType>(), bits, true, threads);
+      ASSERT_EQ(parallel.size(), single.size());
+      for (std::size_t idx = 0; idx != single.size(); ++idx) {
+        EXPECT_EQ(parallel[idx].name, single[idx].name);
+        EXPECT_TRUE(parallel[idx].data == single[idx].data) << bits << " bits, " << threads;
+      }
+    }
+  }
+}
+
+TEST(hibp_integration, toc_indexing_writer) { // NOLINT
+  using PwType        = hibp::pawned_pw_sha1;
+  using writer_type   = flat_file::file_writer<PwType>;
+  const auto db_path  = test_db_path<PwType>();
+  const auto filename = db_path.parent_path() / "indexed.sha1.bin";
+  auto       contents = [](const std::filesystem::path& path) {
+    std::ifstream is(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(is), {});
+  };
+
+  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+  {
+    writer_type                                file(filename.string());
+    hibp::indexing_writer<PwType, writer_type> writer(file, 18, true);
+    for (const auto& pw: db) writer.write(pw);
+    EXPECT_TRUE(writer.finish(filename));
+  }
+  // saved as if built, and newer than the db, so mapped, rather than rebuilt
+  const hibp::table_of_contents<PwType> toc(filename, 18, true);
+  EXPECT_TRUE(toc.mapped());
+  EXPECT_TRUE(toc.has_fences());
+  const auto sections = hibp::toc_sections<PwType>(filename, 18, true);
+  ASSERT_EQ(sections.size(), 2);
+  const auto toc_bytes = contents(filename.string() + ".18.toc");
+  EXPECT_TRUE(toc_bytes == sections[0].data);
+  const auto fences_bytes = contents(filename.string() + ".fences");
+  EXPECT_TRUE(fences_bytes == sections[1].data);
+
+  // a gap, and out of order, so nothing is saved, but the db is still written
+  std::filesystem::remove(filename.string() + ".18.toc");
+  {
+    writer_type                                file(filename.string());
+    hibp::indexing_writer<PwType, writer_type> writer(file, 18);
+    writer.write(db.get_record(db.number_records() - 1));
+    writer.write(db.get_record(0));
+    EXPECT_FALSE(writer.finish(filename));
+  }
+  EXPECT_FALSE(std::filesystem::exists(filename.string() + ".18.toc"));
+  EXPECT_EQ(std::filesystem::file_size(filename), 2 * sizeof(PwType));
+
+  std::filesystem::remove(filename);
+  std::filesystem::remove(filename.string() + ".fences");
+}
+
+TEST(hibp_integration, toc_fences_search) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const hibp::table_of_contents<PwType> toc(test_db_path<PwType>(), 18, true);
+  flat_file::database<PwType>           db(test_db_path<PwType>(), 4096 / sizeof(PwType));
+  EXPECT_TRUE(toc.has_fences());
+
+  constexpr std::size_t stride = 4096 / sizeof(PwType);
+  for (std::size_t pos = 0; pos < db.number_records(); ++pos) {
+    const auto [first, last] = toc.chapter(db.get_record(pos), db.number_records());
+    ASSERT_LE(first, pos);
+    ASSERT_GT(last, pos);
+    ASSERT_LE(last - first, 2 * stride); // one page, unless a 64bit prefix spans a page boundary
+  }
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.back() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::toc_search<PwType>(db, toc, needle).has_value(), present);
+    }
+  }
+}
+
+TEST(hibp_integration, toc_embedded_in_sealed_db) { // NOLINT
+  using PwType      = hibp::pawned_pw_sha1;
+  const auto sealed = test_db_path<PwType>().parent_path() / "sealed_toc.sha1.bin";
+  std::filesystem::copy_file(test_db_path<PwType>(), sealed,
+                             std::filesystem::copy_options::overwrite_existing);
+  const std::size_t db_size = flat_file::database<PwType>(sealed).number_records();
+  flat_file::write_container(sealed, {sizeof(PwType), db_size, 0, "sha1", "hash"},
+                             hibp::toc_sections<PwType>(sealed, 18, true));
+
+  // loaded from the db, so no sidecar files, even though they would be "stale"
+  std::filesystem::last_write_time(sealed, std::filesystem::file_time_type::clock::now());
+  const hibp::table_of_contents<PwType> toc(sealed, 18, true);
+  EXPECT_TRUE(toc.mapped());
+  EXPECT_TRUE(toc.has_fences());
+  EXPECT_FALSE(std::filesystem::exists(sealed.string() + ".18.toc"));
+  EXPECT_FALSE(std::filesystem::exists(sealed.string() + ".fences"));
+
+  // several tocs of the same type of pw in one process, here of two dbs with different bits
+  const hibp::table_of_contents<PwType> plain_toc(test_db_path<PwType>(), 17);
+
+  flat_file::database<PwType> db(sealed, 4096 / sizeof(PwType));
+  ASSERT_EQ(db.number_records(), db_size);
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 7) {
+    const PwType needle = db.get_record(pos);
+    const auto [first, last] = toc.chapter(needle, db.number_records());
+    ASSERT_LE(first, pos);
+    ASSERT_GT(last, pos);
+    EXPECT_TRUE(hibp::toc_search<PwType>(db, toc, needle, hibp::toc_read::chapter));
+    EXPECT_TRUE(hibp::toc_search<PwType>(db, plain_toc, needle));
+  }
+  std::filesystem::remove(test_db_path<PwType>().string() + ".17.toc");
+
+  // other bits are not embedded, so those are built as before
+  {
+    const hibp::table_of_contents<PwType> other_toc(sealed, 17);
+    EXPECT_TRUE(std::filesystem::exists(sealed.string() + ".17.toc"));
+  }
+  std::filesystem::remove(sealed.string() + ".17.toc");
+  std::filesystem::remove(sealed);
+}
+
+TEST(hibp_integration, toc_search_striped_db) { // NOLINT
+  using PwType        = hibp::pawned_pw_sha1;
+  const auto dir      = test_db_path<PwType>().parent_path();
+  const auto manifest = dir / "striped_toc.sha1.bin";
+  const auto stripes  = flat_file::stripe_filenames(manifest, {dir, dir, dir, dir});
+
+  flat_file::database<PwType> db(test_db_path<PwType>(), 4096 / sizeof(PwType));
+  {
+    // the test db only holds the prefixes 00000 to 000FF, so 4 stripes of 64 prefixes
+    flat_file::striped_writer<PwType> writer(manifest, stripes, [](const PwType& pw) {
+      return hibp::hash_stripe(pw, 1U << 20U) / 64;
+    });
+    for (const auto& pw: db) writer.write(pw);
+    writer.close();
+  }
+
+  // the toc, and fences, of the logical db, built by scanning the stripes in turn
+  const hibp::table_of_contents<PwType>     toc(manifest, 18, true);
+  const flat_file::striped_database<PwType> striped(manifest);
+  ASSERT_EQ(striped.number_records(), db.number_records());
+  ASSERT_EQ(striped.stripes().size(), 4);
+  EXPECT_GT(striped.stripes()[3].first, striped.stripes()[2].first);
+  auto cursor = striped.make_cursor(4096 / sizeof(PwType));
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 7) {
+    const PwType needle = db.get_record(pos);
+    const auto [first, last] = toc.chapter(needle, striped.number_records());
+    ASSERT_LE(first, pos);
+    ASSERT_GT(last, pos);
+    EXPECT_TRUE(hibp::toc_search<PwType>(cursor, toc, needle));
+    EXPECT_TRUE(hibp::toc_search<PwType>(cursor, toc, needle, hibp::toc_read::chapter));
+    PwType absent = needle;
+    absent.hash.back() ^= std::byte{0x01};
+    EXPECT_EQ(hibp::toc_search<PwType>(cursor, toc, absent).has_value(),
+              std::binary_search(db.begin(), db.end(), absent));
+  }
+
+  std::filesystem::remove(manifest.string() + ".18.toc");
+  std::filesystem::remove(manifest.string() + ".fences");
+  std::filesystem::remove(manifest);
+  for (const auto& stripe: stripes) std::filesystem::remove(stripe);
+}
+
+TEST(hibp_integration, mmap_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::mmap_database<hibp::pawned_pw_sha1>>(index_t::none);
+}
+
+TEST(hibp_integration, mmap_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm, flat_file::mmap_database<hibp::pawned_pw_ntlm>>(index_t::none);
+}
+
+TEST(hibp_integration, mmap_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64, flat_file::mmap_database<hibp::pawned_pw_sha1t64>>(index_t::none);
+}
+
+TEST(hibp_integration, mmap_toc_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::mmap_database<hibp::pawned_pw_sha1>>(index_t::toc, 18);
+}
+
+TEST(hibp_integration, stree_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1>(index_t::stree);
+}
+
+TEST(hibp_integration, stree_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm>(index_t::stree);
+}
+
+TEST(hibp_integration, stree_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64>(index_t::stree);
+}
+
+TEST(hibp_integration, stree_search_not_found) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const hibp::stree<PwType>        stree(test_db_path<PwType>());
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+
+  // hashes just before and after every 97th record, and beyond both ends of the db
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.back() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::window_search(db, stree, needle).has_value(), present);
+    }
+  }
+  PwType low{};
+  PwType high{};
+  high.hash.fill(std::byte{0xFF});
+  EXPECT_EQ(hibp::window_search(db, stree, low).has_value(),
+            std::binary_search(db.begin(), db.end(), low));
+  EXPECT_EQ(hibp::window_search(db, stree, high).has_value(),
+            std::binary_search(db.begin(), db.end(), high));
+}
+
+TEST(hibp_integration, stree_rebuilds_truncated_sidecar) { // NOLINT
+  using PwType          = hibp::pawned_pw_sha1;
+  const auto db_path    = test_db_path<PwType>();
+  const auto stree_path = std::filesystem::path(db_path.string() + ".stree");
+  { const hibp::stree<PwType> stree(db_path); }
+  const auto good_size = std::filesystem::file_size(stree_path);
+
+  // as if another process were part way through writing it: newer than the db, but short
+  std::filesystem::resize_file(stree_path, good_size / 2);
+  std::filesystem::last_write_time(stree_path, std::filesystem::last_write_time(db_path) +
+                                                   std::chrono::seconds(1));
+
+  const hibp::stree<PwType>        stree(db_path); // rebuilt, rather than used with zeros
+  flat_file::mmap_database<PwType> db(db_path);
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    EXPECT_TRUE(hibp::window_search(db, stree, db.get_record(pos)).has_value());
+  }
+  EXPECT_EQ(std::filesystem::file_size(stree_path), good_size);
+  EXPECT_FALSE(std::filesystem::exists(stree_path.string() + ".tmp"));
+}
+
+TEST(hibp_integration, mphf_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1>(index_t::mphf);
+}
+
+TEST(hibp_integration, mphf_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm>(index_t::mphf);
+}
+
+TEST(hibp_integration, mphf_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64>(index_t::mphf);
+}
+
+TEST(hibp_integration, mphf_search_not_found) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const hibp::mphf<PwType>         mphf(test_db_path<PwType>());
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    const auto [first, last] = mphf.window(db.get_record(pos), db.number_records());
+    EXPECT_EQ(first, pos);
+    EXPECT_LE(last - first, 2U); // one record, unless a 64bit prefix is shared
+
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.front() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::window_search(db, mphf, needle).has_value(), present);
+    }
+  }
+}
+
+TEST(hibp_integration, mphf_small_full_range) { // NOLINT
+  // fewer records than a partition, with keys across the whole key space
+  using PwType       = hibp::pawned_pw_sha1t64;
+  const auto db_path = test_db_path<PwType>().parent_path() / "small.sha1t64.bin";
+  {
+    flat_file::file_writer<PwType> writer(db_path.string());
+    for (const auto* line: {"0000000000000001:1", "8000000000000000:2", "FFFFFFFFFFFFFFFE:3"}) {
+      writer.write(PwType{line});
+    }
+  }
+  std::filesystem::remove(db_path.string() + ".mphf");
+  // each index is of its own db, so one of another db of the same type of pw is unaffected
+  const hibp::mphf<PwType>         other(test_db_path<PwType>());
+  const hibp::mphf<PwType>         mphf(db_path);
+  flat_file::mmap_database<PwType> db(db_path);
+  for (std::size_t pos = 0; pos != db.number_records(); ++pos) {
+    EXPECT_EQ(mphf.window(db.get_record(pos), db.number_records()).first, pos);
+    EXPECT_TRUE(hibp::window_search(db, mphf, db.get_record(pos)).has_value());
+  }
+  EXPECT_FALSE(hibp::window_search(db, mphf, PwType{"7FFFFFFFFFFFFFFF:1"}).has_value());
+  EXPECT_FALSE(hibp::window_search(db, mphf, PwType{"FFFFFFFFFFFFFFFF:1"}).has_value());
+
+  flat_file::mmap_database<PwType> other_db(test_db_path<PwType>());
+  for (std::size_t pos = 0; pos < other_db.number_records(); pos += 97) {
+    EXPECT_EQ(other.window(other_db.get_record(pos), other_db.number_records()).first, pos);
+  }
+  std::filesystem::remove(db_path);
+  std::filesystem::remove(db_path.string() + ".mphf");
+}
+
+TEST(hibp_integration, rmi_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1>(index_t::rmi);
+}
+
+TEST(hibp_integration, rmi_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm>(index_t::rmi);
+}
+
+TEST(hibp_integration, rmi_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64>(index_t::rmi);
+}
+
+TEST(hibp_integration, rmi_search_not_found) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  const hibp::rmi<PwType>          rmi(test_db_path<PwType>());
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+
+  for (std::size_t pos = 0; pos < db.number_records(); ++pos) {
+    const auto [first, last] = rmi.window(db.get_record(pos), db.number_records());
+    ASSERT_LE(first, pos);
+    ASSERT_GT(last, pos);
+  }
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.front() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::window_search(db, rmi, needle).has_value(), present);
+    }
+  }
+}
+
+TEST(hibp_integration, interp_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1>(index_t::interp);
+}
+
+TEST(hibp_integration, interp_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm>(index_t::interp);
+}
+
+TEST(hibp_integration, interp_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64>(index_t::interp);
+}
+
+TEST(hibp_integration, mmap_interp_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::mmap_database<hibp::pawned_pw_sha1>>(
+      index_t::interp);
+}
+
+TEST(hibp_integration, interp_search_not_found) { // NOLINT
+  using PwType = hibp::pawned_pw_ntlm;
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+
+  // hashes just before and after every 97th record, and beyond both ends of the db
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+      PwType needle = db.get_record(pos);
+      needle.hash.back() ^= delta;
+      const bool present = std::binary_search(db.begin(), db.end(), needle);
+      EXPECT_EQ(hibp::interp_search<PwType>(db, needle).has_value(), present);
+    }
+  }
+  PwType low{};
+  PwType high{};
+  high.hash.fill(std::byte{0xFF});
+  EXPECT_EQ(hibp::interp_search<PwType>(db, low).has_value(),
+            std::binary_search(db.begin(), db.end(), low));
+  EXPECT_EQ(hibp::interp_search<PwType>(db, high).has_value(),
+            std::binary_search(db.begin(), db.end(), high));
+}
+
+template <hibp::pw_type PwType>
+std::filesystem::path write_columns(bool counts_only = false) {
+  const auto base = std::filesystem::canonical(std::filesystem::current_path() / "tmp") /
+                    test_db_path<PwType>().filename();
+
+  flat_file::database<PwType>   db(test_db_path<PwType>(), 4096 / sizeof(PwType));
+  hibp::columnar_writer<PwType> writer(base, counts_only);
+  for (const auto& pw: db) writer.write(pw);
+  writer.finish();
+  return base;
+}
+
+template <hibp::pw_type PwType>
+void run_columnar_search() {
+  const auto base = write_columns<PwType>();
+
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+  hibp::columnar_database<PwType>  columns(base);
+  ASSERT_EQ(columns.number_records(), db.number_records());
+
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    const PwType& needle = db.get_record(pos);
+    auto          found  = columns.find(needle);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(*found, needle);             // NOLINT unchecked access
+    EXPECT_EQ(found->count, needle.count); // NOLINT unchecked access
+
+    PwType missing = needle;
+    missing.hash.back() ^= std::byte{0x01};
+    EXPECT_EQ(columns.find(missing).has_value(),
+              std::binary_search(db.begin(), db.end(), missing));
+  }
+}
+
+TEST(hibp_integration, columnar_search_sha1) { // NOLINT
+  run_columnar_search<hibp::pawned_pw_sha1>();
+}
+
+TEST(hibp_integration, columnar_search_ntlm) { // NOLINT
+  run_columnar_search<hibp::pawned_pw_ntlm>();
+}
+
+TEST(hibp_integration, columnar_search_sha1t64) { // NOLINT
+  run_columnar_search<hibp::pawned_pw_sha1t64>();
+}
+
+TEST(hibp_integration, columnar_counts_only) { // NOLINT
+  using PwType    = hibp::pawned_pw_sha1;
+  const auto base = write_columns<PwType>();
+  const auto hashes_time =
+      std::filesystem::last_write_time(hibp::columnar_hashes_filename(base));
+
+  // same hashes: only the counts are rewritten
+  write_columns<PwType>(true);
+  EXPECT_EQ(std::filesystem::last_write_time(hibp::columnar_hashes_filename(base)), hashes_time);
+
+  // different hashes are refused, and the live count column is untouched
+  const auto counts_size = std::filesystem::file_size(hibp::columnar_counts_filename(base));
+  {
+    hibp::columnar_writer<PwType> writer(base, true);
+    EXPECT_THROW(writer.write(PwType{"0000000000000000000000000000000000000000:1"}),
+                 std::runtime_error);
+  }
+  {
+    // as is a short refresh
+    flat_file::database<PwType>   db(test_db_path<PwType>());
+    hibp::columnar_writer<PwType> writer(base, true);
+    writer.write(db.get_record(0));
+    EXPECT_THROW(writer.finish(), std::runtime_error);
+  }
+  EXPECT_EQ(std::filesystem::file_size(hibp::columnar_counts_filename(base)), counts_size);
+  EXPECT_FALSE(std::filesystem::exists(hibp::columnar_counts_filename(base).string() + ".tmp"));
+  EXPECT_EQ(hibp::columnar_database<PwType>(base).number_records(),
+            flat_file::database<PwType>(test_db_path<PwType>()).number_records());
+}
+
+TEST(hibp_integration, columnar_writer_requires_sorted) { // NOLINT
+  using PwType    = hibp::pawned_pw_sha1;
+  const auto base = std::filesystem::canonical(std::filesystem::current_path() / "tmp") /
+                    "unsorted.sha1.bin";
+  {
+    hibp::columnar_writer<PwType> writer(base);
+    writer.write(PwType{"0000000000000000000000000000000000000020:20"});
+    writer.write(PwType{"0000000000000000000000000000000000000020:21"}); // equal is fine
+    EXPECT_THROW(writer.write(PwType{"0000000000000000000000000000000000000010:10"}),
+                 std::runtime_error);
+  }
+  // and nothing is left behind
+  EXPECT_FALSE(std::filesystem::exists(hibp::columnar_hashes_filename(base)));
+  EXPECT_FALSE(std::filesystem::exists(hibp::columnar_hashes_filename(base).string() + ".tmp"));
+  EXPECT_FALSE(std::filesystem::exists(hibp::columnar_counts_filename(base).string() + ".tmp"));
+}
+
+template <hibp::pw_type PwType>
+void run_compressed_search() {
+  const auto path = std::filesystem::canonical(std::filesystem::current_path() / "tmp") /
+                    (test_db_path<PwType>().filename().string() + ".blk");
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+  {
+    std::ofstream                   os(path, std::ios_base::binary);
+    hibp::compressed_writer<PwType> writer(os);
+    for (const auto& pw: db) writer.write(pw);
+  }
+  std::filesystem::remove(path.string() + ".index");
+
+  for (int pass = 0; pass != 2; ++pass) { // build the index, then load it
+    const hibp::compressed_database<PwType> cdb(path);
+    ASSERT_EQ(cdb.number_records(), db.number_records());
+    EXPECT_LT(cdb.filesize(), db.number_records() * sizeof(PwType));
+
+    std::vector<PwType> all;
+    for (std::size_t block = 0; block != cdb.number_blocks(); ++block) {
+      cdb.decode_block(block, all);
+    }
+    ASSERT_EQ(all.size(), db.number_records());
+    for (std::size_t pos = 0; pos != all.size(); ++pos) {
+      ASSERT_EQ(all[pos], db.get_record(pos));
+      ASSERT_EQ(all[pos].count, db.get_record(pos).count);
+    }
+
+    for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+      const PwType& needle = db.get_record(pos);
+      auto          found  = cdb.find(needle);
+      ASSERT_TRUE(found);
+      EXPECT_EQ(*found, needle);             // NOLINT unchecked access
+      EXPECT_EQ(found->count, needle.count); // NOLINT unchecked access
+
+      for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+        PwType missing = needle;
+        missing.hash.back() ^= delta;
+        EXPECT_EQ(cdb.find(missing).has_value(),
+                  std::binary_search(db.begin(), db.end(), missing));
+      }
+    }
+    PwType low{};
+    PwType high{};
+    high.hash.fill(std::byte{0xFF});
+    EXPECT_EQ(cdb.find(low).has_value(), std::binary_search(db.begin(), db.end(), low));
+    EXPECT_EQ(cdb.find(high).has_value(), std::binary_search(db.begin(), db.end(), high));
+  }
+}
+
+TEST(hibp_integration, compressed_search_sha1) { // NOLINT
+  run_compressed_search<hibp::pawned_pw_sha1>();
+}
+
+TEST(hibp_integration, compressed_search_ntlm) { // NOLINT
+  run_compressed_search<hibp::pawned_pw_ntlm>();
+}
+
+TEST(hibp_integration, compressed_search_sha1t64) { // NOLINT
+  run_compressed_search<hibp::pawned_pw_sha1t64>();
+}
+
+TEST(hibp_integration, compressed_writer_requires_sorted) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  std::ostringstream              os;
+  hibp::compressed_writer<PwType> writer(os);
+  writer.write(PwType{"0000000000000000000000000000000000000020:20"});
+  EXPECT_THROW(writer.write(PwType{"0000000000000000000000000000000000000010:10"}),
+               std::runtime_error);
+}
+
+TEST(hibp_integration, packed_counts) { // NOLINT
+  EXPECT_EQ(hibp::count_sat16::decode(hibp::count_sat16::encode(1234)), 1234);
+  EXPECT_EQ(hibp::count_sat16::decode(hibp::count_sat16::encode(100'000)), 65535);
+  EXPECT_EQ(hibp::count_sat16::decode(hibp::count_sat16::encode(-1)), -1);
+
+  EXPECT_EQ(hibp::count_log8::decode(hibp::count_log8::encode(1)), 1);
+  EXPECT_EQ(hibp::count_log8::decode(hibp::count_log8::encode(-1)), -1);
+  for (std::int32_t count = 1; count < (1 << 30); count = count * 3 + 1) {
+    const auto decoded = hibp::count_log8::decode(hibp::count_log8::encode(count));
+    EXPECT_NEAR(decoded, count, 0.05 * count + 1);
+  }
+  const auto max_count = std::numeric_limits<std::int32_t>::max();
+  EXPECT_GT(hibp::count_log8::decode(hibp::count_log8::encode(max_count)), 0);
+
+  const hibp::pawned_pw_sha1t64_nc pw{"0123456789ABCDEF:42"};
+  EXPECT_EQ(pw.get_count(), 1);
+  EXPECT_EQ(pw.to_string(), "0123456789ABCDEF");
+}
+
+template <hibp::any_pw_type PackedType>
+void run_packed_search() {
+  using PwType    = hibp::pawned_pw<PackedType::hash_size>;
+  const auto path = std::filesystem::canonical(std::filesystem::current_path() / "tmp") /
+                    (test_db_path<PwType>().filename().string() + ".packed");
+  flat_file::mmap_database<PwType> db(test_db_path<PwType>());
+  {
+    std::ofstream                        os(path, std::ios_base::binary);
+    flat_file::stream_writer<PackedType> writer(os);
+    for (const auto& pw: db) {
+      PackedType packed;
+      packed.hash = pw.hash;
+      packed.set_count(pw.count);
+      writer.write(packed);
+    }
+  }
+  EXPECT_EQ(std::filesystem::file_size(path), db.number_records() * sizeof(PackedType));
+
+  flat_file::database<PackedType> packed_db(path, 4096 / sizeof(PackedType));
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+    const PwType& pw = db.get_record(pos);
+    PackedType    needle;
+    needle.hash = pw.hash;
+
+    auto iter = std::lower_bound(packed_db.begin(), packed_db.end(), needle);
+    ASSERT_NE(iter, packed_db.end());
+    EXPECT_EQ(iter->hash, pw.hash);
+    EXPECT_EQ(iter->get_count(), PackedType::count_policy_type::decode(
+                                     PackedType::count_policy_type::encode(pw.count)));
+
+    auto found = hibp::interp_search(packed_db, needle);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->hash, pw.hash); // NOLINT unchecked access
+  }
+}
+
+TEST(hibp_integration, packed_search_sha1t64_c16) { // NOLINT
+  run_packed_search<hibp::pawned_pw_sha1t64_c16>();
+}
+
+TEST(hibp_integration, packed_search_sha1t64_c8) { // NOLINT
+  run_packed_search<hibp::pawned_pw_sha1t64_c8>();
+}
+
+TEST(hibp_integration, packed_search_sha1t64_nc) { // NOLINT
+  run_packed_search<hibp::pawned_pw_sha1t64_nc>();
+}
+
+TEST(hibp_integration, elias_fano_search) { // NOLINT
+  using PwType       = hibp::pawned_pw_sha1t64;
+  const auto db_path = test_db_path<PwType>();
+  std::filesystem::remove(db_path.string() + ".ef");
+
+  flat_file::mmap_database<PwType> db(db_path);
+  for (int pass = 0; pass != 2; ++pass) { // build the index, then load it
+    const hibp::elias_fano_database ef(db_path);
+    ASSERT_EQ(ef.number_records(), db.number_records());
+    EXPECT_LT(ef.bits_per_record(), 64.0);
+
+    for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+      const PwType& needle = db.get_record(pos);
+      EXPECT_EQ(ef.get_record(pos), needle);
+      EXPECT_EQ(ef.get_record(pos).count, needle.count);
+
+      auto found = ef.find(needle);
+      ASSERT_TRUE(found);
+      EXPECT_EQ(*found, needle);             // NOLINT unchecked access
+      EXPECT_EQ(found->count, needle.count); // NOLINT unchecked access
+
+      for (const auto delta: {std::byte{0x01}, std::byte{0xFF}}) {
+        PwType missing = needle;
+        missing.hash.back() ^= delta;
+        EXPECT_EQ(ef.find(missing).has_value(),
+                  std::binary_search(db.begin(), db.end(), missing));
+      }
+    }
+    PwType low{};
+    PwType high{};
+    high.hash.fill(std::byte{0xFF});
+    EXPECT_EQ(ef.find(low).has_value(), std::binary_search(db.begin(), db.end(), low));
+    EXPECT_EQ(ef.find(high).has_value(), std::binary_search(db.begin(), db.end(), high));
+  }
+}
+
+TEST(hibp_integration, elias_fano_rebuilds_corrupt_sidecar) { // NOLINT
+  using PwType          = hibp::pawned_pw_sha1t64;
+  const auto db_path    = test_db_path<PwType>();
+  const auto ef_path    = std::filesystem::path(db_path.string() + ".ef");
+  auto       read_bytes = [&] {
+    std::ifstream is(ef_path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(is), {});
+  };
+  auto write_bytes = [&](const std::vector<char>& bytes) {
+    {
+      std::ofstream os(ef_path, std::ios::binary);
+      os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    // newer than the db, so it is loaded, rather than rebuilt as stale
+    std::filesystem::last_write_time(ef_path, std::filesystem::last_write_time(db_path) +
+                                                  std::chrono::seconds(1));
+  };
+  auto word_at = [](std::vector<char>& bytes, std::size_t offset) {
+    return reinterpret_cast<std::uint64_t*>(bytes.data() + offset); // NOLINT reincast
+  };
+
+  std::filesystem::remove(ef_path);
+  { const hibp::elias_fano_database ef(db_path); }
+  const std::vector<char> good = read_bytes();
+  flat_file::mmap_database<PwType> db(db_path);
+
+  // after the 3 word header: upper_, then lows_, each a length followed by its words
+  std::vector<char> huge     = good;
+  const std::size_t upper_at = 3 * sizeof(std::uint64_t);
+  const std::size_t lows_at  = upper_at + (1 + *word_at(huge, upper_at)) * sizeof(std::uint64_t);
+  *word_at(huge, upper_at)   = std::uint64_t{1} << 60U; // far beyond the end of the file
+
+  std::vector<char> short_lows = good; // well formed, but one word short for the db
+  const std::size_t last_low   = lows_at + (*word_at(short_lows, lows_at))-- * 8;
+  short_lows.erase(short_lows.begin() + static_cast<std::ptrdiff_t>(last_low),
+                   short_lows.begin() + static_cast<std::ptrdiff_t>(last_low + 8));
+
+  for (const auto& corrupt: {huge, short_lows}) {
+    write_bytes(corrupt);
+    const hibp::elias_fano_database ef(db_path); // rebuilt, and saved again
+    ASSERT_EQ(ef.number_records(), db.number_records());
+    for (std::size_t pos = 0; pos < db.number_records(); pos += 97) {
+      EXPECT_EQ(ef.get_record(pos), db.get_record(pos));
+    }
+    EXPECT_EQ(read_bytes(), good);
+    EXPECT_FALSE(std::filesystem::exists(ef_path.string() + ".tmp"));
+  }
+}
+
+TEST(hibp_integration, delta_layer_overrides_and_compacts) { // NOLINT
+  using PwType       = hibp::pawned_pw_sha1;
+  const auto db_path = test_db_path<PwType>().parent_path() / "delta_base.sha1.bin";
+  std::filesystem::copy_file(test_db_path<PwType>(), db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::remove_all(hibp::delta_dirname(db_path));
+
+  std::vector<PwType> base;
+  {
+    flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+    base.assign(db.begin(), db.end());
+  }
+
+  // new hashes, and new counts for existing ones, with a memtable small enough for several runs
+  std::vector<PwType> added;
+  std::vector<PwType> changed;
+  {
+    hibp::delta_store<PwType> delta(db_path, 100);
+    for (std::size_t pos = 0; pos < base.size(); pos += 331) {
+      PwType pw = base[pos];
+      pw.hash.back() ^= std::byte{0x5A};
+      if (std::binary_search(base.begin(), base.end(), pw)) continue;
+      pw.count = 7;
+      added.push_back(pw);
+      delta.add(pw);
+
+      PwType existing = base[pos];
+      existing.count  = 1;
+      delta.add(existing);
+      existing.count = 1000 + static_cast<std::int32_t>(pos); // the newest wins
+      delta.add(existing);
+      changed.push_back(existing);
+    }
+    delta.flush();
+    EXPECT_GT(delta.number_runs(), 1);
+  }
+
+  const hibp::delta_store<PwType> delta(db_path); // reopened from the runs
+  for (const auto& pw: added) {
+    const auto found = delta.find(pw);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->count, 7); // NOLINT unchecked access
+  }
+  for (const auto& pw: changed) {
+    const auto found = delta.find(pw);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->count, pw.count); // NOLINT unchecked access
+  }
+  EXPECT_FALSE(delta.find(base[1]));
+
+  // and then merged into the base db, which stays sorted
+  hibp::delta_store<PwType> writer(db_path);
+  EXPECT_EQ(writer.compact(), base.size() + added.size());
+  EXPECT_EQ(writer.number_runs(), 0);
+  EXPECT_TRUE(std::filesystem::is_empty(hibp::delta_dirname(db_path)));
+
+  std::vector<PwType> compacted;
+  {
+    flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+    compacted.assign(db.begin(), db.end());
+  }
+  ASSERT_EQ(compacted.size(), base.size() + added.size());
+  EXPECT_TRUE(std::is_sorted(compacted.begin(), compacted.end()));
+  for (const auto& pw: added) {
+    auto iter = std::lower_bound(compacted.begin(), compacted.end(), pw);
+    ASSERT_NE(iter, compacted.end());
+    EXPECT_EQ(iter->count, 7);
+  }
+  for (const auto& pw: changed) {
+    auto iter = std::lower_bound(compacted.begin(), compacted.end(), pw);
+    ASSERT_NE(iter, compacted.end());
+    EXPECT_EQ(iter->count, pw.count);
+  }
+  auto unchanged = std::lower_bound(compacted.begin(), compacted.end(), base[1]);
+  ASSERT_NE(unchanged, compacted.end());
+  EXPECT_EQ(unchanged->count, base[1].count);
+
+  std::filesystem::remove_all(hibp::delta_dirname(db_path));
+  std::filesystem::remove(db_path);
+}
+
+TEST(hibp_integration, delta_compact_refuses_sealed_and_striped_db) { // NOLINT
+  using PwType       = hibp::pawned_pw_sha1;
+  const auto dir     = test_db_path<PwType>().parent_path();
+  const auto sealed  = dir / "delta_sealed.sha1.bin";
+  const auto striped = dir / "delta_striped.sha1.bin";
+  std::filesystem::copy_file(test_db_path<PwType>(), sealed,
+                             std::filesystem::copy_options::overwrite_existing);
+  const std::size_t db_size = flat_file::database<PwType>(sealed).number_records();
+  flat_file::write_container(sealed, {sizeof(PwType), db_size, 0, "sha1", "hash"},
+                             hibp::toc_sections<PwType>(sealed, 18));
+  flat_file::write_stripe_manifest(striped, {sealed});
+
+  PwType pw = flat_file::database<PwType>(sealed).get_record(0);
+  pw.count  = 7;
+  for (const auto& db_path: {sealed, striped}) {
+    std::filesystem::remove_all(hibp::delta_dirname(db_path));
+    const auto                bytes = std::filesystem::file_size(db_path);
+    hibp::delta_store<PwType> delta(db_path);
+    delta.add(pw);
+    EXPECT_THROW(delta.compact(), std::runtime_error) << db_path;
+    // before any change: the memtable is not flushed, and the db is as it was
+    EXPECT_EQ(delta.number_runs(), 0);
+    EXPECT_FALSE(std::filesystem::exists(hibp::delta_dirname(db_path)));
+    EXPECT_EQ(std::filesystem::file_size(db_path), bytes);
+  }
+  const auto container = flat_file::read_container(sealed);
+  ASSERT_TRUE(container);
+  EXPECT_TRUE(container->find("ctoc", 18)); // NOLINT unchecked access
+  std::filesystem::remove(striped);
+  std::filesystem::remove(sealed);
 }